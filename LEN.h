@@ -9,7 +9,66 @@
 #ifndef LEN_h
 #define LEN_h
 
+#include <stdio.h>
 
-#endif /* LEN_h */
+typedef struct LEN_Interpreter_tag LEN_Interpreter;
+
+/**
+ * 执行方式
+ */
+typedef enum {
+    /**直接遍历分析树*/
+    LEN_EXECUTE_AST = 1,
+    /**编译成字节码，由虚拟机执行*/
+    LEN_EXECUTE_BYTECODE,
+    /**编译成函数指针树(closure compilation)*/
+    LEN_EXECUTE_CLOSURE,
+    /**字节码执行，热点函数编译成机器码(copy-and-patch JIT)*/
+    LEN_EXECUTE_JIT
+} LEN_ExecuteMode;
+
+/**
+ * 字节码和分析树的优化，可以分别关闭，用来测量每一项的效果
+ */
+typedef enum {
+    /**基本块内的公共子表达式消除*/
+    LEN_OPTIMIZE_CSE = 1,
+    /**基于SSA的全局值编号，消除支配树上的冗余运算*/
+    LEN_OPTIMIZE_GVN = 2,
+    /**循环不变量外提，需要GVN*/
+    LEN_OPTIMIZE_LICM = 4,
+    /**把小的用户函数展开到调用的位置，所有的执行方式都有效*/
+    LEN_OPTIMIZE_INLINE = 8,
+    /**推断表达式的类型，只影响遍历分析树的执行方式*/
+    LEN_OPTIMIZE_INFER = 16,
+    /**常见的形状融合成一个节点(superinstruction)，只影响遍历分析树的执行方式*/
+    LEN_OPTIMIZE_FUSE = 32,
+    /**整数计数循环直接按int计数，乘法强度削弱，只影响遍历分析树的执行方式*/
+    LEN_OPTIMIZE_LOOP = 64,
+    /**变量和常量比较的if/elsif分支链编译成分派表，只影响遍历分析树的执行方式*/
+    LEN_OPTIMIZE_DISPATCH = 128,
+    /**字符串的比较、拼接和打印借用变量的值，只影响遍历分析树的执行方式*/
+    LEN_OPTIMIZE_BORROW = 256,
+    /**参数都是常量的纯函数调用在编译时求值，所有的执行方式都有效*/
+    LEN_OPTIMIZE_PURE = 512,
+    /**按参数缓存纯函数的调用结果，只影响遍历分析树的执行方式*/
+    LEN_OPTIMIZE_MEMO = 1024,
+    LEN_OPTIMIZE_ALL = 2047
+} LEN_OptimizeFlag;
 
-typedef struct LEN_Interpreter_tag LEN_Interpreter;
\ No newline at end of file
+/**创建解释器*/
+LEN_Interpreter *LEN_create_interpreter(void);
+/**设置执行方式，必须在LEN_compile()之前调用*/
+void LEN_set_execute_mode(LEN_Interpreter *interpreter, LEN_ExecuteMode mode);
+/**设置优化(LEN_OptimizeFlag的组合)，必须在LEN_compile()之前调用*/
+void LEN_set_optimize_flags(LEN_Interpreter *interpreter, int flags);
+/**编译源文件，生成分析树*/
+void LEN_compile(LEN_Interpreter *interpreter, FILE *fp);
+/**执行解释器*/
+void LEN_interpret(LEN_Interpreter *interpreter);
+/**将编译后的分析树翻译成C语言，输出到fp*/
+void LEN_emit_c(LEN_Interpreter *interpreter, FILE *fp);
+/**销毁解释器*/
+void LEN_dispose_interpreter(LEN_Interpreter *interpreter);
+
+#endif /* LEN_h */
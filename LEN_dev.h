@@ -28,6 +28,11 @@ typedef struct {
 
 /**
  * 定义指针类型
+ * LEN_Value里只保存指向它的指针，由LEN_create_native_pointer()统一分配
+ * 注意：这里和以前的接口不兼容，以前的u.native_pointer是结构体本身，
+ * 直接读写.u.native_pointer.info和.u.native_pointer.pointer的native函数
+ * 不能再编译，需要改用LEN_native_pointer_info()、LEN_native_pointer()读取，
+ * 用LEN_create_native_pointer()创建原生指针值
  */
 typedef struct {
     LEN_NativePointerInfo       *info;
@@ -48,18 +53,24 @@ typedef enum {
 
 /**
  * 定义值
+ * 联合体里的成员都不超过8字节，整个值是16字节，
+ * 按值传递和返回时可以放在两个寄存器里
  */
 typedef struct {
     LEN_ValueType       type;
     union {
         LEN_Boolean     boolean_value;
-        int             int_value;
+        long long       int_value;
         double          double_value;
         LEN_String      *string_value;
-        LEN_NativePointer       native_pointer;
+        LEN_NativePointer       *native_pointer;
     } u;
 } LEN_Value;
 
+/**访问原生指针值的信息和指针，代替以前的.u.native_pointer.info/.pointer*/
+#define LEN_native_pointer_info(value) ((value)->u.native_pointer->info)
+#define LEN_native_pointer(value) ((value)->u.native_pointer->pointer)
+
 typedef LEN_Value LEN_NativeFunctionProc(LEN_Interpreter *interpreter,
                                          int arg_count, LEN_Value *args);
 
@@ -67,5 +78,9 @@ void LEN_add_native_function(LEN_Interpreter *interpreter,
                              char *name, LEN_NativeFunctionProc *proc);
 void LEN_add_global_variable(LEN_Interpreter *inter,
                              char *identifier, LEN_Value *value);
+LEN_Value LEN_create_native_pointer(LEN_Interpreter *inter,
+                                    LEN_NativePointerInfo *info,
+                                    void *pointer);
+void LEN_release_native_pointer(LEN_Interpreter *inter, LEN_Value *value);
 
 #endif /* LEN_dev_h */
@@ -0,0 +1,274 @@
+//
+//  borrow.c
+//  lemon
+//  这个文件在编译结束时标记借用的变量。读取变量时增加字符串的引用计数，
+//  比较、拼接和print/fputs用完之后马上释放，这一对操作互相抵消。
+//  借用的变量求值时不增加引用计数，使用的节点也不释放。
+//  变量的值要一直有效到使用的节点用完为止，所以借用的变量后面求值的
+//  兄弟节点必须是不赋值也不调用函数的表达式
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+static void mark_expression(Expression *expr);
+static void mark_statement_list(StatementList *list);
+
+/**
+ * 变量表达式标记成借用，不是变量时返回LEN_FALSE
+ */
+static LEN_Boolean
+borrow_operand(Expression *expr)
+{
+    if (expr->type != IDENTIFIER_EXPRESSION)
+        return LEN_FALSE;
+    expr->u.identifier.borrowed = LEN_TRUE;
+    return LEN_TRUE;
+}
+
+/**
+ * 比较和加法的操作数，右边最后求值，可以直接借用
+ * 左边只在右边不会改变变量时借用
+ */
+static void
+mark_binary_expression(Expression *expr)
+{
+    BinaryExpression *binary = &expr->u.binary_expression;
+
+    if (borrow_operand(binary->right)) {
+        binary->borrows = LEN_TRUE;
+    }
+    if (len_is_pure_expression(binary->right) && borrow_operand(binary->left)) {
+        binary->borrows = LEN_TRUE;
+    }
+}
+
+static LEN_Boolean
+is_borrowing_function(FunctionDefinition *func)
+{
+    return func && func->type == NATIVE_FUNCTION_DEFINITION
+        && (func->u.native_f.proc == len_nv_print_proc
+            || func->u.native_f.proc == len_nv_fputs_proc);
+}
+
+/**
+ * 后面的实参都不会改变变量时借用
+ */
+static void
+mark_arguments(Expression *expr)
+{
+    ArgumentList *arg_p;
+    ArgumentList *rest;
+
+    for (arg_p = expr->u.function_call_expression.argument; arg_p;
+         arg_p = arg_p->next) {
+        for (rest = arg_p->next; rest; rest = rest->next) {
+            if (!len_is_pure_expression(rest->expression))
+                break;
+        }
+        if (rest == NULL && borrow_operand(arg_p->expression)) {
+            expr->u.function_call_expression.borrows = LEN_TRUE;
+        }
+    }
+}
+
+/**
+ * FUSED_PRINT依次求每一段之后再打印，加法的节点不会执行
+ * 借用后面的段都不会改变变量的段，其他的段照常标记
+ */
+static void
+mark_print_pieces(Expression *call, Expression *expr, LEN_Boolean rest_pure)
+{
+    Expression *right;
+
+    if (expr->type != ADD_EXPRESSION) {
+        if (!(rest_pure && borrow_operand(expr))) {
+            mark_expression(expr);
+        } else {
+            call->u.function_call_expression.borrows = LEN_TRUE;
+        }
+        return;
+    }
+    right = expr->u.binary_expression.right;
+    mark_print_pieces(call, expr->u.binary_expression.left,
+                      rest_pure && len_is_pure_expression(right));
+    if (rest_pure && borrow_operand(right)) {
+        call->u.function_call_expression.borrows = LEN_TRUE;
+    } else {
+        mark_expression(right);
+    }
+}
+
+static void
+mark_expression(Expression *expr)
+{
+    ArgumentList *arg_p;
+    InlineBranch *branch;
+    Expression   *operand;
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+        case INT_EXPRESSION:        /* FALLTHRU */
+        case DOUBLE_EXPRESSION:     /* FALLTHRU */
+        case STRING_EXPRESSION:     /* FALLTHRU */
+        case NULL_EXPRESSION:       /* FALLTHRU */
+        case IDENTIFIER_EXPRESSION:
+            break;
+        case ASSIGN_EXPRESSION:
+            operand = expr->u.assign_expression.operand;
+            // 融合的赋值自己求加法的右边并且释放，不借用
+            if (expr->fused != FUSED_NONE) {
+                mark_expression(operand->u.binary_expression.left);
+                mark_expression(operand->u.binary_expression.right);
+            } else {
+                mark_expression(operand);
+            }
+            break;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:
+            mark_expression(expr->u.binary_expression.left);
+            mark_expression(expr->u.binary_expression.right);
+            mark_binary_expression(expr);
+            break;
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            mark_expression(expr->u.binary_expression.left);
+            mark_expression(expr->u.binary_expression.right);
+            break;
+        case MINUS_EXPRESSION:
+            mark_expression(expr->u.minus_expression);
+            break;
+        case BIT_NOT_EXPRESSION:
+            mark_expression(expr->u.bit_not_expression);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            if (expr->fused == FUSED_PRINT) {
+                mark_print_pieces(expr, expr->u.function_call_expression
+                                  .argument->expression, LEN_TRUE);
+                break;
+            }
+            for (arg_p = expr->u.function_call_expression.argument; arg_p;
+                 arg_p = arg_p->next) {
+                mark_expression(arg_p->expression);
+            }
+            if (is_borrowing_function(expr->u.function_call_expression
+                                      .function)) {
+                mark_arguments(expr);
+            }
+            break;
+        case INLINE_CALL_EXPRESSION:
+            for (arg_p = expr->u.inline_call_expression.binding; arg_p;
+                 arg_p = arg_p->next) {
+                mark_expression(arg_p->expression);
+            }
+            for (branch = expr->u.inline_call_expression.branch; branch;
+                 branch = branch->next) {
+                mark_expression(branch->condition);
+                mark_expression(branch->value);
+            }
+            mark_expression(expr->u.inline_call_expression.body);
+            break;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+}
+
+static void
+mark_statement(Statement *statement)
+{
+    Elsif *elsif;
+
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            mark_expression(statement->u.expression_s);
+            break;
+        case IF_STATEMENT:
+            mark_expression(statement->u.if_s.condition);
+            mark_statement_list(statement->u.if_s.then_block->statement_list);
+            for (elsif = statement->u.if_s.elsif_list; elsif;
+                 elsif = elsif->next) {
+                mark_expression(elsif->condition);
+                mark_statement_list(elsif->block->statement_list);
+            }
+            if (statement->u.if_s.else_block) {
+                mark_statement_list(statement->u.if_s.else_block
+                                    ->statement_list);
+            }
+            break;
+        case WHILE_STATEMENT:
+            mark_expression(statement->u.while_s.condition);
+            mark_statement_list(statement->u.while_s.block->statement_list);
+            break;
+        case FOR_STATEMENT:
+            if (statement->u.for_s.init) {
+                mark_expression(statement->u.for_s.init);
+            }
+            if (statement->u.for_s.condition) {
+                mark_expression(statement->u.for_s.condition);
+            }
+            if (statement->u.for_s.post) {
+                mark_expression(statement->u.for_s.post);
+            }
+            mark_statement_list(statement->u.for_s.block->statement_list);
+            break;
+        case RETURN_STATEMENT:
+            if (statement->u.return_s.return_value) {
+                mark_expression(statement->u.return_s.return_value);
+            }
+            break;
+        case GLOBAL_STATEMENT:      /* FALLTHRU */
+        case BREAK_STATEMENT:       /* FALLTHRU */
+        case CONTINUE_STATEMENT:
+            break;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n", statement->type));
+    }
+}
+
+static void
+mark_statement_list(StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        mark_statement(pos->statement);
+    }
+}
+
+/**
+ * 标记函数和顶层语句链中借用的变量
+ */
+void
+len_mark_borrowed_operands(LEN_Interpreter *inter)
+{
+    FunctionDefinition  *func;
+
+    if (!(inter->optimize_flags & LEN_OPTIMIZE_BORROW))
+        return;
+
+    mark_statement_list(inter->statement_list);
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type != LEMON_FUNCTION_DEFINITION)
+            continue;
+        mark_statement_list(func->u.lemon_f.block->statement_list);
+    }
+}
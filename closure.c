@@ -0,0 +1,1035 @@
+//
+//  closure.c
+//  lemon
+//  这个文件主要用来将分析树编译成函数指针树(closure compilation)
+//  每个节点的执行函数在编译时根据节点类型和操作数选好，
+//  执行时不再需要switch表达式和语句的类型
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+static ExpressionClosure *compile_expression(Expression *expr);
+static StatementClosure *compile_statement_list(StatementList *list,
+                                                int line_number);
+static LEN_Boolean eval_condition(LEN_Interpreter *inter, LocalEnvironment *env,
+                                  ExpressionClosure *condition);
+
+/**两个操作数都是int类型*/
+#define is_int_pair(left, right) \
+((left).type == LEN_INT_VALUE && (right).type == LEN_INT_VALUE)
+
+/**
+ * 定义二元运算的closure
+ * name: 两个操作数都需要求值
+ * name##_int_constant: 右操作数是int常量
+ */
+#define DEFINE_BINARY_CLOSURE(name, operator, expr_type, value_type, field) \
+static LEN_Value \
+name(LEN_Interpreter *inter, LocalEnvironment *env, ExpressionClosure *self)\
+{\
+    LEN_Value left;\
+    LEN_Value right;\
+    LEN_Value result;\
+    left = self->u.binary.left->proc(inter, env, self->u.binary.left);\
+    right = self->u.binary.right->proc(inter, env, self->u.binary.right);\
+    if (is_int_pair(left, right)) {\
+        result.type = (value_type);\
+        result.u.field = left.u.int_value operator right.u.int_value;\
+        return result;\
+    }\
+    return len_eval_binary_values(inter, (expr_type), &left, &right,\
+                                  self->u.binary.left->line_number);\
+}\
+static LEN_Value \
+name##_int_constant(LEN_Interpreter *inter, LocalEnvironment *env,\
+                    ExpressionClosure *self)\
+{\
+    LEN_Value left;\
+    LEN_Value right;\
+    LEN_Value result;\
+    left = self->u.binary.left->proc(inter, env, self->u.binary.left);\
+    if (left.type == LEN_INT_VALUE) {\
+        result.type = (value_type);\
+        result.u.field = left.u.int_value operator self->u.binary.right_int;\
+        return result;\
+    }\
+    right.type = LEN_INT_VALUE;\
+    right.u.int_value = self->u.binary.right_int;\
+    return len_eval_binary_values(inter, (expr_type), &left, &right,\
+                                  self->u.binary.left->line_number);\
+}
+
+/**
+ * 定义int类型检查溢出的加减乘，溢出时交给len_eval_binary_values()报错
+ */
+#define DEFINE_CHECKED_BINARY_CLOSURE(name, builtin, expr_type) \
+static LEN_Value \
+name(LEN_Interpreter *inter, LocalEnvironment *env, ExpressionClosure *self)\
+{\
+    LEN_Value left;\
+    LEN_Value right;\
+    LEN_Value result;\
+    left = self->u.binary.left->proc(inter, env, self->u.binary.left);\
+    right = self->u.binary.right->proc(inter, env, self->u.binary.right);\
+    if (is_int_pair(left, right)\
+        && !builtin(left.u.int_value, right.u.int_value,\
+                    &result.u.int_value)) {\
+        result.type = LEN_INT_VALUE;\
+        return result;\
+    }\
+    return len_eval_binary_values(inter, (expr_type), &left, &right,\
+                                  self->u.binary.left->line_number);\
+}\
+static LEN_Value \
+name##_int_constant(LEN_Interpreter *inter, LocalEnvironment *env,\
+                    ExpressionClosure *self)\
+{\
+    LEN_Value left;\
+    LEN_Value right;\
+    LEN_Value result;\
+    left = self->u.binary.left->proc(inter, env, self->u.binary.left);\
+    if (left.type == LEN_INT_VALUE\
+        && !builtin(left.u.int_value, self->u.binary.right_int,\
+                    &result.u.int_value)) {\
+        result.type = LEN_INT_VALUE;\
+        return result;\
+    }\
+    right.type = LEN_INT_VALUE;\
+    right.u.int_value = self->u.binary.right_int;\
+    return len_eval_binary_values(inter, (expr_type), &left, &right,\
+                                  self->u.binary.left->line_number);\
+}
+
+/**
+ * 定义int类型的移位运算，右操作数一般是常量
+ */
+#define DEFINE_SHIFT_CLOSURE(name, shift, expr_type) \
+static LEN_Value \
+name(LEN_Interpreter *inter, LocalEnvironment *env, ExpressionClosure *self)\
+{\
+    LEN_Value left;\
+    LEN_Value right;\
+    LEN_Value result;\
+    left = self->u.binary.left->proc(inter, env, self->u.binary.left);\
+    right = self->u.binary.right->proc(inter, env, self->u.binary.right);\
+    if (is_int_pair(left, right)) {\
+        result.type = LEN_INT_VALUE;\
+        result.u.int_value = shift(left.u.int_value, right.u.int_value);\
+        return result;\
+    }\
+    return len_eval_binary_values(inter, (expr_type), &left, &right,\
+                                  self->u.binary.left->line_number);\
+}\
+static LEN_Value \
+name##_int_constant(LEN_Interpreter *inter, LocalEnvironment *env,\
+                    ExpressionClosure *self)\
+{\
+    LEN_Value left;\
+    LEN_Value right;\
+    LEN_Value result;\
+    left = self->u.binary.left->proc(inter, env, self->u.binary.left);\
+    if (left.type == LEN_INT_VALUE) {\
+        result.type = LEN_INT_VALUE;\
+        result.u.int_value = shift(left.u.int_value,\
+                                   self->u.binary.right_int);\
+        return result;\
+    }\
+    right.type = LEN_INT_VALUE;\
+    right.u.int_value = self->u.binary.right_int;\
+    return len_eval_binary_values(inter, (expr_type), &left, &right,\
+                                  self->u.binary.left->line_number);\
+}
+
+DEFINE_CHECKED_BINARY_CLOSURE(closure_add, __builtin_add_overflow,
+                              ADD_EXPRESSION)
+DEFINE_CHECKED_BINARY_CLOSURE(closure_sub, __builtin_sub_overflow,
+                              SUB_EXPRESSION)
+DEFINE_CHECKED_BINARY_CLOSURE(closure_mul, __builtin_mul_overflow,
+                              MUL_EXPRESSION)
+DEFINE_BINARY_CLOSURE(closure_eq, ==, EQ_EXPRESSION,
+                      LEN_BOOLEAN_VALUE, boolean_value)
+DEFINE_BINARY_CLOSURE(closure_ne, !=, NE_EXPRESSION,
+                      LEN_BOOLEAN_VALUE, boolean_value)
+DEFINE_BINARY_CLOSURE(closure_gt, >, GT_EXPRESSION,
+                      LEN_BOOLEAN_VALUE, boolean_value)
+DEFINE_BINARY_CLOSURE(closure_ge, >=, GE_EXPRESSION,
+                      LEN_BOOLEAN_VALUE, boolean_value)
+DEFINE_BINARY_CLOSURE(closure_lt, <, LT_EXPRESSION,
+                      LEN_BOOLEAN_VALUE, boolean_value)
+DEFINE_BINARY_CLOSURE(closure_le, <=, LE_EXPRESSION,
+                      LEN_BOOLEAN_VALUE, boolean_value)
+DEFINE_BINARY_CLOSURE(closure_bit_and, &, BIT_AND_EXPRESSION,
+                      LEN_INT_VALUE, int_value)
+DEFINE_BINARY_CLOSURE(closure_bit_or, |, BIT_OR_EXPRESSION,
+                      LEN_INT_VALUE, int_value)
+DEFINE_BINARY_CLOSURE(closure_bit_xor, ^, BIT_XOR_EXPRESSION,
+                      LEN_INT_VALUE, int_value)
+DEFINE_SHIFT_CLOSURE(closure_left_shift, dkc_shift_left,
+                     LEFT_SHIFT_EXPRESSION)
+DEFINE_SHIFT_CLOSURE(closure_right_shift, dkc_shift_right,
+                     RIGHT_SHIFT_EXPRESSION)
+
+/**
+ * 除法和取余需要检查0，全部交给len_eval_binary_values()
+ */
+static LEN_Value
+closure_div(LEN_Interpreter *inter, LocalEnvironment *env,
+            ExpressionClosure *self)
+{
+    LEN_Value left;
+    LEN_Value right;
+
+    left = self->u.binary.left->proc(inter, env, self->u.binary.left);
+    right = self->u.binary.right->proc(inter, env, self->u.binary.right);
+    return len_eval_binary_values(inter, DIV_EXPRESSION, &left, &right,
+                                  self->u.binary.left->line_number);
+}
+
+static LEN_Value
+closure_mod(LEN_Interpreter *inter, LocalEnvironment *env,
+            ExpressionClosure *self)
+{
+    LEN_Value left;
+    LEN_Value right;
+
+    left = self->u.binary.left->proc(inter, env, self->u.binary.left);
+    right = self->u.binary.right->proc(inter, env, self->u.binary.right);
+    return len_eval_binary_values(inter, MOD_EXPRESSION, &left, &right,
+                                  self->u.binary.left->line_number);
+}
+
+static LEN_Value
+closure_constant(LEN_Interpreter *inter, LocalEnvironment *env,
+                 ExpressionClosure *self)
+{
+    return self->u.constant;
+}
+
+/**
+ * 全局变量表中的全局变量
+ */
+static LEN_Value
+closure_global(LEN_Interpreter *inter, LocalEnvironment *env,
+               ExpressionClosure *self)
+{
+    return len_get_global_variable_value(inter,
+                                         self->u.identifier.global_index,
+                                         self->line_number);
+}
+
+/**
+ * 分配了下标的局部变量
+ */
+static LEN_Value
+closure_local(LEN_Interpreter *inter, LocalEnvironment *env,
+              ExpressionClosure *self)
+{
+    return len_get_local_variable_value(env, self->u.identifier.slot,
+                                        self->u.identifier.name,
+                                        self->line_number);
+}
+
+static LEN_Value
+closure_assign_global(LEN_Interpreter *inter, LocalEnvironment *env,
+                      ExpressionClosure *self)
+{
+    LEN_Value v;
+
+    v = self->u.assign.operand->proc(inter, env, self->u.assign.operand);
+    len_assign_global_variable(inter, self->u.assign.global_index, &v);
+    return v;
+}
+
+static LEN_Value
+closure_assign_local(LEN_Interpreter *inter, LocalEnvironment *env,
+                     ExpressionClosure *self)
+{
+    LEN_Value v;
+
+    v = self->u.assign.operand->proc(inter, env, self->u.assign.operand);
+    len_assign_local_variable(env, self->u.assign.slot, &v);
+    return v;
+}
+
+static void
+check_boolean(LEN_Value *v, int line_number)
+{
+    if (v->type != LEN_BOOLEAN_VALUE) {
+        len_runtime_error(line_number, NOT_BOOLEAN_TYPE_ERR,
+                          MESSAGE_ARGUMENT_END);
+    }
+}
+
+static LEN_Value
+closure_logical_and(LEN_Interpreter *inter, LocalEnvironment *env,
+                    ExpressionClosure *self)
+{
+    LEN_Value v;
+
+    v = self->u.binary.left->proc(inter, env, self->u.binary.left);
+    check_boolean(&v, self->u.binary.left->line_number);
+    if (!v.u.boolean_value)
+        return v;
+    v = self->u.binary.right->proc(inter, env, self->u.binary.right);
+    check_boolean(&v, self->u.binary.right->line_number);
+    return v;
+}
+
+static LEN_Value
+closure_logical_or(LEN_Interpreter *inter, LocalEnvironment *env,
+                   ExpressionClosure *self)
+{
+    LEN_Value v;
+
+    v = self->u.binary.left->proc(inter, env, self->u.binary.left);
+    check_boolean(&v, self->u.binary.left->line_number);
+    if (v.u.boolean_value)
+        return v;
+    v = self->u.binary.right->proc(inter, env, self->u.binary.right);
+    check_boolean(&v, self->u.binary.right->line_number);
+    return v;
+}
+
+static LEN_Value
+closure_minus(LEN_Interpreter *inter, LocalEnvironment *env,
+              ExpressionClosure *self)
+{
+    LEN_Value v;
+
+    v = self->u.operand->proc(inter, env, self->u.operand);
+    return len_eval_minus_value(inter, &v, self->u.operand->line_number);
+}
+
+static LEN_Value
+closure_bit_not(LEN_Interpreter *inter, LocalEnvironment *env,
+                ExpressionClosure *self)
+{
+    LEN_Value v;
+
+    v = self->u.operand->proc(inter, env, self->u.operand);
+    return len_eval_bit_not_value(inter, &v, self->u.operand->line_number);
+}
+
+/**
+ * 函数调用，参数全部求值之后再调用
+ * 用户函数的参数直接求值到调用栈上的局部环境中，
+ * 用户函数以尾调用返回时释放局部环境，接着在同一层调用被调用的函数
+ */
+static LEN_Value
+closure_function_call(LEN_Interpreter *inter, LocalEnvironment *env,
+                      ExpressionClosure *self)
+{
+    LEN_Value           value;
+    LEN_Value           *args;
+    FunctionDefinition  *func;
+    LocalEnvironment    *local_env;
+    int arg_count = self->u.call.argument_count;
+    int i;
+
+    func = self->u.call.function;
+    switch (func->type) {
+        case LEMON_FUNCTION_DEFINITION:
+            local_env = len_alloc_local_environment(inter, func->u.lemon_f
+                                                    .local_variable_count);
+            for (i = 0; i < arg_count; i++) {
+                local_env->local_variable[i]
+                = self->u.call.argument[i]->proc(inter, env,
+                                                 self->u.call.argument[i]);
+            }
+            for (;;) {
+                value = len_execute_closure(inter, local_env,
+                                            func->u.lemon_f.closure);
+                len_dispose_local_environment(inter, local_env);
+                if (inter->tail_call_function == NULL)
+                    break;
+                func = inter->tail_call_function;
+                inter->tail_call_function = NULL;
+                local_env
+                = len_create_function_environment(inter, func,
+                                                  inter
+                                                  ->tail_call_argument_count,
+                                                  inter->tail_call_argument);
+            }
+            break;
+        case NATIVE_FUNCTION_DEFINITION:
+            args = len_push_frame(inter, arg_count);
+            for (i = 0; i < arg_count; i++) {
+                args[i] = self->u.call.argument[i]->proc(inter, env,
+                                                         self->u.call
+                                                         .argument[i]);
+            }
+            value = len_call_native_function(inter, func->u.native_f.proc,
+                                             arg_count, args);
+            len_pop_frame(inter, arg_count);
+            break;
+        default:
+            DBG_panic(("bad case..%d\n", func->type));
+    }
+
+    return value;
+}
+
+/**
+ * 展开的函数调用，实参赋给临时变量之后计算返回值
+ */
+static LEN_Value
+closure_inline_call(LEN_Interpreter *inter, LocalEnvironment *env,
+                    ExpressionClosure *self)
+{
+    ExpressionClosure   *body = self->u.inline_call.body;
+    ExpressionClosure   *value;
+    LEN_Value           v;
+    int i;
+
+    for (i = 0; i < self->u.inline_call.binding_count; i++) {
+        v = self->u.inline_call.binding[i]->proc(inter, env,
+                                                 self->u.inline_call
+                                                 .binding[i]);
+        len_release_if_string(&v);
+    }
+    for (i = 0; i < self->u.inline_call.branch_count; i++) {
+        if (eval_condition(inter, env, self->u.inline_call.condition[i])) {
+            value = self->u.inline_call.value[i];
+            return value->proc(inter, env, value);
+        }
+    }
+    return body->proc(inter, env, body);
+}
+
+static ExpressionClosure *
+alloc_expression_closure(ExpressionClosureProc *proc, int line_number)
+{
+    ExpressionClosure *closure;
+
+    closure = len_malloc(sizeof(ExpressionClosure));
+    closure->proc = proc;
+    closure->line_number = line_number;
+
+    return closure;
+}
+
+/**
+ * 根据运算符和右操作数选择二元运算的closure
+ */
+static ExpressionClosureProc *
+select_binary_proc(ExpressionType type, LEN_Boolean right_is_int)
+{
+    switch (type) {
+        case ADD_EXPRESSION:
+            return right_is_int ? closure_add_int_constant : closure_add;
+        case SUB_EXPRESSION:
+            return right_is_int ? closure_sub_int_constant : closure_sub;
+        case MUL_EXPRESSION:
+            return right_is_int ? closure_mul_int_constant : closure_mul;
+        case DIV_EXPRESSION:
+            return closure_div;
+        case MOD_EXPRESSION:
+            return closure_mod;
+        case EQ_EXPRESSION:
+            return right_is_int ? closure_eq_int_constant : closure_eq;
+        case NE_EXPRESSION:
+            return right_is_int ? closure_ne_int_constant : closure_ne;
+        case GT_EXPRESSION:
+            return right_is_int ? closure_gt_int_constant : closure_gt;
+        case GE_EXPRESSION:
+            return right_is_int ? closure_ge_int_constant : closure_ge;
+        case LT_EXPRESSION:
+            return right_is_int ? closure_lt_int_constant : closure_lt;
+        case LE_EXPRESSION:
+            return right_is_int ? closure_le_int_constant : closure_le;
+        case BIT_AND_EXPRESSION:
+            return right_is_int ? closure_bit_and_int_constant
+                                : closure_bit_and;
+        case BIT_OR_EXPRESSION:
+            return right_is_int ? closure_bit_or_int_constant
+                                : closure_bit_or;
+        case BIT_XOR_EXPRESSION:
+            return right_is_int ? closure_bit_xor_int_constant
+                                : closure_bit_xor;
+        case LEFT_SHIFT_EXPRESSION:
+            return right_is_int ? closure_left_shift_int_constant
+                                : closure_left_shift;
+        case RIGHT_SHIFT_EXPRESSION:
+            return right_is_int ? closure_right_shift_int_constant
+                                : closure_right_shift;
+        case LOGICAL_AND_EXPRESSION:
+            return closure_logical_and;
+        case LOGICAL_OR_EXPRESSION:
+            return closure_logical_or;
+        default:
+            DBG_panic(("bad case...%d", type));
+    }
+    return NULL;
+}
+
+static ExpressionClosure *
+compile_binary_expression(Expression *expr)
+{
+    ExpressionClosure *closure;
+    Expression *right = expr->u.binary_expression.right;
+    LEN_Boolean right_is_int;
+
+    right_is_int = (right->type == INT_EXPRESSION);
+    closure = alloc_expression_closure(select_binary_proc(expr->type,
+                                                          right_is_int),
+                                       expr->line_number);
+    closure->u.binary.left = compile_expression(expr->u.binary_expression
+                                                .left);
+    closure->u.binary.right = compile_expression(right);
+    if (right_is_int) {
+        closure->u.binary.right_int = right->u.int_value;
+    }
+
+    return closure;
+}
+
+static ExpressionClosure *
+compile_function_call_expression(Expression *expr)
+{
+    ExpressionClosure *closure;
+    ArgumentList *arg_p;
+    int i;
+
+    closure = alloc_expression_closure(closure_function_call,
+                                       expr->line_number);
+    closure->u.call.function = expr->u.function_call_expression.function;
+    for (arg_p = expr->u.function_call_expression.argument, i = 0;
+         arg_p; arg_p = arg_p->next) {
+        i++;
+    }
+    closure->u.call.argument_count = i;
+    closure->u.call.argument = len_malloc(sizeof(ExpressionClosure*) * (i + 1));
+    for (arg_p = expr->u.function_call_expression.argument, i = 0;
+         arg_p; arg_p = arg_p->next, i++) {
+        closure->u.call.argument[i] = compile_expression(arg_p->expression);
+    }
+
+    return closure;
+}
+
+static ExpressionClosure *
+compile_inline_call_expression(Expression *expr)
+{
+    ExpressionClosure *closure;
+    ArgumentList *pos;
+    InlineBranch *branch;
+    int i;
+
+    closure = alloc_expression_closure(closure_inline_call,
+                                       expr->line_number);
+    for (pos = expr->u.inline_call_expression.binding, i = 0; pos;
+         pos = pos->next) {
+        i++;
+    }
+    closure->u.inline_call.binding_count = i;
+    closure->u.inline_call.binding
+    = len_malloc(sizeof(ExpressionClosure*) * (i + 1));
+    for (pos = expr->u.inline_call_expression.binding, i = 0; pos;
+         pos = pos->next, i++) {
+        closure->u.inline_call.binding[i] = compile_expression(pos->expression);
+    }
+    for (branch = expr->u.inline_call_expression.branch, i = 0; branch;
+         branch = branch->next) {
+        i++;
+    }
+    closure->u.inline_call.branch_count = i;
+    closure->u.inline_call.condition
+    = len_malloc(sizeof(ExpressionClosure*) * (i + 1));
+    closure->u.inline_call.value
+    = len_malloc(sizeof(ExpressionClosure*) * (i + 1));
+    for (branch = expr->u.inline_call_expression.branch, i = 0; branch;
+         branch = branch->next, i++) {
+        closure->u.inline_call.condition[i]
+        = compile_expression(branch->condition);
+        closure->u.inline_call.value[i] = compile_expression(branch->value);
+    }
+    closure->u.inline_call.body
+    = compile_expression(expr->u.inline_call_expression.body);
+
+    return closure;
+}
+
+static ExpressionClosure *
+compile_expression(Expression *expr)
+{
+    ExpressionClosure *closure = NULL;
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:
+            closure = alloc_expression_closure(closure_constant,
+                                               expr->line_number);
+            closure->u.constant.type = LEN_BOOLEAN_VALUE;
+            closure->u.constant.u.boolean_value = expr->u.boolean_value;
+            break;
+        case INT_EXPRESSION:
+            closure = alloc_expression_closure(closure_constant,
+                                               expr->line_number);
+            closure->u.constant.type = LEN_INT_VALUE;
+            closure->u.constant.u.int_value = expr->u.int_value;
+            break;
+        case DOUBLE_EXPRESSION:
+            closure = alloc_expression_closure(closure_constant,
+                                               expr->line_number);
+            closure->u.constant.type = LEN_DOUBLE_VALUE;
+            closure->u.constant.u.double_value = expr->u.double_value;
+            break;
+        case STRING_EXPRESSION:
+            // 字面量是不朽的字符串，和int一样当作常量
+            closure = alloc_expression_closure(closure_constant,
+                                               expr->line_number);
+            closure->u.constant.type = LEN_STRING_VALUE;
+            closure->u.constant.u.string_value = expr->u.string_value;
+            break;
+        case IDENTIFIER_EXPRESSION:
+            closure = alloc_expression_closure(expr->u.identifier.slot >= 0
+                                               ? closure_local
+                                               : closure_global,
+                                               expr->line_number);
+            closure->u.identifier = expr->u.identifier;
+            break;
+        case ASSIGN_EXPRESSION:
+            closure = alloc_expression_closure(expr->u.assign_expression.slot
+                                               >= 0
+                                               ? closure_assign_local
+                                               : closure_assign_global,
+                                               expr->line_number);
+            closure->u.assign.slot = expr->u.assign_expression.slot;
+            closure->u.assign.global_index
+            = expr->u.assign_expression.global_index;
+            closure->u.assign.operand
+            = compile_expression(expr->u.assign_expression.operand);
+            break;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION: /* FALLTHRU */
+        case NE_EXPRESSION: /* FALLTHRU */
+        case GT_EXPRESSION: /* FALLTHRU */
+        case GE_EXPRESSION: /* FALLTHRU */
+        case LT_EXPRESSION: /* FALLTHRU */
+        case LE_EXPRESSION: /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            closure = compile_binary_expression(expr);
+            break;
+        case MINUS_EXPRESSION:
+            closure = alloc_expression_closure(closure_minus,
+                                               expr->line_number);
+            closure->u.operand = compile_expression(expr->u.minus_expression);
+            break;
+        case BIT_NOT_EXPRESSION:
+            closure = alloc_expression_closure(closure_bit_not,
+                                               expr->line_number);
+            closure->u.operand
+            = compile_expression(expr->u.bit_not_expression);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            closure = compile_function_call_expression(expr);
+            break;
+        case NULL_EXPRESSION:
+            closure = alloc_expression_closure(closure_constant,
+                                               expr->line_number);
+            closure->u.constant.type = LEN_NULL_VALUE;
+            break;
+        case INLINE_CALL_EXPRESSION:
+            closure = compile_inline_call_expression(expr);
+            break;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+    return closure;
+}
+
+/**
+ * 求条件表达式的值，必须是boolean型
+ */
+static LEN_Boolean
+eval_condition(LEN_Interpreter *inter, LocalEnvironment *env,
+               ExpressionClosure *condition)
+{
+    LEN_Value cond;
+
+    cond = condition->proc(inter, env, condition);
+    check_boolean(&cond, condition->line_number);
+
+    return cond.u.boolean_value;
+}
+
+static StatementResultType
+closure_expression_statement(LEN_Interpreter *inter, LocalEnvironment *env,
+                             StatementClosure *self, LEN_Value *ret)
+{
+    LEN_Value v;
+
+    v = self->u.expression->proc(inter, env, self->u.expression);
+    len_release_if_string(&v);
+
+    return NORMAL_STATEMENT_RESULT;
+}
+
+static StatementResultType
+closure_global_statement(LEN_Interpreter *inter, LocalEnvironment *env,
+                         StatementClosure *self, LEN_Value *ret)
+{
+    IdentifierList *pos;
+
+    for (pos = self->u.global_list; pos; pos = pos->next) {
+        len_declare_global_variable(inter, env, pos->global_index,
+                                    self->line_number);
+    }
+
+    return NORMAL_STATEMENT_RESULT;
+}
+
+static StatementResultType
+closure_block(LEN_Interpreter *inter, LocalEnvironment *env,
+              StatementClosure *self, LEN_Value *ret)
+{
+    StatementClosure **statement = self->u.block.statement;
+    StatementResultType result;
+    int i;
+
+    for (i = 0; i < self->u.block.statement_count; i++) {
+        result = statement[i]->proc(inter, env, statement[i], ret);
+        if (result != NORMAL_STATEMENT_RESULT)
+            return result;
+    }
+
+    return NORMAL_STATEMENT_RESULT;
+}
+
+static StatementResultType
+closure_if_statement(LEN_Interpreter *inter, LocalEnvironment *env,
+                     StatementClosure *self, LEN_Value *ret)
+{
+    StatementClosure *block;
+    int i;
+
+    for (i = 0; i < self->u.if_s.branch_count; i++) {
+        if (eval_condition(inter, env, self->u.if_s.condition[i])) {
+            block = self->u.if_s.block[i];
+            return block->proc(inter, env, block, ret);
+        }
+    }
+    block = self->u.if_s.else_block;
+    if (block) {
+        return block->proc(inter, env, block, ret);
+    }
+
+    return NORMAL_STATEMENT_RESULT;
+}
+
+static StatementResultType
+closure_while_statement(LEN_Interpreter *inter, LocalEnvironment *env,
+                        StatementClosure *self, LEN_Value *ret)
+{
+    StatementClosure *block = self->u.loop.block;
+    StatementResultType result;
+
+    while (eval_condition(inter, env, self->u.loop.condition)) {
+        result = block->proc(inter, env, block, ret);
+        if (result == RETURN_STATEMENT_RESULT) {
+            return result;
+        } else if (result == BREAK_STATEMENT_RESULT) {
+            break;
+        }
+    }
+
+    return NORMAL_STATEMENT_RESULT;
+}
+
+static StatementResultType
+closure_for_statement(LEN_Interpreter *inter, LocalEnvironment *env,
+                      StatementClosure *self, LEN_Value *ret)
+{
+    StatementClosure *block = self->u.loop.block;
+    ExpressionClosure *post = self->u.loop.post;
+    StatementResultType result;
+    LEN_Value v;
+
+    if (self->u.loop.init) {
+        v = self->u.loop.init->proc(inter, env, self->u.loop.init);
+        len_release_if_string(&v);
+    }
+    for (;;) {
+        if (self->u.loop.condition
+            && !eval_condition(inter, env, self->u.loop.condition))
+            break;
+        result = block->proc(inter, env, block, ret);
+        if (result == RETURN_STATEMENT_RESULT) {
+            return result;
+        } else if (result == BREAK_STATEMENT_RESULT) {
+            break;
+        }
+        if (post) {
+            v = post->proc(inter, env, post);
+            len_release_if_string(&v);
+        }
+    }
+
+    return NORMAL_STATEMENT_RESULT;
+}
+
+static StatementResultType
+closure_return_statement(LEN_Interpreter *inter, LocalEnvironment *env,
+                         StatementClosure *self, LEN_Value *ret)
+{
+    *ret = self->u.return_value->proc(inter, env, self->u.return_value);
+
+    return RETURN_STATEMENT_RESULT;
+}
+
+/**
+ * 循环外面的return f(...)，参数求值之后由closure_function_call()调用f
+ */
+static StatementResultType
+closure_tail_call_statement(LEN_Interpreter *inter, LocalEnvironment *env,
+                            StatementClosure *self, LEN_Value *ret)
+{
+    ExpressionClosure   *call = self->u.return_value;
+    LEN_Value           *args;
+    int arg_count = call->u.call.argument_count;
+    int i;
+
+    args = len_push_frame(inter, arg_count);
+    for (i = 0; i < arg_count; i++) {
+        args[i] = call->u.call.argument[i]->proc(inter, env,
+                                                 call->u.call.argument[i]);
+    }
+    len_set_tail_call(inter, call->u.call.function, arg_count, args);
+    len_pop_frame(inter, arg_count);
+
+    return TAIL_CALL_STATEMENT_RESULT;
+}
+
+static StatementResultType
+closure_return_null_statement(LEN_Interpreter *inter, LocalEnvironment *env,
+                              StatementClosure *self, LEN_Value *ret)
+{
+    ret->type = LEN_NULL_VALUE;
+
+    return RETURN_STATEMENT_RESULT;
+}
+
+static StatementResultType
+closure_break_statement(LEN_Interpreter *inter, LocalEnvironment *env,
+                        StatementClosure *self, LEN_Value *ret)
+{
+    return BREAK_STATEMENT_RESULT;
+}
+
+static StatementResultType
+closure_continue_statement(LEN_Interpreter *inter, LocalEnvironment *env,
+                           StatementClosure *self, LEN_Value *ret)
+{
+    return CONTINUE_STATEMENT_RESULT;
+}
+
+static StatementClosure *
+alloc_statement_closure(StatementClosureProc *proc, int line_number)
+{
+    StatementClosure *closure;
+
+    closure = len_malloc(sizeof(StatementClosure));
+    closure->proc = proc;
+    closure->line_number = line_number;
+
+    return closure;
+}
+
+static ExpressionClosure *
+compile_expression_opt(Expression *expr)
+{
+    if (expr == NULL)
+        return NULL;
+    return compile_expression(expr);
+}
+
+static StatementClosure *
+compile_if_statement(Statement *statement)
+{
+    StatementClosure *closure;
+    Elsif *pos;
+    int count;
+    int i;
+
+    closure = alloc_statement_closure(closure_if_statement,
+                                      statement->line_number);
+    for (count = 1, pos = statement->u.if_s.elsif_list; pos; pos = pos->next) {
+        count++;
+    }
+    closure->u.if_s.branch_count = count;
+    closure->u.if_s.condition = len_malloc(sizeof(ExpressionClosure*) * count);
+    closure->u.if_s.block = len_malloc(sizeof(StatementClosure*) * count);
+    closure->u.if_s.condition[0]
+    = compile_expression(statement->u.if_s.condition);
+    closure->u.if_s.block[0]
+    = compile_statement_list(statement->u.if_s.then_block->statement_list,
+                             statement->line_number);
+    for (i = 1, pos = statement->u.if_s.elsif_list; pos;
+         pos = pos->next, i++) {
+        closure->u.if_s.condition[i] = compile_expression(pos->condition);
+        closure->u.if_s.block[i]
+        = compile_statement_list(pos->block->statement_list,
+                                 statement->line_number);
+    }
+    if (statement->u.if_s.else_block) {
+        closure->u.if_s.else_block
+        = compile_statement_list(statement->u.if_s.else_block->statement_list,
+                                 statement->line_number);
+    } else {
+        closure->u.if_s.else_block = NULL;
+    }
+
+    return closure;
+}
+
+static StatementClosure *
+compile_statement(Statement *statement)
+{
+    StatementClosure *closure = NULL;
+
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            closure = alloc_statement_closure(closure_expression_statement,
+                                              statement->line_number);
+            closure->u.expression
+            = compile_expression(statement->u.expression_s);
+            break;
+        case GLOBAL_STATEMENT:
+            closure = alloc_statement_closure(closure_global_statement,
+                                              statement->line_number);
+            closure->u.global_list = statement->u.global_s.identifier_list;
+            break;
+        case IF_STATEMENT:
+            closure = compile_if_statement(statement);
+            break;
+        case WHILE_STATEMENT:
+            closure = alloc_statement_closure(closure_while_statement,
+                                              statement->line_number);
+            closure->u.loop.condition
+            = compile_expression(statement->u.while_s.condition);
+            closure->u.loop.block
+            = compile_statement_list(statement->u.while_s.block
+                                     ->statement_list,
+                                     statement->line_number);
+            break;
+        case FOR_STATEMENT:
+            closure = alloc_statement_closure(closure_for_statement,
+                                              statement->line_number);
+            closure->u.loop.init
+            = compile_expression_opt(statement->u.for_s.init);
+            closure->u.loop.condition
+            = compile_expression_opt(statement->u.for_s.condition);
+            closure->u.loop.post
+            = compile_expression_opt(statement->u.for_s.post);
+            closure->u.loop.block
+            = compile_statement_list(statement->u.for_s.block->statement_list,
+                                     statement->line_number);
+            break;
+        case RETURN_STATEMENT:
+            if (statement->u.return_s.tail_call
+                && (statement->u.return_s.return_value->type
+                    == FUNCTION_CALL_EXPRESSION)) {
+                closure = alloc_statement_closure(closure_tail_call_statement,
+                                                  statement->line_number);
+                closure->u.return_value
+                = compile_expression(statement->u.return_s.return_value);
+            } else if (statement->u.return_s.return_value) {
+                closure = alloc_statement_closure(closure_return_statement,
+                                                  statement->line_number);
+                closure->u.return_value
+                = compile_expression(statement->u.return_s.return_value);
+            } else {
+                closure = alloc_statement_closure(closure_return_null_statement,
+                                                  statement->line_number);
+            }
+            break;
+        case BREAK_STATEMENT:
+            closure = alloc_statement_closure(closure_break_statement,
+                                              statement->line_number);
+            break;
+        case CONTINUE_STATEMENT:
+            closure = alloc_statement_closure(closure_continue_statement,
+                                              statement->line_number);
+            break;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case ...%d", statement->type));
+    }
+    return closure;
+}
+
+/**
+ * 语句链编译成语句数组
+ */
+static StatementClosure *
+compile_statement_list(StatementList *list, int line_number)
+{
+    StatementClosure *closure;
+    StatementList *pos;
+    int count;
+    int i;
+
+    closure = alloc_statement_closure(closure_block, line_number);
+    for (count = 0, pos = list; pos; pos = pos->next) {
+        count++;
+    }
+    closure->u.block.statement_count = count;
+    closure->u.block.statement
+    = len_malloc(sizeof(StatementClosure*) * (count + 1));
+    for (i = 0, pos = list; pos; pos = pos->next, i++) {
+        closure->u.block.statement[i] = compile_statement(pos->statement);
+    }
+
+    return closure;
+}
+
+/**
+ * 编译所有的函数定义和顶层语句链
+ */
+void
+len_compile_closure(LEN_Interpreter *inter)
+{
+    FunctionDefinition *pos;
+
+    for (pos = inter->function_list; pos; pos = pos->next) {
+        if (pos->type != LEMON_FUNCTION_DEFINITION)
+            continue;
+        pos->u.lemon_f.closure
+        = compile_statement_list(pos->u.lemon_f.block->statement_list,
+                                 inter->current_line_number);
+    }
+    inter->top_level_closure
+    = compile_statement_list(inter->statement_list,
+                             inter->current_line_number);
+}
+
+/**
+ * 执行closure，没有执行return语句时返回null
+ */
+LEN_Value
+len_execute_closure(LEN_Interpreter *inter, LocalEnvironment *env,
+                    StatementClosure *closure)
+{
+    LEN_Value ret;
+
+    if (closure->proc(inter, env, closure, &ret) != RETURN_STATEMENT_RESULT) {
+        ret.type = LEN_NULL_VALUE;
+    }
+
+    return ret;
+}
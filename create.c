@@ -9,6 +9,7 @@
 //
 
 #include <stdio.h>
+#include <string.h>
 #include "MEM.h"
 #include "DBG.h"
 #include "lemon.h"
@@ -33,6 +34,9 @@ len_function_define(char *identifier, ParameterList *parameter_list,
     f->type = LEMON_FUNCTION_DEFINITION;
     f->u.lemon_f.parameter = parameter_list;
     f->u.lemon_f.block = block;
+    f->u.lemon_f.local_variable_count = 0;
+    f->u.lemon_f.pure = LEN_FALSE;
+    f->u.lemon_f.memo = NULL;
     f->next = inter->function_list;
     inter->function_list = f;
 }
@@ -119,32 +123,99 @@ len_create_assign_expression(char *variable, Expression *operand)
 
     exp = len_alloc_expression(ASSIGN_EXPRESSION);
     exp->u.assign_expression.variable = variable;
+    exp->u.assign_expression.slot = -1;
+    exp->u.assign_expression.global_index = -1;
     exp->u.assign_expression.operand = operand;
 
     return exp;
 }
 
 /**
- * 根据值类型，修改表达式类型
+ * 根据值类型，修改表达式类型，行号保持不变
+ * 折叠出来的字符串复制到interpreter_storage，作为不朽的字面量
  */
-static Expression
-convert_value_to_expression(LEN_Value *v)
+void
+len_convert_value_to_expression(LEN_Value *v, Expression *expr)
 {
-    Expression  expr;
-    
+    char *str;
+
     if (v->type == LEN_INT_VALUE) {
-        expr.type = INT_EXPRESSION;
-        expr.u.int_value = v->u.int_value;
+        expr->type = INT_EXPRESSION;
+        expr->u.int_value = v->u.int_value;
     } else if (v->type == LEN_DOUBLE_VALUE) {
-        expr.type = DOUBLE_EXPRESSION;
-        expr.u.double_value = v->u.double_value;
+        expr->type = DOUBLE_EXPRESSION;
+        expr->u.double_value = v->u.double_value;
+    } else if (v->type == LEN_STRING_VALUE) {
+        str = len_malloc(strlen(v->u.string_value->string) + 1);
+        strcpy(str, v->u.string_value->string);
+        len_release_string(v->u.string_value);
+        expr->type = STRING_EXPRESSION;
+        expr->u.string_value
+            = len_literal_to_len_string(len_get_current_interpreter(), str);
     } else {
         DBG_assert(v->type == LEN_BOOLEAN_VALUE,
                    ("v->type..%d\n", v->type));
-        expr.type = BOOLEAN_EXPRESSION;
-        expr.u.boolean_value = v->u.boolean_value;
+        expr->type = BOOLEAN_EXPRESSION;
+        expr->u.boolean_value = v->u.boolean_value;
     }
-    return expr;
+}
+
+#define is_numeric_expression(expr) \
+((expr)->type == INT_EXPRESSION || (expr)->type == DOUBLE_EXPRESSION)
+
+#define is_literal_expression(expr) \
+(is_numeric_expression(expr) || (expr)->type == STRING_EXPRESSION\
+ || (expr)->type == BOOLEAN_EXPRESSION || (expr)->type == NULL_EXPRESSION)
+
+/**
+ * 能否在编译时求值
+ * 只折叠运行时一定不会报错的组合，报错留到执行到这里的时候
+ * (数值之间的运算一直在编译时求值，保持原来的行为)
+ */
+static LEN_Boolean
+is_foldable(ExpressionType operator, Expression *left, Expression *right)
+{
+    // int的除数为0或者溢出时运行到这里才报错
+    if (left->type == INT_EXPRESSION && right->type == INT_EXPRESSION
+        && (operator == DIV_EXPRESSION || operator == MOD_EXPRESSION)
+        && !dkc_is_safe_division(left->u.int_value, right->u.int_value))
+        return LEN_FALSE;
+    if (is_numeric_expression(left) && is_numeric_expression(right))
+        return LEN_TRUE;
+    // 字符串连接，右边的字面量转换成字符串
+    if (left->type == STRING_EXPRESSION && operator == ADD_EXPRESSION
+        && is_literal_expression(right))
+        return LEN_TRUE;
+    if (left->type == STRING_EXPRESSION && right->type == STRING_EXPRESSION
+        && dkc_is_compare_operator(operator))
+        return LEN_TRUE;
+    if (left->type == BOOLEAN_EXPRESSION && right->type == BOOLEAN_EXPRESSION
+        && (operator == EQ_EXPRESSION || operator == NE_EXPRESSION))
+        return LEN_TRUE;
+
+    return LEN_FALSE;
+}
+
+/**
+ * &&和||的左边是boolean常量时的短路
+ * false && x是false，true || x是true，x不会被求值
+ * true && x和false || x只有x也是boolean常量时才能折叠，否则运行时还要检查x的类型
+ */
+static Expression *
+fold_logical_expression(ExpressionType operator, Expression *left,
+                        Expression *right)
+{
+    LEN_Boolean short_circuit;
+
+    if (left->type != BOOLEAN_EXPRESSION)
+        return NULL;
+    short_circuit = (operator == LOGICAL_OR_EXPRESSION);
+    if (left->u.boolean_value == short_circuit)
+        return left;
+    if (right->type == BOOLEAN_EXPRESSION)
+        return right;
+
+    return NULL;
 }
 
 /**
@@ -152,18 +223,23 @@ convert_value_to_expression(LEN_Value *v)
  */
 Expression *
 len_create_binary_expression(ExpressionType operator, Expression *left, Expression *right){
+    Expression *folded;
+
+    if (operator == LOGICAL_AND_EXPRESSION
+        || operator == LOGICAL_OR_EXPRESSION) {
+        folded = fold_logical_expression(operator, left, right);
+        if (folded)
+            return folded;
+    }
     /* 常量折叠优化
      具体来说，对于纯粹是常量构成的表达式，在编译时提前计算结果
      */
-    if ((left->type == INT_EXPRESSION
-         || left->type == DOUBLE_EXPRESSION)
-        && (right->type == INT_EXPRESSION
-            || right->type == DOUBLE_EXPRESSION)) {
+    if (is_foldable(operator, left, right)) {
             LEN_Value v;
             v = len_eval_binary_expression(len_get_current_interpreter(),
                                            NULL, operator, left, right);
             // 用计算的结果复写左表达式.
-            *left = convert_value_to_expression(&v);
+            len_convert_value_to_expression(&v, left);
             
             return left;
     } else {
@@ -171,6 +247,11 @@ len_create_binary_expression(ExpressionType operator, Expression *left, Expressi
         exp = len_alloc_expression(operator);
         exp->u.binary_expression.left = left;
         exp->u.binary_expression.right = right;
+        exp->u.binary_expression.specialization = BINARY_UNSPECIALIZED;
+        exp->u.binary_expression.deopt_count = 0;
+        exp->u.binary_expression.typed = LEN_FALSE;
+        exp->u.binary_expression.induction_valid = LEN_FALSE;
+        exp->u.binary_expression.borrows = LEN_FALSE;
         return exp;
     }
 }
@@ -184,6 +265,8 @@ len_alloc_expression(ExpressionType type){
     exp = len_malloc(sizeof(Expression));
     exp->type = type;
     exp->line_number = len_get_current_interpreter()->current_line_number;
+    exp->value_type = LEN_UNDEFINED_VALUE;
+    exp->fused = FUSED_NONE;
     return exp;
 }
 
@@ -196,7 +279,7 @@ len_create_minus_expression(Expression *operand)
         v = len_eval_minus_expression(len_get_current_interpreter(),
                                       NULL, operand);
         /* Notice! Overwriting operand expression. */
-        *operand = convert_value_to_expression(&v);
+        len_convert_value_to_expression(&v, operand);
         return operand;
     } else {
         Expression      *exp;
@@ -206,13 +289,30 @@ len_create_minus_expression(Expression *operand)
     }
 }
 
+Expression *
+len_create_bit_not_expression(Expression *operand)
+{
+    if (operand->type == INT_EXPRESSION) {
+        operand->u.int_value = ~operand->u.int_value;
+        return operand;
+    } else {
+        Expression      *exp;
+        exp = len_alloc_expression(BIT_NOT_EXPRESSION);
+        exp->u.bit_not_expression = operand;
+        return exp;
+    }
+}
+
 Expression *
 len_create_identifier_expression(char *identifier)
 {
     Expression  *exp;
 
     exp = len_alloc_expression(IDENTIFIER_EXPRESSION);
-    exp->u.identifier = identifier;
+    exp->u.identifier.name = identifier;
+    exp->u.identifier.slot = -1;
+    exp->u.identifier.global_index = -1;
+    exp->u.identifier.borrowed = LEN_FALSE;
 
     return exp;
 }
@@ -225,6 +325,8 @@ len_create_function_call_expression(char *func_name, ArgumentList *argument)
     exp = len_alloc_expression(FUNCTION_CALL_EXPRESSION);
     exp->u.function_call_expression.identifier = func_name;
     exp->u.function_call_expression.argument = argument;
+    exp->u.function_call_expression.function = NULL;
+    exp->u.function_call_expression.borrows = LEN_FALSE;
 
     return exp;
 }
@@ -280,6 +382,7 @@ len_create_global_identifier(char *identifier)
 
     i_list = len_malloc(sizeof(IdentifierList));
     i_list->name = identifier;
+    i_list->global_index = -1;
     i_list->next = NULL;
 
     return i_list;
@@ -309,6 +412,7 @@ len_create_if_statement(Expression *condition,
     st->u.if_s.then_block = then_block;
     st->u.if_s.elsif_list = elsif_list;
     st->u.if_s.else_block = else_block;
+    st->u.if_s.dispatch = NULL;
 
     return st;
 }
@@ -346,6 +450,7 @@ len_create_while_statement(Expression *condition, Block *block)
     st = alloc_statement(WHILE_STATEMENT);
     st->u.while_s.condition = condition;
     st->u.while_s.block = block;
+    len_init_loop_trace_info(&st->u.while_s.trace_info);
 
     return st;
 }
@@ -361,6 +466,8 @@ len_create_for_statement(Expression *init, Expression *cond,
     st->u.for_s.condition = cond;
     st->u.for_s.post = post;
     st->u.for_s.block = block;
+    len_init_loop_trace_info(&st->u.for_s.trace_info);
+    st->u.for_s.counted = NULL;
 
     return st;
 }
@@ -394,6 +501,7 @@ len_create_return_statement(Expression *expression)
 
     st = alloc_statement(RETURN_STATEMENT);
     st->u.return_s.return_value = expression;
+    st->u.return_s.tail_call = LEN_FALSE;
 
     return st;
 }
@@ -407,3 +515,158 @@ Statement *len_create_continue_statement(void)
 {
     return alloc_statement(CONTINUE_STATEMENT);
 }
+
+/**条件是指定值的boolean常量*/
+#define is_constant_condition(expr, value) \
+((expr)->type == BOOLEAN_EXPRESSION && (expr)->u.boolean_value == (value))
+
+static StatementList *eliminate_statement_list(StatementList *list);
+
+static void
+eliminate_block(Block *block)
+{
+    block->statement_list = eliminate_statement_list(block->statement_list);
+}
+
+/**
+ * 删除if语句中条件为常量false的分支，常量true的分支之后的分支不会执行，也删除
+ * if语句不再需要判断条件时返回LEN_FALSE，
+ * 无条件执行的块放在unconditional中(没有时为NULL)
+ */
+static LEN_Boolean
+eliminate_if_statement(Statement *statement, Block **unconditional)
+{
+    IfStatement *if_s = &statement->u.if_s;
+    Elsif       *elsif;
+    Elsif       *head = NULL;
+    Elsif       **tail = &head;
+
+    // if的条件是false时，第一个elsif成为if
+    while (is_constant_condition(if_s->condition, LEN_FALSE)) {
+        if (if_s->elsif_list == NULL) {
+            *unconditional = if_s->else_block;
+            return LEN_FALSE;
+        }
+        if_s->condition = if_s->elsif_list->condition;
+        if_s->then_block = if_s->elsif_list->block;
+        if_s->elsif_list = if_s->elsif_list->next;
+    }
+    if (is_constant_condition(if_s->condition, LEN_TRUE)) {
+        *unconditional = if_s->then_block;
+        return LEN_FALSE;
+    }
+
+    eliminate_block(if_s->then_block);
+    for (elsif = if_s->elsif_list; elsif; elsif = elsif->next) {
+        if (is_constant_condition(elsif->condition, LEN_FALSE))
+            continue;
+        if (is_constant_condition(elsif->condition, LEN_TRUE)) {
+            // 这个分支成为else，之后的分支不会执行
+            if_s->else_block = elsif->block;
+            break;
+        }
+        eliminate_block(elsif->block);
+        *tail = elsif;
+        tail = &elsif->next;
+    }
+    *tail = NULL;
+    if_s->elsif_list = head;
+    if (if_s->else_block) {
+        eliminate_block(if_s->else_block);
+    }
+
+    return LEN_TRUE;
+}
+
+/**
+ * 把list接在rest前面，返回新的链表头
+ */
+static StatementList *
+splice_statement_list(StatementList *list, StatementList *rest)
+{
+    StatementList *pos;
+
+    if (list == NULL)
+        return rest;
+    for (pos = list; pos->next; pos = pos->next)
+        ;
+    pos->next = rest;
+
+    return list;
+}
+
+/**
+ * 删除语句链中执行不到的语句，返回新的语句链
+ * 无条件执行的if块直接展开到语句链中(局部变量的作用域是整个函数，展开不影响变量)
+ */
+static StatementList *
+eliminate_statement_list(StatementList *list)
+{
+    StatementList   *head = NULL;
+    StatementList   **tail = &head;
+    StatementList   *pos;
+    StatementList   *next;
+    Statement       *statement;
+    Block           *unconditional;
+
+    for (pos = list; pos; pos = next) {
+        next = pos->next;
+        statement = pos->statement;
+        switch (statement->type) {
+            case IF_STATEMENT:
+                if (!eliminate_if_statement(statement, &unconditional)) {
+                    if (unconditional) {
+                        next = splice_statement_list(unconditional
+                                                     ->statement_list, next);
+                    }
+                    continue;
+                }
+                break;
+            case WHILE_STATEMENT:
+                if (is_constant_condition(statement->u.while_s.condition,
+                                          LEN_FALSE))
+                    continue;
+                eliminate_block(statement->u.while_s.block);
+                break;
+            case FOR_STATEMENT:
+                eliminate_block(statement->u.for_s.block);
+                break;
+            case EXPRESSION_STATEMENT:  /* FALLTHRU */
+            case GLOBAL_STATEMENT:      /* FALLTHRU */
+            case RETURN_STATEMENT:      /* FALLTHRU */
+            case BREAK_STATEMENT:       /* FALLTHRU */
+            case CONTINUE_STATEMENT:
+                break;
+            case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+            default:
+                DBG_panic(("bad case..%d\n", statement->type));
+        }
+        *tail = pos;
+        tail = &pos->next;
+        // return、break、continue之后的语句执行不到
+        if (statement->type == RETURN_STATEMENT
+            || statement->type == BREAK_STATEMENT
+            || statement->type == CONTINUE_STATEMENT)
+            break;
+    }
+    *tail = NULL;
+
+    return head;
+}
+
+/**
+ * 删除顶层语句链和函数中执行不到的代码
+ * 在len_resolve_variables()之后执行，执行不到的代码中的编译错误照常报告
+ */
+void
+len_eliminate_dead_code(LEN_Interpreter *inter)
+{
+    FunctionDefinition *func;
+
+    inter->statement_list = eliminate_statement_list(inter->statement_list);
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type == LEMON_FUNCTION_DEFINITION) {
+            eliminate_block(func->u.lemon_f.block);
+        }
+    }
+}
@@ -0,0 +1,274 @@
+//
+//  dispatch.c
+//  lemon
+//  这个文件在编译结束时识别if (x == 常量) ... elsif (x == 常量) ...的分支链，
+//  所有的条件都是同一个变量和不同的整数常量或者字符串常量的比较时生成分派表。
+//  整数的键密集时是跳转表，稀疏时二分查找，字符串的键按散列值查找。
+//  条件的求值没有副作用，遍历分析树执行时直接按变量的值找到分支，
+//  变量的类型和键不同时照常依次求条件
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+/**生成分派表最少的分支数量，分支少时依次比较更快*/
+#define DISPATCH_CASE_MIN   (4)
+
+static void build_in_statement_list(StatementList *list);
+
+/**
+ * 取出x == 常量或者常量 == x中的变量和常量
+ */
+static LEN_Boolean
+split_condition(Expression *cond, Expression **variable, Expression **key)
+{
+    Expression *left;
+    Expression *right;
+
+    if (cond->type != EQ_EXPRESSION)
+        return LEN_FALSE;
+    left = cond->u.binary_expression.left;
+    right = cond->u.binary_expression.right;
+    if (right->type == IDENTIFIER_EXPRESSION) {
+        left = right;
+        right = cond->u.binary_expression.left;
+    }
+    if (left->type != IDENTIFIER_EXPRESSION
+        || (right->type != INT_EXPRESSION
+            && right->type != STRING_EXPRESSION))
+        return LEN_FALSE;
+    *variable = left;
+    *key = right;
+    return LEN_TRUE;
+}
+
+static LEN_Boolean
+same_key(DispatchCase *a, DispatchCase *b)
+{
+    if (a->string_key)
+        return !strcmp(a->string_key->string, b->string_key->string);
+    return a->int_key == b->int_key;
+}
+
+/**
+ * 把条件加入分支的数组，变量或者键的类型和第一个条件不同时返回LEN_FALSE
+ * 重复的键只保留第一个，后面的分支永远不会执行
+ */
+static LEN_Boolean
+add_case(DispatchTable *table, DispatchCase *cases, int *count,
+         Expression *cond, Block *block)
+{
+    Expression      *variable;
+    Expression      *key;
+    DispatchCase    *c = &cases[*count];
+    int i;
+
+    if (!split_condition(cond, &variable, &key))
+        return LEN_FALSE;
+    if (*count == 0) {
+        table->slot = variable->u.identifier.slot;
+        table->global_index = variable->u.identifier.global_index;
+        table->kind = (key->type == STRING_EXPRESSION
+                       ? DISPATCH_STRING : DISPATCH_SORTED);
+    } else if (variable->u.identifier.slot != table->slot
+               || variable->u.identifier.global_index != table->global_index
+               || ((key->type == STRING_EXPRESSION)
+                   != (table->kind == DISPATCH_STRING))) {
+        return LEN_FALSE;
+    }
+
+    if (key->type == STRING_EXPRESSION) {
+        c->string_key = key->u.string_value;
+        c->hash = len_hash_string(c->string_key->string);
+    } else {
+        c->string_key = NULL;
+        c->int_key = key->u.int_value;
+    }
+    c->block = block;
+    c->next = NULL;
+    for (i = 0; i < *count; i++) {
+        if (same_key(&cases[i], c))
+            return LEN_TRUE;
+    }
+    (*count)++;
+    return LEN_TRUE;
+}
+
+static int
+compare_case(const void *a, const void *b)
+{
+    long long left = ((const DispatchCase*)a)->int_key;
+    long long right = ((const DispatchCase*)b)->int_key;
+
+    return (left > right) - (left < right);
+}
+
+/**
+ * 整数的键排序，最大和最小的键之差不超过分支数量的两倍时改成跳转表
+ */
+static void
+fix_int_table(DispatchTable *table, DispatchCase *cases, int count)
+{
+    unsigned long long range;
+    int i;
+
+    qsort(cases, count, sizeof(DispatchCase), compare_case);
+    range = (unsigned long long)cases[count - 1].int_key
+        - (unsigned long long)cases[0].int_key;
+    if (range >= (unsigned long long)count * 2) {
+        table->size = count;
+        table->cases = len_malloc(sizeof(DispatchCase) * count);
+        memcpy(table->cases, cases, sizeof(DispatchCase) * count);
+        return;
+    }
+    table->kind = DISPATCH_DENSE;
+    table->min = cases[0].int_key;
+    table->size = (int)range + 1;
+    table->table = len_malloc(sizeof(Block*) * table->size);
+    for (i = 0; i < table->size; i++) {
+        table->table[i] = NULL;
+    }
+    for (i = 0; i < count; i++) {
+        table->table[cases[i].int_key - table->min] = cases[i].block;
+    }
+}
+
+/**
+ * 字符串的键放进散列桶，桶的数量是不小于分支数量的2的幂
+ * 同一个桶中保持原来的顺序
+ */
+static void
+fix_string_table(DispatchTable *table, DispatchCase *cases, int count)
+{
+    DispatchCase    *c;
+    DispatchCase    **tail;
+    int i;
+
+    for (table->size = 1; table->size < count; table->size *= 2)
+        ;
+    table->cases = len_malloc(sizeof(DispatchCase) * count);
+    memcpy(table->cases, cases, sizeof(DispatchCase) * count);
+    table->bucket = len_malloc(sizeof(DispatchCase*) * table->size);
+    for (i = 0; i < table->size; i++) {
+        table->bucket[i] = NULL;
+    }
+    for (i = 0; i < count; i++) {
+        c = &table->cases[i];
+        for (tail = &table->bucket[c->hash & (table->size - 1)]; *tail;
+             tail = &(*tail)->next)
+            ;
+        *tail = c;
+    }
+}
+
+static void
+build_dispatch_table(Statement *statement)
+{
+    DispatchTable   table;
+    DispatchCase    *cases;
+    Elsif   *elsif;
+    int     count = 0;
+
+    for (elsif = statement->u.if_s.elsif_list; elsif; elsif = elsif->next) {
+        count++;
+    }
+    if (count + 1 < DISPATCH_CASE_MIN)
+        return;
+
+    cases = MEM_malloc(sizeof(DispatchCase) * (count + 1));
+    count = 0;
+    table.table = NULL;
+    table.cases = NULL;
+    table.bucket = NULL;
+    if (!add_case(&table, cases, &count, statement->u.if_s.condition,
+                  statement->u.if_s.then_block))
+        goto FUNC_END;
+    for (elsif = statement->u.if_s.elsif_list; elsif; elsif = elsif->next) {
+        if (!add_case(&table, cases, &count, elsif->condition, elsif->block))
+            goto FUNC_END;
+    }
+
+    if (table.kind == DISPATCH_STRING) {
+        fix_string_table(&table, cases, count);
+    } else {
+        fix_int_table(&table, cases, count);
+    }
+    statement->u.if_s.dispatch = len_malloc(sizeof(DispatchTable));
+    *statement->u.if_s.dispatch = table;
+
+FUNC_END:
+    MEM_free(cases);
+}
+
+static void
+build_in_statement(Statement *statement)
+{
+    Elsif *elsif;
+
+    switch (statement->type) {
+        case IF_STATEMENT:
+            build_dispatch_table(statement);
+            build_in_statement_list(statement->u.if_s.then_block
+                                    ->statement_list);
+            for (elsif = statement->u.if_s.elsif_list; elsif;
+                 elsif = elsif->next) {
+                build_in_statement_list(elsif->block->statement_list);
+            }
+            if (statement->u.if_s.else_block) {
+                build_in_statement_list(statement->u.if_s.else_block
+                                        ->statement_list);
+            }
+            break;
+        case WHILE_STATEMENT:
+            build_in_statement_list(statement->u.while_s.block
+                                    ->statement_list);
+            break;
+        case FOR_STATEMENT:
+            build_in_statement_list(statement->u.for_s.block
+                                    ->statement_list);
+            break;
+        case EXPRESSION_STATEMENT:  /* FALLTHRU */
+        case GLOBAL_STATEMENT:      /* FALLTHRU */
+        case RETURN_STATEMENT:      /* FALLTHRU */
+        case BREAK_STATEMENT:       /* FALLTHRU */
+        case CONTINUE_STATEMENT:
+            break;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n", statement->type));
+    }
+}
+
+static void
+build_in_statement_list(StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        build_in_statement(pos->statement);
+    }
+}
+
+/**
+ * 生成函数和顶层语句链中if/elsif分支链的分派表
+ */
+void
+len_build_dispatch_tables(LEN_Interpreter *inter)
+{
+    FunctionDefinition  *func;
+
+    if (!(inter->optimize_flags & LEN_OPTIMIZE_DISPATCH))
+        return;
+
+    build_in_statement_list(inter->statement_list);
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type != LEMON_FUNCTION_DEFINITION)
+            continue;
+        build_in_statement_list(func->u.lemon_f.block->statement_list);
+    }
+}
@@ -0,0 +1,1333 @@
+//
+//  emit.c
+//  lemon
+//  这个文件主要用来将分析树翻译成C语言(lemon --emit-c)
+//  生成的代码和运行时(string_pool.c、eval.c、native.c等)链接之后执行
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include <stdarg.h>
+#include <limits.h>
+#include <string.h>
+#include <math.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+/**
+ * 函数中出现的局部变量(分配了下标的参数和变量)
+ */
+typedef struct {
+    int         count;
+    char        **name;
+    /**前parameter_count个是参数，一定有值*/
+    int         parameter_count;
+} LocalNames;
+
+/**
+ * 从顶层语句链可以调用到的用户函数，只输出这些函数
+ */
+typedef struct {
+    int         count;
+    FunctionDefinition  **function;
+} CalledFunctions;
+
+/**
+ * 变量的访问方式
+ * 全局变量总是通过g_xxx中保存的全局变量表下标访问
+ */
+typedef enum {
+    /**函数中的局部变量翻译成C的局部变量*/
+    SLOT_ACCESS = 1,
+    /**顶层语句链，没有局部变量*/
+    GLOBAL_ACCESS
+} VariableAccess;
+
+/**
+ * 翻译过程中的上下文
+ * fp为NULL时只统计临时变量的数量，不输出
+ */
+typedef struct {
+    FILE        *fp;
+    int         indent;
+    /**当前第一个空闲的临时变量*/
+    int         current_temp;
+    int         temp_count;
+    VariableAccess  access;
+    LocalNames  locals;
+    int         label_count;
+    /**当前循环continue时跳转的标签，-1表示while循环，-2表示不在循环中*/
+    int         continue_label;
+    LEN_Boolean continue_used;
+    /**正在翻译的函数，顶层语句链为NULL*/
+    FunctionDefinition  *function;
+    /**函数中有调用自己的尾调用，需要输出FUNC_START标签*/
+    LEN_Boolean tail_call_used;
+    /**有跳到FUNC_END的return，需要输出FUNC_END标签*/
+    LEN_Boolean end_used;
+    /**不为NULL时记录调用的用户函数*/
+    CalledFunctions *called;
+} EmitContext;
+
+#define NOT_IN_LOOP         (-2)
+#define WHILE_LOOP          (-1)
+
+static void emit_expression(EmitContext *ec, Expression *expr, int dst);
+static void emit_statement_list(EmitContext *ec, StatementList *list);
+
+/**
+ * 按当前缩进输出一行
+ */
+static void
+emit_line(EmitContext *ec, char *format, ...)
+{
+    va_list ap;
+    int i;
+
+    if (ec->fp == NULL)
+        return;
+    for (i = 0; i < ec->indent; i++) {
+        fputs("    ", ec->fp);
+    }
+    va_start(ap, format);
+    vfprintf(ec->fp, format, ap);
+    va_end(ap);
+    fputc('\n', ec->fp);
+}
+
+/**
+ * 输出C语言的字符串字面量
+ */
+static void
+emit_string_literal(FILE *fp, char *str)
+{
+    unsigned char *pos;
+
+    fputc('"', fp);
+    for (pos = (unsigned char *)str; *pos; pos++) {
+        switch (*pos) {
+            case '"':
+                fputs("\\\"", fp);
+                break;
+            case '\\':
+                fputs("\\\\", fp);
+                break;
+            case '\n':
+                fputs("\\n", fp);
+                break;
+            case '\t':
+                fputs("\\t", fp);
+                break;
+            default:
+                if (*pos < ' ' || *pos >= 0x7f) {
+                    fprintf(fp, "\\%03o", *pos);
+                } else {
+                    fputc(*pos, fp);
+                }
+        }
+    }
+    fputc('"', fp);
+}
+
+static int
+alloc_temp(EmitContext *ec)
+{
+    int temp;
+
+    temp = ec->current_temp++;
+    if (ec->current_temp > ec->temp_count) {
+        ec->temp_count = ec->current_temp;
+    }
+    return temp;
+}
+
+static void
+free_temp(EmitContext *ec, int temp)
+{
+    ec->current_temp--;
+    DBG_assert(ec->current_temp == temp, ("temp..%d\n", temp));
+}
+
+/**************************************局部变量*************************************/
+
+static int
+search_local(LocalNames *locals, char *name)
+{
+    int i;
+
+    for (i = 0; i < locals->count; i++) {
+        if (locals->name[i] == name)
+            return i;
+    }
+    return -1;
+}
+
+static void
+add_local(LocalNames *locals, char *name)
+{
+    if (search_local(locals, name) >= 0)
+        return;
+    locals->name = MEM_realloc(locals->name,
+                               sizeof(char*) * (locals->count + 1));
+    locals->name[locals->count] = name;
+    locals->count++;
+}
+
+/**************************************调用的函数*************************************/
+
+static LEN_Boolean
+is_called_function(CalledFunctions *called, FunctionDefinition *func)
+{
+    int i;
+
+    for (i = 0; i < called->count; i++) {
+        if (called->function[i] == func)
+            return LEN_TRUE;
+    }
+    return LEN_FALSE;
+}
+
+static void
+add_called_function(CalledFunctions *called, FunctionDefinition *func)
+{
+    if (is_called_function(called, func))
+        return;
+    called->function = MEM_realloc(called->function,
+                                   sizeof(FunctionDefinition*)
+                                   * (called->count + 1));
+    called->function[called->count] = func;
+    called->count++;
+}
+
+/**
+ * 收集表达式中分配了下标的局部变量
+ */
+static void
+collect_expression_locals(LocalNames *locals, Expression *expr)
+{
+    ArgumentList *arg_p;
+    InlineBranch *branch;
+
+    if (expr == NULL)
+        return;
+    switch (expr->type) {
+        case IDENTIFIER_EXPRESSION:
+            if (expr->u.identifier.slot >= 0) {
+                add_local(locals, expr->u.identifier.name);
+            }
+            break;
+        case ASSIGN_EXPRESSION:
+            if (expr->u.assign_expression.slot >= 0) {
+                add_local(locals, expr->u.assign_expression.variable);
+            }
+            collect_expression_locals(locals,
+                                      expr->u.assign_expression.operand);
+            break;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            collect_expression_locals(locals, expr->u.binary_expression.left);
+            collect_expression_locals(locals, expr->u.binary_expression.right);
+            break;
+        case MINUS_EXPRESSION:
+            collect_expression_locals(locals, expr->u.minus_expression);
+            break;
+        case BIT_NOT_EXPRESSION:
+            collect_expression_locals(locals, expr->u.bit_not_expression);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            for (arg_p = expr->u.function_call_expression.argument;
+                 arg_p; arg_p = arg_p->next) {
+                collect_expression_locals(locals, arg_p->expression);
+            }
+            break;
+        case INLINE_CALL_EXPRESSION:
+            // 临时变量是调用者的局部变量
+            for (arg_p = expr->u.inline_call_expression.binding;
+                 arg_p; arg_p = arg_p->next) {
+                collect_expression_locals(locals, arg_p->expression);
+            }
+            for (branch = expr->u.inline_call_expression.branch; branch;
+                 branch = branch->next) {
+                collect_expression_locals(locals, branch->condition);
+                collect_expression_locals(locals, branch->value);
+            }
+            collect_expression_locals(locals,
+                                      expr->u.inline_call_expression.body);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * 收集语句链中分配了下标的局部变量
+ */
+static void
+collect_statement_list_locals(LocalNames *locals, StatementList *list)
+{
+    StatementList   *pos;
+    Statement       *statement;
+    Elsif           *elsif;
+
+#define collect_expression(expr) \
+    collect_expression_locals(locals, (expr))
+#define collect_block(block) \
+    collect_statement_list_locals(locals, (block)->statement_list)
+
+    for (pos = list; pos; pos = pos->next) {
+        statement = pos->statement;
+        switch (statement->type) {
+            case EXPRESSION_STATEMENT:
+                collect_expression(statement->u.expression_s);
+                break;
+            case GLOBAL_STATEMENT:
+                break;
+            case IF_STATEMENT:
+                collect_expression(statement->u.if_s.condition);
+                collect_block(statement->u.if_s.then_block);
+                for (elsif = statement->u.if_s.elsif_list; elsif;
+                     elsif = elsif->next) {
+                    collect_expression(elsif->condition);
+                    collect_block(elsif->block);
+                }
+                if (statement->u.if_s.else_block) {
+                    collect_block(statement->u.if_s.else_block);
+                }
+                break;
+            case WHILE_STATEMENT:
+                collect_expression(statement->u.while_s.condition);
+                collect_block(statement->u.while_s.block);
+                break;
+            case FOR_STATEMENT:
+                collect_expression(statement->u.for_s.init);
+                collect_expression(statement->u.for_s.condition);
+                collect_expression(statement->u.for_s.post);
+                collect_block(statement->u.for_s.block);
+                break;
+            case RETURN_STATEMENT:
+                collect_expression(statement->u.return_s.return_value);
+                break;
+            case BREAK_STATEMENT:       /* FALLTHRU */
+            case CONTINUE_STATEMENT:
+                break;
+            case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+            default:
+                DBG_panic(("bad case..%d\n", statement->type));
+        }
+    }
+
+#undef collect_expression
+#undef collect_block
+}
+
+/**************************************表达式*************************************/
+
+static char *
+expression_type_name(ExpressionType type)
+{
+    switch (type) {
+        case ADD_EXPRESSION:
+            return "ADD_EXPRESSION";
+        case SUB_EXPRESSION:
+            return "SUB_EXPRESSION";
+        case MUL_EXPRESSION:
+            return "MUL_EXPRESSION";
+        case DIV_EXPRESSION:
+            return "DIV_EXPRESSION";
+        case MOD_EXPRESSION:
+            return "MOD_EXPRESSION";
+        case EQ_EXPRESSION:
+            return "EQ_EXPRESSION";
+        case NE_EXPRESSION:
+            return "NE_EXPRESSION";
+        case GT_EXPRESSION:
+            return "GT_EXPRESSION";
+        case GE_EXPRESSION:
+            return "GE_EXPRESSION";
+        case LT_EXPRESSION:
+            return "LT_EXPRESSION";
+        case LE_EXPRESSION:
+            return "LE_EXPRESSION";
+        case BIT_AND_EXPRESSION:
+            return "BIT_AND_EXPRESSION";
+        case BIT_OR_EXPRESSION:
+            return "BIT_OR_EXPRESSION";
+        case BIT_XOR_EXPRESSION:
+            return "BIT_XOR_EXPRESSION";
+        case LEFT_SHIFT_EXPRESSION:
+            return "LEFT_SHIFT_EXPRESSION";
+        case RIGHT_SHIFT_EXPRESSION:
+            return "RIGHT_SHIFT_EXPRESSION";
+        default:
+            DBG_panic(("bad case..%d\n", type));
+    }
+    return NULL;
+}
+
+static void
+emit_runtime_error(EmitContext *ec, int line_number, char *error)
+{
+    emit_line(ec, "len_runtime_error(%d, %s, MESSAGE_ARGUMENT_END);",
+              line_number, error);
+}
+
+static void
+emit_name_error(EmitContext *ec, int line_number, char *error, char *name)
+{
+    emit_line(ec, "len_runtime_error(%d, %s, STRING_MESSAGE_ARGUMENT, "
+              "\"name\", \"%s\", MESSAGE_ARGUMENT_END);",
+              line_number, error, name);
+}
+
+static void
+emit_check_boolean(EmitContext *ec, int temp, int line_number)
+{
+    emit_line(ec, "if (tmp[%d].type != LEN_BOOLEAN_VALUE) {", temp);
+    ec->indent++;
+    emit_runtime_error(ec, line_number, "NOT_BOOLEAN_TYPE_ERR");
+    ec->indent--;
+    emit_line(ec, "}");
+}
+
+/**
+ * int常量写成C的long long常量，最小值不能直接写成负数
+ */
+static void
+format_int_literal(char *buf, long long value)
+{
+    if (value == LLONG_MIN) {
+        sprintf(buf, "(%lldLL - 1)", value + 1);
+    } else {
+        sprintf(buf, "%lldLL", value);
+    }
+}
+
+static void
+emit_double_expression(EmitContext *ec, double value, int dst)
+{
+    emit_line(ec, "tmp[%d].type = LEN_DOUBLE_VALUE;", dst);
+    if (isinf(value)) {
+        emit_line(ec, "tmp[%d].u.double_value = HUGE_VAL;", dst);
+    } else {
+        emit_line(ec, "tmp[%d].u.double_value = %.17g;", dst, value);
+    }
+}
+
+/**
+ * 字符串字面量第一次求值时创建不朽的LEN_String，之后直接使用
+ */
+static void
+emit_string_expression(EmitContext *ec, LEN_String *str, int dst)
+{
+    int i;
+
+    emit_line(ec, "{");
+    ec->indent++;
+    emit_line(ec, "static LEN_String *literal;");
+    emit_line(ec, "if (literal == NULL) {");
+    if (ec->fp != NULL) {
+        for (i = 0; i <= ec->indent; i++) {
+            fputs("    ", ec->fp);
+        }
+        fputs("literal = len_literal_to_len_string(inter, ", ec->fp);
+        emit_string_literal(ec->fp, str->string);
+        fputs(");\n", ec->fp);
+    }
+    emit_line(ec, "}");
+    emit_line(ec, "tmp[%d].type = LEN_STRING_VALUE;", dst);
+    emit_line(ec, "tmp[%d].u.string_value = literal;", dst);
+    ec->indent--;
+    emit_line(ec, "}");
+}
+
+static void
+emit_identifier_expression(EmitContext *ec, Expression *expr, int dst)
+{
+    char    *name = expr->u.identifier.name;
+    int     index;
+
+    if (expr->u.identifier.slot < 0) {
+        emit_line(ec, "tmp[%d] = len_get_global_variable_value(inter, g_%s, "
+                  "%d);", dst, name, expr->line_number);
+        return;
+    }
+    index = search_local(&ec->locals, name);
+    if (index >= ec->locals.parameter_count) {
+        emit_line(ec, "if (v_%s.type == LEN_UNDEFINED_VALUE) {", name);
+        ec->indent++;
+        emit_name_error(ec, expr->line_number, "VARIABLE_NOT_FOUND_ERR",
+                        name);
+        ec->indent--;
+        emit_line(ec, "}");
+    }
+    emit_line(ec, "tmp[%d] = v_%s;", dst, name);
+    emit_line(ec, "len_refer_if_string(&tmp[%d]);", dst);
+}
+
+static void
+emit_assign_expression(EmitContext *ec, Expression *expr, int dst)
+{
+    char *name = expr->u.assign_expression.variable;
+
+    emit_expression(ec, expr->u.assign_expression.operand, dst);
+    if (expr->u.assign_expression.slot < 0) {
+        emit_line(ec, "len_assign_global_variable(inter, g_%s, &tmp[%d]);",
+                  name, dst);
+    } else {
+        emit_line(ec, "len_release_if_string(&v_%s);", name);
+        emit_line(ec, "v_%s = tmp[%d];", name, dst);
+        emit_line(ec, "len_refer_if_string(&v_%s);", name);
+    }
+}
+
+/**
+ * 二元运算，int类型直接计算，其他类型交给len_eval_binary_values()
+ * 右操作数是int常量时不占用临时变量
+ * 加减乘用溢出检查的内建函数计算，溢出时也交给len_eval_binary_values()报错
+ */
+static void
+emit_binary_expression(EmitContext *ec, Expression *expr, int dst)
+{
+    Expression  *left = expr->u.binary_expression.left;
+    Expression  *right = expr->u.binary_expression.right;
+    char        *op = NULL;
+    char        *builtin = NULL;
+    char        *shift = NULL;
+    char        right_int[64];
+    LEN_Boolean is_compare;
+    int         right_temp;
+
+    emit_expression(ec, left, dst);
+    right_temp = alloc_temp(ec);
+
+    switch (expr->type) {
+        case ADD_EXPRESSION:
+            builtin = "__builtin_add_overflow";
+            break;
+        case SUB_EXPRESSION:
+            builtin = "__builtin_sub_overflow";
+            break;
+        case MUL_EXPRESSION:
+            builtin = "__builtin_mul_overflow";
+            break;
+        case EQ_EXPRESSION:
+            op = "==";
+            break;
+        case NE_EXPRESSION:
+            op = "!=";
+            break;
+        case GT_EXPRESSION:
+            op = ">";
+            break;
+        case GE_EXPRESSION:
+            op = ">=";
+            break;
+        case LT_EXPRESSION:
+            op = "<";
+            break;
+        case LE_EXPRESSION:
+            op = "<=";
+            break;
+        case BIT_AND_EXPRESSION:
+            op = "&";
+            break;
+        case BIT_OR_EXPRESSION:
+            op = "|";
+            break;
+        case BIT_XOR_EXPRESSION:
+            op = "^";
+            break;
+        case LEFT_SHIFT_EXPRESSION:
+            shift = "dkc_shift_left";
+            break;
+        case RIGHT_SHIFT_EXPRESSION:
+            shift = "dkc_shift_right";
+            break;
+        default:
+            // 除法要检查除数为0，交给运行时
+            emit_expression(ec, right, right_temp);
+            emit_line(ec, "tmp[%d] = len_eval_binary_values(inter, %s, "
+                      "&tmp[%d], &tmp[%d], %d);",
+                      dst, expression_type_name(expr->type),
+                      dst, right_temp, left->line_number);
+            free_temp(ec, right_temp);
+            return;
+    }
+    is_compare = dkc_is_compare_operator(expr->type);
+
+    if (builtin) {
+        emit_line(ec, "{");
+        ec->indent++;
+        emit_line(ec, "long long int_result;");
+    }
+    if (right->type == INT_EXPRESSION) {
+        format_int_literal(right_int, right->u.int_value);
+        if (builtin) {
+            emit_line(ec, "if (tmp[%d].type == LEN_INT_VALUE", dst);
+        } else {
+            emit_line(ec, "if (tmp[%d].type == LEN_INT_VALUE) {", dst);
+        }
+    } else {
+        emit_expression(ec, right, right_temp);
+        sprintf(right_int, "tmp[%d].u.int_value", right_temp);
+        emit_line(ec, "if (tmp[%d].type == LEN_INT_VALUE "
+                  "&& tmp[%d].type == LEN_INT_VALUE%s", dst, right_temp,
+                  builtin ? "" : ") {");
+    }
+    if (builtin) {
+        emit_line(ec, "    && !%s(tmp[%d].u.int_value, %s, &int_result)) {",
+                  builtin, dst, right_int);
+    }
+    ec->indent++;
+    if (is_compare) {
+        emit_line(ec, "tmp[%d].u.boolean_value", dst);
+        emit_line(ec, "= tmp[%d].u.int_value %s %s;", dst, op, right_int);
+        emit_line(ec, "tmp[%d].type = LEN_BOOLEAN_VALUE;", dst);
+    } else if (builtin) {
+        emit_line(ec, "tmp[%d].u.int_value = int_result;", dst);
+    } else if (shift) {
+        emit_line(ec, "tmp[%d].u.int_value = %s(tmp[%d].u.int_value, %s);",
+                  dst, shift, dst, right_int);
+    } else {
+        emit_line(ec, "tmp[%d].u.int_value = tmp[%d].u.int_value %s %s;",
+                  dst, dst, op, right_int);
+    }
+    ec->indent--;
+    emit_line(ec, "} else {");
+    ec->indent++;
+    if (right->type == INT_EXPRESSION) {
+        emit_expression(ec, right, right_temp);
+    }
+    emit_line(ec, "tmp[%d] = len_eval_binary_values(inter, %s, "
+              "&tmp[%d], &tmp[%d], %d);",
+              dst, expression_type_name(expr->type),
+              dst, right_temp, left->line_number);
+    ec->indent--;
+    emit_line(ec, "}");
+    if (builtin) {
+        ec->indent--;
+        emit_line(ec, "}");
+    }
+    free_temp(ec, right_temp);
+}
+
+static void
+emit_logical_expression(EmitContext *ec, Expression *expr, int dst)
+{
+    Expression  *left = expr->u.binary_expression.left;
+    Expression  *right = expr->u.binary_expression.right;
+    int         right_temp;
+
+    emit_expression(ec, left, dst);
+    emit_check_boolean(ec, dst, left->line_number);
+    if (expr->type == LOGICAL_AND_EXPRESSION) {
+        emit_line(ec, "if (tmp[%d].u.boolean_value) {", dst);
+    } else {
+        emit_line(ec, "if (!tmp[%d].u.boolean_value) {", dst);
+    }
+    ec->indent++;
+    right_temp = alloc_temp(ec);
+    emit_expression(ec, right, right_temp);
+    emit_check_boolean(ec, right_temp, right->line_number);
+    emit_line(ec, "tmp[%d].u.boolean_value = tmp[%d].u.boolean_value;",
+              dst, right_temp);
+    free_temp(ec, right_temp);
+    ec->indent--;
+    emit_line(ec, "}");
+}
+
+/**
+ * 函数调用，参数放在从dst开始的临时变量里，返回值放在dst
+ * 函数和参数的数量在编译结束时已经检查过
+ */
+static void
+emit_function_call_expression(EmitContext *ec, Expression *expr, int dst)
+{
+    char                *identifier = expr->u.function_call_expression.identifier;
+    FunctionDefinition  *func = expr->u.function_call_expression.function;
+    ArgumentList        *arg_p;
+    int arg_count = 0;
+    int arg_temp;
+    int i;
+
+    for (arg_p = expr->u.function_call_expression.argument; arg_p;
+         arg_p = arg_p->next) {
+        arg_temp = (arg_count == 0) ? dst : alloc_temp(ec);
+        emit_expression(ec, arg_p->expression, arg_temp);
+        arg_count++;
+    }
+
+    if (func->type == LEMON_FUNCTION_DEFINITION) {
+        if (ec->called) {
+            add_called_function(ec->called, func);
+        }
+        emit_line(ec, "tmp[%d] = len_f_%s(inter, &tmp[%d]);",
+                  dst, identifier, dst);
+    } else {
+        emit_line(ec, "tmp[%d] = len_call_native_function(inter, "
+                  "len_n_%s->u.native_f.proc, %d, &tmp[%d]);",
+                  dst, identifier, arg_count, dst);
+    }
+    for (i = arg_count - 1; i > 0; i--) {
+        free_temp(ec, dst + i);
+    }
+}
+
+/**
+ * 展开的函数调用，赋值的结果先放在tmp[dst]中丢弃，再计算返回值
+ * 分支的条件也放在tmp[dst]中，后面的分支嵌套在前面分支的else中
+ */
+static void
+emit_inline_call_expression(EmitContext *ec, Expression *expr, int dst)
+{
+    ArgumentList    *pos;
+    InlineBranch    *branch;
+    int             depth = 0;
+
+    for (pos = expr->u.inline_call_expression.binding; pos; pos = pos->next) {
+        emit_expression(ec, pos->expression, dst);
+        emit_line(ec, "len_release_if_string(&tmp[%d]);", dst);
+    }
+    for (branch = expr->u.inline_call_expression.branch; branch;
+         branch = branch->next) {
+        emit_expression(ec, branch->condition, dst);
+        emit_check_boolean(ec, dst, branch->condition->line_number);
+        emit_line(ec, "if (tmp[%d].u.boolean_value) {", dst);
+        ec->indent++;
+        emit_expression(ec, branch->value, dst);
+        ec->indent--;
+        emit_line(ec, "} else {");
+        ec->indent++;
+        depth++;
+    }
+    emit_expression(ec, expr->u.inline_call_expression.body, dst);
+    for (; depth > 0; depth--) {
+        ec->indent--;
+        emit_line(ec, "}");
+    }
+}
+
+static void
+emit_expression(EmitContext *ec, Expression *expr, int dst)
+{
+    char    int_literal[64];
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:
+            emit_line(ec, "tmp[%d].type = LEN_BOOLEAN_VALUE;", dst);
+            emit_line(ec, "tmp[%d].u.boolean_value = %s;", dst,
+                      expr->u.boolean_value ? "LEN_TRUE" : "LEN_FALSE");
+            break;
+        case INT_EXPRESSION:
+            format_int_literal(int_literal, expr->u.int_value);
+            emit_line(ec, "tmp[%d].type = LEN_INT_VALUE;", dst);
+            emit_line(ec, "tmp[%d].u.int_value = %s;", dst, int_literal);
+            break;
+        case DOUBLE_EXPRESSION:
+            emit_double_expression(ec, expr->u.double_value, dst);
+            break;
+        case STRING_EXPRESSION:
+            emit_string_expression(ec, expr->u.string_value, dst);
+            break;
+        case IDENTIFIER_EXPRESSION:
+            emit_identifier_expression(ec, expr, dst);
+            break;
+        case ASSIGN_EXPRESSION:
+            emit_assign_expression(ec, expr, dst);
+            break;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            emit_binary_expression(ec, expr, dst);
+            break;
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION:
+            emit_logical_expression(ec, expr, dst);
+            break;
+        case MINUS_EXPRESSION:
+            emit_expression(ec, expr->u.minus_expression, dst);
+            emit_line(ec, "tmp[%d] = len_eval_minus_value(inter, &tmp[%d], "
+                      "%d);", dst, dst,
+                      expr->u.minus_expression->line_number);
+            break;
+        case BIT_NOT_EXPRESSION:
+            emit_expression(ec, expr->u.bit_not_expression, dst);
+            emit_line(ec, "tmp[%d] = len_eval_bit_not_value(inter, &tmp[%d], "
+                      "%d);", dst, dst,
+                      expr->u.bit_not_expression->line_number);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            emit_function_call_expression(ec, expr, dst);
+            break;
+        case NULL_EXPRESSION:
+            emit_line(ec, "tmp[%d].type = LEN_NULL_VALUE;", dst);
+            break;
+        case INLINE_CALL_EXPRESSION:
+            emit_inline_call_expression(ec, expr, dst);
+            break;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+}
+
+/**
+ * 求值之后丢弃结果，和表达式语句一样释放string
+ */
+static void
+emit_pop_expression(EmitContext *ec, Expression *expr)
+{
+    int temp;
+
+    temp = alloc_temp(ec);
+    emit_expression(ec, expr, temp);
+    emit_line(ec, "len_release_if_string(&tmp[%d]);", temp);
+    free_temp(ec, temp);
+}
+
+/**
+ * 条件为false时执行action
+ */
+static void
+emit_condition(EmitContext *ec, Expression *condition, char *action)
+{
+    int temp;
+
+    temp = alloc_temp(ec);
+    emit_expression(ec, condition, temp);
+    emit_check_boolean(ec, temp, condition->line_number);
+    emit_line(ec, "if (!tmp[%d].u.boolean_value)", temp);
+    ec->indent++;
+    emit_line(ec, "%s", action);
+    ec->indent--;
+    free_temp(ec, temp);
+}
+
+/**************************************语句*************************************/
+
+static void
+emit_block(EmitContext *ec, Block *block)
+{
+    ec->indent++;
+    emit_statement_list(ec, block->statement_list);
+    ec->indent--;
+}
+
+static void
+emit_if_statement(EmitContext *ec, Statement *statement)
+{
+    Elsif   *elsif;
+    int     temp;
+    int     depth = 0;
+
+    temp = alloc_temp(ec);
+    emit_expression(ec, statement->u.if_s.condition, temp);
+    emit_check_boolean(ec, temp, statement->u.if_s.condition->line_number);
+    emit_line(ec, "if (tmp[%d].u.boolean_value) {", temp);
+    free_temp(ec, temp);
+    emit_block(ec, statement->u.if_s.then_block);
+
+    // elsif的条件在前面的分支都不成立时才求值，所以用嵌套的else
+    for (elsif = statement->u.if_s.elsif_list; elsif; elsif = elsif->next) {
+        emit_line(ec, "} else {");
+        ec->indent++;
+        depth++;
+        temp = alloc_temp(ec);
+        emit_expression(ec, elsif->condition, temp);
+        emit_check_boolean(ec, temp, elsif->condition->line_number);
+        emit_line(ec, "if (tmp[%d].u.boolean_value) {", temp);
+        free_temp(ec, temp);
+        emit_block(ec, elsif->block);
+    }
+    if (statement->u.if_s.else_block) {
+        emit_line(ec, "} else {");
+        emit_block(ec, statement->u.if_s.else_block);
+    }
+    emit_line(ec, "}");
+    for (; depth > 0; depth--) {
+        ec->indent--;
+        emit_line(ec, "}");
+    }
+}
+
+/**
+ * 循环体，保存外层循环的continue标签
+ */
+static void
+emit_loop_body(EmitContext *ec, Block *block, int continue_label)
+{
+    int         outer_label = ec->continue_label;
+    LEN_Boolean outer_used = ec->continue_used;
+
+    ec->continue_label = continue_label;
+    ec->continue_used = LEN_FALSE;
+    emit_block(ec, block);
+    if (continue_label >= 0 && ec->continue_used) {
+        emit_line(ec, "CONTINUE_%d:", continue_label);
+        emit_line(ec, "    ;");
+    }
+    ec->continue_label = outer_label;
+    ec->continue_used = outer_used;
+}
+
+static void
+emit_while_statement(EmitContext *ec, Statement *statement)
+{
+    emit_line(ec, "for (;;) {");
+    ec->indent++;
+    emit_condition(ec, statement->u.while_s.condition, "break;");
+    ec->indent--;
+    emit_loop_body(ec, statement->u.while_s.block, WHILE_LOOP);
+    emit_line(ec, "}");
+}
+
+/**
+ * continue之后还要执行post，所以用goto跳到post之前
+ */
+static void
+emit_for_statement(EmitContext *ec, Statement *statement)
+{
+    int label;
+
+    if (statement->u.for_s.init) {
+        emit_pop_expression(ec, statement->u.for_s.init);
+    }
+    label = ec->label_count++;
+    emit_line(ec, "for (;;) {");
+    ec->indent++;
+    if (statement->u.for_s.condition) {
+        emit_condition(ec, statement->u.for_s.condition, "break;");
+    }
+    ec->indent--;
+    emit_loop_body(ec, statement->u.for_s.block, label);
+    ec->indent++;
+    if (statement->u.for_s.post) {
+        emit_pop_expression(ec, statement->u.for_s.post);
+    }
+    ec->indent--;
+    emit_line(ec, "}");
+}
+
+/**
+ * 后面有同名的参数
+ */
+static LEN_Boolean
+is_shadowed_parameter(ParameterList *param)
+{
+    ParameterList *pos;
+
+    for (pos = param->next; pos; pos = pos->next) {
+        if (pos->name == param->name)
+            return LEN_TRUE;
+    }
+    return LEN_FALSE;
+}
+
+/**
+ * 调用自己的尾调用，参数求值之后释放局部变量，参数换成新的值，
+ * 再回到函数开头，递归不会增加C的栈
+ */
+static void
+emit_self_tail_call(EmitContext *ec, Expression *expr)
+{
+    ParameterList   *param_p;
+    ArgumentList    *arg_p;
+    int arg_count = 0;
+    int temp;
+    int i;
+
+    temp = ec->current_temp;
+    for (arg_p = expr->u.function_call_expression.argument; arg_p;
+         arg_p = arg_p->next) {
+        emit_expression(ec, arg_p->expression, alloc_temp(ec));
+        arg_count++;
+    }
+    for (i = 0; i < ec->locals.count; i++) {
+        emit_line(ec, "len_release_if_string(&v_%s);", ec->locals.name[i]);
+    }
+    for (i = 0, param_p = ec->function->u.lemon_f.parameter; param_p;
+         i++, param_p = param_p->next) {
+        if (is_shadowed_parameter(param_p)) {
+            emit_line(ec, "len_release_if_string(&tmp[%d]);", temp + i);
+        } else {
+            emit_line(ec, "v_%s = tmp[%d];", param_p->name, temp + i);
+        }
+    }
+    for (i = ec->locals.parameter_count; i < ec->locals.count; i++) {
+        emit_line(ec, "v_%s.type = LEN_UNDEFINED_VALUE;", ec->locals.name[i]);
+    }
+    emit_line(ec, "goto FUNC_START;");
+    for (i = arg_count - 1; i >= 0; i--) {
+        free_temp(ec, temp + i);
+    }
+    ec->tail_call_used = LEN_TRUE;
+}
+
+static void
+emit_return_statement(EmitContext *ec, Statement *statement)
+{
+    Expression  *value = statement->u.return_s.return_value;
+    int temp;
+
+    if (statement->u.return_s.tail_call
+        && value->type == FUNCTION_CALL_EXPRESSION
+        && value->u.function_call_expression.function == ec->function) {
+        emit_self_tail_call(ec, value);
+        return;
+    }
+    if (statement->u.return_s.return_value) {
+        temp = alloc_temp(ec);
+        emit_expression(ec, statement->u.return_s.return_value, temp);
+        emit_line(ec, "ret = tmp[%d];", temp);
+        free_temp(ec, temp);
+    } else {
+        emit_line(ec, "ret.type = LEN_NULL_VALUE;");
+    }
+    emit_line(ec, "goto FUNC_END;");
+    ec->end_used = LEN_TRUE;
+}
+
+/**
+ * 循环外的break和continue结束当前语句链，返回null
+ */
+static void
+emit_jump_statement(EmitContext *ec, Statement *statement)
+{
+    if (ec->continue_label == NOT_IN_LOOP) {
+        emit_line(ec, "ret.type = LEN_NULL_VALUE;");
+        emit_line(ec, "goto FUNC_END;");
+        ec->end_used = LEN_TRUE;
+    } else if (statement->type == BREAK_STATEMENT) {
+        emit_line(ec, "break;");
+    } else if (ec->continue_label == WHILE_LOOP) {
+        emit_line(ec, "continue;");
+    } else {
+        emit_line(ec, "goto CONTINUE_%d;", ec->continue_label);
+        ec->continue_used = LEN_TRUE;
+    }
+}
+
+/**
+ * global语句只检查全局变量是否已经定义
+ */
+static void
+emit_global_statement(EmitContext *ec, Statement *statement)
+{
+    IdentifierList *pos;
+
+    if (ec->access == GLOBAL_ACCESS) {
+        emit_runtime_error(ec, statement->line_number,
+                           "GLOBAL_STATEMENT_IN_TOPLEVEL_ERR");
+        return;
+    }
+    for (pos = statement->u.global_s.identifier_list; pos; pos = pos->next) {
+        emit_line(ec, "if (inter->global_variable.value[g_%s].type "
+                  "== LEN_UNDEFINED_VALUE) {", pos->name);
+        ec->indent++;
+        emit_name_error(ec, statement->line_number,
+                        "GLOBAL_VARIABLE_NOT_FOUND_ERR", pos->name);
+        ec->indent--;
+        emit_line(ec, "}");
+    }
+}
+
+static void
+emit_statement(EmitContext *ec, Statement *statement)
+{
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            emit_pop_expression(ec, statement->u.expression_s);
+            break;
+        case GLOBAL_STATEMENT:
+            emit_global_statement(ec, statement);
+            break;
+        case IF_STATEMENT:
+            emit_if_statement(ec, statement);
+            break;
+        case WHILE_STATEMENT:
+            emit_while_statement(ec, statement);
+            break;
+        case FOR_STATEMENT:
+            emit_for_statement(ec, statement);
+            break;
+        case RETURN_STATEMENT:
+            emit_return_statement(ec, statement);
+            break;
+        case BREAK_STATEMENT:       /* FALLTHRU */
+        case CONTINUE_STATEMENT:
+            emit_jump_statement(ec, statement);
+            break;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n", statement->type));
+    }
+}
+
+static void
+emit_statement_list(EmitContext *ec, StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        emit_statement(ec, pos->statement);
+    }
+}
+
+/**************************************函数*************************************/
+
+static void
+init_context(EmitContext *ec, FILE *fp)
+{
+    ec->fp = fp;
+    ec->indent = 1;
+    ec->current_temp = 0;
+    ec->temp_count = 0;
+    ec->label_count = 0;
+    ec->continue_label = NOT_IN_LOOP;
+    ec->continue_used = LEN_FALSE;
+}
+
+/**
+ * 不输出翻译一遍函数体，统计临时变量的数量和用到的标签
+ */
+static void
+count_function_body(EmitContext *ec, FunctionDefinition *func,
+                    StatementList *list)
+{
+    ec->function = func;
+    ec->tail_call_used = LEN_FALSE;
+    ec->end_used = LEN_FALSE;
+    init_context(ec, NULL);
+    emit_statement_list(ec, list);
+}
+
+/**
+ * 输出函数体
+ * 先不输出翻译一遍，得到临时变量的数量之后再输出
+ */
+static void
+emit_function_body(EmitContext *ec, FILE *fp, FunctionDefinition *func,
+                   StatementList *list)
+{
+    ParameterList   *param_p;
+    int temp_count;
+    int i;
+
+    count_function_body(ec, func, list);
+    temp_count = ec->temp_count;
+
+    init_context(ec, fp);
+    emit_line(ec, "LEN_Value ret;");
+    if (temp_count > 0) {
+        emit_line(ec, "LEN_Value tmp[%d];", temp_count);
+    }
+    for (i = 0; i < ec->locals.count; i++) {
+        emit_line(ec, "LEN_Value v_%s;", ec->locals.name[i]);
+    }
+    fputc('\n', fp);
+
+    if (ec->access == SLOT_ACCESS) {
+        // 参数重名时使用后面的参数
+        for (i = 0, param_p = func->u.lemon_f.parameter; param_p;
+             i++, param_p = param_p->next) {
+            if (is_shadowed_parameter(param_p)) {
+                emit_line(ec, "len_release_if_string(&args[%d]);", i);
+            } else {
+                emit_line(ec, "v_%s = args[%d];", param_p->name, i);
+            }
+        }
+        for (i = ec->locals.parameter_count; i < ec->locals.count; i++) {
+            emit_line(ec, "v_%s.type = LEN_UNDEFINED_VALUE;",
+                      ec->locals.name[i]);
+        }
+    }
+    if (ec->tail_call_used) {
+        fputs("\nFUNC_START:\n", fp);
+    }
+
+    emit_statement_list(ec, list);
+    emit_line(ec, "ret.type = LEN_NULL_VALUE;");
+    if (ec->end_used) {
+        fputs("\nFUNC_END:\n", fp);
+    }
+    for (i = 0; i < ec->locals.count; i++) {
+        emit_line(ec, "len_release_if_string(&v_%s);", ec->locals.name[i]);
+    }
+    emit_line(ec, "return ret;");
+}
+
+/**
+ * 收集用户函数的参数和局部变量
+ */
+static void
+init_function_locals(EmitContext *ec, FunctionDefinition *func)
+{
+    ParameterList   *param_p;
+
+    ec->locals.count = 0;
+    ec->locals.name = NULL;
+    for (param_p = func->u.lemon_f.parameter; param_p;
+         param_p = param_p->next) {
+        add_local(&ec->locals, param_p->name);
+    }
+    ec->locals.parameter_count = ec->locals.count;
+    ec->access = SLOT_ACCESS;
+    collect_statement_list_locals(&ec->locals,
+                                  func->u.lemon_f.block->statement_list);
+}
+
+static void
+emit_function(FILE *fp, FunctionDefinition *func)
+{
+    EmitContext     ec;
+
+    init_function_locals(&ec, func);
+    ec.called = NULL;
+    fprintf(fp, "static LEN_Value\n"
+            "len_f_%s(LEN_Interpreter *inter, LEN_Value *args)\n{\n",
+            func->name);
+    emit_function_body(&ec, fp, func, func->u.lemon_f.block->statement_list);
+    fputs("}\n\n", fp);
+
+    MEM_free(ec.locals.name);
+}
+
+/**
+ * 从顶层语句链开始，不输出翻译一遍，找出所有调用得到的用户函数
+ * 完全展开的函数和没有被调用的函数不输出，生成的C没有未使用的static函数
+ */
+static void
+collect_called_functions(LEN_Interpreter *inter, CalledFunctions *called)
+{
+    EmitContext         ec;
+    FunctionDefinition  *func;
+    int i;
+
+    ec.locals.count = 0;
+    ec.locals.name = NULL;
+    ec.locals.parameter_count = 0;
+    ec.access = GLOBAL_ACCESS;
+    ec.called = called;
+    count_function_body(&ec, NULL, inter->statement_list);
+
+    // 数组在循环中增长，新加入的函数也会被翻译
+    for (i = 0; i < called->count; i++) {
+        func = called->function[i];
+        init_function_locals(&ec, func);
+        ec.called = called;
+        count_function_body(&ec, func, func->u.lemon_f.block->statement_list);
+        MEM_free(ec.locals.name);
+    }
+}
+
+/**
+ * 将函数定义和顶层语句链翻译成C语言
+ * 用户函数翻译成len_f_xxx()，native函数在main()中按名字查找一次
+ */
+void
+len_emit_c(LEN_Interpreter *inter, FILE *fp)
+{
+    EmitContext         ec;
+    CalledFunctions     called;
+    FunctionDefinition  *func;
+    int i;
+
+    called.count = 0;
+    called.function = NULL;
+    collect_called_functions(inter, &called);
+
+    fputs("/* generated by lemon --emit-c */\n"
+          "#include <math.h>\n"
+          "#include \"MEM.h\"\n"
+          "#include \"lemon.h\"\n"
+          "\n", fp);
+
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type == NATIVE_FUNCTION_DEFINITION) {
+            fprintf(fp, "static FunctionDefinition *len_n_%s;\n", func->name);
+        } else if (is_called_function(&called, func)) {
+            fprintf(fp, "static LEN_Value len_f_%s(LEN_Interpreter *inter, "
+                    "LEN_Value *args);\n", func->name);
+        }
+    }
+    // 全局变量表的下标在main()中重新分配
+    for (i = 0; i < inter->global_variable.count; i++) {
+        fprintf(fp, "static int g_%s;\n", inter->global_variable.name[i]);
+    }
+    fputc('\n', fp);
+
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type == LEMON_FUNCTION_DEFINITION
+            && is_called_function(&called, func)) {
+            emit_function(fp, func);
+        }
+    }
+    MEM_free(called.function);
+
+    ec.locals.count = 0;
+    ec.locals.name = NULL;
+    ec.locals.parameter_count = 0;
+    ec.access = GLOBAL_ACCESS;
+    ec.called = NULL;
+    fputs("static LEN_Value\n"
+          "len_top_level(LEN_Interpreter *inter)\n{\n", fp);
+    emit_function_body(&ec, fp, NULL, inter->statement_list);
+    fputs("}\n\n", fp);
+
+    fputs("int\n"
+          "main(int argc, char **argv)\n"
+          "{\n"
+          "    LEN_Interpreter *interpreter;\n"
+          "\n"
+          "    interpreter = LEN_create_interpreter();\n", fp);
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type == NATIVE_FUNCTION_DEFINITION) {
+            fprintf(fp, "    len_n_%s = len_search_function("
+                    "len_intern_symbol(interpreter, \"%s\"));\n",
+                    func->name, func->name);
+        }
+    }
+    for (i = 0; i < inter->global_variable.count; i++) {
+        fprintf(fp, "    g_%s = len_add_global_variable(interpreter, "
+                "len_intern_symbol(interpreter, \"%s\"));\n",
+                inter->global_variable.name[i],
+                inter->global_variable.name[i]);
+    }
+    fputs("    len_interpret_emitted(interpreter, len_top_level);\n"
+          "    LEN_dispose_interpreter(interpreter);\n"
+          "\n"
+          "    MEM_dump_blocks(stdout);\n"
+          "\n"
+          "    return 0;\n"
+          "}\n", fp);
+}
@@ -13,6 +13,9 @@ MessageFormat len_compile_error_message_format[] = {
     { "($(token)附近有语法错误)"},
     { "错误的字符($(bad_char))"},
     { "函数名重复($(name))"},
+    { "找不到函数($(name))"},
+    { "调用函数$(name)时参数的数量不正确(需要$(need)个，传递了$(count)个)"},
+    { "字节码的操作数超过了上限($(max))，请把这里的代码拆分成更小的函数"},
     { "dummy" },
 };
 
@@ -22,5 +25,20 @@ MessageFormat len_runtime_error_message_format[] = {
     { "找不到函数($(name))" },
     { "传递的参数多于函数所要求的参数。" },
     { "传递的参数小于函数所要求的参数。" },
+    { "条件表达式的值必须是boolean型。" },
+    { "减法运算的操作数必须是数值类型。" },
+    { "双目操作符$(operator)的操作数类型不正确。" },
+    { "$(operator)操作符不能用于boolean型。" },
+    { "请为fopen()函数传入文件的路径和打开方式（两者都是字符串类型的）。" },
+    { "请为fclose()函数传入文件指针。" },
+    { "请为fgets()函数传入文件指针。" },
+    { "请为fputs()函数传入文件指针和字符串。" },
+    { "null只能用于运算符 == 和 !=(不能进行$(operator)操作)。" },
+    { "不能被0除。" },
+    { "全局变量$(name)不存在。" },
+    { "不能在函数外使用global语句。" },
+    { "字符串类型不能进行$(operator)操作。" },
+    { "整数运算$(operator)溢出。" },
+    { "按位取反运算的操作数必须是int类型。" },
     { "dummy" },
 };
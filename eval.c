@@ -12,6 +12,12 @@
 #include "DBG.h"
 #include "lemon.h"
 
+/**调用栈每一块的大小(LEN_Value的个数)*/
+#define FRAME_CHUNK_SIZE    (4096)
+/**LocalEnvironment在调用栈上占用的LEN_Value的个数*/
+#define ENV_HEADER_SIZE \
+((int)((sizeof(LocalEnvironment) + sizeof(LEN_Value) - 1) / sizeof(LEN_Value)))
+
 static LEN_Value eval_expression(LEN_Interpreter *inter, LocalEnvironment *env,
                                  Expression *expr);
 
@@ -25,7 +31,7 @@ eval_boolean_expression(LEN_Boolean boolean_value)
 }
 
 static LEN_Value
-eval_int_expression(int int_value)
+eval_int_expression(long long int_value)
 {
     LEN_Value   v;
     v.type = LEN_INT_VALUE;
@@ -43,14 +49,14 @@ eval_double_expression(double double_value)
 }
 
 /**
- * 返回LEN_String， 并且将ref_count置为1
+ * 返回编译时创建的不朽LEN_String，不分配内存
  */
 static LEN_Value
-eval_string_expression(LEN_Interpreter *inter, char *string_value)
+eval_string_expression(LEN_Interpreter *inter, LEN_String *string_value)
 {
     LEN_Value v;
     v.type = LEN_STRING_VALUE;
-    v.u.string_value = len_literal_to_len_string(inter, string_value);
+    v.u.string_value = string_value;
     return v;
 }
 
@@ -63,75 +69,85 @@ eval_null_expression(void)
 }
 
 /**
- * 使用了引用类型是LEN_STRING的引用计数+1
- */
-static void
-refer_if_string(LEN_Value *v)
-{
-    if (v->type == LEN_STRING_VALUE) {
-        len_refer_string(v->u.string_value);
-    }
-}
-
-/**
- * ref_count-=1 加入引用计数为0，回收内存
+ * 拼接两个字符串，不改变left和right的引用计数
  */
-static void
-release_if_string(LEN_Value *v)
-{
-    if (v->type == LEN_STRING_VALUE) {
-        len_release_string(v->u.string_value);
-    }
-}
-
-LEN_String *
-chain_string(LEN_Interpreter *inter, LEN_String *left, LEN_String *right)
+static LEN_String *
+concat_string(LEN_Interpreter *inter, LEN_String *left, LEN_String *right)
 {
     int len;
     char *str;
-    LEN_String *ret;
     
     len = strlen(left->string) + strlen(right->string);
     str = MEM_malloc(len + 1);
     strcpy(str, left->string);
     strcat(str, right->string);
-    ret = len_create_lemon_string(inter, str);
+    return len_create_lemon_string(inter, str);
+}
+
+LEN_String *
+chain_string(LEN_Interpreter *inter, LEN_String *left, LEN_String *right)
+{
+    LEN_String *ret;
+    
+    ret = concat_string(inter, left, right);
     len_release_string(left);
     len_release_string(right);
     return ret;
 }
 
 /**
- * 查找全局变量
+ * 字符串拼接整数，释放left
+ * 格式化的缓冲区在这个函数的栈上，不占用eval_binary_expression()递归的栈
  */
-static Variable *
-search_global_variable_from_env(LEN_Interpreter *inter,
-                                LocalEnvironment *env, char *name)
+static LEN_NOINLINE LEN_String *
+chain_string_int(LEN_Interpreter *inter, LEN_String *left, long long right)
 {
-    GlobalVariableRef *pos;
+    char buf[LINE_BUF_SIZE];
     
-    if (env == NULL) {
-        return len_search_global_variable(inter, name);
+    sprintf(buf, "%lld", right);
+    return chain_string(inter, left,
+                        len_create_lemon_string(inter, MEM_strdup(buf)));
+}
+
+/**
+ * int溢出时的错误
+ */
+static void
+int_overflow_error(ExpressionType operator, int line_number)
+{
+    len_runtime_error(line_number, INTEGER_OVERFLOW_ERR,
+                      STRING_MESSAGE_ARGUMENT, "operator",
+                      len_get_operator_string(operator),
+                      MESSAGE_ARGUMENT_END);
+}
+
+/**
+ * int的除法和取余，除数为0或者LLONG_MIN除以-1时报错
+ */
+static void
+check_int_division(ExpressionType operator, long long left, long long right,
+                   int line_number)
+{
+    if (right == 0) {
+        len_runtime_error(line_number, DIVISION_BY_ZERO_ERR,
+                          MESSAGE_ARGUMENT_END);
     }
-    
-    for (pos = env->global_variable; pos; pos = pos->next) {
-        if (!strcmp(pos->variable->name, name)) {
-            return pos->variable;
-        }
+    if (!dkc_is_safe_division(left, right)) {
+        int_overflow_error(operator, line_number);
     }
-    return NULL;
 }
 
 /**
  * int类型求值
+ * 加减乘检查溢出，溢出时是运行时错误
  */
 static void
 eval_binary_int(LEN_Interpreter *inter, ExpressionType operator,
-                int left, int right,
+                long long left, long long right,
                 LEN_Value *result, int line_number)
 {
-    // 数值操作
-    if (dkc_is_math_operator(operator)) {
+    // 数值操作和位运算
+    if (dkc_is_math_operator(operator) || dkc_is_bit_operator(operator)) {
         result->type = LEN_INT_VALUE;
     }
     // 比较操作
@@ -151,20 +167,43 @@ eval_binary_int(LEN_Interpreter *inter, ExpressionType operator,
             DBG_panic(("bad case...%d", operator));
             break;
         case ADD_EXPRESSION:
-            result->u.int_value = left + right;
+            if (__builtin_add_overflow(left, right, &result->u.int_value)) {
+                int_overflow_error(operator, line_number);
+            }
             break;
         case SUB_EXPRESSION:
-            result->u.int_value = left - right;
+            if (__builtin_sub_overflow(left, right, &result->u.int_value)) {
+                int_overflow_error(operator, line_number);
+            }
             break;
         case MUL_EXPRESSION:
-            result->u.int_value = left * right;
+            if (__builtin_mul_overflow(left, right, &result->u.int_value)) {
+                int_overflow_error(operator, line_number);
+            }
             break;
         case DIV_EXPRESSION:
+            check_int_division(operator, left, right, line_number);
             result->u.int_value = left / right;
             break;
         case MOD_EXPRESSION:
+            check_int_division(operator, left, right, line_number);
             result->u.int_value = left % right;
             break;
+        case BIT_AND_EXPRESSION:
+            result->u.int_value = left & right;
+            break;
+        case BIT_OR_EXPRESSION:
+            result->u.int_value = left | right;
+            break;
+        case BIT_XOR_EXPRESSION:
+            result->u.int_value = left ^ right;
+            break;
+        case LEFT_SHIFT_EXPRESSION:
+            result->u.int_value = dkc_shift_left(left, right);
+            break;
+        case RIGHT_SHIFT_EXPRESSION:
+            result->u.int_value = dkc_shift_right(left, right);
+            break;
         case LOGICAL_AND_EXPRESSION:        /* FALLTHRU */
         case LOGICAL_OR_EXPRESSION:
             DBG_panic(("bad case...%d", operator));
@@ -190,6 +229,7 @@ eval_binary_int(LEN_Interpreter *inter, ExpressionType operator,
         case MINUS_EXPRESSION:              /* FALLTHRU */
         case FUNCTION_CALL_EXPRESSION:      /* FALLTHRU */
         case NULL_EXPRESSION:               /* FALLTHRU */
+        case INLINE_CALL_EXPRESSION:        /* FALLTHRU */
         case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
         default:
             DBG_panic(("bad case...%d", operator));
@@ -258,20 +298,24 @@ eval_binary_double(LEN_Interpreter *inter, ExpressionType operator,
         case MINUS_EXPRESSION:              /* FALLTHRU */
         case FUNCTION_CALL_EXPRESSION:      /* FALLTHRU */
         case NULL_EXPRESSION:               /* FALLTHRU */
+        case INLINE_CALL_EXPRESSION:        /* FALLTHRU */
         case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
         default:
             DBG_panic(("bad default...%d", operator));
     }
 }
 
+/**
+ * 比较两个字符串，不改变left和right的引用计数
+ */
 static LEN_Boolean
-eval_compare_string(ExpressionType operator,
-                    LEN_Value *left, LEN_Value *right, int line_number)
+compare_string(ExpressionType operator,
+               LEN_String *left, LEN_String *right, int line_number)
 {
     LEN_Boolean result;
     int cmp;
     
-    cmp = strcmp(left->u.string_value->string, right->u.string_value->string);
+    cmp = strcmp(left->string, right->string);
     
     if (operator == EQ_EXPRESSION) {
         result = (cmp == 0);
@@ -291,6 +335,17 @@ eval_compare_string(ExpressionType operator,
                           STRING_MESSAGE_ARGUMENT, "operator", op_str,
                           MESSAGE_ARGUMENT_END);
     }
+    return result;
+}
+
+static LEN_Boolean
+eval_compare_string(ExpressionType operator,
+                    LEN_Value *left, LEN_Value *right, int line_number)
+{
+    LEN_Boolean result;
+    
+    result = compare_string(operator, left->u.string_value,
+                            right->u.string_value, line_number);
     len_release_string(left->u.string_value);
     len_release_string(right->u.string_value);
     return result;
@@ -312,8 +367,8 @@ eval_binary_null(LEN_Interpreter *inter, ExpressionType operator,
                           STRING_MESSAGE_ARGUMENT, "operator", op_str,
                           MESSAGE_ARGUMENT_END);
     }
-    release_if_string(left);
-    release_if_string(right);
+    len_release_if_string(left);
+    len_release_if_string(right);
     return result;
 }
 
@@ -338,42 +393,49 @@ eval_binary_boolean(LEN_Interpreter *inter, ExpressionType operator,
 }
 
 /**
- * 二元表达式求值
+ * 对已经求值的两个操作数进行二元运算
  */
 LEN_Value
-len_eval_binary_expression(LEN_Interpreter *inter, LocalEnvironment *env,
-                           ExpressionType operator,
-                           Expression *left, Expression *right)
+len_eval_binary_values(LEN_Interpreter *inter, ExpressionType operator,
+                       LEN_Value *left, LEN_Value *right, int line_number)
 {
     LEN_Value left_val;
     LEN_Value right_val;
     LEN_Value result;
     
-    left_val = eval_expression(inter, env, left);
-    right_val = eval_expression(inter, env, right);
+    left_val = *left;
+    right_val = *right;
     
+    if (dkc_is_bit_operator(operator)
+        && (left_val.type != LEN_INT_VALUE
+            || right_val.type != LEN_INT_VALUE)) {
+        char *op_str = len_get_operator_string(operator);
+        len_runtime_error(line_number, BAD_OPERAND_TYPE_ERR,
+                          STRING_MESSAGE_ARGUMENT, "operator", op_str,
+                          MESSAGE_ARGUMENT_END);
+    }
     if (left_val.type == LEN_INT_VALUE
         && right_val.type == LEN_INT_VALUE) {
         eval_binary_int(inter, operator,
                         left_val.u.int_value, right_val.u.int_value,
-                        &result, left->line_number);
+                        &result, line_number);
     } else if (left_val.type == LEN_DOUBLE_VALUE
                && right_val.type == LEN_DOUBLE_VALUE) {
         eval_binary_double(inter, operator,
                            left_val.u.double_value, right_val.u.double_value,
-                           &result, left->line_number);
+                           &result, line_number);
     } else if (left_val.type == LEN_INT_VALUE
                && right_val.type == LEN_DOUBLE_VALUE) {
         left_val.u.double_value = left_val.u.int_value;
         eval_binary_double(inter, operator,
                            left_val.u.double_value, right_val.u.double_value,
-                           &result, left->line_number);
+                           &result, line_number);
     } else if (left_val.type == LEN_DOUBLE_VALUE
                && right_val.type == LEN_INT_VALUE) {
         right_val.u.double_value = right_val.u.int_value;
         eval_binary_double(inter, operator,
                            left_val.u.double_value, right_val.u.double_value,
-                           &result, left->line_number);
+                           &result, line_number);
     } else if (left_val.type == LEN_BOOLEAN_VALUE
                && right_val.type == LEN_BOOLEAN_VALUE) {
         result.type = LEN_BOOLEAN_VALUE;
@@ -381,14 +443,14 @@ len_eval_binary_expression(LEN_Interpreter *inter, LocalEnvironment *env,
         = eval_binary_boolean(inter, operator,
                               left_val.u.boolean_value,
                               right_val.u.boolean_value,
-                              left->line_number);
+                              line_number);
     } else if (left_val.type == LEN_STRING_VALUE
                && operator == ADD_EXPRESSION) {
         char    buf[LINE_BUF_SIZE];
         LEN_String *right_str;
         
         if (right_val.type == LEN_INT_VALUE) {
-            sprintf(buf, "%d", right_val.u.int_value);
+            sprintf(buf, "%lld", right_val.u.int_value);
             right_str = len_create_lemon_string(inter, MEM_strdup(buf));
         } else if (right_val.type == LEN_DOUBLE_VALUE) {
             sprintf(buf, "%f", right_val.u.double_value);
@@ -403,8 +465,8 @@ len_eval_binary_expression(LEN_Interpreter *inter, LocalEnvironment *env,
             right_str = right_val.u.string_value;
         } else if (right_val.type == LEN_NATIVE_POINTER_VALUE) {
             sprintf(buf, "(%s:%p)",
-                    right_val.u.native_pointer.info->name,
-                    right_val.u.native_pointer.pointer);
+                    LEN_native_pointer_info(&right_val)->name,
+                    LEN_native_pointer(&right_val));
             right_str = len_create_lemon_string(inter, MEM_strdup(buf));
         } else if (right_val.type == LEN_NULL_VALUE) {
             right_str = len_create_lemon_string(inter, MEM_strdup("null"));
@@ -418,16 +480,16 @@ len_eval_binary_expression(LEN_Interpreter *inter, LocalEnvironment *env,
         result.type = LEN_BOOLEAN_VALUE;
         result.u.boolean_value
         = eval_compare_string(operator, &left_val, &right_val,
-                              left->line_number);
+                              line_number);
     } else if (left_val.type == LEN_NULL_VALUE
                || right_val.type == LEN_NULL_VALUE) {
         result.type = LEN_BOOLEAN_VALUE;
         result.u.boolean_value
         = eval_binary_null(inter, operator, &left_val, &right_val,
-                           left->line_number);
+                           line_number);
     } else {
         char *op_str = len_get_operator_string(operator);
-        len_runtime_error(left->line_number, BAD_OPERAND_TYPE_ERR,
+        len_runtime_error(line_number, BAD_OPERAND_TYPE_ERR,
                           STRING_MESSAGE_ARGUMENT, "operator", op_str,
                           MESSAGE_ARGUMENT_END);
     }
@@ -436,36 +498,680 @@ len_eval_binary_expression(LEN_Interpreter *inter, LocalEnvironment *env,
 }
 
 /**
- * 解析变量的值
+ * 二元表达式求值
+ */
+LEN_Value
+len_eval_binary_expression(LEN_Interpreter *inter, LocalEnvironment *env,
+                           ExpressionType operator,
+                           Expression *left, Expression *right)
+{
+    LEN_Value left_val;
+    LEN_Value right_val;
+    
+    left_val = eval_expression(inter, env, left);
+    right_val = eval_expression(inter, env, right);
+    
+    return len_eval_binary_values(inter, operator, &left_val, &right_val,
+                                  left->line_number);
+}
+
+/**两个操作数都是指定的类型*/
+#define is_type_pair(left, right, value_type) \
+((left)->type == (value_type) && (right)->type == (value_type))
+
+/**特化的二元运算，类型检查通过时直接返回结果*/
+#define QUICK_BINARY(value_type, member, op, result_type, result_member) \
+if (is_type_pair(&left_val, &right_val, (value_type))) {\
+    result.result_member = left_val.member op right_val.member;\
+    result.type = (result_type);\
+    return result;\
+}
+
+#define QUICK_INT_MATH(op) \
+QUICK_BINARY(LEN_INT_VALUE, u.int_value, op, LEN_INT_VALUE, u.int_value)
+/**加减乘溢出时交给len_eval_binary_values()报错*/
+#define QUICK_INT_CHECKED(builtin) \
+if (is_type_pair(&left_val, &right_val, LEN_INT_VALUE)\
+    && !builtin(left_val.u.int_value, right_val.u.int_value,\
+                &result.u.int_value)) {\
+    result.type = LEN_INT_VALUE;\
+    return result;\
+}
+/**除数为0或者溢出时交给len_eval_binary_values()报错*/
+#define QUICK_INT_DIVIDE(op) \
+if (is_type_pair(&left_val, &right_val, LEN_INT_VALUE)\
+    && dkc_is_safe_division(left_val.u.int_value, right_val.u.int_value)) {\
+    result.u.int_value = left_val.u.int_value op right_val.u.int_value;\
+    result.type = LEN_INT_VALUE;\
+    return result;\
+}
+#define QUICK_INT_SHIFT(shift) \
+if (is_type_pair(&left_val, &right_val, LEN_INT_VALUE)) {\
+    result.u.int_value = shift(left_val.u.int_value, right_val.u.int_value);\
+    result.type = LEN_INT_VALUE;\
+    return result;\
+}
+#define QUICK_INT_COMPARE(op) \
+QUICK_BINARY(LEN_INT_VALUE, u.int_value, op, \
+             LEN_BOOLEAN_VALUE, u.boolean_value)
+#define QUICK_DOUBLE_MATH(op) \
+QUICK_BINARY(LEN_DOUBLE_VALUE, u.double_value, op, \
+             LEN_DOUBLE_VALUE, u.double_value)
+#define QUICK_DOUBLE_COMPARE(op) \
+QUICK_BINARY(LEN_DOUBLE_VALUE, u.double_value, op, \
+             LEN_BOOLEAN_VALUE, u.boolean_value)
+
+/**特化的类型检查失败这么多次之后不再特化*/
+#define QUICKEN_DEOPT_MAX   (4)
+
+/**
+ * 根据操作数的类型选择特化的求值方式
+ * 执行时的quickening和infer.c的类型推断共用
+ */
+BinarySpecialization
+len_specialize_binary_types(ExpressionType operator,
+                            LEN_ValueType left, LEN_ValueType right)
+{
+    if (left == LEN_INT_VALUE && right == LEN_INT_VALUE) {
+        if (dkc_is_bit_operator(operator)) {
+            return BIT_AND_INT_INT + (operator - BIT_AND_EXPRESSION);
+        }
+        return ADD_INT_INT + (operator - ADD_EXPRESSION);
+    }
+    if (dkc_is_bit_operator(operator)) {
+        return BINARY_GENERIC;
+    }
+    if (left == LEN_DOUBLE_VALUE && right == LEN_DOUBLE_VALUE) {
+        return ADD_DOUBLE_DOUBLE + (operator - ADD_EXPRESSION);
+    }
+    if (left == LEN_STRING_VALUE && operator == ADD_EXPRESSION) {
+        if (right == LEN_INT_VALUE) {
+            return CONCAT_STRING_INT;
+        } else if (right == LEN_STRING_VALUE) {
+            return CONCAT_STRING_STRING;
+        }
+    }
+    return BINARY_GENERIC;
+}
+
+/**
+ * 改写表达式的特化方式，类型检查失败太多次时退回通用的求值
+ */
+static void
+quicken_binary_expression(Expression *expr, LEN_Value *left, LEN_Value *right)
+{
+    BinaryExpression *binary = &expr->u.binary_expression;
+
+    if (binary->specialization != BINARY_UNSPECIALIZED) {
+        binary->deopt_count++;
+        if (binary->deopt_count >= QUICKEN_DEOPT_MAX) {
+            binary->specialization = BINARY_GENERIC;
+            return;
+        }
+    }
+    binary->specialization = len_specialize_binary_types(expr->type,
+                                                         left->type,
+                                                         right->type);
+}
+
+/**类型推断确定了操作数类型的二元运算，不再检查类型*/
+#define TYPED_BINARY(member, op, result_type, result_member) \
+result.result_member = left->member op right->member;\
+result.type = (result_type);\
+return result
+
+#define TYPED_INT_MATH(op) \
+TYPED_BINARY(u.int_value, op, LEN_INT_VALUE, u.int_value)
+/**加减乘溢出时交给len_eval_binary_values()报错*/
+#define TYPED_INT_CHECKED(builtin) \
+if (!builtin(left->u.int_value, right->u.int_value, &result.u.int_value)) {\
+    result.type = LEN_INT_VALUE;\
+    return result;\
+}
+/**除数为0或者溢出时交给len_eval_binary_values()报错*/
+#define TYPED_INT_DIVIDE(op) \
+if (dkc_is_safe_division(left->u.int_value, right->u.int_value)) {\
+    TYPED_BINARY(u.int_value, op, LEN_INT_VALUE, u.int_value);\
+}
+#define TYPED_INT_SHIFT(shift) \
+result.u.int_value = shift(left->u.int_value, right->u.int_value);\
+result.type = LEN_INT_VALUE;\
+return result
+#define TYPED_INT_COMPARE(op) \
+TYPED_BINARY(u.int_value, op, LEN_BOOLEAN_VALUE, u.boolean_value)
+#define TYPED_DOUBLE_MATH(op) \
+TYPED_BINARY(u.double_value, op, LEN_DOUBLE_VALUE, u.double_value)
+#define TYPED_DOUBLE_COMPARE(op) \
+TYPED_BINARY(u.double_value, op, LEN_BOOLEAN_VALUE, u.boolean_value)
+
+/**
+ * 操作数的类型由infer.c推断出来的二元表达式求值
+ * 特化的方式在编译时就确定了，只剩下int溢出的检查
+ */
+static LEN_Value
+eval_typed_binary_expression(LEN_Interpreter *inter, Expression *expr,
+                             LEN_Value *left, LEN_Value *right)
+{
+    LEN_Value   result;
+
+    switch (expr->u.binary_expression.specialization) {
+        case ADD_INT_INT:
+            TYPED_INT_CHECKED(__builtin_add_overflow);
+            break;
+        case SUB_INT_INT:
+            TYPED_INT_CHECKED(__builtin_sub_overflow);
+            break;
+        case MUL_INT_INT:
+            TYPED_INT_CHECKED(__builtin_mul_overflow);
+            break;
+        case DIV_INT_INT:
+            TYPED_INT_DIVIDE(/);
+            break;
+        case MOD_INT_INT:
+            TYPED_INT_DIVIDE(%);
+            break;
+        case EQ_INT_INT:
+            TYPED_INT_COMPARE(==);
+        case NE_INT_INT:
+            TYPED_INT_COMPARE(!=);
+        case GT_INT_INT:
+            TYPED_INT_COMPARE(>);
+        case GE_INT_INT:
+            TYPED_INT_COMPARE(>=);
+        case LT_INT_INT:
+            TYPED_INT_COMPARE(<);
+        case LE_INT_INT:
+            TYPED_INT_COMPARE(<=);
+        case BIT_AND_INT_INT:
+            TYPED_INT_MATH(&);
+        case BIT_OR_INT_INT:
+            TYPED_INT_MATH(|);
+        case BIT_XOR_INT_INT:
+            TYPED_INT_MATH(^);
+        case LEFT_SHIFT_INT_INT:
+            TYPED_INT_SHIFT(dkc_shift_left);
+        case RIGHT_SHIFT_INT_INT:
+            TYPED_INT_SHIFT(dkc_shift_right);
+        case ADD_DOUBLE_DOUBLE:
+            TYPED_DOUBLE_MATH(+);
+        case SUB_DOUBLE_DOUBLE:
+            TYPED_DOUBLE_MATH(-);
+        case MUL_DOUBLE_DOUBLE:
+            TYPED_DOUBLE_MATH(*);
+        case DIV_DOUBLE_DOUBLE:
+            TYPED_DOUBLE_MATH(/);
+        case MOD_DOUBLE_DOUBLE:
+            result.type = LEN_DOUBLE_VALUE;
+            result.u.double_value = fmod(left->u.double_value,
+                                         right->u.double_value);
+            return result;
+        case EQ_DOUBLE_DOUBLE:
+            TYPED_DOUBLE_COMPARE(==);
+        case NE_DOUBLE_DOUBLE:
+            TYPED_DOUBLE_COMPARE(!=);
+        case GT_DOUBLE_DOUBLE:
+            TYPED_DOUBLE_COMPARE(>);
+        case GE_DOUBLE_DOUBLE:
+            TYPED_DOUBLE_COMPARE(>=);
+        case LT_DOUBLE_DOUBLE:
+            TYPED_DOUBLE_COMPARE(<);
+        case LE_DOUBLE_DOUBLE:
+            TYPED_DOUBLE_COMPARE(<=);
+        case CONCAT_STRING_INT:
+            result.type = LEN_STRING_VALUE;
+            result.u.string_value = chain_string_int(inter,
+                                                     left->u.string_value,
+                                                     right->u.int_value);
+            return result;
+        case CONCAT_STRING_STRING:
+            result.type = LEN_STRING_VALUE;
+            result.u.string_value = chain_string(inter,
+                                                 left->u.string_value,
+                                                 right->u.string_value);
+            return result;
+        case BINARY_UNSPECIALIZED:  /* FALLTHRU */
+        case BINARY_GENERIC:        /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n",
+                       expr->u.binary_expression.specialization));
+    }
+
+    return len_eval_binary_values(inter, expr->type, left, right,
+                                  expr->u.binary_expression.left->line_number);
+}
+
+/**
+ * 变量在局部环境或者全局变量表中的位置
+ */
+LEN_Value *
+len_variable_address(LEN_Interpreter *inter, LocalEnvironment *env,
+                     int slot, int global_index)
+{
+    if (slot >= 0) {
+        return &env->local_variable[slot];
+    }
+    return &inter->global_variable.value[global_index];
+}
+
+/**
+ * 取出比较的操作数(变量或者整数常量)，不是int类型时返回LEN_FALSE
+ */
+static LEN_Boolean
+fetch_int_operand(LEN_Interpreter *inter, LocalEnvironment *env,
+                  Expression *operand, long long *value)
+{
+    LEN_Value   *v;
+
+    if (operand->type == INT_EXPRESSION) {
+        *value = operand->u.int_value;
+        return LEN_TRUE;
+    }
+    v = len_variable_address(inter, env, operand->u.identifier.slot,
+                         operand->u.identifier.global_index);
+    if (v->type != LEN_INT_VALUE)
+        return LEN_FALSE;
+    *value = v->u.int_value;
+    return LEN_TRUE;
+}
+
+/**
+ * 融合执行两边都是变量或者整数常量的比较，不分派子节点
+ * 两边都是int类型时返回LEN_TRUE，其他类型(包括还没有赋值)交给通常的求值
+ */
+static LEN_Boolean
+eval_fused_compare(LEN_Interpreter *inter, LocalEnvironment *env,
+                   Expression *expr, LEN_Boolean *result)
+{
+    long long   left;
+    long long   right;
+
+    if (!fetch_int_operand(inter, env, expr->u.binary_expression.left, &left)
+        || !fetch_int_operand(inter, env, expr->u.binary_expression.right,
+                              &right))
+        return LEN_FALSE;
+
+    switch (expr->type) {
+        case EQ_EXPRESSION:
+            *result = (left == right);
+            break;
+        case NE_EXPRESSION:
+            *result = (left != right);
+            break;
+        case GT_EXPRESSION:
+            *result = (left > right);
+            break;
+        case GE_EXPRESSION:
+            *result = (left >= right);
+            break;
+        case LT_EXPRESSION:
+            *result = (left < right);
+            break;
+        case LE_EXPRESSION:
+            *result = (left <= right);
+            break;
+        default:
+            DBG_panic(("bad case..%d\n", expr->type));
+    }
+    return LEN_TRUE;
+}
+
+/**借用的变量，求值时没有增加引用计数*/
+#define is_borrowed(expr) \
+((expr)->type == IDENTIFIER_EXPRESSION && (expr)->u.identifier.borrowed)
+
+/**
+ * 有借用的操作数的二元表达式
+ * 两边都是字符串的比较和拼接直接使用借用的字符串，只释放没有借用的一边
+ * 其他情况给借用的一边补上引用，交给通常的求值，返回LEN_FALSE
+ */
+static LEN_Boolean
+eval_borrowed_binary(LEN_Interpreter *inter, Expression *expr,
+                     LEN_Value *left, LEN_Value *right, LEN_Value *result)
+{
+    BinaryExpression *binary = &expr->u.binary_expression;
+
+    if (left->type != LEN_STRING_VALUE || right->type != LEN_STRING_VALUE) {
+        if (is_borrowed(binary->left)) {
+            len_refer_if_string(left);
+        }
+        if (is_borrowed(binary->right)) {
+            len_refer_if_string(right);
+        }
+        return LEN_FALSE;
+    }
+
+    if (expr->type == ADD_EXPRESSION) {
+        result->type = LEN_STRING_VALUE;
+        result->u.string_value = concat_string(inter, left->u.string_value,
+                                               right->u.string_value);
+    } else {
+        result->type = LEN_BOOLEAN_VALUE;
+        result->u.boolean_value = compare_string(expr->type,
+                                                 left->u.string_value,
+                                                 right->u.string_value,
+                                                 binary->left->line_number);
+    }
+    if (!is_borrowed(binary->left)) {
+        len_release_string(left->u.string_value);
+    }
+    if (!is_borrowed(binary->right)) {
+        len_release_string(right->u.string_value);
+    }
+    return LEN_TRUE;
+}
+
+/**
+ * 遍历分析树时的二元表达式求值
+ * 第一次执行之后按照操作数的类型改写成特化的求值方式，
+ * 类型和特化时不同的话重新特化，并且交给len_eval_binary_values()
+ */
+static LEN_Value
+eval_binary_expression(LEN_Interpreter *inter, LocalEnvironment *env,
+                       Expression *expr)
+{
+    LEN_Value   left_val;
+    LEN_Value   right_val;
+    LEN_Value   result;
+    
+    if (expr->fused == FUSED_INDUCTION
+        && expr->u.binary_expression.induction_valid) {
+        result.type = LEN_INT_VALUE;
+        result.u.int_value = expr->u.binary_expression.induction_value;
+        return result;
+    }
+    if (expr->fused == FUSED_COMPARE
+        && eval_fused_compare(inter, env, expr, &result.u.boolean_value)) {
+        result.type = LEN_BOOLEAN_VALUE;
+        return result;
+    }
+    left_val = eval_expression(inter, env, expr->u.binary_expression.left);
+    right_val = eval_expression(inter, env, expr->u.binary_expression.right);
+    
+    if (expr->u.binary_expression.borrows
+        && eval_borrowed_binary(inter, expr, &left_val, &right_val, &result))
+        return result;
+    if (expr->u.binary_expression.typed) {
+        return eval_typed_binary_expression(inter, expr,
+                                            &left_val, &right_val);
+    }
+    switch (expr->u.binary_expression.specialization) {
+        case ADD_INT_INT:
+            QUICK_INT_CHECKED(__builtin_add_overflow);
+            break;
+        case SUB_INT_INT:
+            QUICK_INT_CHECKED(__builtin_sub_overflow);
+            break;
+        case MUL_INT_INT:
+            QUICK_INT_CHECKED(__builtin_mul_overflow);
+            break;
+        case DIV_INT_INT:
+            QUICK_INT_DIVIDE(/);
+            break;
+        case MOD_INT_INT:
+            QUICK_INT_DIVIDE(%);
+            break;
+        case EQ_INT_INT:
+            QUICK_INT_COMPARE(==);
+            break;
+        case NE_INT_INT:
+            QUICK_INT_COMPARE(!=);
+            break;
+        case GT_INT_INT:
+            QUICK_INT_COMPARE(>);
+            break;
+        case GE_INT_INT:
+            QUICK_INT_COMPARE(>=);
+            break;
+        case LT_INT_INT:
+            QUICK_INT_COMPARE(<);
+            break;
+        case LE_INT_INT:
+            QUICK_INT_COMPARE(<=);
+            break;
+        case BIT_AND_INT_INT:
+            QUICK_INT_MATH(&);
+            break;
+        case BIT_OR_INT_INT:
+            QUICK_INT_MATH(|);
+            break;
+        case BIT_XOR_INT_INT:
+            QUICK_INT_MATH(^);
+            break;
+        case LEFT_SHIFT_INT_INT:
+            QUICK_INT_SHIFT(dkc_shift_left);
+            break;
+        case RIGHT_SHIFT_INT_INT:
+            QUICK_INT_SHIFT(dkc_shift_right);
+            break;
+        case ADD_DOUBLE_DOUBLE:
+            QUICK_DOUBLE_MATH(+);
+            break;
+        case SUB_DOUBLE_DOUBLE:
+            QUICK_DOUBLE_MATH(-);
+            break;
+        case MUL_DOUBLE_DOUBLE:
+            QUICK_DOUBLE_MATH(*);
+            break;
+        case DIV_DOUBLE_DOUBLE:
+            QUICK_DOUBLE_MATH(/);
+            break;
+        case MOD_DOUBLE_DOUBLE:
+            if (is_type_pair(&left_val, &right_val, LEN_DOUBLE_VALUE)) {
+                result.type = LEN_DOUBLE_VALUE;
+                result.u.double_value = fmod(left_val.u.double_value,
+                                             right_val.u.double_value);
+                return result;
+            }
+            break;
+        case EQ_DOUBLE_DOUBLE:
+            QUICK_DOUBLE_COMPARE(==);
+            break;
+        case NE_DOUBLE_DOUBLE:
+            QUICK_DOUBLE_COMPARE(!=);
+            break;
+        case GT_DOUBLE_DOUBLE:
+            QUICK_DOUBLE_COMPARE(>);
+            break;
+        case GE_DOUBLE_DOUBLE:
+            QUICK_DOUBLE_COMPARE(>=);
+            break;
+        case LT_DOUBLE_DOUBLE:
+            QUICK_DOUBLE_COMPARE(<);
+            break;
+        case LE_DOUBLE_DOUBLE:
+            QUICK_DOUBLE_COMPARE(<=);
+            break;
+        case CONCAT_STRING_INT:
+            if (left_val.type == LEN_STRING_VALUE
+                && right_val.type == LEN_INT_VALUE) {
+                result.type = LEN_STRING_VALUE;
+                result.u.string_value
+                = chain_string_int(inter, left_val.u.string_value,
+                                   right_val.u.int_value);
+                return result;
+            }
+            break;
+        case CONCAT_STRING_STRING:
+            if (is_type_pair(&left_val, &right_val, LEN_STRING_VALUE)) {
+                result.type = LEN_STRING_VALUE;
+                result.u.string_value = chain_string(inter,
+                                                     left_val.u.string_value,
+                                                     right_val.u.string_value);
+                return result;
+            }
+            break;
+        case BINARY_UNSPECIALIZED:  /* FALLTHRU */
+        case BINARY_GENERIC:
+            break;
+        default:
+            DBG_panic(("bad case..%d\n",
+                       expr->u.binary_expression.specialization));
+    }
+    
+    if (expr->u.binary_expression.specialization != BINARY_GENERIC) {
+        quicken_binary_expression(expr, &left_val, &right_val);
+    }
+    return len_eval_binary_values(inter, expr->type, &left_val, &right_val,
+                                  expr->u.binary_expression.left->line_number);
+}
+
+/**
+ * 读取全局变量表中下标为index的全局变量的值
+ */
+LEN_Value
+len_get_global_variable_value(LEN_Interpreter *inter, int index,
+                              int line_number)
+{
+    LEN_Value   v;
+    
+    v = inter->global_variable.value[index];
+    if (v.type == LEN_UNDEFINED_VALUE) {
+        len_runtime_error(line_number, VARIABLE_NOT_FOUND_ERR,
+                          STRING_MESSAGE_ARGUMENT,
+                          "name", inter->global_variable.name[index],
+                          MESSAGE_ARGUMENT_END);
+    }
+    // string类型增加引用计数
+    len_refer_if_string(&v);
+    
+    return v;
+}
+
+/**
+ * 读取下标为slot的局部变量的值
+ */
+LEN_Value
+len_get_local_variable_value(LocalEnvironment *env, int slot,
+                             char *identifier, int line_number)
+{
+    LEN_Value   v;
+    
+    v = env->local_variable[slot];
+    if (v.type == LEN_UNDEFINED_VALUE) {
+        len_runtime_error(line_number, VARIABLE_NOT_FOUND_ERR,
+                          STRING_MESSAGE_ARGUMENT,
+                          "name", identifier,
+                          MESSAGE_ARGUMENT_END);
+    }
+    len_refer_if_string(&v);
+    
+    return v;
+}
+
+/**
+ * 解析变量的值，局部变量和全局变量都直接按下标读取
+ * 类型推断确定了类型的变量一定已经赋值，只有string类型需要增加引用计数
  */
 static LEN_Value
 eval_identifier_expression(LEN_Interpreter *inter,
                            LocalEnvironment *env, Expression *expr)
 {
     LEN_Value   v;
-    Variable    *vp;
-    
-    // 先查询局部变量
-    vp = len_search_local_variable(env, expr->u.identifier);
-    if (vp != NULL) {
-        v = vp->value;
-    }
-    // 查询全局变量
-    else {
-        vp = search_global_variable_from_env(inter, env, expr->u.identifier);
-        if (vp != NULL) {
-            v = vp->value;
+
+    // 借用的变量不增加引用计数，还没有赋值时照常报错
+    if (expr->u.identifier.borrowed) {
+        v = *len_variable_address(inter, env, expr->u.identifier.slot,
+                                  expr->u.identifier.global_index);
+        if (v.type != LEN_UNDEFINED_VALUE)
+            return v;
+    }
+    if (expr->value_type != LEN_UNDEFINED_VALUE) {
+        if (expr->u.identifier.slot >= 0) {
+            v = env->local_variable[expr->u.identifier.slot];
         } else {
-            len_runtime_error(expr->line_number, VARIABLE_NOT_FOUND_ERR,
-                              STRING_MESSAGE_ARGUMENT,
-                              "name", expr->u.identifier,
-                              MESSAGE_ARGUMENT_END);
+            v = inter->global_variable
+            .value[expr->u.identifier.global_index];
+        }
+        if (expr->value_type == LEN_STRING_VALUE) {
+            len_refer_string(v.u.string_value);
         }
+        return v;
     }
-    // string类型增加引用计数
-    refer_if_string(&v);
-    
-    return v;
+    if (expr->u.identifier.slot >= 0) {
+        return len_get_local_variable_value(env, expr->u.identifier.slot,
+                                            expr->u.identifier.name,
+                                            expr->line_number);
+    }
+    return len_get_global_variable_value(inter,
+                                         expr->u.identifier.global_index,
+                                         expr->line_number);
+}
+
+/**
+ * 给全局变量表中下标为index的全局变量赋值，调用者仍然持有value的一个引用
+ */
+void
+len_assign_global_variable(LEN_Interpreter *inter, int index,
+                           LEN_Value *value)
+{
+    // 如果是string类型 释放引用
+    len_release_if_string(&inter->global_variable.value[index]);
+    inter->global_variable.value[index] = *value;
+    // 如果是string类型 增加引用计数
+    len_refer_if_string(value);
+}
+
+/**
+ * 给下标为slot的局部变量赋值，调用者仍然持有value的一个引用
+ */
+void
+len_assign_local_variable(LocalEnvironment *env, int slot, LEN_Value *value)
+{
+    len_release_if_string(&env->local_variable[slot]);
+    env->local_variable[slot] = *value;
+    len_refer_if_string(value);
+}
+
+/**
+ * 融合执行x = x + 常量和x = x + 表达式，直接在变量的位置上计算
+ * x还没有赋值或者常量加法的类型不是int时交给通常的求值，返回LEN_FALSE
+ * 右边的表达式不会改变x，所以可以先确认x已经赋值再求右边
+ */
+static LEN_Boolean
+eval_fused_assign(LEN_Interpreter *inter, LocalEnvironment *env,
+                  Expression *expr, LEN_Value *result)
+{
+    BinaryExpression    *add;
+    LEN_Value   *dest;
+    LEN_Value   left;
+    LEN_Value   right;
+    long long   sum;
+
+    add = &expr->u.assign_expression.operand->u.binary_expression;
+    dest = len_variable_address(inter, env, expr->u.assign_expression.slot,
+                                expr->u.assign_expression.global_index);
+    if (expr->fused == FUSED_INCREMENT) {
+        if (dest->type != LEN_INT_VALUE
+            || __builtin_add_overflow(dest->u.int_value,
+                                      add->right->u.int_value, &sum))
+            return LEN_FALSE;
+        dest->u.int_value = sum;
+        *result = *dest;
+        return LEN_TRUE;
+    }
+
+    if (dest->type == LEN_UNDEFINED_VALUE)
+        return LEN_FALSE;
+    right = eval_expression(inter, env, add->right);
+    if (dest->type == LEN_INT_VALUE && right.type == LEN_INT_VALUE
+        && !__builtin_add_overflow(dest->u.int_value, right.u.int_value,
+                                   &sum)) {
+        dest->u.int_value = sum;
+    } else if (dest->type == LEN_DOUBLE_VALUE
+               && right.type == LEN_DOUBLE_VALUE) {
+        dest->u.double_value += right.u.double_value;
+    } else {
+        // 其他类型和溢出交给len_eval_binary_values()，引用计数和通常的求值相同
+        left = *dest;
+        len_refer_if_string(&left);
+        left = len_eval_binary_values(inter, ADD_EXPRESSION, &left, &right,
+                                      add->left->line_number);
+        len_release_if_string(dest);
+        *dest = left;
+        len_refer_if_string(dest);
+    }
+    *result = *dest;
+    return LEN_TRUE;
 }
 
 /**
@@ -473,31 +1179,19 @@ eval_identifier_expression(LEN_Interpreter *inter,
  */
 static LEN_Value
 eval_assign_expression(LEN_Interpreter *inter, LocalEnvironment *env,
-                       char *identifier, Expression *expression)
+                       Expression *expr)
 {
     LEN_Value   v;
-    Variable    *left;
-    
-    v = eval_expression(inter, env, expression);
     
-    left = len_search_local_variable(env, identifier);
-    if (left == NULL) {
-        left = search_global_variable_from_env(inter, env, identifier);
-    }
-    if (left != NULL) {
-        // 如果是string类型 释放引用
-        release_if_string(&left->value);
-        left->value = v;
-        // 如果是string类型 增加引用计数
-        refer_if_string(&v);
+    if (expr->fused != FUSED_NONE && eval_fused_assign(inter, env, expr, &v))
+        return v;
+    v = eval_expression(inter, env, expr->u.assign_expression.operand);
+    if (expr->u.assign_expression.slot >= 0) {
+        len_assign_local_variable(env, expr->u.assign_expression.slot, &v);
     } else {
-        // 增加环境变量
-        if (env != NULL) {
-            len_add_local_variable(env, identifier, &v);
-        } else {
-            LEN_add_global_variable(inter, identifier, &v);
-        }
-        refer_if_string(&v);
+        len_assign_global_variable(inter,
+                                   expr->u.assign_expression.global_index,
+                                   &v);
     }
     
     return v;
@@ -519,7 +1213,8 @@ eval_logical_and_or_expression(LEN_Interpreter *inter,
     result.type = LEN_BOOLEAN_VALUE;
     left_val = eval_expression(inter, env, left);
     
-    if (left_val.type != LEN_BOOLEAN_VALUE) {
+    if (left->value_type != LEN_BOOLEAN_VALUE
+        && left_val.type != LEN_BOOLEAN_VALUE) {
         len_runtime_error(left->line_number, NOT_BOOLEAN_TYPE_ERR,
                           MESSAGE_ARGUMENT_END);
     }
@@ -538,7 +1233,8 @@ eval_logical_and_or_expression(LEN_Interpreter *inter,
     }
     
     right_val = eval_expression(inter, env, right);
-    if (right_val.type != LEN_BOOLEAN_VALUE) {
+    if (right->value_type != LEN_BOOLEAN_VALUE
+        && right_val.type != LEN_BOOLEAN_VALUE) {
         len_runtime_error(right->line_number, NOT_BOOLEAN_TYPE_ERR,
                           MESSAGE_ARGUMENT_END);
     }
@@ -547,38 +1243,167 @@ eval_logical_and_or_expression(LEN_Interpreter *inter,
     return result;
 }
 
+/**
+ * 对已经求值的操作数取负
+ */
 LEN_Value
-len_eval_minus_expression(LEN_Interpreter *inter, LocalEnvironment *env,
-                          Expression *operand)
+len_eval_minus_value(LEN_Interpreter *inter, LEN_Value *operand,
+                     int line_number)
 {
-    LEN_Value   operand_val;
     LEN_Value   result;
 
-    operand_val = eval_expression(inter, env, operand);
-    if (operand_val.type == LEN_INT_VALUE) {
+    if (operand->type == LEN_INT_VALUE) {
         result.type = LEN_INT_VALUE;
-        result.u.int_value = -operand_val.u.int_value;
-    } else if (operand_val.type == LEN_DOUBLE_VALUE) {
+        if (__builtin_sub_overflow(0, operand->u.int_value,
+                                   &result.u.int_value)) {
+            int_overflow_error(MINUS_EXPRESSION, line_number);
+        }
+    } else if (operand->type == LEN_DOUBLE_VALUE) {
         result.type = LEN_DOUBLE_VALUE;
-        result.u.double_value = -operand_val.u.double_value;
+        result.u.double_value = -operand->u.double_value;
     } else {
-        len_runtime_error(operand->line_number, MINUS_OPERAND_TYPE_ERR,
+        len_runtime_error(line_number, MINUS_OPERAND_TYPE_ERR,
                           MESSAGE_ARGUMENT_END);
     }
     return result;
 }
 
+LEN_Value
+len_eval_minus_expression(LEN_Interpreter *inter, LocalEnvironment *env,
+                          Expression *operand)
+{
+    LEN_Value   operand_val;
+
+    operand_val = eval_expression(inter, env, operand);
+    return len_eval_minus_value(inter, &operand_val, operand->line_number);
+}
+
 /**
- * 分配局部环境变量
+ * 对已经求值的操作数按位取反
  */
-static LocalEnvironment *
-alloc_local_environment()
+LEN_Value
+len_eval_bit_not_value(LEN_Interpreter *inter, LEN_Value *operand,
+                       int line_number)
+{
+    LEN_Value   result;
+
+    if (operand->type != LEN_INT_VALUE) {
+        len_runtime_error(line_number, BIT_NOT_OPERAND_TYPE_ERR,
+                          MESSAGE_ARGUMENT_END);
+    }
+    result.type = LEN_INT_VALUE;
+    result.u.int_value = ~operand->u.int_value;
+    return result;
+}
+
+LEN_Value
+len_eval_bit_not_expression(LEN_Interpreter *inter, LocalEnvironment *env,
+                            Expression *operand)
+{
+    LEN_Value   operand_val;
+
+    operand_val = eval_expression(inter, env, operand);
+    return len_eval_bit_not_value(inter, &operand_val, operand->line_number);
+}
+
+static void
+free_frame_chunks(FrameChunk *chunk)
+{
+    FrameChunk *next;
+    
+    for (; chunk; chunk = next) {
+        next = chunk->next;
+        MEM_free(chunk->value);
+        MEM_free(chunk);
+    }
+}
+
+/**
+ * 在调用栈上分配count个值
+ * 当前的块放不下时换到下一块，下一块不够大时重新分配
+ */
+LEN_Value *
+len_push_frame(LEN_Interpreter *inter, int count)
+{
+    FrameChunk  *chunk = inter->frame_chunk;
+    FrameChunk  *next;
+    LEN_Value   *ret;
+    
+    if (chunk == NULL || chunk->used + count > chunk->alloc_size) {
+        next = chunk ? chunk->next : NULL;
+        if (next && next->alloc_size < count) {
+            free_frame_chunks(next);
+            next = NULL;
+        }
+        if (next == NULL) {
+            next = MEM_malloc(sizeof(FrameChunk));
+            next->alloc_size = larger(count, FRAME_CHUNK_SIZE);
+            next->value = MEM_malloc(sizeof(LEN_Value) * next->alloc_size);
+            next->prev = chunk;
+            next->next = NULL;
+            if (chunk) {
+                chunk->next = next;
+            }
+        }
+        next->used = 0;
+        chunk = next;
+        inter->frame_chunk = chunk;
+    }
+    ret = &chunk->value[chunk->used];
+    chunk->used += count;
+    
+    return ret;
+}
+
+/**
+ * 弹出调用栈上最后分配的count个值，块空了之后回到上一块
+ */
+void
+len_pop_frame(LEN_Interpreter *inter, int count)
+{
+    FrameChunk *chunk = inter->frame_chunk;
+    
+    chunk->used -= count;
+    DBG_assert(chunk->used >= 0, ("used..%d\n", chunk->used));
+    if (chunk->used == 0 && chunk->prev) {
+        inter->frame_chunk = chunk->prev;
+    }
+}
+
+void
+len_dispose_frame_stack(LEN_Interpreter *inter)
+{
+    FrameChunk *chunk = inter->frame_chunk;
+    
+    MEM_free(inter->tail_call_argument);
+    inter->tail_call_argument = NULL;
+    inter->tail_call_argument_size = 0;
+    if (chunk == NULL)
+        return;
+    while (chunk->prev) {
+        chunk = chunk->prev;
+    }
+    free_frame_chunks(chunk);
+    inter->frame_chunk = NULL;
+}
+
+/**
+ * 在调用栈上分配局部环境，局部变量紧跟在LocalEnvironment后面
+ */
+LocalEnvironment *
+len_alloc_local_environment(LEN_Interpreter *inter, int local_variable_count)
 {
     LocalEnvironment *ret;
+    LEN_Value *frame;
+    int i;
     
-    ret = MEM_malloc(sizeof(LocalEnvironment));
-    ret->variable = NULL;
-    ret->global_variable = NULL;
+    frame = len_push_frame(inter, ENV_HEADER_SIZE + local_variable_count);
+    ret = (LocalEnvironment *)frame;
+    ret->local_variable_count = local_variable_count;
+    ret->local_variable = frame + ENV_HEADER_SIZE;
+    for (i = 0; i < local_variable_count; i++) {
+        ret->local_variable[i].type = LEN_UNDEFINED_VALUE;
+    }
     
     return ret;
 }
@@ -586,29 +1411,57 @@ alloc_local_environment()
 /**
  * 释放局部环境变量
  */
-static void
-dispose_local_environment(LEN_Interpreter *inter, LocalEnvironment *env)
-{
-    // 遍历每一个变量
-    while (env->variable) {
-        Variable *temp;
-        temp = env->variable;
-        if (env->variable->value.type == LEN_STRING_VALUE) {
-            len_release_string(env->variable->value.u.string_value);
-        }
-        env->variable = temp->next;
-        MEM_free(temp);
+void
+len_dispose_local_environment(LEN_Interpreter *inter, LocalEnvironment *env)
+{
+    int i;
+    
+    for (i = 0; i < env->local_variable_count; i++) {
+        len_release_if_string(&env->local_variable[i]);
     }
-    // 释放全局变量
-    while (env->global_variable) {
-        GlobalVariableRef *ref;
-        ref = env->global_variable;
-        env->global_variable = ref->next;
-        // TODO 查看具体实现
-        MEM_free(ref);
+    len_pop_frame(inter, ENV_HEADER_SIZE + env->local_variable_count);
+}
+
+/**
+ * 为用户函数创建局部环境，参数的引用交给局部环境
+ * 参数的数量在编译结束时已经检查过
+ */
+LocalEnvironment *
+len_create_function_environment(LEN_Interpreter *inter,
+                                FunctionDefinition *func,
+                                int arg_count, LEN_Value *args)
+{
+    LocalEnvironment    *local_env;
+    int i;
+    
+    local_env = len_alloc_local_environment(inter, func->u.lemon_f
+                                            .local_variable_count);
+    DBG_assert(arg_count <= local_env->local_variable_count,
+               ("arg_count..%d\n", arg_count));
+    for (i = 0; i < arg_count; i++) {
+        // 参数的下标和参数的位置相同
+        local_env->local_variable[i] = args[i];
     }
     
-    MEM_free(env);
+    return local_env;
+}
+
+/**
+ * 调用native函数，调用结束后释放参数
+ */
+LEN_Value
+len_call_native_function(LEN_Interpreter *inter, LEN_NativeFunctionProc *proc,
+                         int arg_count, LEN_Value *args)
+{
+    LEN_Value value;
+    int i;
+    
+    value = proc(inter, arg_count, args);
+    for (i = 0; i < arg_count; i++) {
+        len_release_if_string(&args[i]);
+    }
+    
+    return value;
 }
 
 /**
@@ -618,44 +1471,123 @@ static LEN_Value
 call_lemon_function(LEN_Interpreter *inter, LocalEnvironment *env,
                       Expression *expr, FunctionDefinition *func)
 {
-    LEN_Value   value;
-    StatementResult     result;
     ArgumentList        *arg_p;
-    ParameterList       *param_p;
     LocalEnvironment    *local_env;
+    int i;
     
-    local_env = alloc_local_environment();
+    local_env = len_alloc_local_environment(inter, func->u.lemon_f
+                                            .local_variable_count);
     
-    for (arg_p = expr->u.function_call_expression.argument,
-         param_p = func->u.lemon_f.parameter;
-         arg_p;
-         arg_p = arg_p->next, param_p = param_p->next) {
-        LEN_Value arg_val;
-        
-        if (param_p == NULL) {
-            len_runtime_error(expr->line_number, ARGUMENT_TOO_MANY_ERR,
-                              MESSAGE_ARGUMENT_END);
-        }
-        arg_val = eval_expression(inter, env, arg_p->expression);
-        len_add_local_variable(local_env, param_p->name, &arg_val);
+    // 参数的数量在编译结束时已经检查过，参数直接求值到局部环境中
+    for (arg_p = expr->u.function_call_expression.argument, i = 0;
+         arg_p; arg_p = arg_p->next, i++) {
+        local_env->local_variable[i]
+        = eval_expression(inter, env, arg_p->expression);
     }
-    if (param_p) {
-        len_runtime_error(expr->line_number, ARGUMENT_TOO_FEW_ERR,
-                          MESSAGE_ARGUMENT_END);
+    
+    return len_execute_function_body(inter, func, local_env);
+}
+
+/**
+ * 执行用户函数的主体，执行结束后释放局部环境
+ * 主体以尾调用结束时先释放当前的局部环境，在调用栈的同一个位置
+ * 为被调用的函数创建局部环境，接着执行，尾递归不会增加C的栈和调用栈
+ * 缓存结果的纯函数先按参数查找缓存，执行结束后把结果保存到缓存
+ */
+LEN_Value
+len_execute_function_body(LEN_Interpreter *inter, FunctionDefinition *func,
+                          LocalEnvironment *local_env)
+{
+    LEN_Value       value;
+    StatementResult result;
+    MemoTable       *memo = func->u.lemon_f.memo;
+    LEN_Value       key[MEMO_ARGUMENT_MAX];
+    
+    if (memo && len_memo_lookup(memo, local_env->local_variable, key,
+                                &value)) {
+        len_dispose_local_environment(inter, local_env);
+        return value;
+    }
+    for (;;) {
+        result = len_execute_statement_list(inter, local_env,
+                                            func->u.lemon_f.block
+                                            ->statement_list);
+        if (result.type != TAIL_CALL_STATEMENT_RESULT)
+            break;
+        len_dispose_local_environment(inter, local_env);
+        func = inter->tail_call_function;
+        inter->tail_call_function = NULL;
+        local_env = len_create_function_environment(inter, func,
+                                                    inter
+                                                    ->tail_call_argument_count,
+                                                    inter->tail_call_argument);
     }
-    result = len_execute_statement_list(inter, local_env,
-                                        func->u.lemon_f.block
-                                        ->statement_list);
     if (result.type == RETURN_STATEMENT_RESULT) {
         value = result.u.return_value;
     } else {
         value.type = LEN_NULL_VALUE;
     }
-    dispose_local_environment(inter, local_env);
+    len_dispose_local_environment(inter, local_env);
+    if (memo) {
+        len_memo_store(memo, key, &value);
+    }
     
     return value;
 }
 
+/**
+ * return语句中的尾调用，参数在当前的局部环境中求值
+ * 求值时可能调用其他函数，参数先放在调用栈上，全部求值之后再移到
+ * tail_call_argument，局部环境释放之后由len_execute_function_body()调用函数
+ */
+StatementResult
+len_eval_tail_call(LEN_Interpreter *inter, LocalEnvironment *env,
+                   Expression *expr)
+{
+    StatementResult result;
+    ArgumentList    *arg_p;
+    LEN_Value       *args;
+    int arg_count;
+    int i;
+    
+    for (arg_count = 0, arg_p = expr->u.function_call_expression.argument;
+         arg_p; arg_p = arg_p->next) {
+        arg_count++;
+    }
+    args = len_push_frame(inter, arg_count);
+    for (arg_p = expr->u.function_call_expression.argument, i = 0;
+         arg_p; arg_p = arg_p->next, i++) {
+        args[i] = eval_expression(inter, env, arg_p->expression);
+    }
+    len_set_tail_call(inter, expr->u.function_call_expression.function,
+                      arg_count, args);
+    len_pop_frame(inter, arg_count);
+    
+    result.type = TAIL_CALL_STATEMENT_RESULT;
+    
+    return result;
+}
+
+/**
+ * 尾调用的参数从调用栈或者寄存器移到tail_call_argument，
+ * 调用者释放局部环境之后用它们创建被调用的函数的局部环境
+ */
+void
+len_set_tail_call(LEN_Interpreter *inter, FunctionDefinition *func,
+                  int arg_count, LEN_Value *args)
+{
+    if (inter->tail_call_argument_size < arg_count) {
+        inter->tail_call_argument
+        = MEM_realloc(inter->tail_call_argument, sizeof(LEN_Value) * arg_count);
+        inter->tail_call_argument_size = arg_count;
+    }
+    if (arg_count > 0) {
+        memcpy(inter->tail_call_argument, args, sizeof(LEN_Value) * arg_count);
+    }
+    inter->tail_call_function = func;
+    inter->tail_call_argument_count = arg_count;
+}
+
 /**
  * 调用native函数
  */
@@ -674,39 +1606,92 @@ call_native_function(LEN_Interpreter *inter, LocalEnvironment *env,
         arg_count++;
     }
     
-    args = MEM_malloc(sizeof(LEN_Value) * arg_count);
+    args = len_push_frame(inter, arg_count);
     
     for (arg_p = expr->u.function_call_expression.argument, i = 0;
          arg_p; arg_p = arg_p->next, i++) {
         args[i] = eval_expression(inter, env, arg_p->expression);
     }
-    value = proc(inter, arg_count, args);
-    for (i = 0; i < arg_count; i++) {
-        release_if_string(&args[i]);
+    if (expr->u.function_call_expression.borrows) {
+        // print和fputs不保留实参，借用的实参不释放
+        value = proc(inter, arg_count, args);
+        for (arg_p = expr->u.function_call_expression.argument, i = 0;
+             arg_p; arg_p = arg_p->next, i++) {
+            if (!is_borrowed(arg_p->expression)) {
+                len_release_if_string(&args[i]);
+            }
+        }
+    } else {
+        value = len_call_native_function(inter, proc, arg_count, args);
     }
-    MEM_free(args);
+    len_pop_frame(inter, arg_count);
     
     return value;
 }
 
 /**
- * 函数调用
+ * 依次求print(字符串常量 + a + b ...)的每一段，返回段数
+ * borrowed记录每一段是不是借用的变量
+ */
+static int
+eval_print_pieces(LEN_Interpreter *inter, LocalEnvironment *env,
+                  Expression *expr, LEN_Value *piece, LEN_Boolean *borrowed)
+{
+    int count;
+
+    if (expr->type != ADD_EXPRESSION) {
+        piece[0] = eval_expression(inter, env, expr);
+        borrowed[0] = is_borrowed(expr);
+        return 1;
+    }
+    count = eval_print_pieces(inter, env, expr->u.binary_expression.left,
+                              piece, borrowed);
+    piece[count] = eval_expression(inter, env,
+                                   expr->u.binary_expression.right);
+    borrowed[count] = is_borrowed(expr->u.binary_expression.right);
+    return count + 1;
+}
+
+/**
+ * 融合执行print(字符串常量 + a + b ...)
+ * 所有的段求值之后再依次打印，不再拼接中间的字符串
+ */
+static LEN_Value
+eval_fused_print(LEN_Interpreter *inter, LocalEnvironment *env,
+                 Expression *expr)
+{
+    LEN_Value   piece[FUSED_PRINT_PIECE_MAX];
+    LEN_Boolean borrowed[FUSED_PRINT_PIECE_MAX];
+    LEN_Value   value;
+    int count;
+    int i;
+
+    count = eval_print_pieces(inter, env,
+                              expr->u.function_call_expression.argument
+                              ->expression, piece, borrowed);
+    for (i = 0; i < count; i++) {
+        len_nv_print_proc(inter, 1, &piece[i]);
+        if (!borrowed[i]) {
+            len_release_if_string(&piece[i]);
+        }
+    }
+    value.type = LEN_NULL_VALUE;
+
+    return value;
+}
+
+/**
+ * 函数调用，函数在编译结束时已经绑定
  */
 static LEN_Value
 eval_function_call_expression(LEN_Interpreter *inter, LocalEnvironment *env,
                               Expression *expr)
 {
     LEN_Value           value;
-    FunctionDefinition  *func;
+    FunctionDefinition  *func = expr->u.function_call_expression.function;
     
-    char *identifier = expr->u.function_call_expression.identifier;
-    
-    func = len_search_function(identifier);
-    if (func == NULL) {
-        len_runtime_error(expr->line_number, FUNCTION_NOT_FOUND_ERR,
-                          STRING_MESSAGE_ARGUMENT, "name", identifier,
-                          MESSAGE_ARGUMENT_END);
-    }
+    if (expr->fused == FUSED_PRINT)
+        return eval_fused_print(inter, env, expr);
     switch (func->type) {
         case LEMON_FUNCTION_DEFINITION:
             value = call_lemon_function(inter, env, expr, func);
@@ -721,6 +1706,29 @@ eval_function_call_expression(LEN_Interpreter *inter, LocalEnvironment *env,
     return value;
 }
 
+/**
+ * 展开的函数调用，实参赋给临时变量之后计算返回值
+ */
+static LEN_Value
+eval_inline_call_expression(LEN_Interpreter *inter, LocalEnvironment *env,
+                            Expression *expr)
+{
+    LEN_Value       v;
+    ArgumentList    *pos;
+    InlineBranch    *branch;
+
+    for (pos = expr->u.inline_call_expression.binding; pos; pos = pos->next) {
+        v = eval_expression(inter, env, pos->expression);
+        len_release_if_string(&v);
+    }
+    for (branch = expr->u.inline_call_expression.branch; branch;
+         branch = branch->next) {
+        if (len_eval_condition(inter, env, branch->condition))
+            return eval_expression(inter, env, branch->value);
+    }
+    return eval_expression(inter, env, expr->u.inline_call_expression.body);
+}
+
 /**
  * 根据表达式的类型， 求出表达式的值
  */
@@ -746,9 +1754,7 @@ eval_expression(LEN_Interpreter *inter, LocalEnvironment *env,
             v = eval_identifier_expression(inter, env, expr);
             break;
         case ASSIGN_EXPRESSION:
-            v = eval_assign_expression(inter, env,
-                                       expr->u.assign_expression.variable,
-                                       expr->u.assign_expression.operand);
+            v = eval_assign_expression(inter, env, expr);
             break;
         case ADD_EXPRESSION:        /* FALLTHRU */
         case SUB_EXPRESSION:        /* FALLTHRU */
@@ -760,11 +1766,13 @@ eval_expression(LEN_Interpreter *inter, LocalEnvironment *env,
         case GT_EXPRESSION: /* FALLTHRU */
         case GE_EXPRESSION: /* FALLTHRU */
         case LT_EXPRESSION: /* FALLTHRU */
-        case LE_EXPRESSION:
-            v = len_eval_binary_expression(inter, env,
-                                           expr->type,
-                                           expr->u.binary_expression.left,
-                                           expr->u.binary_expression.right);
+        case LE_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            v = eval_binary_expression(inter, env, expr);
             break;
         case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
         case LOGICAL_OR_EXPRESSION:
@@ -775,12 +1783,19 @@ eval_expression(LEN_Interpreter *inter, LocalEnvironment *env,
         case MINUS_EXPRESSION:
             v = len_eval_minus_expression(inter, env, expr->u.minus_expression);
             break;
+        case BIT_NOT_EXPRESSION:
+            v = len_eval_bit_not_expression(inter, env,
+                                            expr->u.bit_not_expression);
+            break;
         case FUNCTION_CALL_EXPRESSION:
             v = eval_function_call_expression(inter, env, expr);
             break;
         case NULL_EXPRESSION:
             v = eval_null_expression();
             break;
+        case INLINE_CALL_EXPRESSION:
+            v = eval_inline_call_expression(inter, env, expr);
+            break;
         case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
         default:
             DBG_panic(("bad case. type..%d\n", expr->type));
@@ -797,3 +1812,26 @@ len_eval_expression(LEN_Interpreter *inter, LocalEnvironment *env,
 {
     return eval_expression(inter, env, expr);
 }
+
+/**
+ * 求if、while和for的条件，不是boolean类型时报错
+ * 类型推断确定是boolean类型的条件不再检查类型
+ */
+LEN_Boolean
+len_eval_condition(LEN_Interpreter *inter, LocalEnvironment *env,
+                   Expression *expr)
+{
+    LEN_Value   cond;
+    LEN_Boolean result;
+
+    if (expr->fused == FUSED_COMPARE
+        && eval_fused_compare(inter, env, expr, &result))
+        return result;
+    cond = eval_expression(inter, env, expr);
+    if (expr->value_type != LEN_BOOLEAN_VALUE
+        && cond.type != LEN_BOOLEAN_VALUE) {
+        len_runtime_error(expr->line_number, NOT_BOOLEAN_TYPE_ERR,
+                          MESSAGE_ARGUMENT_END);
+    }
+    return cond.u.boolean_value;
+}
@@ -12,10 +12,6 @@
 #include "DBG.h"
 #include "lemon.h"
 
-static StatementResult
-execute_statement(LEN_Interpreter *inter, LocalEnvironment *env,
-                  Statement *statement);
-
 /**
  * 执行表达式语句
  */
@@ -37,6 +33,27 @@ execute_expression_statement(LEN_Interpreter *inter, LocalEnvironment *env,
     return result;
 }
 
+/**
+ * 执行global语句，全局变量在编译时已经解析成下标，这里只检查全局变量是否已经定义
+ */
+void
+len_declare_global_variable(LEN_Interpreter *inter, LocalEnvironment *env,
+                            int index, int line_number)
+{
+    if (env == NULL) {
+        len_runtime_error(line_number,
+                          GLOBAL_STATEMENT_IN_TOPLEVEL_ERR,
+                          MESSAGE_ARGUMENT_END);
+    }
+    if (inter->global_variable.value[index].type == LEN_UNDEFINED_VALUE) {
+        len_runtime_error(line_number,
+                          GLOBAL_VARIABLE_NOT_FOUND_ERR,
+                          STRING_MESSAGE_ARGUMENT, "name",
+                          inter->global_variable.name[index],
+                          MESSAGE_ARGUMENT_END);
+    }
+}
+
 /**
  * 执行全局语句
  */
@@ -55,26 +72,8 @@ execute_global_statement(LEN_Interpreter *inter, LocalEnvironment *env,
                           MESSAGE_ARGUMENT_END);
     }
     for (pos = statement->u.global_s.identifier_list; pos; pos = pos->next) {
-        GlobalVariableRef *ref_pos;
-        GlobalVariableRef *new_ref;
-        Variable *variable;
-        for (ref_pos = env->global_variable; ref_pos;ref_pos = ref_pos->next) {
-            if (!strcmp(ref_pos->variable->name, pos->name))
-                goto NEXT_IDENTIFIER;
-        }
-        variable = len_search_global_variable(inter, pos->name);
-        if (variable == NULL) {
-            crb_runtime_error(statement->line_number,
-                              GLOBAL_VARIABLE_NOT_FOUND_ERR,
-                              STRING_MESSAGE_ARGUMENT, "name", pos->name,
-                              MESSAGE_ARGUMENT_END);
-        }
-        new_ref = MEM_malloc(sizeof(GlobalVariableRef));
-        new_ref->variable = variable;
-        new_ref->next = env->global_variable;
-        env->global_variable = new_ref;
-    NEXT_IDENTIFIER:
-        ;
+        len_declare_global_variable(inter, env, pos->global_index,
+                                    statement->line_number);
     }
     
     return result;
@@ -88,23 +87,17 @@ execute_elsif(LEN_Interpreter *inter, LocalEnvironment *env,
               Elsif *elsif_list, LEN_Boolean *executed)
 {
     StatementResult result;
-    LEN_Value   cond;
     Elsif *pos;
     
     *executed = LEN_FALSE;
     result.type = NORMAL_STATEMENT_RESULT;
     for (pos = elsif_list; pos; pos = pos->next) {
-        cond = len_eval_expression(inter, env, pos->condition);
-        if (cond.type != LEN_BOOLEAN_VALUE) {
-            crb_runtime_error(pos->condition->line_number,
-                              NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
-        }
-        if (cond.u.boolean_value) {
+        if (len_eval_condition(inter, env, pos->condition)) {
             result = len_execute_statement_list(inter, env,
                                                 pos->block->statement_list);
             *executed = LEN_TRUE;
-            if (result.type != NORMAL_STATEMENT_RESULT)
-                goto FUNC_END;
+            // 只执行第一个条件为真的分支
+            goto FUNC_END;
         }
     }
     
@@ -112,6 +105,93 @@ FUNC_END:
     return result;
 }
 
+/**
+ * 从elsif_list开始执行if语句剩下的分支，没有条件为真的elsif时执行else
+ */
+StatementResult
+len_execute_elsif_and_else(LEN_Interpreter *inter, LocalEnvironment *env,
+                           Statement *statement, Elsif *elsif_list)
+{
+    StatementResult result;
+    LEN_Boolean elsif_executed;
+    
+    result = execute_elsif(inter, env, elsif_list, &elsif_executed);
+    if (result.type != NORMAL_STATEMENT_RESULT)
+        goto FUNC_END;
+    if (!elsif_executed && statement->u.if_s.else_block) {
+        result = len_execute_statement_list(inter, env,
+                                            statement->u.if_s.else_block
+                                            ->statement_list);
+    }
+    
+FUNC_END:
+    return result;
+}
+
+/**
+ * 按变量的值在分派表中找到执行的分支，没有对应的分支时*block为NULL
+ * 变量的类型和键的类型不同时返回LEN_FALSE，照常依次求条件
+ */
+static LEN_Boolean
+dispatch_block(LEN_Interpreter *inter, LocalEnvironment *env,
+               DispatchTable *table, Block **block)
+{
+    LEN_Value   *v;
+    DispatchCase    *c;
+    unsigned long long  offset;
+    unsigned int    hash;
+    int low;
+    int high;
+    int mid;
+
+    v = len_variable_address(inter, env, table->slot, table->global_index);
+    *block = NULL;
+    switch (table->kind) {
+        case DISPATCH_DENSE:
+            if (v->type != LEN_INT_VALUE)
+                return LEN_FALSE;
+            offset = (unsigned long long)v->u.int_value
+                - (unsigned long long)table->min;
+            if (offset < (unsigned long long)table->size) {
+                *block = table->table[offset];
+            }
+            break;
+        case DISPATCH_SORTED:
+            if (v->type != LEN_INT_VALUE)
+                return LEN_FALSE;
+            low = 0;
+            high = table->size - 1;
+            while (low <= high) {
+                mid = (low + high) / 2;
+                if (table->cases[mid].int_key == v->u.int_value) {
+                    *block = table->cases[mid].block;
+                    break;
+                } else if (table->cases[mid].int_key < v->u.int_value) {
+                    low = mid + 1;
+                } else {
+                    high = mid - 1;
+                }
+            }
+            break;
+        case DISPATCH_STRING:
+            if (v->type != LEN_STRING_VALUE)
+                return LEN_FALSE;
+            hash = len_hash_string(v->u.string_value->string);
+            for (c = table->bucket[hash & (table->size - 1)]; c; c = c->next) {
+                if (c->hash == hash
+                    && !strcmp(c->string_key->string,
+                               v->u.string_value->string)) {
+                    *block = c->block;
+                    break;
+                }
+            }
+            break;
+        default:
+            DBG_panic(("bad case...%d", table->kind));
+    }
+    return LEN_TRUE;
+}
+
 /**
  * 执行if语句
  */
@@ -120,36 +200,32 @@ execute_if_statement(LEN_Interpreter *inter, LocalEnvironment *env,
                      Statement *statement)
 {
     StatementResult result;
-    LEN_Value   cond;
+    Block   *block;
     
     result.type = NORMAL_STATEMENT_RESULT;
-    cond = len_eval_expression(inter, env, statement->u.if_s.condition);
-    if (cond.type != LEN_BOOLEAN_VALUE) {
-        len_runtime_error(statement->u.if_s.condition->line_number,
-                          NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
+    // 有分派表时直接找到执行的分支
+    if (statement->u.if_s.dispatch
+        && dispatch_block(inter, env, statement->u.if_s.dispatch, &block)) {
+        if (block == NULL) {
+            block = statement->u.if_s.else_block;
+        }
+        if (block) {
+            result = len_execute_statement_list(inter, env,
+                                                block->statement_list);
+        }
+        return result;
     }
-    DBG_assert(cond.type == LEN_BOOLEAN_VALUE, ("cond.type..%d", cond.type));
-    
     // 条件为真，执行if语句块内容
-    if (cond.u.boolean_value) {
+    if (len_eval_condition(inter, env, statement->u.if_s.condition)) {
         result = len_execute_statement_list(inter, env,
                                             statement->u.if_s.then_block
                                             ->statement_list);
     } else {
-        // 执行else语句内容
-        LEN_Boolean elsif_executed;
-        result = execute_elsif(inter, env, statement->u.if_s.elsif_list,
-                               &elsif_executed);
-        if (result.type != NORMAL_STATEMENT_RESULT)
-            goto FUNC_END;
-        if (!elsif_executed && statement->u.if_s.else_block) {
-            result = len_execute_statement_list(inter, env,
-                                                statement->u.if_s.else_block
-                                                ->statement_list);
-        }
+        // 执行elsif和else语句内容
+        result = len_execute_elsif_and_else(inter, env, statement,
+                                            statement->u.if_s.elsif_list);
     }
     
-FUNC_END:
     return result;
 }
 
@@ -161,20 +237,14 @@ execute_while_statement(LEN_Interpreter *inter, LocalEnvironment *env,
                         Statement *statement)
 {
     StatementResult result;
-    LEN_Value   cond;
     
     result.type = NORMAL_STATEMENT_RESULT;
     for (;;) {
-        // 获得条件语句的执行结果
-        cond = len_eval_expression(inter, env, statement->u.while_s.condition);
-        if (cond.type != LEN_BOOLEAN_VALUE) {
-            len_runtime_error(statement->u.while_s.condition->line_number,
-                              NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
-        }
-        DBG_assert(cond.type == LEN_BOOLEAN_VALUE,
-                   ("cond.type..%d", cond.type));
-        // 条件为真结束循环
-        if (!cond.u.boolean_value)
+        // 循环变热之后剩下的迭代交给trace
+        if (len_execute_trace(inter, env, statement, &result))
+            break;
+        // 条件为假结束循环
+        if (!len_eval_condition(inter, env, statement->u.while_s.condition))
             break;
         // 继续执行循环体内部的语句
         result = len_execute_statement_list(inter, env,
@@ -187,11 +257,163 @@ execute_while_statement(LEN_Interpreter *inter, LocalEnvironment *env,
             result.type = NORMAL_STATEMENT_RESULT;
             break;
         }
+        // continue不能传到循环外面
+        result.type = NORMAL_STATEMENT_RESULT;
     }
     
     return result;
 }
 
+/**
+ * 进入计数循环时计算强度削弱的乘法的初值和每次迭代的增量
+ * 乘数不是int或者溢出的乘法照常计算
+ */
+static void
+start_inductions(LEN_Interpreter *inter, LocalEnvironment *env,
+                 CountedLoop *loop, long long counter)
+{
+    BinaryExpression    *mul;
+    Expression  *factor;
+    LEN_Value   *value;
+    long long   k;
+    int i;
+
+    for (i = 0; i < loop->induction_count; i++) {
+        mul = &loop->induction[i]->u.binary_expression;
+        factor = mul->right;
+        if (factor->type == IDENTIFIER_EXPRESSION
+            && factor->u.identifier.slot == loop->slot
+            && factor->u.identifier.global_index == loop->global_index) {
+            factor = mul->left;
+        }
+        if (factor->type == INT_EXPRESSION) {
+            k = factor->u.int_value;
+        } else {
+            value = len_variable_address(inter, env,
+                                         factor->u.identifier.slot,
+                                         factor->u.identifier.global_index);
+            if (value->type != LEN_INT_VALUE)
+                continue;
+            k = value->u.int_value;
+        }
+        mul->induction_valid
+            = !__builtin_mul_overflow(counter, k, &mul->induction_value)
+            && !__builtin_mul_overflow(k, loop->step,
+                                       &loop->induction_step[i]);
+    }
+}
+
+/**
+ * 计数变量加上增量之后每个积加上自己的增量，溢出之后退回乘法
+ */
+static void
+step_inductions(CountedLoop *loop)
+{
+    BinaryExpression    *mul;
+    int i;
+
+    for (i = 0; i < loop->induction_count; i++) {
+        mul = &loop->induction[i]->u.binary_expression;
+        if (mul->induction_valid
+            && __builtin_add_overflow(mul->induction_value,
+                                      loop->induction_step[i],
+                                      &mul->induction_value)) {
+            mul->induction_valid = LEN_FALSE;
+        }
+    }
+}
+
+static void
+stop_inductions(CountedLoop *loop)
+{
+    int i;
+
+    for (i = 0; i < loop->induction_count; i++) {
+        loop->induction[i]->u.binary_expression.induction_valid = LEN_FALSE;
+    }
+}
+
+/**
+ * 按int执行计数循环，计数变量和上限在循环体中不会改变，
+ * 直接比较和加上增量，不再求条件和post表达式
+ * 进入时计数变量或者上限不是int类型返回LEN_FALSE，交给通常的执行
+ */
+static LEN_Boolean
+execute_counted_loop(LEN_Interpreter *inter, LocalEnvironment *env,
+                     Statement *statement, StatementResult *result)
+{
+    CountedLoop *loop = statement->u.for_s.counted;
+    LEN_Value   *counter;
+    LEN_Value   *limit_value;
+    LEN_Value   v;
+    long long   limit;
+    long long   next;
+    LEN_Boolean more;
+
+    counter = len_variable_address(inter, env, loop->slot, loop->global_index);
+    if (counter->type != LEN_INT_VALUE)
+        return LEN_FALSE;
+    if (loop->limit->type == INT_EXPRESSION) {
+        limit = loop->limit->u.int_value;
+    } else {
+        limit_value = len_variable_address(inter, env,
+                                           loop->limit->u.identifier.slot,
+                                           loop->limit->u.identifier
+                                           .global_index);
+        if (limit_value->type != LEN_INT_VALUE)
+            return LEN_FALSE;
+        limit = limit_value->u.int_value;
+    }
+    start_inductions(inter, env, loop, counter->u.int_value);
+
+    result->type = NORMAL_STATEMENT_RESULT;
+    for (;;) {
+        switch (loop->operator) {
+            case NE_EXPRESSION:
+                more = counter->u.int_value != limit;
+                break;
+            case GT_EXPRESSION:
+                more = counter->u.int_value > limit;
+                break;
+            case GE_EXPRESSION:
+                more = counter->u.int_value >= limit;
+                break;
+            case LT_EXPRESSION:
+                more = counter->u.int_value < limit;
+                break;
+            case LE_EXPRESSION:
+                more = counter->u.int_value <= limit;
+                break;
+            default:
+                DBG_panic(("bad case...%d", loop->operator));
+        }
+        if (!more)
+            break;
+        *result = len_execute_statement_list(inter, env,
+                                             statement->u.for_s.block
+                                             ->statement_list);
+        if (result->type == RETURN_STATEMENT_RESULT) {
+            break;
+        } else if (result->type == BREAK_STATEMENT_RESULT) {
+            result->type = NORMAL_STATEMENT_RESULT;
+            break;
+        }
+        result->type = NORMAL_STATEMENT_RESULT;
+
+        if (__builtin_add_overflow(counter->u.int_value, loop->step, &next)) {
+            // 溢出时照常求post表达式，报告溢出的错误
+            v = len_eval_expression(inter, env, statement->u.for_s.post);
+            len_release_if_string(&v);
+            continue;
+        }
+        counter->u.int_value = next;
+        step_inductions(loop);
+    }
+    stop_inductions(loop);
+
+    return LEN_TRUE;
+}
+
 /**
  * 执行for语句
  */
@@ -200,26 +422,23 @@ execute_for_statement(LEN_Interpreter *inter, LocalEnvironment *env,
                       Statement *statement)
 {
     StatementResult result;
-    LEN_Value   cond;
+    LEN_Value   v;
     
     result.type = NORMAL_STATEMENT_RESULT;
     
     if (statement->u.for_s.init) {
-        len_eval_expression(inter, env, statement->u.for_s.init);
+        v = len_eval_expression(inter, env, statement->u.for_s.init);
+        len_release_if_string(&v);
     }
+    if (statement->u.for_s.counted
+        && execute_counted_loop(inter, env, statement, &result))
+        return result;
     for (;;) {
-        if (statement->u.for_s.condition) {
-            cond = len_eval_expression(inter, env,
-                                       statement->u.for_s.condition);
-            if (cond.type != LEN_BOOLEAN_VALUE) {
-                len_runtime_error(statement->u.for_s.condition->line_number,
-                                  NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
-            }
-            DBG_assert(cond.type == LEN_BOOLEAN_VALUE,
-                       ("cond.type..%d", cond.type));
-            if (!cond.u.boolean_value)
-                break;
-        }
+        if (len_execute_trace(inter, env, statement, &result))
+            break;
+        if (statement->u.for_s.condition
+            && !len_eval_condition(inter, env, statement->u.for_s.condition))
+            break;
         result = len_execute_statement_list(inter, env,
                                             statement->u.for_s.block
                                             ->statement_list);
@@ -229,9 +448,11 @@ execute_for_statement(LEN_Interpreter *inter, LocalEnvironment *env,
             result.type = NORMAL_STATEMENT_RESULT;
             break;
         }
+        result.type = NORMAL_STATEMENT_RESULT;
         
         if (statement->u.for_s.post) {
-            len_eval_expression(inter, env, statement->u.for_s.post);
+            v = len_eval_expression(inter, env, statement->u.for_s.post);
+            len_release_if_string(&v);
         }
     }
     
@@ -247,6 +468,13 @@ execute_return_statement(LEN_Interpreter *inter, LocalEnvironment *env,
 {
     StatementResult result;
     
+    // 尾调用交给len_execute_function_body()，展开的函数调用照常求值
+    if (statement->u.return_s.tail_call
+        && (statement->u.return_s.return_value->type
+            == FUNCTION_CALL_EXPRESSION)) {
+        return len_eval_tail_call(inter, env,
+                                  statement->u.return_s.return_value);
+    }
     result.type = RETURN_STATEMENT_RESULT;
     // 返回结果赋值
     if (statement->u.return_s.return_value) {
@@ -289,18 +517,39 @@ execute_continue_statement(LEN_Interpreter *inter, LocalEnvironment *env,
 /**
  * 执行单条语句
  */
-static StatementResult
-execute_statement(LEN_Interpreter *inter, LocalEnvironment *env, Statement *statement){
+StatementResult
+len_execute_statement(LEN_Interpreter *inter, LocalEnvironment *env, Statement *statement){
     StatementResult result;
     result.type = NORMAL_STATEMENT_RESULT;
     
     switch (statement->type) {
         case EXPRESSION_STATEMENT:
-            
+            result = execute_expression_statement(inter, env, statement);
+            break;
+        case GLOBAL_STATEMENT:
+            result = execute_global_statement(inter, env, statement);
+            break;
+        case IF_STATEMENT:
+            result = execute_if_statement(inter, env, statement);
+            break;
+        case WHILE_STATEMENT:
+            result = execute_while_statement(inter, env, statement);
+            break;
+        case FOR_STATEMENT:
+            result = execute_for_statement(inter, env, statement);
+            break;
+        case RETURN_STATEMENT:
+            result = execute_return_statement(inter, env, statement);
+            break;
+        case BREAK_STATEMENT:
+            result = execute_break_statement(inter, env, statement);
+            break;
+        case CONTINUE_STATEMENT:
+            result = execute_continue_statement(inter, env, statement);
             break;
-            
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
         default:
-            DBG_panic(("bad case ...%s", statement->type));
+            DBG_panic(("bad case ...%d", statement->type));
     }
     return result;
 }
@@ -316,7 +565,7 @@ len_execute_statement_list(LEN_Interpreter *inter, LocalEnvironment *env, Statem
     result.type = NORMAL_STATEMENT_RESULT;
     // 按照链表顺序执行语句
     for (pos = list; pos; pos = pos->next) {
-        result = execute_statement(inter, env, pos->statement);
+        result = len_execute_statement(inter, env, pos->statement);
         if (result.type != NORMAL_STATEMENT_RESULT) {
             goto FUNC_END;
         }
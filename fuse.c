@@ -0,0 +1,301 @@
+//
+//  fuse.c
+//  lemon
+//  这个文件在编译结束时识别遍历分析树执行时最常见的几种形状，
+//  把它们标记成融合的节点(superinstruction)，由eval.c一次执行完，
+//  不再逐个分派子节点。子节点保持不变，融合的执行遇到不常见的类型时
+//  退回通常的求值，trace和其他执行方式也照常使用子节点
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+static void fuse_expression(Expression *expr);
+static void fuse_statement_list(StatementList *list);
+
+/**
+ * 变量表达式和赋值的是同一个变量
+ */
+static LEN_Boolean
+is_assigned_variable(Expression *identifier, Expression *assign)
+{
+    return identifier->type == IDENTIFIER_EXPRESSION
+        && identifier->u.identifier.slot == assign->u.assign_expression.slot
+        && (identifier->u.identifier.global_index
+            == assign->u.assign_expression.global_index);
+}
+
+/**
+ * 不赋值也不调用函数的表达式，求值时变量的值不会改变
+ */
+LEN_Boolean
+len_is_pure_expression(Expression *expr)
+{
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+        case INT_EXPRESSION:        /* FALLTHRU */
+        case DOUBLE_EXPRESSION:     /* FALLTHRU */
+        case STRING_EXPRESSION:     /* FALLTHRU */
+        case NULL_EXPRESSION:       /* FALLTHRU */
+        case IDENTIFIER_EXPRESSION:
+            return LEN_TRUE;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            return len_is_pure_expression(expr->u.binary_expression.left)
+                && len_is_pure_expression(expr->u.binary_expression.right);
+        case MINUS_EXPRESSION:
+            return len_is_pure_expression(expr->u.minus_expression);
+        case BIT_NOT_EXPRESSION:
+            return len_is_pure_expression(expr->u.bit_not_expression);
+        case ASSIGN_EXPRESSION:         /* FALLTHRU */
+        case FUNCTION_CALL_EXPRESSION:  /* FALLTHRU */
+        case INLINE_CALL_EXPRESSION:
+            return LEN_FALSE;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+    return LEN_FALSE;
+}
+
+/**
+ * x = x + 常量和x = x + 表达式
+ * 融合的执行先确认x已经赋值再求右边，右边不能改变x
+ */
+static void
+fuse_assign_expression(Expression *expr)
+{
+    Expression *operand = expr->u.assign_expression.operand;
+
+    if (operand->type != ADD_EXPRESSION
+        || !is_assigned_variable(operand->u.binary_expression.left, expr))
+        return;
+
+    if (operand->u.binary_expression.right->type == INT_EXPRESSION) {
+        expr->fused = FUSED_INCREMENT;
+    } else if (len_is_pure_expression(operand->u.binary_expression.right)) {
+        expr->fused = FUSED_ACCUMULATE;
+    }
+}
+
+/**
+ * 两边都是变量或者整数常量的比较
+ */
+static void
+fuse_compare_expression(Expression *expr)
+{
+    Expression *left = expr->u.binary_expression.left;
+    Expression *right = expr->u.binary_expression.right;
+
+    if ((left->type == IDENTIFIER_EXPRESSION || left->type == INT_EXPRESSION)
+        && (right->type == IDENTIFIER_EXPRESSION
+            || right->type == INT_EXPRESSION)) {
+        expr->fused = FUSED_COMPARE;
+    }
+}
+
+/**
+ * print(字符串常量 + a + b ...)
+ * 最左边是字符串的加法每一步的结果都是字符串，
+ * 依次打印每一段和打印拼接之后的字符串结果相同
+ */
+static void
+fuse_print_call(Expression *expr)
+{
+    FunctionDefinition  *func = expr->u.function_call_expression.function;
+    ArgumentList        *arg = expr->u.function_call_expression.argument;
+    Expression          *pos;
+    int piece_count;
+
+    if (func == NULL || func->type != NATIVE_FUNCTION_DEFINITION
+        || func->u.native_f.proc != len_nv_print_proc)
+        return;
+    if (arg == NULL || arg->next != NULL
+        || arg->expression->type != ADD_EXPRESSION)
+        return;
+
+    piece_count = 1;
+    for (pos = arg->expression; pos->type == ADD_EXPRESSION;
+         pos = pos->u.binary_expression.left) {
+        piece_count++;
+    }
+    if (pos->type == STRING_EXPRESSION
+        && piece_count <= FUSED_PRINT_PIECE_MAX) {
+        expr->fused = FUSED_PRINT;
+    }
+}
+
+static void
+fuse_expression(Expression *expr)
+{
+    ArgumentList *arg_p;
+    InlineBranch *branch;
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+        case INT_EXPRESSION:        /* FALLTHRU */
+        case DOUBLE_EXPRESSION:     /* FALLTHRU */
+        case STRING_EXPRESSION:     /* FALLTHRU */
+        case NULL_EXPRESSION:       /* FALLTHRU */
+        case IDENTIFIER_EXPRESSION:
+            break;
+        case ASSIGN_EXPRESSION:
+            fuse_expression(expr->u.assign_expression.operand);
+            fuse_assign_expression(expr);
+            break;
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:
+            fuse_expression(expr->u.binary_expression.left);
+            fuse_expression(expr->u.binary_expression.right);
+            fuse_compare_expression(expr);
+            break;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            fuse_expression(expr->u.binary_expression.left);
+            fuse_expression(expr->u.binary_expression.right);
+            break;
+        case MINUS_EXPRESSION:
+            fuse_expression(expr->u.minus_expression);
+            break;
+        case BIT_NOT_EXPRESSION:
+            fuse_expression(expr->u.bit_not_expression);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            for (arg_p = expr->u.function_call_expression.argument; arg_p;
+                 arg_p = arg_p->next) {
+                fuse_expression(arg_p->expression);
+            }
+            fuse_print_call(expr);
+            break;
+        case INLINE_CALL_EXPRESSION:
+            for (arg_p = expr->u.inline_call_expression.binding; arg_p;
+                 arg_p = arg_p->next) {
+                fuse_expression(arg_p->expression);
+            }
+            for (branch = expr->u.inline_call_expression.branch; branch;
+                 branch = branch->next) {
+                fuse_expression(branch->condition);
+                fuse_expression(branch->value);
+            }
+            fuse_expression(expr->u.inline_call_expression.body);
+            break;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+}
+
+static void
+fuse_statement(Statement *statement)
+{
+    Elsif *elsif;
+
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            fuse_expression(statement->u.expression_s);
+            break;
+        case IF_STATEMENT:
+            fuse_expression(statement->u.if_s.condition);
+            fuse_statement_list(statement->u.if_s.then_block->statement_list);
+            for (elsif = statement->u.if_s.elsif_list; elsif;
+                 elsif = elsif->next) {
+                fuse_expression(elsif->condition);
+                fuse_statement_list(elsif->block->statement_list);
+            }
+            if (statement->u.if_s.else_block) {
+                fuse_statement_list(statement->u.if_s.else_block
+                                    ->statement_list);
+            }
+            break;
+        case WHILE_STATEMENT:
+            fuse_expression(statement->u.while_s.condition);
+            fuse_statement_list(statement->u.while_s.block->statement_list);
+            break;
+        case FOR_STATEMENT:
+            if (statement->u.for_s.init) {
+                fuse_expression(statement->u.for_s.init);
+            }
+            if (statement->u.for_s.condition) {
+                fuse_expression(statement->u.for_s.condition);
+            }
+            if (statement->u.for_s.post) {
+                fuse_expression(statement->u.for_s.post);
+            }
+            fuse_statement_list(statement->u.for_s.block->statement_list);
+            break;
+        case RETURN_STATEMENT:
+            if (statement->u.return_s.return_value) {
+                fuse_expression(statement->u.return_s.return_value);
+            }
+            break;
+        case GLOBAL_STATEMENT:      /* FALLTHRU */
+        case BREAK_STATEMENT:       /* FALLTHRU */
+        case CONTINUE_STATEMENT:
+            break;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n", statement->type));
+    }
+}
+
+static void
+fuse_statement_list(StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        fuse_statement(pos->statement);
+    }
+}
+
+/**
+ * 标记函数和顶层语句链中可以融合执行的节点
+ */
+void
+len_fuse_expressions(LEN_Interpreter *inter)
+{
+    FunctionDefinition  *func;
+
+    if (!(inter->optimize_flags & LEN_OPTIMIZE_FUSE))
+        return;
+
+    fuse_statement_list(inter->statement_list);
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type != LEMON_FUNCTION_DEFINITION)
+            continue;
+        fuse_statement_list(func->u.lemon_f.block->statement_list);
+    }
+}
@@ -0,0 +1,845 @@
+//
+//  generate.c
+//  lemon
+//  这个文件主要用来将分析树编译成寄存器式的字节码
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+#define CODE_ALLOC_SIZE     (256)
+#define OPERAND_MAX         (65535)
+
+/**
+ * 等待回填跳转目标的指令
+ */
+typedef struct PatchList_tag {
+    int         pc;
+    struct PatchList_tag *next;
+} PatchList;
+
+/**
+ * 循环的信息，用于处理break和continue
+ */
+typedef struct LoopInfo_tag {
+    PatchList   *break_list;
+    PatchList   *continue_list;
+    struct LoopInfo_tag *outer;
+} LoopInfo;
+
+/**
+ * 编译过程中的字节码缓冲
+ */
+typedef struct {
+    int         code_alloc_size;
+    int         code_size;
+    Instruction *code;
+    int         *line_number;
+    int         constant_count;
+    LEN_Value   *constant;
+    int         name_count;
+    char        **name;
+    int         function_count;
+    FunctionDefinition  **function;
+    /**当前第一个空闲的寄存器*/
+    int         current_register;
+    int         register_count;
+    LoopInfo    *loop;
+    /**LEN_OptimizeFlag的组合*/
+    int         optimize_flags;
+} CodeBuffer;
+
+static void generate_expression(CodeBuffer *cb, Expression *expr, int dst);
+static void generate_statement_list(CodeBuffer *cb, StatementList *list);
+static int generate_condition(CodeBuffer *cb, Expression *condition);
+
+/**
+ * 操作数只有16位，寄存器、常量等超过上限时报编译错误
+ */
+static void
+check_operand(int operand, int line_number)
+{
+    DBG_assert(operand >= 0, ("operand..%d\n", operand));
+    if (operand > OPERAND_MAX) {
+        len_get_current_interpreter()->current_line_number = line_number;
+        len_compile_error(OPERAND_TOO_LARGE_ERR,
+                          INT_MESSAGE_ARGUMENT, "max", OPERAND_MAX,
+                          MESSAGE_ARGUMENT_END);
+    }
+}
+
+/**
+ * 追加一条指令，返回指令的位置
+ */
+static int
+add_instruction(CodeBuffer *cb, OpCode opcode, int a, int b, int c,
+                int line_number)
+{
+    Instruction *ins;
+
+    if (cb->code_size == cb->code_alloc_size) {
+        cb->code_alloc_size += CODE_ALLOC_SIZE;
+        cb->code = MEM_realloc(cb->code,
+                               sizeof(Instruction) * cb->code_alloc_size);
+        cb->line_number = MEM_realloc(cb->line_number,
+                                      sizeof(int) * cb->code_alloc_size);
+    }
+    check_operand(a, line_number);
+    check_operand(b, line_number);
+    check_operand(c, line_number);
+    ins = &cb->code[cb->code_size];
+    ins->opcode = opcode;
+    ins->a = a;
+    ins->b = b;
+    ins->c = c;
+    cb->line_number[cb->code_size] = line_number;
+
+    return cb->code_size++;
+}
+
+/**
+ * 设置pc处跳转指令的目标，目标占用b和c两个操作数
+ */
+static void
+patch_jump(CodeBuffer *cb, int pc, int target)
+{
+    DBG_assert(target >= 0, ("target..%d\n", target));
+    dkc_set_jump_target(&cb->code[pc], target);
+}
+
+/**
+ * 追加跳转到target的指令，target之后再确定时先传0
+ */
+static int
+add_jump(CodeBuffer *cb, OpCode opcode, int a, int target, int line_number)
+{
+    int pc;
+
+    pc = add_instruction(cb, opcode, a, 0, 0, line_number);
+    patch_jump(cb, pc, target);
+
+    return pc;
+}
+
+/**
+ * 常量(数值、字符串字面量)加入常量池，返回下标
+ */
+static int
+add_constant(CodeBuffer *cb, LEN_Value *value)
+{
+    int i;
+
+    for (i = 0; i < cb->constant_count; i++) {
+        if (cb->constant[i].type != value->type)
+            continue;
+        if (value->type == LEN_INT_VALUE
+            && cb->constant[i].u.int_value == value->u.int_value)
+            return i;
+        if (value->type == LEN_DOUBLE_VALUE
+            && cb->constant[i].u.double_value == value->u.double_value)
+            return i;
+        if (value->type == LEN_STRING_VALUE
+            && cb->constant[i].u.string_value == value->u.string_value)
+            return i;
+    }
+    cb->constant = MEM_realloc(cb->constant,
+                               sizeof(LEN_Value) * (cb->constant_count + 1));
+    cb->constant[cb->constant_count] = *value;
+
+    return cb->constant_count++;
+}
+
+/**
+ * 变量名加入名字表，返回下标
+ */
+static int
+add_name(CodeBuffer *cb, char *name)
+{
+    int i;
+
+    for (i = 0; i < cb->name_count; i++) {
+        if (!strcmp(cb->name[i], name))
+            return i;
+    }
+    cb->name = MEM_realloc(cb->name, sizeof(char*) * (cb->name_count + 1));
+    cb->name[cb->name_count] = name;
+
+    return cb->name_count++;
+}
+
+/**
+ * 调用的函数加入函数表，返回下标
+ */
+static int
+add_function(CodeBuffer *cb, FunctionDefinition *func)
+{
+    int i;
+
+    for (i = 0; i < cb->function_count; i++) {
+        if (cb->function[i] == func)
+            return i;
+    }
+    cb->function = MEM_realloc(cb->function, sizeof(FunctionDefinition*)
+                               * (cb->function_count + 1));
+    cb->function[cb->function_count] = func;
+
+    return cb->function_count++;
+}
+
+static int
+alloc_register(CodeBuffer *cb)
+{
+    int reg;
+
+    reg = cb->current_register++;
+    if (cb->current_register > cb->register_count) {
+        cb->register_count = cb->current_register;
+    }
+    return reg;
+}
+
+/**
+ * 寄存器按照栈的顺序分配和释放
+ */
+static void
+free_register(CodeBuffer *cb, int reg)
+{
+    DBG_assert(reg == cb->current_register - 1,
+               ("reg..%d, current..%d\n", reg, cb->current_register));
+    cb->current_register--;
+}
+
+static PatchList *
+add_patch(PatchList *list, int pc)
+{
+    PatchList *patch;
+
+    patch = MEM_malloc(sizeof(PatchList));
+    patch->pc = pc;
+    patch->next = list;
+
+    return patch;
+}
+
+/**
+ * 把链表中所有跳转指令的目标设为target，并释放链表
+ */
+static void
+backpatch(CodeBuffer *cb, PatchList *list, int target)
+{
+    PatchList *temp;
+
+    while (list) {
+        patch_jump(cb, list->pc, target);
+        temp = list;
+        list = list->next;
+        MEM_free(temp);
+    }
+}
+
+static OpCode
+binary_opcode(ExpressionType type)
+{
+    switch (type) {
+        case ADD_EXPRESSION:
+            return OP_ADD;
+        case SUB_EXPRESSION:
+            return OP_SUB;
+        case MUL_EXPRESSION:
+            return OP_MUL;
+        case DIV_EXPRESSION:
+            return OP_DIV;
+        case MOD_EXPRESSION:
+            return OP_MOD;
+        case EQ_EXPRESSION:
+            return OP_EQ;
+        case NE_EXPRESSION:
+            return OP_NE;
+        case GT_EXPRESSION:
+            return OP_GT;
+        case GE_EXPRESSION:
+            return OP_GE;
+        case LT_EXPRESSION:
+            return OP_LT;
+        case LE_EXPRESSION:
+            return OP_LE;
+        case BIT_AND_EXPRESSION:
+            return OP_BIT_AND;
+        case BIT_OR_EXPRESSION:
+            return OP_BIT_OR;
+        case BIT_XOR_EXPRESSION:
+            return OP_BIT_XOR;
+        case LEFT_SHIFT_EXPRESSION:
+            return OP_LEFT_SHIFT;
+        case RIGHT_SHIFT_EXPRESSION:
+            return OP_RIGHT_SHIFT;
+        default:
+            DBG_panic(("bad case...%d", type));
+    }
+    return 0;
+}
+
+/**
+ * 生成二元运算，左操作数放在dst，右操作数放在下一个寄存器
+ */
+static void
+generate_binary_expression(CodeBuffer *cb, Expression *expr, int dst)
+{
+    int right;
+
+    generate_expression(cb, expr->u.binary_expression.left, dst);
+    right = alloc_register(cb);
+    generate_expression(cb, expr->u.binary_expression.right, right);
+    add_instruction(cb, binary_opcode(expr->type), dst, dst, right,
+                    expr->u.binary_expression.left->line_number);
+    free_register(cb, right);
+}
+
+/**
+ * 生成逻辑运算，右操作数只在需要时求值
+ */
+static void
+generate_logical_expression(CodeBuffer *cb, Expression *expr, int dst)
+{
+    Expression *left = expr->u.binary_expression.left;
+    Expression *right = expr->u.binary_expression.right;
+    OpCode  jump;
+    int     jump_pc;
+
+    if (expr->type == LOGICAL_AND_EXPRESSION) {
+        jump = OP_JUMP_IF_FALSE;
+    } else {
+        jump = OP_JUMP_IF_TRUE;
+    }
+    generate_expression(cb, left, dst);
+    jump_pc = add_instruction(cb, jump, dst, 0, 0, left->line_number);
+    generate_expression(cb, right, dst);
+    add_instruction(cb, OP_CHECK_BOOLEAN, dst, 0, 0, right->line_number);
+    patch_jump(cb, jump_pc, cb->code_size);
+}
+
+/**
+ * 生成函数调用，参数依次放在dst开始的寄存器中
+ */
+static void
+generate_function_call_expression(CodeBuffer *cb, Expression *expr, int dst)
+{
+    ArgumentList *arg_p;
+    int arg_count;
+    int reg;
+
+    for (arg_p = expr->u.function_call_expression.argument, arg_count = 0;
+         arg_p; arg_p = arg_p->next, arg_count++) {
+        if (arg_count == 0) {
+            reg = dst;
+        } else {
+            reg = alloc_register(cb);
+        }
+        generate_expression(cb, arg_p->expression, reg);
+    }
+    add_instruction(cb, OP_CALL, dst,
+                    add_function(cb, expr->u.function_call_expression.function),
+                    arg_count, expr->line_number);
+    for (; arg_count > 1; arg_count--) {
+        free_register(cb, dst + arg_count - 1);
+    }
+}
+
+/**
+ * 生成展开的函数调用，赋值的结果先放在dst中丢弃，再计算返回值
+ * 条件成立的分支把返回值放在dst中跳到结尾
+ */
+static void
+generate_inline_call_expression(CodeBuffer *cb, Expression *expr, int dst)
+{
+    PatchList       *end_list = NULL;
+    ArgumentList    *pos;
+    InlineBranch    *branch;
+    int false_pc;
+
+    for (pos = expr->u.inline_call_expression.binding; pos; pos = pos->next) {
+        generate_expression(cb, pos->expression, dst);
+        add_instruction(cb, OP_POP, dst, 0, 0, pos->expression->line_number);
+    }
+    for (branch = expr->u.inline_call_expression.branch; branch;
+         branch = branch->next) {
+        false_pc = generate_condition(cb, branch->condition);
+        generate_expression(cb, branch->value, dst);
+        end_list = add_patch(end_list,
+                             add_instruction(cb, OP_JUMP, 0, 0, 0,
+                                             expr->line_number));
+        patch_jump(cb, false_pc, cb->code_size);
+    }
+    generate_expression(cb, expr->u.inline_call_expression.body, dst);
+    backpatch(cb, end_list, cb->code_size);
+}
+
+/**
+ * 生成表达式，结果放在寄存器dst中
+ */
+static void
+generate_expression(CodeBuffer *cb, Expression *expr, int dst)
+{
+    LEN_Value v;
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:
+            add_instruction(cb, OP_LOAD_BOOLEAN, dst, expr->u.boolean_value, 0,
+                            expr->line_number);
+            break;
+        case INT_EXPRESSION:
+            v.type = LEN_INT_VALUE;
+            v.u.int_value = expr->u.int_value;
+            add_instruction(cb, OP_LOAD_CONSTANT, dst, add_constant(cb, &v), 0,
+                            expr->line_number);
+            break;
+        case DOUBLE_EXPRESSION:
+            v.type = LEN_DOUBLE_VALUE;
+            v.u.double_value = expr->u.double_value;
+            add_instruction(cb, OP_LOAD_CONSTANT, dst, add_constant(cb, &v), 0,
+                            expr->line_number);
+            break;
+        case STRING_EXPRESSION:
+            v.type = LEN_STRING_VALUE;
+            v.u.string_value = expr->u.string_value;
+            add_instruction(cb, OP_LOAD_CONSTANT, dst, add_constant(cb, &v), 0,
+                            expr->line_number);
+            break;
+        case IDENTIFIER_EXPRESSION:
+            if (expr->u.identifier.slot >= 0) {
+                add_instruction(cb, OP_LOAD_LOCAL, dst,
+                                expr->u.identifier.slot,
+                                add_name(cb, expr->u.identifier.name),
+                                expr->line_number);
+            } else {
+                add_instruction(cb, OP_LOAD_GLOBAL, dst,
+                                expr->u.identifier.global_index, 0,
+                                expr->line_number);
+            }
+            break;
+        case ASSIGN_EXPRESSION:
+            generate_expression(cb, expr->u.assign_expression.operand, dst);
+            if (expr->u.assign_expression.slot >= 0) {
+                add_instruction(cb, OP_STORE_LOCAL, dst,
+                                expr->u.assign_expression.slot, 0,
+                                expr->line_number);
+            } else {
+                add_instruction(cb, OP_STORE_GLOBAL, dst,
+                                expr->u.assign_expression.global_index, 0,
+                                expr->line_number);
+            }
+            break;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION: /* FALLTHRU */
+        case NE_EXPRESSION: /* FALLTHRU */
+        case GT_EXPRESSION: /* FALLTHRU */
+        case GE_EXPRESSION: /* FALLTHRU */
+        case LT_EXPRESSION: /* FALLTHRU */
+        case LE_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            generate_binary_expression(cb, expr, dst);
+            break;
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION:
+            generate_logical_expression(cb, expr, dst);
+            break;
+        case MINUS_EXPRESSION:
+            generate_expression(cb, expr->u.minus_expression, dst);
+            add_instruction(cb, OP_MINUS, dst, dst, 0,
+                            expr->u.minus_expression->line_number);
+            break;
+        case BIT_NOT_EXPRESSION:
+            generate_expression(cb, expr->u.bit_not_expression, dst);
+            add_instruction(cb, OP_BIT_NOT, dst, dst, 0,
+                            expr->u.bit_not_expression->line_number);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            generate_function_call_expression(cb, expr, dst);
+            break;
+        case NULL_EXPRESSION:
+            add_instruction(cb, OP_LOAD_NULL, dst, 0, 0, expr->line_number);
+            break;
+        case INLINE_CALL_EXPRESSION:
+            generate_inline_call_expression(cb, expr, dst);
+            break;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+}
+
+/**
+ * 生成表达式并丢弃结果
+ */
+static void
+generate_pop_expression(CodeBuffer *cb, Expression *expr)
+{
+    int reg;
+
+    reg = alloc_register(cb);
+    generate_expression(cb, expr, reg);
+    add_instruction(cb, OP_POP, reg, 0, 0, expr->line_number);
+    free_register(cb, reg);
+}
+
+/**
+ * 生成条件跳转，条件为false时跳转，返回跳转指令的位置
+ */
+static int
+generate_condition(CodeBuffer *cb, Expression *condition)
+{
+    int reg;
+    int pc;
+
+    reg = alloc_register(cb);
+    generate_expression(cb, condition, reg);
+    pc = add_instruction(cb, OP_JUMP_IF_FALSE, reg, 0, 0,
+                         condition->line_number);
+    free_register(cb, reg);
+
+    return pc;
+}
+
+static void
+generate_global_statement(CodeBuffer *cb, Statement *statement)
+{
+    IdentifierList *pos;
+
+    for (pos = statement->u.global_s.identifier_list; pos; pos = pos->next) {
+        add_instruction(cb, OP_GLOBAL, 0, pos->global_index, 0,
+                        statement->line_number);
+    }
+}
+
+static void
+generate_if_statement(CodeBuffer *cb, Statement *statement)
+{
+    PatchList *end_list = NULL;
+    Elsif *pos;
+    int false_pc;
+
+    false_pc = generate_condition(cb, statement->u.if_s.condition);
+    generate_statement_list(cb,
+                            statement->u.if_s.then_block->statement_list);
+    for (pos = statement->u.if_s.elsif_list; pos; pos = pos->next) {
+        end_list = add_patch(end_list,
+                             add_instruction(cb, OP_JUMP, 0, 0, 0,
+                                             statement->line_number));
+        patch_jump(cb, false_pc, cb->code_size);
+        false_pc = generate_condition(cb, pos->condition);
+        generate_statement_list(cb, pos->block->statement_list);
+    }
+    if (statement->u.if_s.else_block) {
+        end_list = add_patch(end_list,
+                             add_instruction(cb, OP_JUMP, 0, 0, 0,
+                                             statement->line_number));
+        patch_jump(cb, false_pc, cb->code_size);
+        generate_statement_list(cb,
+                                statement->u.if_s.else_block->statement_list);
+    } else {
+        patch_jump(cb, false_pc, cb->code_size);
+    }
+    backpatch(cb, end_list, cb->code_size);
+}
+
+/**
+ * 生成循环体，循环体中的break和continue记录在loop中，由调用者回填
+ */
+static void
+generate_loop_body(CodeBuffer *cb, LoopInfo *loop, Block *block)
+{
+    loop->break_list = NULL;
+    loop->continue_list = NULL;
+    loop->outer = cb->loop;
+    cb->loop = loop;
+    generate_statement_list(cb, block->statement_list);
+    cb->loop = loop->outer;
+}
+
+/**
+ * 循环中有循环不变的运算时剥离第一次迭代，
+ * 之后的迭代被第一次迭代支配，不变的运算由len_optimize_code()消除
+ */
+static LEN_Boolean
+should_peel_loop(CodeBuffer *cb, Statement *statement)
+{
+    return (cb->optimize_flags & LEN_OPTIMIZE_LICM)
+        && (cb->optimize_flags & LEN_OPTIMIZE_GVN)
+        && len_has_loop_invariant(statement);
+}
+
+static void
+generate_while_statement(CodeBuffer *cb, Statement *statement)
+{
+    LoopInfo loop;
+    LoopInfo peel;
+    int cond_pc;
+    int exit_pc;
+    int peel_exit_pc = -1;
+
+    if (should_peel_loop(cb, statement)) {
+        peel_exit_pc = generate_condition(cb, statement->u.while_s.condition);
+        generate_loop_body(cb, &peel, statement->u.while_s.block);
+        backpatch(cb, peel.continue_list, cb->code_size);
+    }
+    cond_pc = cb->code_size;
+    exit_pc = generate_condition(cb, statement->u.while_s.condition);
+    generate_loop_body(cb, &loop, statement->u.while_s.block);
+    add_jump(cb, OP_JUMP, 0, cond_pc, statement->line_number);
+    patch_jump(cb, exit_pc, cb->code_size);
+    backpatch(cb, loop.continue_list, cond_pc);
+    backpatch(cb, loop.break_list, cb->code_size);
+    if (peel_exit_pc >= 0) {
+        patch_jump(cb, peel_exit_pc, cb->code_size);
+        backpatch(cb, peel.break_list, cb->code_size);
+    }
+}
+
+static void
+generate_for_statement(CodeBuffer *cb, Statement *statement)
+{
+    LoopInfo loop;
+    LoopInfo peel;
+    LEN_Boolean peeled = LEN_FALSE;
+    int cond_pc;
+    int exit_pc = -1;
+    int peel_exit_pc = -1;
+
+    if (statement->u.for_s.init) {
+        generate_pop_expression(cb, statement->u.for_s.init);
+    }
+    if (should_peel_loop(cb, statement)) {
+        peeled = LEN_TRUE;
+        if (statement->u.for_s.condition) {
+            peel_exit_pc = generate_condition(cb,
+                                              statement->u.for_s.condition);
+        }
+        generate_loop_body(cb, &peel, statement->u.for_s.block);
+        backpatch(cb, peel.continue_list, cb->code_size);
+        if (statement->u.for_s.post) {
+            generate_pop_expression(cb, statement->u.for_s.post);
+        }
+    }
+    cond_pc = cb->code_size;
+    if (statement->u.for_s.condition) {
+        exit_pc = generate_condition(cb, statement->u.for_s.condition);
+    }
+    generate_loop_body(cb, &loop, statement->u.for_s.block);
+    backpatch(cb, loop.continue_list, cb->code_size);
+    if (statement->u.for_s.post) {
+        generate_pop_expression(cb, statement->u.for_s.post);
+    }
+    add_jump(cb, OP_JUMP, 0, cond_pc, statement->line_number);
+    if (exit_pc >= 0) {
+        patch_jump(cb, exit_pc, cb->code_size);
+    }
+    backpatch(cb, loop.break_list, cb->code_size);
+    if (peeled) {
+        if (peel_exit_pc >= 0) {
+            patch_jump(cb, peel_exit_pc, cb->code_size);
+        }
+        backpatch(cb, peel.break_list, cb->code_size);
+    }
+}
+
+static void
+generate_return_statement(CodeBuffer *cb, Statement *statement)
+{
+    int reg;
+
+    if (statement->u.return_s.return_value) {
+        reg = alloc_register(cb);
+        generate_expression(cb, statement->u.return_s.return_value, reg);
+        add_instruction(cb, OP_RETURN, reg, 0, 0, statement->line_number);
+        free_register(cb, reg);
+    } else {
+        add_instruction(cb, OP_RETURN_NULL, 0, 0, 0, statement->line_number);
+    }
+}
+
+/**
+ * break和continue在循环外时，与树遍历一样结束当前的语句链
+ */
+static void
+generate_jump_statement(CodeBuffer *cb, Statement *statement)
+{
+    int pc;
+
+    if (cb->loop == NULL) {
+        add_instruction(cb, OP_RETURN_NULL, 0, 0, 0, statement->line_number);
+        return;
+    }
+    pc = add_instruction(cb, OP_JUMP, 0, 0, 0, statement->line_number);
+    if (statement->type == BREAK_STATEMENT) {
+        cb->loop->break_list = add_patch(cb->loop->break_list, pc);
+    } else {
+        cb->loop->continue_list = add_patch(cb->loop->continue_list, pc);
+    }
+}
+
+static void
+generate_statement(CodeBuffer *cb, Statement *statement)
+{
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            generate_pop_expression(cb, statement->u.expression_s);
+            break;
+        case GLOBAL_STATEMENT:
+            generate_global_statement(cb, statement);
+            break;
+        case IF_STATEMENT:
+            generate_if_statement(cb, statement);
+            break;
+        case WHILE_STATEMENT:
+            generate_while_statement(cb, statement);
+            break;
+        case FOR_STATEMENT:
+            generate_for_statement(cb, statement);
+            break;
+        case RETURN_STATEMENT:
+            generate_return_statement(cb, statement);
+            break;
+        case BREAK_STATEMENT:       /* FALLTHRU */
+        case CONTINUE_STATEMENT:
+            generate_jump_statement(cb, statement);
+            break;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case ...%d", statement->type));
+    }
+}
+
+static void
+generate_statement_list(CodeBuffer *cb, StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        generate_statement(cb, pos->statement);
+    }
+}
+
+/**
+ * 把缓冲中的内容复制到解释器的内存中
+ */
+static ByteCode *
+fix_code(CodeBuffer *cb)
+{
+    ByteCode *code;
+
+    code = len_malloc(sizeof(ByteCode));
+    code->code_size = cb->code_size;
+    code->code = len_malloc(sizeof(Instruction) * cb->code_size);
+    memcpy(code->code, cb->code, sizeof(Instruction) * cb->code_size);
+    code->line_number = len_malloc(sizeof(int) * cb->code_size);
+    memcpy(code->line_number, cb->line_number, sizeof(int) * cb->code_size);
+    code->constant_count = cb->constant_count;
+    code->constant = len_malloc(sizeof(LEN_Value) * (cb->constant_count + 1));
+    // 表是空的时候缓冲区还没有分配，不能传给memcpy
+    if (cb->constant_count > 0) {
+        memcpy(code->constant, cb->constant,
+               sizeof(LEN_Value) * cb->constant_count);
+    }
+    code->name_count = cb->name_count;
+    code->name = len_malloc(sizeof(char*) * (cb->name_count + 1));
+    if (cb->name_count > 0) {
+        memcpy(code->name, cb->name, sizeof(char*) * cb->name_count);
+    }
+    code->function_count = cb->function_count;
+    code->function = len_malloc(sizeof(FunctionDefinition*)
+                                * (cb->function_count + 1));
+    if (cb->function_count > 0) {
+        memcpy(code->function, cb->function,
+               sizeof(FunctionDefinition*) * cb->function_count);
+    }
+    code->register_count = cb->register_count;
+    code->call_count = 0;
+    code->jit_code = NULL;
+    code->jit_failed = LEN_FALSE;
+
+    MEM_free(cb->code);
+    MEM_free(cb->line_number);
+    MEM_free(cb->constant);
+    MEM_free(cb->name);
+    MEM_free(cb->function);
+
+    return code;
+}
+
+/**
+ * 优化之后把函数中紧接着返回结果的用户函数调用改成尾调用
+ */
+static void
+mark_tail_calls(ByteCode *code)
+{
+    Instruction *ins;
+    int pc;
+
+    for (pc = 0; pc + 1 < code->code_size; pc++) {
+        ins = &code->code[pc];
+        if (ins->opcode == OP_CALL
+            && code->code[pc + 1].opcode == OP_RETURN
+            && code->code[pc + 1].a == ins->a
+            && code->function[ins->b]->type == LEMON_FUNCTION_DEFINITION) {
+            ins->opcode = OP_TAIL_CALL;
+        }
+    }
+}
+
+/**
+ * parameter_count是函数的参数个数，顶层语句链为0
+ */
+static ByteCode *
+generate_block(LEN_Interpreter *inter, StatementList *list,
+               int parameter_count, int line_number)
+{
+    CodeBuffer  cb;
+    ByteCode    *code;
+
+    memset(&cb, 0, sizeof(CodeBuffer));
+    cb.optimize_flags = inter->optimize_flags;
+    generate_statement_list(&cb, list);
+    add_instruction(&cb, OP_RETURN_NULL, 0, 0, 0, line_number);
+    code = fix_code(&cb);
+    len_optimize_code(inter, code, parameter_count);
+
+    return code;
+}
+
+/**
+ * 编译所有的函数定义和顶层语句链
+ */
+void
+len_generate_code(LEN_Interpreter *inter)
+{
+    FunctionDefinition  *pos;
+    ParameterList       *param;
+    int parameter_count;
+
+    for (pos = inter->function_list; pos; pos = pos->next) {
+        if (pos->type != LEMON_FUNCTION_DEFINITION)
+            continue;
+        parameter_count = 0;
+        for (param = pos->u.lemon_f.parameter; param; param = param->next) {
+            parameter_count++;
+        }
+        pos->u.lemon_f.code
+        = generate_block(inter, pos->u.lemon_f.block->statement_list,
+                         parameter_count, inter->current_line_number);
+        mark_tail_calls(pos->u.lemon_f.code);
+    }
+    inter->top_level_code = generate_block(inter, inter->statement_list, 0,
+                                           inter->current_line_number);
+}
@@ -0,0 +1,537 @@
+//
+//  infer.c
+//  lemon
+//  这个文件在编译结束时推断表达式的类型，给遍历分析树的执行方式使用
+//  沿着控制流逐条语句跟踪每个变量可能的类型，分支的结尾合并，
+//  循环反复计算到循环开头的类型不再变化为止。
+//  变量可能的类型用位集合表示，LEN_UNDEFINED_VALUE那一位表示可能还没有赋值。
+//  调用用户函数时可能给全局变量赋值，调用之后全局变量可能是任意类型。
+//  只能是一种类型的表达式把类型记在Expression.value_type，
+//  两个操作数的类型都确定的二元表达式在编译时特化，执行时不再检查类型
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+#define type_bit(type)  (1 << (type))
+
+/**赋值之后可能的类型*/
+#define ANY_VALUE_TYPES \
+(type_bit(LEN_BOOLEAN_VALUE) | type_bit(LEN_INT_VALUE)\
+ | type_bit(LEN_DOUBLE_VALUE) | type_bit(LEN_STRING_VALUE)\
+ | type_bit(LEN_NATIVE_POINTER_VALUE) | type_bit(LEN_NULL_VALUE))
+
+/**什么都不知道的变量，可能还没有赋值*/
+#define UNKNOWN_TYPES   (ANY_VALUE_TYPES | type_bit(LEN_UNDEFINED_VALUE))
+
+#define NUMBER_TYPES    (type_bit(LEN_INT_VALUE) | type_bit(LEN_DOUBLE_VALUE))
+
+/**
+ * 程序中某一点每个变量可能的类型，局部变量在前，全局变量在后
+ */
+typedef struct {
+    /**执行不到这里，合并时忽略*/
+    LEN_Boolean reachable;
+    int         *types;
+} TypeState;
+
+/**
+ * 正在分析的循环，break和continue处的类型合并到这里
+ */
+typedef struct LoopStates_tag {
+    TypeState   break_state;
+    TypeState   continue_state;
+    struct LoopStates_tag   *outer;
+} LoopStates;
+
+typedef struct {
+    /**局部变量的数量，顶层语句链为0*/
+    int         local_count;
+    /**局部变量和全局变量的数量*/
+    int         variable_count;
+    LoopStates  *loop;
+} InferContext;
+
+static void infer_statement_list(InferContext *ic, TypeState *state,
+                                 StatementList *list);
+
+static void
+alloc_state(InferContext *ic, TypeState *state)
+{
+    state->reachable = LEN_FALSE;
+    state->types = MEM_malloc(sizeof(int) * (ic->variable_count + 1));
+}
+
+static void
+free_state(TypeState *state)
+{
+    MEM_free(state->types);
+}
+
+static void
+copy_state(InferContext *ic, TypeState *dest, TypeState *src)
+{
+    dest->reachable = src->reachable;
+    memcpy(dest->types, src->types, sizeof(int) * ic->variable_count);
+}
+
+/**
+ * 把src合并到dest，dest变化时返回LEN_TRUE
+ */
+static LEN_Boolean
+join_state(InferContext *ic, TypeState *dest, TypeState *src)
+{
+    LEN_Boolean changed = LEN_FALSE;
+    int i;
+
+    if (!src->reachable)
+        return LEN_FALSE;
+    if (!dest->reachable) {
+        copy_state(ic, dest, src);
+        return LEN_TRUE;
+    }
+    for (i = 0; i < ic->variable_count; i++) {
+        if ((dest->types[i] | src->types[i]) != dest->types[i]) {
+            dest->types[i] |= src->types[i];
+            changed = LEN_TRUE;
+        }
+    }
+    return changed;
+}
+
+/**
+ * 位集合中只有一种值的类型时返回这个类型，否则返回LEN_UNDEFINED_VALUE
+ */
+static LEN_ValueType
+single_type(int types)
+{
+    LEN_ValueType type;
+
+    for (type = LEN_BOOLEAN_VALUE; type <= LEN_NULL_VALUE; type++) {
+        if (types == type_bit(type))
+            return type;
+    }
+    return LEN_UNDEFINED_VALUE;
+}
+
+/**
+ * 变量在TypeState中的下标
+ */
+static int
+variable_index(InferContext *ic, int slot, int global_index)
+{
+    if (slot >= 0)
+        return slot;
+    return ic->local_count + global_index;
+}
+
+/**
+ * 算术运算结果可能的类型
+ */
+static int
+math_result_types(ExpressionType operator, int left, int right)
+{
+    if (left == type_bit(LEN_INT_VALUE) && right == type_bit(LEN_INT_VALUE))
+        return type_bit(LEN_INT_VALUE);
+    if ((left & ~NUMBER_TYPES) == 0 && (right & ~NUMBER_TYPES) == 0) {
+        // 有一边一定是double时结果是double
+        if (left == type_bit(LEN_DOUBLE_VALUE)
+            || right == type_bit(LEN_DOUBLE_VALUE))
+            return type_bit(LEN_DOUBLE_VALUE);
+        return NUMBER_TYPES;
+    }
+    if (operator == ADD_EXPRESSION && left == type_bit(LEN_STRING_VALUE))
+        return type_bit(LEN_STRING_VALUE);
+    return ANY_VALUE_TYPES;
+}
+
+/**
+ * 两个操作数的类型都确定时在编译时特化二元表达式
+ * 循环会分析好几遍，类型不再确定时要撤销上一遍的特化
+ */
+static void
+type_binary_expression(Expression *expr)
+{
+    BinaryExpression    *binary = &expr->u.binary_expression;
+    BinarySpecialization specialization = BINARY_GENERIC;
+
+    if (binary->left->value_type != LEN_UNDEFINED_VALUE
+        && binary->right->value_type != LEN_UNDEFINED_VALUE) {
+        specialization
+        = len_specialize_binary_types(expr->type, binary->left->value_type,
+                                      binary->right->value_type);
+    }
+    if (specialization != BINARY_GENERIC) {
+        binary->specialization = specialization;
+        binary->typed = LEN_TRUE;
+    } else if (binary->typed) {
+        binary->specialization = BINARY_UNSPECIALIZED;
+        binary->typed = LEN_FALSE;
+    }
+}
+
+/**
+ * 推断表达式可能的类型，同时更新赋值和读取之后变量的类型
+ */
+static int
+infer_expression(InferContext *ic, TypeState *state, Expression *expr)
+{
+    int types = ANY_VALUE_TYPES;
+    int left;
+    int right;
+    int index;
+    int i;
+    TypeState   right_state;
+    ArgumentList    *arg_p;
+    InlineBranch    *branch;
+    FunctionDefinition  *func;
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:
+            types = type_bit(LEN_BOOLEAN_VALUE);
+            break;
+        case INT_EXPRESSION:
+            types = type_bit(LEN_INT_VALUE);
+            break;
+        case DOUBLE_EXPRESSION:
+            types = type_bit(LEN_DOUBLE_VALUE);
+            break;
+        case STRING_EXPRESSION:
+            types = type_bit(LEN_STRING_VALUE);
+            break;
+        case NULL_EXPRESSION:
+            types = type_bit(LEN_NULL_VALUE);
+            break;
+        case IDENTIFIER_EXPRESSION:
+            index = variable_index(ic, expr->u.identifier.slot,
+                                   expr->u.identifier.global_index);
+            // 可能还没有赋值的变量仍然要检查，single_type()不会返回类型
+            expr->value_type = single_type(state->types[index]);
+            types = state->types[index] & ANY_VALUE_TYPES;
+            if (types == 0) {
+                // 一定还没有赋值，执行时报错
+                types = ANY_VALUE_TYPES;
+            }
+            // 没有报错的话之后一定已经赋值
+            state->types[index] = types;
+            return types;
+        case ASSIGN_EXPRESSION:
+            types = infer_expression(ic, state,
+                                     expr->u.assign_expression.operand);
+            index = variable_index(ic, expr->u.assign_expression.slot,
+                                   expr->u.assign_expression.global_index);
+            state->types[index] = types;
+            break;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:
+            left = infer_expression(ic, state, expr->u.binary_expression.left);
+            right = infer_expression(ic, state,
+                                     expr->u.binary_expression.right);
+            types = math_result_types(expr->type, left, right);
+            type_binary_expression(expr);
+            break;
+        case EQ_EXPRESSION: /* FALLTHRU */
+        case NE_EXPRESSION: /* FALLTHRU */
+        case GT_EXPRESSION: /* FALLTHRU */
+        case GE_EXPRESSION: /* FALLTHRU */
+        case LT_EXPRESSION: /* FALLTHRU */
+        case LE_EXPRESSION:
+            infer_expression(ic, state, expr->u.binary_expression.left);
+            infer_expression(ic, state, expr->u.binary_expression.right);
+            types = type_bit(LEN_BOOLEAN_VALUE);
+            type_binary_expression(expr);
+            break;
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            infer_expression(ic, state, expr->u.binary_expression.left);
+            infer_expression(ic, state, expr->u.binary_expression.right);
+            types = type_bit(LEN_INT_VALUE);
+            type_binary_expression(expr);
+            break;
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION:
+            infer_expression(ic, state, expr->u.binary_expression.left);
+            // 右边不一定求值
+            alloc_state(ic, &right_state);
+            copy_state(ic, &right_state, state);
+            infer_expression(ic, &right_state,
+                             expr->u.binary_expression.right);
+            join_state(ic, state, &right_state);
+            free_state(&right_state);
+            types = type_bit(LEN_BOOLEAN_VALUE);
+            break;
+        case MINUS_EXPRESSION:
+            types = infer_expression(ic, state, expr->u.minus_expression)
+                & NUMBER_TYPES;
+            if (types == 0) {
+                types = NUMBER_TYPES;
+            }
+            break;
+        case BIT_NOT_EXPRESSION:
+            infer_expression(ic, state, expr->u.bit_not_expression);
+            types = type_bit(LEN_INT_VALUE);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            for (arg_p = expr->u.function_call_expression.argument; arg_p;
+                 arg_p = arg_p->next) {
+                infer_expression(ic, state, arg_p->expression);
+            }
+            func = expr->u.function_call_expression.function;
+            if (func == NULL || func->type == LEMON_FUNCTION_DEFINITION) {
+                // 用户函数中可能给全局变量赋值
+                for (i = ic->local_count; i < ic->variable_count; i++) {
+                    state->types[i] |= ANY_VALUE_TYPES;
+                }
+            }
+            types = ANY_VALUE_TYPES;
+            break;
+        case INLINE_CALL_EXPRESSION:
+            for (arg_p = expr->u.inline_call_expression.binding; arg_p;
+                 arg_p = arg_p->next) {
+                infer_expression(ic, state, arg_p->expression);
+            }
+            // 展开的条件和返回值中没有赋值，不改变状态
+            types = 0;
+            for (branch = expr->u.inline_call_expression.branch; branch;
+                 branch = branch->next) {
+                infer_expression(ic, state, branch->condition);
+                types |= infer_expression(ic, state, branch->value);
+            }
+            types |= infer_expression(ic, state,
+                                      expr->u.inline_call_expression.body);
+            break;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+    expr->value_type = single_type(types);
+
+    return types;
+}
+
+/**
+ * 分析循环，state进来时是循环之前的类型，出去时是循环之后的类型
+ * 没有条件的for循环只能从break出去
+ */
+static void
+infer_loop(InferContext *ic, TypeState *state, Expression *condition,
+           Expression *post, Block *block)
+{
+    TypeState   head;
+    TypeState   exit;
+    LoopStates  loop;
+
+    alloc_state(ic, &head);
+    alloc_state(ic, &exit);
+    alloc_state(ic, &loop.break_state);
+    alloc_state(ic, &loop.continue_state);
+    loop.outer = ic->loop;
+    ic->loop = &loop;
+
+    copy_state(ic, &head, state);
+    for (;;) {
+        copy_state(ic, state, &head);
+        if (condition) {
+            infer_expression(ic, state, condition);
+            copy_state(ic, &exit, state);
+        }
+        loop.break_state.reachable = LEN_FALSE;
+        loop.continue_state.reachable = LEN_FALSE;
+        infer_statement_list(ic, state, block->statement_list);
+        join_state(ic, state, &loop.continue_state);
+        if (post && state->reachable) {
+            infer_expression(ic, state, post);
+        }
+        // 回到循环开头的类型没有变化时结束，最后一遍分析的结果对所有迭代都成立
+        if (!join_state(ic, &head, state))
+            break;
+    }
+
+    ic->loop = loop.outer;
+    copy_state(ic, state, &exit);
+    join_state(ic, state, &loop.break_state);
+
+    free_state(&head);
+    free_state(&exit);
+    free_state(&loop.break_state);
+    free_state(&loop.continue_state);
+}
+
+/**
+ * 分析if语句，每个分支结束时的类型合并成if语句之后的类型
+ */
+static void
+infer_if_statement(InferContext *ic, TypeState *state, Statement *statement)
+{
+    TypeState   result;
+    TypeState   branch;
+    Elsif       *pos;
+
+    alloc_state(ic, &result);
+    alloc_state(ic, &branch);
+
+    infer_expression(ic, state, statement->u.if_s.condition);
+    copy_state(ic, &branch, state);
+    infer_statement_list(ic, &branch,
+                         statement->u.if_s.then_block->statement_list);
+    join_state(ic, &result, &branch);
+    for (pos = statement->u.if_s.elsif_list; pos; pos = pos->next) {
+        infer_expression(ic, state, pos->condition);
+        copy_state(ic, &branch, state);
+        infer_statement_list(ic, &branch, pos->block->statement_list);
+        join_state(ic, &result, &branch);
+    }
+    if (statement->u.if_s.else_block) {
+        infer_statement_list(ic, state,
+                             statement->u.if_s.else_block->statement_list);
+    }
+    join_state(ic, &result, state);
+    copy_state(ic, state, &result);
+
+    free_state(&result);
+    free_state(&branch);
+}
+
+static void
+infer_statement(InferContext *ic, TypeState *state, Statement *statement)
+{
+    IdentifierList  *pos;
+    int i;
+
+    if (!state->reachable) {
+        // 死代码已经删除，剩下的执行不到的语句按什么都不知道处理
+        for (i = 0; i < ic->variable_count; i++) {
+            state->types[i] = UNKNOWN_TYPES;
+        }
+        state->reachable = LEN_TRUE;
+    }
+
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            infer_expression(ic, state, statement->u.expression_s);
+            break;
+        case GLOBAL_STATEMENT:
+            // 没有赋值的全局变量执行时报错
+            for (pos = statement->u.global_s.identifier_list; pos;
+                 pos = pos->next) {
+                i = ic->local_count + pos->global_index;
+                if (state->types[i] & ANY_VALUE_TYPES) {
+                    state->types[i] &= ANY_VALUE_TYPES;
+                }
+            }
+            break;
+        case IF_STATEMENT:
+            infer_if_statement(ic, state, statement);
+            break;
+        case WHILE_STATEMENT:
+            infer_loop(ic, state, statement->u.while_s.condition, NULL,
+                       statement->u.while_s.block);
+            break;
+        case FOR_STATEMENT:
+            if (statement->u.for_s.init) {
+                infer_expression(ic, state, statement->u.for_s.init);
+            }
+            infer_loop(ic, state, statement->u.for_s.condition,
+                       statement->u.for_s.post, statement->u.for_s.block);
+            break;
+        case RETURN_STATEMENT:
+            if (statement->u.return_s.return_value) {
+                infer_expression(ic, state,
+                                 statement->u.return_s.return_value);
+            }
+            state->reachable = LEN_FALSE;
+            break;
+        case BREAK_STATEMENT:
+            if (ic->loop) {
+                join_state(ic, &ic->loop->break_state, state);
+            }
+            state->reachable = LEN_FALSE;
+            break;
+        case CONTINUE_STATEMENT:
+            if (ic->loop) {
+                join_state(ic, &ic->loop->continue_state, state);
+            }
+            state->reachable = LEN_FALSE;
+            break;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case...%d", statement->type));
+    }
+}
+
+static void
+infer_statement_list(InferContext *ic, TypeState *state, StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        infer_statement(ic, state, pos->statement);
+    }
+}
+
+/**
+ * 分析一个函数或者顶层语句链
+ * 参数一定已经赋值，其他局部变量一开始还没有赋值，全局变量什么都不知道
+ */
+static void
+infer_block(LEN_Interpreter *inter, int local_count, int parameter_count,
+            StatementList *list)
+{
+    InferContext    ic;
+    TypeState       state;
+    int i;
+
+    ic.local_count = local_count;
+    ic.variable_count = local_count + inter->global_variable.count;
+    ic.loop = NULL;
+
+    alloc_state(&ic, &state);
+    state.reachable = LEN_TRUE;
+    for (i = 0; i < ic.variable_count; i++) {
+        if (i < parameter_count) {
+            state.types[i] = ANY_VALUE_TYPES;
+        } else if (i < local_count) {
+            state.types[i] = type_bit(LEN_UNDEFINED_VALUE);
+        } else {
+            state.types[i] = UNKNOWN_TYPES;
+        }
+    }
+    infer_statement_list(&ic, &state, list);
+    free_state(&state);
+}
+
+/**
+ * 推断函数和顶层语句链中表达式的类型
+ */
+void
+len_infer_types(LEN_Interpreter *inter)
+{
+    FunctionDefinition  *func;
+    ParameterList       *param;
+    int parameter_count;
+
+    if (!(inter->optimize_flags & LEN_OPTIMIZE_INFER))
+        return;
+
+    infer_block(inter, 0, 0, inter->statement_list);
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type != LEMON_FUNCTION_DEFINITION)
+            continue;
+        parameter_count = 0;
+        for (param = func->u.lemon_f.parameter; param; param = param->next) {
+            parameter_count++;
+        }
+        infer_block(inter, func->u.lemon_f.local_variable_count,
+                    parameter_count, func->u.lemon_f.block->statement_list);
+    }
+}
@@ -0,0 +1,498 @@
+//
+//  inline.c
+//  lemon
+//  这个文件在编译结束时把小的用户函数展开到调用的位置
+//  只展开主体是若干global语句、若干只含一条return语句的if/elsif/else和最后一条
+//  return语句，表达式只用到参数和全局变量并且不调用其他函数的函数，
+//  不调用其他函数的函数不会递归，展开之后也不会再出现需要展开的调用。
+//  实参和调用时一样依次求值，赋给调用者新增的临时变量(顶层语句链中是全局变量)，
+//  常量实参直接代入。展开的表达式保留函数中原来的行号，运行时错误的行号不变
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+/**条件和返回值表达式的节点数之和超过这个值时不展开*/
+#define INLINE_SIZE_LIMIT   (16)
+/**if/elsif分支超过这个数量时不展开*/
+#define INLINE_BRANCH_LIMIT (4)
+
+#define is_literal_expression(expr) \
+((expr)->type == INT_EXPRESSION || (expr)->type == DOUBLE_EXPRESSION\
+ || (expr)->type == STRING_EXPRESSION || (expr)->type == BOOLEAN_EXPRESSION\
+ || (expr)->type == NULL_EXPRESSION)
+
+typedef struct {
+    LEN_Interpreter     *inter;
+    /**正在处理的函数，顶层语句链为NULL*/
+    FunctionDefinition  *caller;
+} InlineContext;
+
+/**
+ * 可以展开的函数的主体
+ */
+typedef struct {
+    int         branch_count;
+    Expression  *condition[INLINE_BRANCH_LIMIT];
+    Expression  *value[INLINE_BRANCH_LIMIT];
+    /**条件都不成立时的返回值*/
+    Expression  *body;
+} InlineBody;
+
+static void inline_expression(InlineContext *ic, Expression *expr);
+static void inline_statement_list(InlineContext *ic, StatementList *list);
+
+/**
+ * 表达式的节点数，有不能展开的节点时返回-1
+ * 变量只能是参数和全局变量，其他局部变量在函数中一定还没有赋值，读取时报错
+ */
+static int
+expression_size(Expression *expr, int parameter_count)
+{
+    int left;
+    int right;
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+        case INT_EXPRESSION:        /* FALLTHRU */
+        case DOUBLE_EXPRESSION:     /* FALLTHRU */
+        case STRING_EXPRESSION:     /* FALLTHRU */
+        case NULL_EXPRESSION:
+            return 1;
+        case IDENTIFIER_EXPRESSION:
+            if (expr->u.identifier.slot < parameter_count)
+                return 1;
+            return -1;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            left = expression_size(expr->u.binary_expression.left,
+                                   parameter_count);
+            right = expression_size(expr->u.binary_expression.right,
+                                    parameter_count);
+            if (left < 0 || right < 0)
+                return -1;
+            return left + right + 1;
+        case MINUS_EXPRESSION:
+            left = expression_size(expr->u.minus_expression, parameter_count);
+            return left < 0 ? -1 : left + 1;
+        case BIT_NOT_EXPRESSION:
+            left = expression_size(expr->u.bit_not_expression,
+                                   parameter_count);
+            return left < 0 ? -1 : left + 1;
+        case ASSIGN_EXPRESSION:         /* FALLTHRU */
+        case FUNCTION_CALL_EXPRESSION:  /* FALLTHRU */
+        case INLINE_CALL_EXPRESSION:
+            return -1;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+    return -1;
+}
+
+/**
+ * 代码块只有一条带返回值的return语句时返回它的返回值，否则返回NULL
+ */
+static Expression *
+get_return_value(Block *block)
+{
+    StatementList *list = block->statement_list;
+
+    if (list == NULL || list->next != NULL
+        || list->statement->type != RETURN_STATEMENT)
+        return NULL;
+    return list->statement->u.return_s.return_value;
+}
+
+static LEN_Boolean
+add_branch(InlineBody *ib, Expression *condition, Block *block)
+{
+    Expression *value = get_return_value(block);
+
+    if (value == NULL || ib->branch_count == INLINE_BRANCH_LIMIT)
+        return LEN_FALSE;
+    ib->condition[ib->branch_count] = condition;
+    ib->value[ib->branch_count] = value;
+    ib->branch_count++;
+    return LEN_TRUE;
+}
+
+/**
+ * 可以展开的函数把主体填到ib中，返回LEN_TRUE
+ * global语句只在开头，有else的if语句和最后的return语句一样是函数的结尾
+ */
+static LEN_Boolean
+get_inline_body(FunctionDefinition *func, InlineBody *ib)
+{
+    StatementList   *pos;
+    Statement       *statement;
+    ParameterList   *param_p;
+    Elsif           *elsif;
+    int parameter_count = 0;
+    int total = 0;
+    int size;
+    int i;
+
+    if (func->type != LEMON_FUNCTION_DEFINITION)
+        return LEN_FALSE;
+    ib->branch_count = 0;
+    ib->body = NULL;
+    for (pos = func->u.lemon_f.block->statement_list;
+         pos && pos->statement->type == GLOBAL_STATEMENT; pos = pos->next)
+        ;
+    for (; pos && ib->body == NULL; pos = pos->next) {
+        statement = pos->statement;
+        if (statement->type == RETURN_STATEMENT) {
+            ib->body = statement->u.return_s.return_value;
+            if (ib->body == NULL)
+                return LEN_FALSE;
+            continue;
+        }
+        if (statement->type != IF_STATEMENT
+            || !add_branch(ib, statement->u.if_s.condition,
+                           statement->u.if_s.then_block))
+            return LEN_FALSE;
+        for (elsif = statement->u.if_s.elsif_list; elsif;
+             elsif = elsif->next) {
+            if (!add_branch(ib, elsif->condition, elsif->block))
+                return LEN_FALSE;
+        }
+        if (statement->u.if_s.else_block) {
+            ib->body = get_return_value(statement->u.if_s.else_block);
+            if (ib->body == NULL)
+                return LEN_FALSE;
+        }
+    }
+    if (ib->body == NULL || pos != NULL)
+        return LEN_FALSE;
+    for (param_p = func->u.lemon_f.parameter; param_p;
+         param_p = param_p->next) {
+        parameter_count++;
+    }
+    for (i = 0; i < ib->branch_count; i++) {
+        size = expression_size(ib->condition[i], parameter_count);
+        if (size < 0)
+            return LEN_FALSE;
+        total += size;
+        size = expression_size(ib->value[i], parameter_count);
+        if (size < 0)
+            return LEN_FALSE;
+        total += size;
+    }
+    size = expression_size(ib->body, parameter_count);
+    if (size < 0 || total + size > INLINE_SIZE_LIMIT)
+        return LEN_FALSE;
+
+    return LEN_TRUE;
+}
+
+/**
+ * 复制条件或返回值表达式，参数换成argument中对应的表达式
+ * 复制的节点保留原来的行号，二元运算的特化状态重新开始
+ */
+static Expression *
+copy_body(Expression *expr, Expression **argument)
+{
+    Expression *copy;
+
+    copy = len_alloc_expression(expr->type);
+    *copy = *expr;
+    switch (expr->type) {
+        case IDENTIFIER_EXPRESSION:
+            // 全局变量照原样读取
+            if (expr->u.identifier.slot < 0)
+                break;
+            *copy = *argument[expr->u.identifier.slot];
+            copy->line_number = expr->line_number;
+            break;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            copy->u.binary_expression.left
+            = copy_body(expr->u.binary_expression.left, argument);
+            copy->u.binary_expression.right
+            = copy_body(expr->u.binary_expression.right, argument);
+            copy->u.binary_expression.specialization = BINARY_UNSPECIALIZED;
+            copy->u.binary_expression.deopt_count = 0;
+            copy->u.binary_expression.typed = LEN_FALSE;
+            copy->u.binary_expression.induction_valid = LEN_FALSE;
+            break;
+        case MINUS_EXPRESSION:
+            copy->u.minus_expression
+            = copy_body(expr->u.minus_expression, argument);
+            break;
+        case BIT_NOT_EXPRESSION:
+            copy->u.bit_not_expression
+            = copy_body(expr->u.bit_not_expression, argument);
+            break;
+        default:
+            break;
+    }
+    return copy;
+}
+
+/**
+ * 给实参分配临时变量，返回读取临时变量的表达式
+ * 赋值表达式追加到binding
+ */
+static Expression *
+bind_argument(InlineContext *ic, char *parameter, Expression *arg,
+              ArgumentList **binding, int line_number)
+{
+    Expression  *temp;
+    Expression  *assign;
+    char        *name;
+
+    name = len_create_unique_symbol(ic->inter, parameter);
+    temp = len_create_identifier_expression(name);
+    temp->line_number = line_number;
+    if (ic->caller) {
+        temp->u.identifier.slot
+        = ic->caller->u.lemon_f.local_variable_count++;
+    } else {
+        temp->u.identifier.global_index
+        = len_add_global_variable(ic->inter, name);
+    }
+    assign = len_create_assign_expression(name, arg);
+    assign->line_number = line_number;
+    assign->u.assign_expression.slot = temp->u.identifier.slot;
+    assign->u.assign_expression.global_index
+    = temp->u.identifier.global_index;
+    if (*binding == NULL) {
+        *binding = len_create_argument_list(assign);
+    } else {
+        len_chain_argument_list(*binding, assign);
+    }
+    return temp;
+}
+
+/**
+ * 函数调用改写成展开的函数调用，实参已经处理过
+ */
+static void
+inline_function_call(InlineContext *ic, Expression *expr)
+{
+    FunctionDefinition  *func = expr->u.function_call_expression.function;
+    ParameterList       *param_p;
+    ArgumentList        *arg_p;
+    ArgumentList        *binding = NULL;
+    InlineBranch        *branch = NULL;
+    InlineBranch        *new_branch;
+    InlineBody          ib;
+    Expression          **argument;
+    int count = 0;
+    int i;
+
+    if (!get_inline_body(func, &ib))
+        return;
+    for (param_p = func->u.lemon_f.parameter; param_p;
+         param_p = param_p->next) {
+        count++;
+    }
+    argument = MEM_malloc(sizeof(Expression*) * (count + 1));
+    for (param_p = func->u.lemon_f.parameter,
+         arg_p = expr->u.function_call_expression.argument, i = 0;
+         param_p; param_p = param_p->next, arg_p = arg_p->next, i++) {
+        if (is_literal_expression(arg_p->expression)) {
+            argument[i] = arg_p->expression;
+        } else {
+            argument[i] = bind_argument(ic, param_p->name, arg_p->expression,
+                                        &binding, expr->line_number);
+        }
+    }
+    for (i = ib.branch_count - 1; i >= 0; i--) {
+        new_branch = len_malloc(sizeof(InlineBranch));
+        new_branch->condition = copy_body(ib.condition[i], argument);
+        new_branch->value = copy_body(ib.value[i], argument);
+        new_branch->next = branch;
+        branch = new_branch;
+    }
+    expr->type = INLINE_CALL_EXPRESSION;
+    expr->u.inline_call_expression.binding = binding;
+    expr->u.inline_call_expression.branch = branch;
+    expr->u.inline_call_expression.body = copy_body(ib.body, argument);
+    expr->u.inline_call_expression.function = func;
+    MEM_free(argument);
+}
+
+static void
+inline_expression(InlineContext *ic, Expression *expr)
+{
+    ArgumentList *arg_p;
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+        case INT_EXPRESSION:        /* FALLTHRU */
+        case DOUBLE_EXPRESSION:     /* FALLTHRU */
+        case STRING_EXPRESSION:     /* FALLTHRU */
+        case NULL_EXPRESSION:       /* FALLTHRU */
+        case IDENTIFIER_EXPRESSION:
+            break;
+        case ASSIGN_EXPRESSION:
+            inline_expression(ic, expr->u.assign_expression.operand);
+            break;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            inline_expression(ic, expr->u.binary_expression.left);
+            inline_expression(ic, expr->u.binary_expression.right);
+            break;
+        case MINUS_EXPRESSION:
+            inline_expression(ic, expr->u.minus_expression);
+            break;
+        case BIT_NOT_EXPRESSION:
+            inline_expression(ic, expr->u.bit_not_expression);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            for (arg_p = expr->u.function_call_expression.argument; arg_p;
+                 arg_p = arg_p->next) {
+                inline_expression(ic, arg_p->expression);
+            }
+            inline_function_call(ic, expr);
+            break;
+        case INLINE_CALL_EXPRESSION:    /* FALLTHRU */
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+}
+
+static void
+inline_statement(InlineContext *ic, Statement *statement)
+{
+    Elsif *elsif;
+
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            inline_expression(ic, statement->u.expression_s);
+            break;
+        case IF_STATEMENT:
+            inline_expression(ic, statement->u.if_s.condition);
+            inline_statement_list(ic, statement->u.if_s.then_block
+                                  ->statement_list);
+            for (elsif = statement->u.if_s.elsif_list; elsif;
+                 elsif = elsif->next) {
+                inline_expression(ic, elsif->condition);
+                inline_statement_list(ic, elsif->block->statement_list);
+            }
+            if (statement->u.if_s.else_block) {
+                inline_statement_list(ic, statement->u.if_s.else_block
+                                      ->statement_list);
+            }
+            break;
+        case WHILE_STATEMENT:
+            inline_expression(ic, statement->u.while_s.condition);
+            inline_statement_list(ic, statement->u.while_s.block
+                                  ->statement_list);
+            break;
+        case FOR_STATEMENT:
+            if (statement->u.for_s.init) {
+                inline_expression(ic, statement->u.for_s.init);
+            }
+            if (statement->u.for_s.condition) {
+                inline_expression(ic, statement->u.for_s.condition);
+            }
+            if (statement->u.for_s.post) {
+                inline_expression(ic, statement->u.for_s.post);
+            }
+            inline_statement_list(ic, statement->u.for_s.block
+                                  ->statement_list);
+            break;
+        case RETURN_STATEMENT:
+            if (statement->u.return_s.return_value) {
+                inline_expression(ic, statement->u.return_s.return_value);
+            }
+            break;
+        case GLOBAL_STATEMENT:      /* FALLTHRU */
+        case BREAK_STATEMENT:       /* FALLTHRU */
+        case CONTINUE_STATEMENT:
+            break;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n", statement->type));
+    }
+}
+
+static void
+inline_statement_list(InlineContext *ic, StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        inline_statement(ic, pos->statement);
+    }
+}
+
+/**
+ * 在变量绑定和删除死代码之后调用，临时变量的下标接着已经分配的下标
+ * 展开的函数不调用其他函数，它的主体不会被改写，可以放心复制
+ */
+void
+len_inline_functions(LEN_Interpreter *inter)
+{
+    InlineContext       ic;
+    FunctionDefinition  *func;
+
+    if (!(inter->optimize_flags & LEN_OPTIMIZE_INLINE))
+        return;
+
+    ic.inter = inter;
+    ic.caller = NULL;
+    inline_statement_list(&ic, inter->statement_list);
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type != LEMON_FUNCTION_DEFINITION)
+            continue;
+        ic.caller = func;
+        inline_statement_list(&ic, func->u.lemon_f.block->statement_list);
+    }
+}
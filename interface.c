@@ -6,6 +6,7 @@
 //  Copyright © 2018年 Azure. All rights reserved.
 //
 
+#include <stdint.h>
 #include "MEM.h"
 #include "DBG.h"
 #define GLOBAL_VARIABLE_DEFINE
@@ -26,16 +27,38 @@ LEN_create_interpreter(void)
 {
     MEM_Storage storage;
     LEN_Interpreter *interpreter;
+    int i;
     
     storage = MEM_open_storage(0);
     interpreter = MEM_storage_malloc(storage,
                                      sizeof(struct LEN_Interpreter_tag));
     interpreter->interpreter_storage = storage;
     interpreter->execute_storage = NULL;
-    interpreter->variable = NULL;
+    interpreter->symbol_table.bucket_count = 0;
+    interpreter->symbol_table.bucket = NULL;
+    interpreter->global_variable.count = 0;
+    interpreter->global_variable.alloc_size = 0;
+    interpreter->global_variable.name = NULL;
+    interpreter->global_variable.value = NULL;
+    for (i = 0; i < NATIVE_POINTER_BUCKET_SIZE; i++) {
+        interpreter->native_pointer_bucket[i] = NULL;
+    }
     interpreter->function_list = NULL;
     interpreter->statement_list = NULL;
     interpreter->current_line_number = 1;
+    interpreter->top_level_code = NULL;
+    interpreter->stack.alloc_size = 0;
+    interpreter->stack.stack_pointer = 0;
+    interpreter->stack.stack = NULL;
+    interpreter->frame_chunk = NULL;
+    interpreter->tail_call_function = NULL;
+    interpreter->tail_call_argument = NULL;
+    interpreter->tail_call_argument_count = 0;
+    interpreter->tail_call_argument_size = 0;
+    interpreter->top_level_closure = NULL;
+    interpreter->execute_mode = LEN_EXECUTE_BYTECODE;
+    interpreter->optimize_flags = LEN_OPTIMIZE_ALL;
+    interpreter->jit_code_list = NULL;
     
     len_set_current_interpreter(interpreter);
     add_native_functions(interpreter);
@@ -43,6 +66,18 @@ LEN_create_interpreter(void)
     return interpreter;
 }
 
+void
+LEN_set_execute_mode(LEN_Interpreter *interpreter, LEN_ExecuteMode mode)
+{
+    interpreter->execute_mode = mode;
+}
+
+void
+LEN_set_optimize_flags(LEN_Interpreter *interpreter, int flags)
+{
+    interpreter->optimize_flags = flags;
+}
+
 void
 LEN_compile(LEN_Interpreter *interpreter, FILE *fp)
 {
@@ -58,36 +93,122 @@ LEN_compile(LEN_Interpreter *interpreter, FILE *fp)
         exit(1);
     }
     len_reset_string_literal_buffer();
+    // 给函数的参数和局部变量分配下标，绑定函数调用
+    len_resolve_variables(interpreter);
+    // 分析纯函数，参数都是常量的纯函数调用在编译时求值
+    len_analyze_pure_functions(interpreter);
+    len_fold_pure_calls(interpreter);
+    // 删除执行不到的代码
+    len_eliminate_dead_code(interpreter);
+    // 把小的函数展开到调用的位置
+    len_inline_functions(interpreter);
+    
+    switch (interpreter->execute_mode) {
+        case LEN_EXECUTE_AST:
+            // 推断表达式的类型，确定类型的表达式执行时不再检查类型
+            len_infer_types(interpreter);
+            // 常见的形状融合成一个节点
+            len_fuse_expressions(interpreter);
+            // 识别计数循环，强度削弱计数变量的乘法
+            len_find_counted_loops(interpreter);
+            // if/elsif分支链编译成分派表
+            len_build_dispatch_tables(interpreter);
+            // 标记借用的变量，省掉成对的引用计数操作
+            len_mark_borrowed_operands(interpreter);
+            // 选出按参数缓存结果的纯函数
+            len_select_memo_functions(interpreter);
+            break;
+        case LEN_EXECUTE_BYTECODE:  /* FALLTHRU */
+        case LEN_EXECUTE_JIT:
+            // 将分析树编译成字节码
+            len_generate_code(interpreter);
+            break;
+        case LEN_EXECUTE_CLOSURE:
+            // 将分析树编译成closure
+            len_compile_closure(interpreter);
+            break;
+        default:
+            DBG_panic(("bad case..%d\n", interpreter->execute_mode));
+    }
 }
 
 /**
- * 执行解释器
+ * 准备运行时环境
  */
-void
-LEN_interpret(LEN_Interpreter *interpreter){
+static void
+prepare_execute(LEN_Interpreter *interpreter)
+{
     // 分配运行时需要的内存
     interpreter->execute_storage = MEM_open_storage(0);
     // 注册stdin, stdout, stderr
     len_add_std_fp(interpreter);
-    // 执行语句链，statement_list是一个链表,所以可以按照顺序依次执行
-    len_execute_statement_list(interpreter, NULL, interpreter->statement_list);
 }
 
-static void
-release_global_strings(LEN_Interpreter *interpreter) {
-    while (interpreter->variable) {
-        Variable *temp = interpreter->variable;
-        interpreter->variable = temp->next;
-        if (temp->value.type == LEN_STRING_VALUE) {
-            len_release_string(temp->value.u.string_value);
-        }
+/**
+ * 执行解释器
+ */
+void
+LEN_interpret(LEN_Interpreter *interpreter){
+    StatementResult result;
+    LEN_Value ret;
+    
+    prepare_execute(interpreter);
+    
+    switch (interpreter->execute_mode) {
+        case LEN_EXECUTE_AST:
+            // 执行语句链，statement_list是一个链表,所以可以按照顺序依次执行
+            result = len_execute_statement_list(interpreter, NULL,
+                                                interpreter->statement_list);
+            if (result.type == RETURN_STATEMENT_RESULT) {
+                len_release_if_string(&result.u.return_value);
+            }
+            break;
+        case LEN_EXECUTE_BYTECODE:  /* FALLTHRU */
+        case LEN_EXECUTE_JIT:
+            // 执行顶层语句链编译后的字节码，JIT模式下函数调用时再编译
+            ret = len_execute_bytecode(interpreter, NULL,
+                                       interpreter->top_level_code);
+            len_release_if_string(&ret);
+            break;
+        case LEN_EXECUTE_CLOSURE:
+            ret = len_execute_closure(interpreter, NULL,
+                                      interpreter->top_level_closure);
+            len_release_if_string(&ret);
+            break;
+        default:
+            DBG_panic(("bad case..%d\n", interpreter->execute_mode));
     }
 }
 
+void
+LEN_emit_c(LEN_Interpreter *interpreter, FILE *fp)
+{
+    len_emit_c(interpreter, fp);
+}
+
+/**
+ * 执行--emit-c生成的代码，顶层语句链已经翻译成top_level
+ */
+void
+len_interpret_emitted(LEN_Interpreter *interpreter,
+                      EmittedTopLevelProc *top_level)
+{
+    LEN_Value ret;
+    
+    prepare_execute(interpreter);
+    ret = top_level(interpreter);
+    len_release_if_string(&ret);
+}
+
 void
 LEN_dispose_interpreter(LEN_Interpreter *interpreter)
 {
-    release_global_strings(interpreter);
+    len_dispose_memo_tables(interpreter);
+    len_dispose_global_variable(interpreter);
+    len_dispose_stack(interpreter);
+    len_dispose_frame_stack(interpreter);
+    len_dispose_jit(interpreter);
+    len_dispose_symbol_table(interpreter);
     
     if (interpreter->execute_storage) {
         MEM_dispose_storage(interpreter->execute_storage);
@@ -103,7 +224,7 @@ LEN_add_native_function(LEN_Interpreter *interpreter,
     FunctionDefinition *fd;
     
     fd = len_malloc(sizeof(FunctionDefinition));
-    fd->name = name;
+    fd->name = len_intern_symbol(interpreter, name);
     fd->type = NATIVE_FUNCTION_DEFINITION;
     fd->u.native_f.proc = proc;
     fd->next = interpreter->function_list;
@@ -111,3 +232,75 @@ LEN_add_native_function(LEN_Interpreter *interpreter,
     interpreter->function_list = fd;
 }
 
+
+static NativePointerBox **
+native_pointer_bucket(LEN_Interpreter *inter,
+                      LEN_NativePointerInfo *info, void *pointer)
+{
+    uintptr_t hash = ((uintptr_t)info ^ (uintptr_t)pointer) >> 4;
+    
+    hash ^= hash >> 8;
+    return &inter->native_pointer_bucket[hash
+                                         & (NATIVE_POINTER_BUCKET_SIZE - 1)];
+}
+
+/**
+ * 创建原生指针值，相同的信息和指针只分配一次，随解释器一起释放
+ * LEN_release_native_pointer()释放的原生指针不会重新使用，
+ * 否则旧的变量会指向新打开的文件
+ */
+LEN_Value
+LEN_create_native_pointer(LEN_Interpreter *inter,
+                          LEN_NativePointerInfo *info, void *pointer)
+{
+    LEN_Value value;
+    NativePointerBox **bucket;
+    NativePointerBox *pos;
+    
+    bucket = native_pointer_bucket(inter, info, pointer);
+    for (pos = *bucket; pos; pos = pos->next) {
+        if (pos->native_pointer.info == info
+            && pos->native_pointer.pointer == pointer) {
+            break;
+        }
+    }
+    if (pos == NULL) {
+        pos = MEM_storage_malloc(inter->interpreter_storage,
+                                 sizeof(NativePointerBox));
+        pos->native_pointer.info = info;
+        pos->native_pointer.pointer = pointer;
+        pos->next = *bucket;
+        *bucket = pos;
+    }
+    value.type = LEN_NATIVE_POINTER_VALUE;
+    value.u.native_pointer = &pos->native_pointer;
+    
+    return value;
+}
+
+/**
+ * 指针不再使用时(关闭文件之后)释放原生指针，从散列表中删除
+ * 信息清空后作为"已关闭"的标记一直保留，不会重新使用，
+ * 仍然保存着这个值的变量传给native函数时是类型错误
+ */
+void
+LEN_release_native_pointer(LEN_Interpreter *inter, LEN_Value *value)
+{
+    LEN_NativePointer *native_pointer = value->u.native_pointer;
+    NativePointerBox **pos;
+    NativePointerBox *box;
+    
+    for (pos = native_pointer_bucket(inter, native_pointer->info,
+                                     native_pointer->pointer);
+         *pos; pos = &(*pos)->next) {
+        if (&(*pos)->native_pointer == native_pointer)
+            break;
+    }
+    if (*pos == NULL)
+        return;
+    box = *pos;
+    *pos = box->next;
+    box->native_pointer.info = NULL;
+    box->native_pointer.pointer = NULL;
+    box->next = NULL;
+}
@@ -0,0 +1,1668 @@
+//
+//  jit.c
+//  lemon
+//  这个文件是copy-and-patch方式的基线JIT：
+//  预先汇编好每种指令的机器码模板(stencil)，编译时把模板依次复制到可执行内存，
+//  再把模板里的空位(hole)填上寄存器偏移、立即数和跳转地址
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_AVAILABLE
+#include <sys/mman.h>
+#endif
+
+/**
+ * 函数被调用多少次之后编译成机器码
+ * 编译只是复制模板和填空位，3000个各调用一次的小函数全部编译也测不出时间差，
+ * 而只被调用一次、里面是长循环的函数(比如顶层调用一次的run())
+ * 在阈值为2时一直留在虚拟机里，比第一次调用就编译慢三倍左右，所以取1
+ */
+#define JIT_THRESHOLD       (1)
+#define JIT_BUFFER_ALLOC_SIZE   (256)
+
+/**
+ * 机器码执行时的上下文，生成的代码里r12指向它，rbx指向寄存器窗口
+ */
+typedef struct {
+    LEN_Interpreter     *inter;
+    LocalEnvironment    *env;
+    ByteCode            *code;
+    /**env->local_variable，生成的代码里r13指向它*/
+    LEN_Value           *local_variable;
+    /**寄存器窗口在寄存器栈中的位置*/
+    int                 base;
+    /**返回值所在的寄存器，return null时为-1*/
+    int                 return_register;
+} JitFrame;
+
+typedef void JitEntry(JitFrame *frame, LEN_Value *reg);
+
+/**
+ * JIT生成的机器码
+ */
+typedef struct JitCode_tag {
+    JitEntry            *entry;
+    unsigned char       *memory;
+    size_t              size;
+    struct JitCode_tag  *next;
+} JitCode;
+
+/**
+ * 在寄存器栈顶分配寄存器窗口，执行编译好的机器码
+ */
+static LEN_Value
+run_jit_code(LEN_Interpreter *inter, LocalEnvironment *env, ByteCode *code)
+{
+    JitFrame    frame;
+    LEN_Value   ret;
+
+    len_expand_stack(inter, code->register_count);
+    frame.inter = inter;
+    frame.env = env;
+    frame.code = code;
+    frame.local_variable = env->local_variable;
+    frame.base = inter->stack.stack_pointer;
+    frame.return_register = -1;
+    inter->stack.stack_pointer += code->register_count;
+
+    code->jit_code->entry(&frame, &inter->stack.stack[frame.base]);
+
+    if (frame.return_register < 0) {
+        ret.type = LEN_NULL_VALUE;
+    } else {
+        ret = inter->stack.stack[frame.base + frame.return_register];
+    }
+    inter->stack.stack_pointer = frame.base;
+
+    return ret;
+}
+
+#ifdef JIT_AVAILABLE
+
+/**
+ * 模板中的空位
+ * 寄存器偏移 = 寄存器编号 * sizeof(LEN_Value) + 成员偏移
+ * 变量读写指令的ins->b是变量的下标，在r13或全局变量表上按同样的方法计算偏移
+ */
+typedef enum {
+    HOLE_END = 0,
+    /**ins->a的type和值的偏移*/
+    HOLE_TYPE_A,
+    HOLE_VALUE_A,
+    HOLE_TYPE_B,
+    HOLE_VALUE_B,
+    HOLE_TYPE_C,
+    HOLE_VALUE_C,
+    HOLE_INT_TYPE,
+    HOLE_BOOLEAN_TYPE,
+    HOLE_STRING_TYPE,
+    /**load_immediate写入的类型和值*/
+    HOLE_IMMEDIATE_TYPE,
+    HOLE_IMMEDIATE,
+    /**慢速路径交给jit_execute_instruction()的pc*/
+    HOLE_PC,
+    HOLE_RETURN_REGISTER,
+    HOLE_FRAME_RETURN,
+    /**JitFrame和解释器中成员的偏移*/
+    HOLE_FRAME_LOCAL,
+    HOLE_FRAME_INTER,
+    HOLE_GLOBAL_VALUE,
+    /**jit_execute_instruction()的地址(64位)*/
+    HOLE_HELPER,
+    /**jit_call_function()的地址(64位)*/
+    HOLE_CALL_HELPER,
+    /**跳转目标的相对地址，所有指令排好之后再填*/
+    HOLE_TARGET,
+    /**跳到epilogue的相对地址*/
+    HOLE_EXIT
+} HoleKind;
+
+#define STENCIL_HOLE_MAX    (16)
+
+typedef struct {
+    HoleKind    kind;
+    int         offset;
+} Hole;
+
+typedef struct {
+    int             size;
+    unsigned char   *code;
+    Hole            hole[STENCIL_HOLE_MAX];
+} Stencil;
+
+/*
+ * 以下模板由汇编器生成，空位处是占位用的特殊值。
+ * 慢速路径(slow)调用jit_execute_instruction()，
+ * 它返回新的寄存器窗口地址(寄存器栈可能被扩展)。
+ * r13指向局部变量，局部变量和全局变量的读写只在值不是string、
+ * 变量已经赋值时走快速路径，引用计数和报错都交给慢速路径。
+ */
+
+/*
+ *     push rbx
+ *     push r12
+ *     push r13
+ *     mov r12, rdi
+ *     mov rbx, rsi
+ *     mov r13, [rdi + frame.local_variable]
+ */
+static unsigned char st_prologue_code[] = {
+    0x53, 0x41, 0x54, 0x41, 0x55, 0x49, 0x89, 0xfc, 0x48, 0x89, 0xf3, 0x4c,
+    0x8b, 0xaf, 0x09, 0x0b, 0x0b, 0x0b,
+};
+static Stencil st_prologue = {
+    sizeof(st_prologue_code), st_prologue_code,
+    {
+        {HOLE_FRAME_LOCAL, 14},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     pop r13
+ *     pop r12
+ *     pop rbx
+ *     ret
+ */
+static unsigned char st_epilogue_code[] = {
+    0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3,
+};
+static Stencil st_epilogue = {
+    sizeof(st_epilogue_code), st_epilogue_code,
+    {
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     mov dword ptr [rbx + type(a)], imm_type
+ *     mov qword ptr [rbx + value(a)], imm
+ */
+static unsigned char st_load_immediate_code[] = {
+    0xc7, 0x83, 0x01, 0x0a, 0x0a, 0x0a, 0x03, 0x0b, 0x0b, 0x0b, 0x48, 0xc7,
+    0x83, 0x02, 0x0a, 0x0a, 0x0a, 0x04, 0x0b, 0x0b, 0x0b,
+};
+static Stencil st_load_immediate = {
+    sizeof(st_load_immediate_code), st_load_immediate_code,
+    {
+        {HOLE_TYPE_A, 2},
+        {HOLE_IMMEDIATE_TYPE, 6},
+        {HOLE_VALUE_A, 13},
+        {HOLE_IMMEDIATE, 17},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(b)], LEN_INT_VALUE
+ *     jne slow
+ *     cmp dword ptr [rbx + type(c)], LEN_INT_VALUE
+ *     jne slow
+ *     mov rax, [rbx + value(b)]
+ *     add rax, [rbx + value(c)]
+ *     jo slow
+ *     mov dword ptr [rbx + type(a)], LEN_INT_VALUE
+ *     mov [rbx + value(a)], rax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_add_code[] = {
+    0x81, 0xbb, 0x03, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x2f,
+    0x81, 0xbb, 0x05, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x23,
+    0x48, 0x8b, 0x83, 0x04, 0x0a, 0x0a, 0x0a, 0x48, 0x03, 0x83, 0x06, 0x0a,
+    0x0a, 0x0a, 0x70, 0x13, 0xc7, 0x83, 0x01, 0x0a, 0x0a, 0x0a, 0x01, 0x0b,
+    0x0b, 0x0b, 0x48, 0x89, 0x83, 0x02, 0x0a, 0x0a, 0x0a, 0xeb, 0x17, 0x4c,
+    0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8, 0x01, 0x0c, 0x0c,
+    0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89, 0xc3,
+};
+static Stencil st_add = {
+    sizeof(st_add_code), st_add_code,
+    {
+        {HOLE_TYPE_B, 2},
+        {HOLE_INT_TYPE, 6},
+        {HOLE_TYPE_C, 14},
+        {HOLE_INT_TYPE, 18},
+        {HOLE_VALUE_B, 27},
+        {HOLE_VALUE_C, 34},
+        {HOLE_TYPE_A, 42},
+        {HOLE_INT_TYPE, 46},
+        {HOLE_VALUE_A, 53},
+        {HOLE_PC, 63},
+        {HOLE_HELPER, 69},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(b)], LEN_INT_VALUE
+ *     jne slow
+ *     cmp dword ptr [rbx + type(c)], LEN_INT_VALUE
+ *     jne slow
+ *     mov rax, [rbx + value(b)]
+ *     sub rax, [rbx + value(c)]
+ *     jo slow
+ *     mov dword ptr [rbx + type(a)], LEN_INT_VALUE
+ *     mov [rbx + value(a)], rax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_sub_code[] = {
+    0x81, 0xbb, 0x03, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x2f,
+    0x81, 0xbb, 0x05, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x23,
+    0x48, 0x8b, 0x83, 0x04, 0x0a, 0x0a, 0x0a, 0x48, 0x2b, 0x83, 0x06, 0x0a,
+    0x0a, 0x0a, 0x70, 0x13, 0xc7, 0x83, 0x01, 0x0a, 0x0a, 0x0a, 0x01, 0x0b,
+    0x0b, 0x0b, 0x48, 0x89, 0x83, 0x02, 0x0a, 0x0a, 0x0a, 0xeb, 0x17, 0x4c,
+    0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8, 0x01, 0x0c, 0x0c,
+    0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89, 0xc3,
+};
+static Stencil st_sub = {
+    sizeof(st_sub_code), st_sub_code,
+    {
+        {HOLE_TYPE_B, 2},
+        {HOLE_INT_TYPE, 6},
+        {HOLE_TYPE_C, 14},
+        {HOLE_INT_TYPE, 18},
+        {HOLE_VALUE_B, 27},
+        {HOLE_VALUE_C, 34},
+        {HOLE_TYPE_A, 42},
+        {HOLE_INT_TYPE, 46},
+        {HOLE_VALUE_A, 53},
+        {HOLE_PC, 63},
+        {HOLE_HELPER, 69},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(b)], LEN_INT_VALUE
+ *     jne slow
+ *     cmp dword ptr [rbx + type(c)], LEN_INT_VALUE
+ *     jne slow
+ *     mov rax, [rbx + value(b)]
+ *     imul rax, [rbx + value(c)]
+ *     jo slow
+ *     mov dword ptr [rbx + type(a)], LEN_INT_VALUE
+ *     mov [rbx + value(a)], rax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_mul_code[] = {
+    0x81, 0xbb, 0x03, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x30,
+    0x81, 0xbb, 0x05, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x24,
+    0x48, 0x8b, 0x83, 0x04, 0x0a, 0x0a, 0x0a, 0x48, 0x0f, 0xaf, 0x83, 0x06,
+    0x0a, 0x0a, 0x0a, 0x70, 0x13, 0xc7, 0x83, 0x01, 0x0a, 0x0a, 0x0a, 0x01,
+    0x0b, 0x0b, 0x0b, 0x48, 0x89, 0x83, 0x02, 0x0a, 0x0a, 0x0a, 0xeb, 0x17,
+    0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8, 0x01, 0x0c,
+    0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89, 0xc3,
+};
+static Stencil st_mul = {
+    sizeof(st_mul_code), st_mul_code,
+    {
+        {HOLE_TYPE_B, 2},
+        {HOLE_INT_TYPE, 6},
+        {HOLE_TYPE_C, 14},
+        {HOLE_INT_TYPE, 18},
+        {HOLE_VALUE_B, 27},
+        {HOLE_VALUE_C, 35},
+        {HOLE_TYPE_A, 43},
+        {HOLE_INT_TYPE, 47},
+        {HOLE_VALUE_A, 54},
+        {HOLE_PC, 64},
+        {HOLE_HELPER, 70},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(b)], LEN_INT_VALUE
+ *     jne slow
+ *     cmp dword ptr [rbx + type(c)], LEN_INT_VALUE
+ *     jne slow
+ *     mov rax, [rbx + value(b)]
+ *     and rax, [rbx + value(c)]
+ *     mov dword ptr [rbx + type(a)], LEN_INT_VALUE
+ *     mov [rbx + value(a)], rax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_bit_and_code[] = {
+    0x81, 0xbb, 0x03, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x2d,
+    0x81, 0xbb, 0x05, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x21,
+    0x48, 0x8b, 0x83, 0x04, 0x0a, 0x0a, 0x0a, 0x48, 0x23, 0x83, 0x06, 0x0a,
+    0x0a, 0x0a, 0xc7, 0x83, 0x01, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b,
+    0x48, 0x89, 0x83, 0x02, 0x0a, 0x0a, 0x0a, 0xeb, 0x17, 0x4c, 0x89, 0xe7,
+    0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8, 0x01, 0x0c, 0x0c, 0x0c, 0x0c,
+    0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89, 0xc3,
+};
+static Stencil st_bit_and = {
+    sizeof(st_bit_and_code), st_bit_and_code,
+    {
+        {HOLE_TYPE_B, 2},
+        {HOLE_INT_TYPE, 6},
+        {HOLE_TYPE_C, 14},
+        {HOLE_INT_TYPE, 18},
+        {HOLE_VALUE_B, 27},
+        {HOLE_VALUE_C, 34},
+        {HOLE_TYPE_A, 40},
+        {HOLE_INT_TYPE, 44},
+        {HOLE_VALUE_A, 51},
+        {HOLE_PC, 61},
+        {HOLE_HELPER, 67},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(b)], LEN_INT_VALUE
+ *     jne slow
+ *     cmp dword ptr [rbx + type(c)], LEN_INT_VALUE
+ *     jne slow
+ *     mov rax, [rbx + value(b)]
+ *     or rax, [rbx + value(c)]
+ *     mov dword ptr [rbx + type(a)], LEN_INT_VALUE
+ *     mov [rbx + value(a)], rax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_bit_or_code[] = {
+    0x81, 0xbb, 0x03, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x2d,
+    0x81, 0xbb, 0x05, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x21,
+    0x48, 0x8b, 0x83, 0x04, 0x0a, 0x0a, 0x0a, 0x48, 0x0b, 0x83, 0x06, 0x0a,
+    0x0a, 0x0a, 0xc7, 0x83, 0x01, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b,
+    0x48, 0x89, 0x83, 0x02, 0x0a, 0x0a, 0x0a, 0xeb, 0x17, 0x4c, 0x89, 0xe7,
+    0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8, 0x01, 0x0c, 0x0c, 0x0c, 0x0c,
+    0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89, 0xc3,
+};
+static Stencil st_bit_or = {
+    sizeof(st_bit_or_code), st_bit_or_code,
+    {
+        {HOLE_TYPE_B, 2},
+        {HOLE_INT_TYPE, 6},
+        {HOLE_TYPE_C, 14},
+        {HOLE_INT_TYPE, 18},
+        {HOLE_VALUE_B, 27},
+        {HOLE_VALUE_C, 34},
+        {HOLE_TYPE_A, 40},
+        {HOLE_INT_TYPE, 44},
+        {HOLE_VALUE_A, 51},
+        {HOLE_PC, 61},
+        {HOLE_HELPER, 67},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(b)], LEN_INT_VALUE
+ *     jne slow
+ *     cmp dword ptr [rbx + type(c)], LEN_INT_VALUE
+ *     jne slow
+ *     mov rax, [rbx + value(b)]
+ *     xor rax, [rbx + value(c)]
+ *     mov dword ptr [rbx + type(a)], LEN_INT_VALUE
+ *     mov [rbx + value(a)], rax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_bit_xor_code[] = {
+    0x81, 0xbb, 0x03, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x2d,
+    0x81, 0xbb, 0x05, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x21,
+    0x48, 0x8b, 0x83, 0x04, 0x0a, 0x0a, 0x0a, 0x48, 0x33, 0x83, 0x06, 0x0a,
+    0x0a, 0x0a, 0xc7, 0x83, 0x01, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b,
+    0x48, 0x89, 0x83, 0x02, 0x0a, 0x0a, 0x0a, 0xeb, 0x17, 0x4c, 0x89, 0xe7,
+    0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8, 0x01, 0x0c, 0x0c, 0x0c, 0x0c,
+    0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89, 0xc3,
+};
+static Stencil st_bit_xor = {
+    sizeof(st_bit_xor_code), st_bit_xor_code,
+    {
+        {HOLE_TYPE_B, 2},
+        {HOLE_INT_TYPE, 6},
+        {HOLE_TYPE_C, 14},
+        {HOLE_INT_TYPE, 18},
+        {HOLE_VALUE_B, 27},
+        {HOLE_VALUE_C, 34},
+        {HOLE_TYPE_A, 40},
+        {HOLE_INT_TYPE, 44},
+        {HOLE_VALUE_A, 51},
+        {HOLE_PC, 61},
+        {HOLE_HELPER, 67},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(b)], LEN_INT_VALUE
+ *     jne slow
+ *     cmp dword ptr [rbx + type(c)], LEN_INT_VALUE
+ *     jne slow
+ *     mov rax, [rbx + value(b)]
+ *     cmp rax, [rbx + value(c)]
+ *     sete al
+ *     movzx eax, al
+ *     mov dword ptr [rbx + type(a)], LEN_BOOLEAN_VALUE
+ *     mov [rbx + value(a)], eax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_eq_code[] = {
+    0x81, 0xbb, 0x03, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x32,
+    0x81, 0xbb, 0x05, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x26,
+    0x48, 0x8b, 0x83, 0x04, 0x0a, 0x0a, 0x0a, 0x48, 0x3b, 0x83, 0x06, 0x0a,
+    0x0a, 0x0a, 0x0f, 0x94, 0xc0, 0x0f, 0xb6, 0xc0, 0xc7, 0x83, 0x01, 0x0a,
+    0x0a, 0x0a, 0x02, 0x0b, 0x0b, 0x0b, 0x89, 0x83, 0x02, 0x0a, 0x0a, 0x0a,
+    0xeb, 0x17, 0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8,
+    0x01, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89,
+    0xc3,
+};
+static Stencil st_eq = {
+    sizeof(st_eq_code), st_eq_code,
+    {
+        {HOLE_TYPE_B, 2},
+        {HOLE_INT_TYPE, 6},
+        {HOLE_TYPE_C, 14},
+        {HOLE_INT_TYPE, 18},
+        {HOLE_VALUE_B, 27},
+        {HOLE_VALUE_C, 34},
+        {HOLE_TYPE_A, 46},
+        {HOLE_BOOLEAN_TYPE, 50},
+        {HOLE_VALUE_A, 56},
+        {HOLE_PC, 66},
+        {HOLE_HELPER, 72},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(b)], LEN_INT_VALUE
+ *     jne slow
+ *     cmp dword ptr [rbx + type(c)], LEN_INT_VALUE
+ *     jne slow
+ *     mov rax, [rbx + value(b)]
+ *     cmp rax, [rbx + value(c)]
+ *     setne al
+ *     movzx eax, al
+ *     mov dword ptr [rbx + type(a)], LEN_BOOLEAN_VALUE
+ *     mov [rbx + value(a)], eax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_ne_code[] = {
+    0x81, 0xbb, 0x03, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x32,
+    0x81, 0xbb, 0x05, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x26,
+    0x48, 0x8b, 0x83, 0x04, 0x0a, 0x0a, 0x0a, 0x48, 0x3b, 0x83, 0x06, 0x0a,
+    0x0a, 0x0a, 0x0f, 0x95, 0xc0, 0x0f, 0xb6, 0xc0, 0xc7, 0x83, 0x01, 0x0a,
+    0x0a, 0x0a, 0x02, 0x0b, 0x0b, 0x0b, 0x89, 0x83, 0x02, 0x0a, 0x0a, 0x0a,
+    0xeb, 0x17, 0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8,
+    0x01, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89,
+    0xc3,
+};
+static Stencil st_ne = {
+    sizeof(st_ne_code), st_ne_code,
+    {
+        {HOLE_TYPE_B, 2},
+        {HOLE_INT_TYPE, 6},
+        {HOLE_TYPE_C, 14},
+        {HOLE_INT_TYPE, 18},
+        {HOLE_VALUE_B, 27},
+        {HOLE_VALUE_C, 34},
+        {HOLE_TYPE_A, 46},
+        {HOLE_BOOLEAN_TYPE, 50},
+        {HOLE_VALUE_A, 56},
+        {HOLE_PC, 66},
+        {HOLE_HELPER, 72},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(b)], LEN_INT_VALUE
+ *     jne slow
+ *     cmp dword ptr [rbx + type(c)], LEN_INT_VALUE
+ *     jne slow
+ *     mov rax, [rbx + value(b)]
+ *     cmp rax, [rbx + value(c)]
+ *     setg al
+ *     movzx eax, al
+ *     mov dword ptr [rbx + type(a)], LEN_BOOLEAN_VALUE
+ *     mov [rbx + value(a)], eax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_gt_code[] = {
+    0x81, 0xbb, 0x03, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x32,
+    0x81, 0xbb, 0x05, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x26,
+    0x48, 0x8b, 0x83, 0x04, 0x0a, 0x0a, 0x0a, 0x48, 0x3b, 0x83, 0x06, 0x0a,
+    0x0a, 0x0a, 0x0f, 0x9f, 0xc0, 0x0f, 0xb6, 0xc0, 0xc7, 0x83, 0x01, 0x0a,
+    0x0a, 0x0a, 0x02, 0x0b, 0x0b, 0x0b, 0x89, 0x83, 0x02, 0x0a, 0x0a, 0x0a,
+    0xeb, 0x17, 0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8,
+    0x01, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89,
+    0xc3,
+};
+static Stencil st_gt = {
+    sizeof(st_gt_code), st_gt_code,
+    {
+        {HOLE_TYPE_B, 2},
+        {HOLE_INT_TYPE, 6},
+        {HOLE_TYPE_C, 14},
+        {HOLE_INT_TYPE, 18},
+        {HOLE_VALUE_B, 27},
+        {HOLE_VALUE_C, 34},
+        {HOLE_TYPE_A, 46},
+        {HOLE_BOOLEAN_TYPE, 50},
+        {HOLE_VALUE_A, 56},
+        {HOLE_PC, 66},
+        {HOLE_HELPER, 72},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(b)], LEN_INT_VALUE
+ *     jne slow
+ *     cmp dword ptr [rbx + type(c)], LEN_INT_VALUE
+ *     jne slow
+ *     mov rax, [rbx + value(b)]
+ *     cmp rax, [rbx + value(c)]
+ *     setge al
+ *     movzx eax, al
+ *     mov dword ptr [rbx + type(a)], LEN_BOOLEAN_VALUE
+ *     mov [rbx + value(a)], eax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_ge_code[] = {
+    0x81, 0xbb, 0x03, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x32,
+    0x81, 0xbb, 0x05, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x26,
+    0x48, 0x8b, 0x83, 0x04, 0x0a, 0x0a, 0x0a, 0x48, 0x3b, 0x83, 0x06, 0x0a,
+    0x0a, 0x0a, 0x0f, 0x9d, 0xc0, 0x0f, 0xb6, 0xc0, 0xc7, 0x83, 0x01, 0x0a,
+    0x0a, 0x0a, 0x02, 0x0b, 0x0b, 0x0b, 0x89, 0x83, 0x02, 0x0a, 0x0a, 0x0a,
+    0xeb, 0x17, 0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8,
+    0x01, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89,
+    0xc3,
+};
+static Stencil st_ge = {
+    sizeof(st_ge_code), st_ge_code,
+    {
+        {HOLE_TYPE_B, 2},
+        {HOLE_INT_TYPE, 6},
+        {HOLE_TYPE_C, 14},
+        {HOLE_INT_TYPE, 18},
+        {HOLE_VALUE_B, 27},
+        {HOLE_VALUE_C, 34},
+        {HOLE_TYPE_A, 46},
+        {HOLE_BOOLEAN_TYPE, 50},
+        {HOLE_VALUE_A, 56},
+        {HOLE_PC, 66},
+        {HOLE_HELPER, 72},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(b)], LEN_INT_VALUE
+ *     jne slow
+ *     cmp dword ptr [rbx + type(c)], LEN_INT_VALUE
+ *     jne slow
+ *     mov rax, [rbx + value(b)]
+ *     cmp rax, [rbx + value(c)]
+ *     setl al
+ *     movzx eax, al
+ *     mov dword ptr [rbx + type(a)], LEN_BOOLEAN_VALUE
+ *     mov [rbx + value(a)], eax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_lt_code[] = {
+    0x81, 0xbb, 0x03, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x32,
+    0x81, 0xbb, 0x05, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x26,
+    0x48, 0x8b, 0x83, 0x04, 0x0a, 0x0a, 0x0a, 0x48, 0x3b, 0x83, 0x06, 0x0a,
+    0x0a, 0x0a, 0x0f, 0x9c, 0xc0, 0x0f, 0xb6, 0xc0, 0xc7, 0x83, 0x01, 0x0a,
+    0x0a, 0x0a, 0x02, 0x0b, 0x0b, 0x0b, 0x89, 0x83, 0x02, 0x0a, 0x0a, 0x0a,
+    0xeb, 0x17, 0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8,
+    0x01, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89,
+    0xc3,
+};
+static Stencil st_lt = {
+    sizeof(st_lt_code), st_lt_code,
+    {
+        {HOLE_TYPE_B, 2},
+        {HOLE_INT_TYPE, 6},
+        {HOLE_TYPE_C, 14},
+        {HOLE_INT_TYPE, 18},
+        {HOLE_VALUE_B, 27},
+        {HOLE_VALUE_C, 34},
+        {HOLE_TYPE_A, 46},
+        {HOLE_BOOLEAN_TYPE, 50},
+        {HOLE_VALUE_A, 56},
+        {HOLE_PC, 66},
+        {HOLE_HELPER, 72},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(b)], LEN_INT_VALUE
+ *     jne slow
+ *     cmp dword ptr [rbx + type(c)], LEN_INT_VALUE
+ *     jne slow
+ *     mov rax, [rbx + value(b)]
+ *     cmp rax, [rbx + value(c)]
+ *     setle al
+ *     movzx eax, al
+ *     mov dword ptr [rbx + type(a)], LEN_BOOLEAN_VALUE
+ *     mov [rbx + value(a)], eax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_le_code[] = {
+    0x81, 0xbb, 0x03, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x32,
+    0x81, 0xbb, 0x05, 0x0a, 0x0a, 0x0a, 0x01, 0x0b, 0x0b, 0x0b, 0x75, 0x26,
+    0x48, 0x8b, 0x83, 0x04, 0x0a, 0x0a, 0x0a, 0x48, 0x3b, 0x83, 0x06, 0x0a,
+    0x0a, 0x0a, 0x0f, 0x9e, 0xc0, 0x0f, 0xb6, 0xc0, 0xc7, 0x83, 0x01, 0x0a,
+    0x0a, 0x0a, 0x02, 0x0b, 0x0b, 0x0b, 0x89, 0x83, 0x02, 0x0a, 0x0a, 0x0a,
+    0xeb, 0x17, 0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8,
+    0x01, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89,
+    0xc3,
+};
+static Stencil st_le = {
+    sizeof(st_le_code), st_le_code,
+    {
+        {HOLE_TYPE_B, 2},
+        {HOLE_INT_TYPE, 6},
+        {HOLE_TYPE_C, 14},
+        {HOLE_INT_TYPE, 18},
+        {HOLE_VALUE_B, 27},
+        {HOLE_VALUE_C, 34},
+        {HOLE_TYPE_A, 46},
+        {HOLE_BOOLEAN_TYPE, 50},
+        {HOLE_VALUE_A, 56},
+        {HOLE_PC, 66},
+        {HOLE_HELPER, 72},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(a)], LEN_BOOLEAN_VALUE
+ *     je ok
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * ok:
+ *     cmp dword ptr [rbx + value(a)], 0
+ *     je target
+ */
+static unsigned char st_jump_if_false_code[] = {
+    0x81, 0xbb, 0x01, 0x0a, 0x0a, 0x0a, 0x02, 0x0b, 0x0b, 0x0b, 0x74, 0x17,
+    0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8, 0x01, 0x0c,
+    0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89, 0xc3, 0x83,
+    0xbb, 0x02, 0x0a, 0x0a, 0x0a, 0x00, 0x0f, 0x84, 0x00, 0x00, 0x00, 0x00,
+};
+static Stencil st_jump_if_false = {
+    sizeof(st_jump_if_false_code), st_jump_if_false_code,
+    {
+        {HOLE_TYPE_A, 2},
+        {HOLE_BOOLEAN_TYPE, 6},
+        {HOLE_PC, 16},
+        {HOLE_HELPER, 22},
+        {HOLE_VALUE_A, 37},
+        {HOLE_TARGET, 44},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(a)], LEN_BOOLEAN_VALUE
+ *     je ok
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * ok:
+ *     cmp dword ptr [rbx + value(a)], 0
+ *     jne target
+ */
+static unsigned char st_jump_if_true_code[] = {
+    0x81, 0xbb, 0x01, 0x0a, 0x0a, 0x0a, 0x02, 0x0b, 0x0b, 0x0b, 0x74, 0x17,
+    0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8, 0x01, 0x0c,
+    0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89, 0xc3, 0x83,
+    0xbb, 0x02, 0x0a, 0x0a, 0x0a, 0x00, 0x0f, 0x85, 0x00, 0x00, 0x00, 0x00,
+};
+static Stencil st_jump_if_true = {
+    sizeof(st_jump_if_true_code), st_jump_if_true_code,
+    {
+        {HOLE_TYPE_A, 2},
+        {HOLE_BOOLEAN_TYPE, 6},
+        {HOLE_PC, 16},
+        {HOLE_HELPER, 22},
+        {HOLE_VALUE_A, 37},
+        {HOLE_TARGET, 44},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [rbx + type(a)], LEN_BOOLEAN_VALUE
+ *     je done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_check_boolean_code[] = {
+    0x81, 0xbb, 0x01, 0x0a, 0x0a, 0x0a, 0x02, 0x0b, 0x0b, 0x0b, 0x74, 0x17,
+    0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8, 0x01, 0x0c,
+    0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89, 0xc3,
+};
+static Stencil st_check_boolean = {
+    sizeof(st_check_boolean_code), st_check_boolean_code,
+    {
+        {HOLE_TYPE_A, 2},
+        {HOLE_BOOLEAN_TYPE, 6},
+        {HOLE_PC, 16},
+        {HOLE_HELPER, 22},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     jmp target
+ */
+static unsigned char st_jump_code[] = {
+    0xe9, 0x00, 0x00, 0x00, 0x00,
+};
+static Stencil st_jump = {
+    sizeof(st_jump_code), st_jump_code,
+    {
+        {HOLE_TARGET, 1},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ */
+static unsigned char st_generic_code[] = {
+    0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8, 0x01, 0x0c,
+    0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89, 0xc3,
+};
+static Stencil st_generic = {
+    sizeof(st_generic_code), st_generic_code,
+    {
+        {HOLE_PC, 4},
+        {HOLE_HELPER, 10},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     mov eax, [r13 + type(b)]
+ *     test eax, eax                   ; LEN_UNDEFINED_VALUE
+ *     je slow
+ *     cmp eax, LEN_STRING_VALUE
+ *     je slow
+ *     mov [rbx + type(a)], eax
+ *     mov rax, [r13 + value(b)]
+ *     mov [rbx + value(a)], rax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_load_local_code[] = {
+    0x41, 0x8b, 0x85, 0x03, 0x0a, 0x0a, 0x0a, 0x85, 0xc0, 0x74, 0x1d, 0x3d,
+    0x08, 0x0b, 0x0b, 0x0b, 0x74, 0x16, 0x89, 0x83, 0x01, 0x0a, 0x0a, 0x0a,
+    0x49, 0x8b, 0x85, 0x04, 0x0a, 0x0a, 0x0a, 0x48, 0x89, 0x83, 0x02, 0x0a,
+    0x0a, 0x0a, 0xeb, 0x17, 0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b,
+    0x48, 0xb8, 0x01, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0,
+    0x48, 0x89, 0xc3,
+};
+static Stencil st_load_local = {
+    sizeof(st_load_local_code), st_load_local_code,
+    {
+        {HOLE_TYPE_B, 3},
+        {HOLE_STRING_TYPE, 12},
+        {HOLE_TYPE_A, 20},
+        {HOLE_VALUE_B, 27},
+        {HOLE_VALUE_A, 34},
+        {HOLE_PC, 44},
+        {HOLE_HELPER, 50},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     cmp dword ptr [r13 + type(b)], LEN_STRING_VALUE
+ *     je slow
+ *     mov eax, [rbx + type(a)]
+ *     cmp eax, LEN_STRING_VALUE
+ *     je slow
+ *     mov [r13 + type(b)], eax
+ *     mov rax, [rbx + value(a)]
+ *     mov [r13 + value(b)], rax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_store_local_code[] = {
+    0x41, 0x81, 0xbd, 0x03, 0x0a, 0x0a, 0x0a, 0x08, 0x0b, 0x0b, 0x0b, 0x74,
+    0x24, 0x8b, 0x83, 0x01, 0x0a, 0x0a, 0x0a, 0x3d, 0x08, 0x0b, 0x0b, 0x0b,
+    0x74, 0x17, 0x41, 0x89, 0x85, 0x03, 0x0a, 0x0a, 0x0a, 0x48, 0x8b, 0x83,
+    0x02, 0x0a, 0x0a, 0x0a, 0x49, 0x89, 0x85, 0x04, 0x0a, 0x0a, 0x0a, 0xeb,
+    0x17, 0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8, 0x01,
+    0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89, 0xc3,
+};
+static Stencil st_store_local = {
+    sizeof(st_store_local_code), st_store_local_code,
+    {
+        {HOLE_TYPE_B, 3},
+        {HOLE_STRING_TYPE, 7},
+        {HOLE_TYPE_A, 15},
+        {HOLE_STRING_TYPE, 20},
+        {HOLE_TYPE_B, 29},
+        {HOLE_VALUE_A, 36},
+        {HOLE_VALUE_B, 43},
+        {HOLE_PC, 53},
+        {HOLE_HELPER, 59},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     mov rax, [r12 + frame.inter]
+ *     mov rax, [rax + inter.global_variable.value]
+ *     mov ecx, [rax + type(b)]
+ *     test ecx, ecx                   ; LEN_UNDEFINED_VALUE
+ *     je slow
+ *     cmp ecx, LEN_STRING_VALUE
+ *     je slow
+ *     mov [rbx + type(a)], ecx
+ *     mov rax, [rax + value(b)]
+ *     mov [rbx + value(a)], rax
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_load_global_code[] = {
+    0x49, 0x8b, 0x84, 0x24, 0x0c, 0x0b, 0x0b, 0x0b, 0x48, 0x8b, 0x80, 0x0d,
+    0x0b, 0x0b, 0x0b, 0x8b, 0x88, 0x03, 0x0a, 0x0a, 0x0a, 0x85, 0xc9, 0x74,
+    0x1e, 0x81, 0xf9, 0x08, 0x0b, 0x0b, 0x0b, 0x74, 0x16, 0x89, 0x8b, 0x01,
+    0x0a, 0x0a, 0x0a, 0x48, 0x8b, 0x80, 0x04, 0x0a, 0x0a, 0x0a, 0x48, 0x89,
+    0x83, 0x02, 0x0a, 0x0a, 0x0a, 0xeb, 0x17, 0x4c, 0x89, 0xe7, 0xbe, 0x05,
+    0x0b, 0x0b, 0x0b, 0x48, 0xb8, 0x01, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c,
+    0x0c, 0xff, 0xd0, 0x48, 0x89, 0xc3,
+};
+static Stencil st_load_global = {
+    sizeof(st_load_global_code), st_load_global_code,
+    {
+        {HOLE_FRAME_INTER, 4},
+        {HOLE_GLOBAL_VALUE, 11},
+        {HOLE_TYPE_B, 17},
+        {HOLE_STRING_TYPE, 27},
+        {HOLE_TYPE_A, 35},
+        {HOLE_VALUE_B, 42},
+        {HOLE_VALUE_A, 49},
+        {HOLE_PC, 59},
+        {HOLE_HELPER, 65},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     mov rax, [r12 + frame.inter]
+ *     mov rax, [rax + inter.global_variable.value]
+ *     cmp dword ptr [rax + type(b)], LEN_STRING_VALUE
+ *     je slow
+ *     mov ecx, [rbx + type(a)]
+ *     cmp ecx, LEN_STRING_VALUE
+ *     je slow
+ *     mov [rax + type(b)], ecx
+ *     mov rcx, [rbx + value(a)]
+ *     mov [rax + value(b)], rcx
+ *     jmp done
+ * slow:
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_execute_instruction
+ *     call rax
+ *     mov rbx, rax
+ * done:
+ */
+static unsigned char st_store_global_code[] = {
+    0x49, 0x8b, 0x84, 0x24, 0x0c, 0x0b, 0x0b, 0x0b, 0x48, 0x8b, 0x80, 0x0d,
+    0x0b, 0x0b, 0x0b, 0x81, 0xb8, 0x03, 0x0a, 0x0a, 0x0a, 0x08, 0x0b, 0x0b,
+    0x0b, 0x74, 0x24, 0x8b, 0x8b, 0x01, 0x0a, 0x0a, 0x0a, 0x81, 0xf9, 0x08,
+    0x0b, 0x0b, 0x0b, 0x74, 0x16, 0x89, 0x88, 0x03, 0x0a, 0x0a, 0x0a, 0x48,
+    0x8b, 0x8b, 0x02, 0x0a, 0x0a, 0x0a, 0x48, 0x89, 0x88, 0x04, 0x0a, 0x0a,
+    0x0a, 0xeb, 0x17, 0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48,
+    0xb8, 0x01, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48,
+    0x89, 0xc3,
+};
+static Stencil st_store_global = {
+    sizeof(st_store_global_code), st_store_global_code,
+    {
+        {HOLE_FRAME_INTER, 4},
+        {HOLE_GLOBAL_VALUE, 11},
+        {HOLE_TYPE_B, 17},
+        {HOLE_STRING_TYPE, 21},
+        {HOLE_TYPE_A, 29},
+        {HOLE_STRING_TYPE, 35},
+        {HOLE_TYPE_B, 43},
+        {HOLE_VALUE_A, 50},
+        {HOLE_VALUE_B, 57},
+        {HOLE_PC, 67},
+        {HOLE_HELPER, 73},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     mov rdi, r12
+ *     mov esi, pc
+ *     movabs rax, jit_call_function
+ *     call rax
+ *     mov rbx, rax
+ */
+static unsigned char st_call_code[] = {
+    0x4c, 0x89, 0xe7, 0xbe, 0x05, 0x0b, 0x0b, 0x0b, 0x48, 0xb8, 0x02, 0x0c,
+    0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0xff, 0xd0, 0x48, 0x89, 0xc3,
+};
+static Stencil st_call = {
+    sizeof(st_call_code), st_call_code,
+    {
+        {HOLE_PC, 4},
+        {HOLE_CALL_HELPER, 10},
+        {HOLE_END, 0}
+    }
+};
+
+/*
+ *     mov dword ptr [r12 + frame.return_register], return_reg
+ *     jmp epilogue
+ */
+static unsigned char st_return_code[] = {
+    0x41, 0xc7, 0x84, 0x24, 0x07, 0x0b, 0x0b, 0x0b, 0x06, 0x0b, 0x0b, 0x0b,
+    0xe9, 0x00, 0x00, 0x00, 0x00,
+};
+static Stencil st_return = {
+    sizeof(st_return_code), st_return_code,
+    {
+        {HOLE_FRAME_RETURN, 4},
+        {HOLE_RETURN_REGISTER, 8},
+        {HOLE_EXIT, 13},
+        {HOLE_END, 0}
+    }
+};
+
+/**
+ * 跳转地址的修正，所有指令的位置确定之后再填
+ */
+typedef struct {
+    int     offset;
+    /**跳转目标的pc，-1表示epilogue*/
+    int     target_pc;
+} JumpFixup;
+
+typedef struct {
+    int             size;
+    int             alloc_size;
+    unsigned char   *code;
+    int             fixup_count;
+    int             fixup_alloc_size;
+    JumpFixup       *fixup;
+} JitBuffer;
+
+static void
+check_boolean(LEN_Value *v, int line_number)
+{
+    if (v->type != LEN_BOOLEAN_VALUE) {
+        len_runtime_error(line_number, NOT_BOOLEAN_TYPE_ERR,
+                          MESSAGE_ARGUMENT_END);
+    }
+}
+
+static ExpressionType
+opcode_to_expression_type(OpCode opcode)
+{
+    switch (opcode) {
+        case OP_ADD:
+            return ADD_EXPRESSION;
+        case OP_SUB:
+            return SUB_EXPRESSION;
+        case OP_MUL:
+            return MUL_EXPRESSION;
+        case OP_DIV:
+            return DIV_EXPRESSION;
+        case OP_MOD:
+            return MOD_EXPRESSION;
+        case OP_EQ:
+            return EQ_EXPRESSION;
+        case OP_NE:
+            return NE_EXPRESSION;
+        case OP_GT:
+            return GT_EXPRESSION;
+        case OP_GE:
+            return GE_EXPRESSION;
+        case OP_LT:
+            return LT_EXPRESSION;
+        case OP_LE:
+            return LE_EXPRESSION;
+        case OP_BIT_AND:
+            return BIT_AND_EXPRESSION;
+        case OP_BIT_OR:
+            return BIT_OR_EXPRESSION;
+        case OP_BIT_XOR:
+            return BIT_XOR_EXPRESSION;
+        case OP_LEFT_SHIFT:
+            return LEFT_SHIFT_EXPRESSION;
+        case OP_RIGHT_SHIFT:
+            return RIGHT_SHIFT_EXPRESSION;
+        default:
+            DBG_panic(("bad opcode..%d\n", opcode));
+    }
+    return ADD_EXPRESSION;
+}
+
+/**
+ * 机器码的慢速路径，执行pc处的一条指令
+ * 返回寄存器窗口的新地址
+ */
+static LEN_Value *
+jit_execute_instruction(JitFrame *frame, int pc)
+{
+    LEN_Interpreter *inter = frame->inter;
+    ByteCode        *code = frame->code;
+    Instruction     *ins = &code->code[pc];
+    LEN_Value       *reg = &inter->stack.stack[frame->base];
+    LEN_Value       ret;
+
+    switch (ins->opcode) {
+        case OP_LOAD_CONSTANT:
+            reg[ins->a] = code->constant[ins->b];
+            break;
+        case OP_LOAD_GLOBAL:
+            reg[ins->a] = len_get_global_variable_value(inter, ins->b,
+                                                        code->line_number[pc]);
+            break;
+        case OP_STORE_GLOBAL:
+            len_assign_global_variable(inter, ins->b, &reg[ins->a]);
+            break;
+        case OP_LOAD_LOCAL:
+            reg[ins->a] = len_get_local_variable_value(frame->env, ins->b,
+                                                       code->name[ins->c],
+                                                       code->line_number[pc]);
+            break;
+        case OP_STORE_LOCAL:
+            len_assign_local_variable(frame->env, ins->b, &reg[ins->a]);
+            break;
+        case OP_ADD:    /* FALLTHRU */
+        case OP_SUB:    /* FALLTHRU */
+        case OP_MUL:    /* FALLTHRU */
+        case OP_DIV:    /* FALLTHRU */
+        case OP_MOD:    /* FALLTHRU */
+        case OP_EQ:     /* FALLTHRU */
+        case OP_NE:     /* FALLTHRU */
+        case OP_GT:     /* FALLTHRU */
+        case OP_GE:     /* FALLTHRU */
+        case OP_LT:     /* FALLTHRU */
+        case OP_LE:     /* FALLTHRU */
+        case OP_BIT_AND:        /* FALLTHRU */
+        case OP_BIT_OR:         /* FALLTHRU */
+        case OP_BIT_XOR:        /* FALLTHRU */
+        case OP_LEFT_SHIFT:     /* FALLTHRU */
+        case OP_RIGHT_SHIFT:
+            reg[ins->a]
+            = len_eval_binary_values(inter,
+                                     opcode_to_expression_type(ins->opcode),
+                                     &reg[ins->b], &reg[ins->c],
+                                     code->line_number[pc]);
+            break;
+        case OP_MINUS:
+            reg[ins->a] = len_eval_minus_value(inter, &reg[ins->b],
+                                               code->line_number[pc]);
+            break;
+        case OP_BIT_NOT:
+            reg[ins->a] = len_eval_bit_not_value(inter, &reg[ins->b],
+                                                 code->line_number[pc]);
+            break;
+        case OP_CHECK_BOOLEAN:      /* FALLTHRU */
+        case OP_JUMP_IF_FALSE:      /* FALLTHRU */
+        case OP_JUMP_IF_TRUE:
+            check_boolean(&reg[ins->a], code->line_number[pc]);
+            break;
+        case OP_CALL:
+            ret = len_vm_call_function(inter, code->function[ins->b],
+                                       ins->c, &reg[ins->a]);
+            reg = &inter->stack.stack[frame->base];
+            reg[ins->a] = ret;
+            break;
+        case OP_TAIL_CALL:
+            // 接下来的OP_RETURN退出机器码，由len_vm_call_function()调用
+            len_set_tail_call(inter, code->function[ins->b], ins->c,
+                              &reg[ins->a]);
+            break;
+        case OP_POP:
+            len_release_if_string(&reg[ins->a]);
+            break;
+        case OP_COPY:
+            reg[ins->a] = reg[ins->b];
+            len_refer_if_string(&reg[ins->a]);
+            break;
+        case OP_SAVE:
+            len_release_if_string(&reg[ins->a]);
+            reg[ins->a] = reg[ins->b];
+            len_refer_if_string(&reg[ins->a]);
+            break;
+        case OP_GLOBAL:
+            len_declare_global_variable(inter, frame->env, ins->b,
+                                        code->line_number[pc]);
+            break;
+        default:
+            DBG_panic(("bad opcode..%d\n", ins->opcode));
+    }
+
+    return reg;
+}
+
+/**
+ * 机器码中的函数调用
+ * 被调用的函数已经编译成机器码时直接执行，省去len_vm_call_function()的分派，
+ * 其他情况和慢速路径一样交给len_vm_call_function()
+ */
+static LEN_Value *
+jit_call_function(JitFrame *frame, int pc)
+{
+    LEN_Interpreter     *inter = frame->inter;
+    Instruction         *ins = &frame->code->code[pc];
+    FunctionDefinition  *func = frame->code->function[ins->b];
+    LEN_Value           *reg = &inter->stack.stack[frame->base];
+    LocalEnvironment    *local_env;
+    LEN_Value           ret;
+
+    if (func->type == LEMON_FUNCTION_DEFINITION
+        && func->u.lemon_f.code->jit_code != NULL) {
+        local_env = len_create_function_environment(inter, func, ins->c,
+                                                    &reg[ins->a]);
+        ret = run_jit_code(inter, local_env, func->u.lemon_f.code);
+        len_dispose_local_environment(inter, local_env);
+        if (inter->tail_call_function != NULL) {
+            // 尾调用的循环交给len_vm_call_function()
+            func = inter->tail_call_function;
+            inter->tail_call_function = NULL;
+            ret = len_vm_call_function(inter, func,
+                                       inter->tail_call_argument_count,
+                                       inter->tail_call_argument);
+        }
+    } else {
+        ret = len_vm_call_function(inter, func, ins->c, &reg[ins->a]);
+    }
+    reg = &inter->stack.stack[frame->base];
+    reg[ins->a] = ret;
+
+    return reg;
+}
+
+static void
+put_int32(unsigned char *dest, int value)
+{
+    memcpy(dest, &value, sizeof(int));
+}
+
+static int
+register_offset(int reg, size_t member)
+{
+    return (int)(reg * sizeof(LEN_Value) + member);
+}
+
+static void
+add_fixup(JitBuffer *buf, int offset, int target_pc)
+{
+    if (buf->fixup_count >= buf->fixup_alloc_size) {
+        buf->fixup_alloc_size += JIT_BUFFER_ALLOC_SIZE;
+        buf->fixup = MEM_realloc(buf->fixup,
+                                 sizeof(JumpFixup) * buf->fixup_alloc_size);
+    }
+    buf->fixup[buf->fixup_count].offset = offset;
+    buf->fixup[buf->fixup_count].target_pc = target_pc;
+    buf->fixup_count++;
+}
+
+/**
+ * 复制模板，然后填空位
+ * immediate_type和immediate只有load_immediate用到
+ */
+static void
+emit_stencil(JitBuffer *buf, Stencil *st, Instruction *ins, int pc,
+             int immediate_type, int immediate)
+{
+    unsigned char   *dest;
+    uintptr_t       helper;
+    int i;
+
+    if (buf->size + st->size > buf->alloc_size) {
+        buf->alloc_size = buf->size + st->size + JIT_BUFFER_ALLOC_SIZE;
+        buf->code = MEM_realloc(buf->code, buf->alloc_size);
+    }
+    dest = &buf->code[buf->size];
+    memcpy(dest, st->code, st->size);
+
+    for (i = 0; st->hole[i].kind != HOLE_END; i++) {
+        unsigned char *hole = dest + st->hole[i].offset;
+
+        switch (st->hole[i].kind) {
+            case HOLE_TYPE_A:
+                put_int32(hole, register_offset(ins->a,
+                                                offsetof(LEN_Value, type)));
+                break;
+            case HOLE_VALUE_A:
+                put_int32(hole, register_offset(ins->a,
+                                                offsetof(LEN_Value, u)));
+                break;
+            case HOLE_TYPE_B:
+                put_int32(hole, register_offset(ins->b,
+                                                offsetof(LEN_Value, type)));
+                break;
+            case HOLE_VALUE_B:
+                put_int32(hole, register_offset(ins->b,
+                                                offsetof(LEN_Value, u)));
+                break;
+            case HOLE_TYPE_C:
+                put_int32(hole, register_offset(ins->c,
+                                                offsetof(LEN_Value, type)));
+                break;
+            case HOLE_VALUE_C:
+                put_int32(hole, register_offset(ins->c,
+                                                offsetof(LEN_Value, u)));
+                break;
+            case HOLE_INT_TYPE:
+                put_int32(hole, LEN_INT_VALUE);
+                break;
+            case HOLE_BOOLEAN_TYPE:
+                put_int32(hole, LEN_BOOLEAN_VALUE);
+                break;
+            case HOLE_STRING_TYPE:
+                put_int32(hole, LEN_STRING_VALUE);
+                break;
+            case HOLE_IMMEDIATE_TYPE:
+                put_int32(hole, immediate_type);
+                break;
+            case HOLE_IMMEDIATE:
+                put_int32(hole, immediate);
+                break;
+            case HOLE_PC:
+                put_int32(hole, pc);
+                break;
+            case HOLE_RETURN_REGISTER:
+                put_int32(hole, ins->opcode == OP_RETURN ? ins->a : -1);
+                break;
+            case HOLE_FRAME_RETURN:
+                put_int32(hole, (int)offsetof(JitFrame, return_register));
+                break;
+            case HOLE_FRAME_LOCAL:
+                put_int32(hole, (int)offsetof(JitFrame, local_variable));
+                break;
+            case HOLE_FRAME_INTER:
+                put_int32(hole, (int)offsetof(JitFrame, inter));
+                break;
+            case HOLE_GLOBAL_VALUE:
+                put_int32(hole, (int)(offsetof(LEN_Interpreter,
+                                               global_variable)
+                                      + offsetof(GlobalVariableTable,
+                                                 value)));
+                break;
+            case HOLE_HELPER:
+                helper = (uintptr_t)jit_execute_instruction;
+                memcpy(hole, &helper, sizeof(helper));
+                break;
+            case HOLE_CALL_HELPER:
+                helper = (uintptr_t)jit_call_function;
+                memcpy(hole, &helper, sizeof(helper));
+                break;
+            case HOLE_TARGET:
+                add_fixup(buf, buf->size + st->hole[i].offset,
+                          dkc_jump_target(ins));
+                break;
+            case HOLE_EXIT:
+                add_fixup(buf, buf->size + st->hole[i].offset, -1);
+                break;
+            case HOLE_END:  /* FALLTHRU */
+            default:
+                DBG_panic(("bad case..%d\n", st->hole[i].kind));
+        }
+    }
+    buf->size += st->size;
+}
+
+static void
+emit_instruction(JitBuffer *buf, ByteCode *code, int pc)
+{
+    Instruction *ins = &code->code[pc];
+    LEN_Value   *constant;
+
+    switch (ins->opcode) {
+        case OP_LOAD_NULL:
+            emit_stencil(buf, &st_load_immediate, ins, pc,
+                         LEN_NULL_VALUE, 0);
+            break;
+        case OP_LOAD_BOOLEAN:
+            emit_stencil(buf, &st_load_immediate, ins, pc,
+                         LEN_BOOLEAN_VALUE, ins->b);
+            break;
+        case OP_LOAD_CONSTANT:
+            constant = &code->constant[ins->b];
+            if (constant->type == LEN_INT_VALUE
+                && constant->u.int_value >= INT32_MIN
+                && constant->u.int_value <= INT32_MAX) {
+                // 立即数按符号扩展成64位
+                emit_stencil(buf, &st_load_immediate, ins, pc,
+                             LEN_INT_VALUE, (int)constant->u.int_value);
+            } else {
+                emit_stencil(buf, &st_generic, ins, pc, 0, 0);
+            }
+            break;
+        case OP_ADD:
+            emit_stencil(buf, &st_add, ins, pc, 0, 0);
+            break;
+        case OP_SUB:
+            emit_stencil(buf, &st_sub, ins, pc, 0, 0);
+            break;
+        case OP_MUL:
+            emit_stencil(buf, &st_mul, ins, pc, 0, 0);
+            break;
+        case OP_BIT_AND:
+            emit_stencil(buf, &st_bit_and, ins, pc, 0, 0);
+            break;
+        case OP_BIT_OR:
+            emit_stencil(buf, &st_bit_or, ins, pc, 0, 0);
+            break;
+        case OP_BIT_XOR:
+            emit_stencil(buf, &st_bit_xor, ins, pc, 0, 0);
+            break;
+        case OP_EQ:
+            emit_stencil(buf, &st_eq, ins, pc, 0, 0);
+            break;
+        case OP_NE:
+            emit_stencil(buf, &st_ne, ins, pc, 0, 0);
+            break;
+        case OP_GT:
+            emit_stencil(buf, &st_gt, ins, pc, 0, 0);
+            break;
+        case OP_GE:
+            emit_stencil(buf, &st_ge, ins, pc, 0, 0);
+            break;
+        case OP_LT:
+            emit_stencil(buf, &st_lt, ins, pc, 0, 0);
+            break;
+        case OP_LE:
+            emit_stencil(buf, &st_le, ins, pc, 0, 0);
+            break;
+        case OP_CHECK_BOOLEAN:
+            emit_stencil(buf, &st_check_boolean, ins, pc, 0, 0);
+            break;
+        case OP_JUMP:
+            emit_stencil(buf, &st_jump, ins, pc, 0, 0);
+            break;
+        case OP_JUMP_IF_FALSE:
+            emit_stencil(buf, &st_jump_if_false, ins, pc, 0, 0);
+            break;
+        case OP_JUMP_IF_TRUE:
+            emit_stencil(buf, &st_jump_if_true, ins, pc, 0, 0);
+            break;
+        case OP_RETURN:         /* FALLTHRU */
+        case OP_RETURN_NULL:
+            emit_stencil(buf, &st_return, ins, pc, 0, 0);
+            break;
+        case OP_LOAD_LOCAL:
+            emit_stencil(buf, &st_load_local, ins, pc, 0, 0);
+            break;
+        case OP_STORE_LOCAL:
+            emit_stencil(buf, &st_store_local, ins, pc, 0, 0);
+            break;
+        case OP_LOAD_GLOBAL:
+            emit_stencil(buf, &st_load_global, ins, pc, 0, 0);
+            break;
+        case OP_STORE_GLOBAL:
+            emit_stencil(buf, &st_store_global, ins, pc, 0, 0);
+            break;
+        case OP_CALL:
+            emit_stencil(buf, &st_call, ins, pc, 0, 0);
+            break;
+        case OP_DIV:            /* FALLTHRU */
+        case OP_MOD:            /* FALLTHRU */
+        case OP_LEFT_SHIFT:     /* FALLTHRU */
+        case OP_RIGHT_SHIFT:    /* FALLTHRU */
+        case OP_MINUS:          /* FALLTHRU */
+        case OP_BIT_NOT:        /* FALLTHRU */
+        case OP_TAIL_CALL:      /* FALLTHRU */
+        case OP_POP:            /* FALLTHRU */
+        case OP_COPY:           /* FALLTHRU */
+        case OP_SAVE:           /* FALLTHRU */
+        case OP_GLOBAL:
+            emit_stencil(buf, &st_generic, ins, pc, 0, 0);
+            break;
+        case OP_CODE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad opcode..%d\n", ins->opcode));
+    }
+}
+
+/**
+ * 把字节码编译成机器码，不能编译时返回NULL
+ */
+static JitCode *
+compile_function(LEN_Interpreter *inter, ByteCode *code)
+{
+    JitBuffer       buf;
+    JitCode         *jit;
+    unsigned char   *memory;
+    int             *native_offset;
+    int             epilogue_offset;
+    int             target;
+    int pc;
+    int i;
+
+    buf.size = 0;
+    buf.alloc_size = 0;
+    buf.code = NULL;
+    buf.fixup_count = 0;
+    buf.fixup_alloc_size = 0;
+    buf.fixup = NULL;
+    native_offset = MEM_malloc(sizeof(int) * code->code_size);
+
+    emit_stencil(&buf, &st_prologue, NULL, 0, 0, 0);
+    for (pc = 0; pc < code->code_size; pc++) {
+        native_offset[pc] = buf.size;
+        emit_instruction(&buf, code, pc);
+    }
+    epilogue_offset = buf.size;
+    emit_stencil(&buf, &st_epilogue, NULL, 0, 0, 0);
+
+    for (i = 0; i < buf.fixup_count; i++) {
+        if (buf.fixup[i].target_pc < 0) {
+            target = epilogue_offset;
+        } else {
+            target = native_offset[buf.fixup[i].target_pc];
+        }
+        put_int32(&buf.code[buf.fixup[i].offset],
+                  target - (buf.fixup[i].offset + (int)sizeof(int)));
+    }
+    MEM_free(native_offset);
+    MEM_free(buf.fixup);
+
+    memory = mmap(NULL, buf.size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        MEM_free(buf.code);
+        return NULL;
+    }
+    memcpy(memory, buf.code, buf.size);
+    MEM_free(buf.code);
+    if (mprotect(memory, buf.size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, buf.size);
+        return NULL;
+    }
+
+    jit = MEM_malloc(sizeof(JitCode));
+    jit->entry = (JitEntry *)(uintptr_t)memory;
+    jit->memory = memory;
+    jit->size = buf.size;
+    jit->next = inter->jit_code_list;
+    inter->jit_code_list = jit;
+
+    return jit;
+}
+
+#else /* JIT_AVAILABLE */
+
+/**
+ * 不是x86-64 Linux时不编译，一直交给虚拟机
+ */
+static JitCode *
+compile_function(LEN_Interpreter *inter, ByteCode *code)
+{
+    return NULL;
+}
+
+#endif /* JIT_AVAILABLE */
+
+LEN_Value
+len_execute_jit(LEN_Interpreter *inter, LocalEnvironment *env,
+                ByteCode *code)
+{
+    if (code->jit_code == NULL && !code->jit_failed) {
+        code->call_count++;
+        if (code->call_count >= JIT_THRESHOLD) {
+            code->jit_code = compile_function(inter, code);
+            if (code->jit_code == NULL) {
+                code->jit_failed = LEN_TRUE;
+            }
+        }
+    }
+    if (code->jit_code == NULL) {
+        return len_execute_bytecode(inter, env, code);
+    }
+
+    return run_jit_code(inter, env, code);
+}
+
+void
+len_dispose_jit(LEN_Interpreter *inter)
+{
+    JitCode *jit;
+
+    while (inter->jit_code_list) {
+        jit = inter->jit_code_list;
+        inter->jit_code_list = jit->next;
+#ifdef JIT_AVAILABLE
+        munmap(jit->memory, jit->size);
+#endif
+        MEM_free(jit);
+    }
+}
@@ -9,6 +9,7 @@
 #ifndef lemon_h
 #define lemon_h
 
+#include <limits.h>
 #include "MEM.h"
 #include "LEN.h"
 #include "LEN_dev.h"
@@ -18,6 +19,8 @@
 
 #define MESSAGE_ARGUMENT_MAX    (256)
 #define LINE_BUF_SIZE           (1024)
+/**不展开到调用者中的函数，大的局部数组不会占用递归求值的栈*/
+#define LEN_NOINLINE            __attribute__((noinline))
 
 /********************************** 开始错误信息定义 *****************************/
 
@@ -26,6 +29,9 @@ typedef enum {
     PARSE_ERR = 1,
     CHARACTER_INVALID_ERR,
     FUNCTION_MULTIPLE_DEFINE_ERR,
+    FUNCTION_NOT_DEFINED_ERR,
+    ARGUMENT_COUNT_MISMATCH_ERR,
+    OPERAND_TOO_LARGE_ERR,
     COMPILE_ERROR_COUNT_PLUS_1
 } CompileError;
 
@@ -48,6 +54,8 @@ typedef enum {
     GLOBAL_VARIABLE_NOT_FOUND_ERR,
     GLOBAL_STATEMENT_IN_TOPLEVEL_ERR,
     BAD_OPERATOR_FOR_STRING_ERR,
+    INTEGER_OVERFLOW_ERR,
+    BIT_NOT_OPERAND_TYPE_ERR,
     RUNTIME_ERROR_COUNT_PLUS_1
 } RuntimeError;
 
@@ -115,9 +123,17 @@ typedef enum {
     LE_EXPRESSION,
     LOGICAL_AND_EXPRESSION,
     LOGICAL_OR_EXPRESSION,
+    BIT_AND_EXPRESSION,
+    BIT_OR_EXPRESSION,
+    BIT_XOR_EXPRESSION,
+    LEFT_SHIFT_EXPRESSION,
+    RIGHT_SHIFT_EXPRESSION,
     MINUS_EXPRESSION,
+    BIT_NOT_EXPRESSION,
     FUNCTION_CALL_EXPRESSION,
     NULL_EXPRESSION,
+    /**展开的函数调用，由inline.c在编译结束时生成*/
+    INLINE_CALL_EXPRESSION,
     EXPRESSION_TYPE_COUNT_PLUS_1
 } ExpressionType;
 
@@ -137,20 +153,112 @@ typedef enum {
 #define dkc_is_logical_operator(operator) \
 ((operator) == LOGICAL_AND_EXPRESSION || (operator) == LOGICAL_OR_EXPRESSION)
 
+/**判断是否是位运算操作符，操作数只能是int类型*/
+#define dkc_is_bit_operator(operator) \
+((operator) == BIT_AND_EXPRESSION || (operator) == BIT_OR_EXPRESSION\
+|| (operator) == BIT_XOR_EXPRESSION || (operator) == LEFT_SHIFT_EXPRESSION\
+|| (operator) == RIGHT_SHIFT_EXPRESSION)
+
+/**
+ * 移位运算，移位数只取低6位
+ * 左移按无符号数计算，右移是算术右移
+ */
+#define dkc_shift_left(left, right) \
+((long long)((unsigned long long)(left) << ((right) & 63)))
+#define dkc_shift_right(left, right) \
+((left) >> ((right) & 63))
+
+/**
+ * int的除法和取余可以直接计算：除数不是0，也不是LLONG_MIN除以-1
+ * 其他情况是运行时错误，C里直接计算会SIGFPE
+ */
+#define dkc_is_safe_division(left, right) \
+((right) != 0 && !((right) == -1 && (left) == LLONG_MIN))
+
+/**
+ * 变量表达式
+ */
+typedef struct {
+    char        *name;
+    /**局部变量的下标，全局变量为-1*/
+    int         slot;
+    /**全局变量在全局变量表中的下标，局部变量为-1*/
+    int         global_index;
+    /**借用的变量，求值时不增加引用计数，使用的节点也不释放，由borrow.c标记*/
+    LEN_Boolean borrowed;
+} IdentifierExpression;
+
 /**
  * 赋值表达式
  */
 typedef struct {
     char        *variable;
+    /**局部变量的下标，全局变量为-1*/
+    int         slot;
+    /**全局变量在全局变量表中的下标，局部变量为-1*/
+    int         global_index;
     Expression  *operand;
 } AssignExpression;
 
+/**
+ * 二元表达式按照执行时操作数的类型特化之后的求值方式(quickening)
+ * 算术和比较运算的顺序和ExpressionType相同
+ */
+typedef enum {
+    /**还没有执行过*/
+    BINARY_UNSPECIALIZED = 0,
+    /**类型不稳定，不再特化*/
+    BINARY_GENERIC,
+    ADD_INT_INT,
+    SUB_INT_INT,
+    MUL_INT_INT,
+    DIV_INT_INT,
+    MOD_INT_INT,
+    EQ_INT_INT,
+    NE_INT_INT,
+    GT_INT_INT,
+    GE_INT_INT,
+    LT_INT_INT,
+    LE_INT_INT,
+    ADD_DOUBLE_DOUBLE,
+    SUB_DOUBLE_DOUBLE,
+    MUL_DOUBLE_DOUBLE,
+    DIV_DOUBLE_DOUBLE,
+    MOD_DOUBLE_DOUBLE,
+    EQ_DOUBLE_DOUBLE,
+    NE_DOUBLE_DOUBLE,
+    GT_DOUBLE_DOUBLE,
+    GE_DOUBLE_DOUBLE,
+    LT_DOUBLE_DOUBLE,
+    LE_DOUBLE_DOUBLE,
+    CONCAT_STRING_INT,
+    CONCAT_STRING_STRING,
+    /**位运算的顺序和ExpressionType相同*/
+    BIT_AND_INT_INT,
+    BIT_OR_INT_INT,
+    BIT_XOR_INT_INT,
+    LEFT_SHIFT_INT_INT,
+    RIGHT_SHIFT_INT_INT
+} BinarySpecialization;
+
 /**
  * 二元表达式
  */
 typedef struct {
     Expression  *left;
     Expression  *right;
+    /**遍历分析树执行时特化的求值方式*/
+    BinarySpecialization    specialization;
+    /**特化的类型检查失败的次数*/
+    int         deopt_count;
+    /**操作数的类型由infer.c推断出来，特化的求值方式不再检查类型*/
+    LEN_Boolean typed;
+    /**强度削弱的乘法由计数循环每次迭代加上增量维护的积*/
+    long long   induction_value;
+    /**induction_value可以使用，溢出或者不在循环中时照常计算乘法*/
+    LEN_Boolean induction_valid;
+    /**有借用的操作数，字符串的比较和拼接不改变借用的字符串的引用计数*/
+    LEN_Boolean borrows;
 } BinaryExpression;
 
 /**
@@ -159,8 +267,57 @@ typedef struct {
 typedef struct {
     char                *identifier;
     ArgumentList        *argument;
+    /**编译结束时绑定的函数定义*/
+    struct FunctionDefinition_tag   *function;
+    /**print或者fputs有借用的实参，调用结束后不释放借用的实参*/
+    LEN_Boolean borrows;
 } FunctionCallExpression;
 
+/**
+ * 展开的函数中if/elsif的一个分支，条件为true时返回value
+ */
+typedef struct InlineBranch_tag {
+    Expression              *condition;
+    Expression              *value;
+    struct InlineBranch_tag *next;
+} InlineBranch;
+
+/**
+ * 展开的函数调用
+ * 实参依次赋给调用者的临时变量，再计算函数的返回值
+ */
+typedef struct {
+    /**实参赋给临时变量的赋值表达式，常量实参直接代入，没有赋值*/
+    ArgumentList        *binding;
+    /**依次求条件，第一个为true的分支的value是返回值，没有分支时为NULL*/
+    InlineBranch        *branch;
+    /**条件都不成立时返回值的表达式，参数换成了临时变量或者常量*/
+    Expression          *body;
+    /**展开的函数定义*/
+    struct FunctionDefinition_tag   *function;
+} InlineCallExpression;
+
+/**
+ * 遍历分析树执行时融合成一个节点执行的常见形状(superinstruction)
+ * 由fuse.c在编译结束时识别，子节点保持不变，其他执行方式照常使用
+ */
+typedef enum {
+    FUSED_NONE = 0,
+    /**x = x + 整数常量*/
+    FUSED_INCREMENT,
+    /**x = x + 表达式，表达式不赋值也不调用函数*/
+    FUSED_ACCUMULATE,
+    /**两边都是变量或者整数常量的比较*/
+    FUSED_COMPARE,
+    /**print(字符串常量 + ...)，依次打印每一段，不再拼接字符串*/
+    FUSED_PRINT,
+    /**计数变量乘以循环不变量，由loop.c强度削弱成加法*/
+    FUSED_INDUCTION
+} FusedShape;
+
+/**FUSED_PRINT最多打印的段数*/
+#define FUSED_PRINT_PIECE_MAX   (8)
+
 /**
  * 表达式定义
  */
@@ -169,16 +326,23 @@ struct Expression_tag {
     ExpressionType type;
     /**行号*/
     int line_number;
+    /**infer.c推断出的值的类型，不能确定时为LEN_UNDEFINED_VALUE*/
+    LEN_ValueType value_type;
+    /**遍历分析树时融合执行的形状*/
+    FusedShape  fused;
     union {
         LEN_Boolean             boolean_value;
-        int                     int_value;
+        long long               int_value;
         double                  double_value;
-        char                    *string_value;
-        char                    *identifier;
+        /**编译时创建的不朽字符串*/
+        LEN_String              *string_value;
+        IdentifierExpression    identifier;
         AssignExpression        assign_expression;
         BinaryExpression        binary_expression;
         Expression              *minus_expression;
+        Expression              *bit_not_expression;
         FunctionCallExpression  function_call_expression;
+        InlineCallExpression    inline_call_expression;
     } u;
 };
 
@@ -202,6 +366,8 @@ typedef struct {
 
 typedef struct IdentifierList_tag {
     char        *name;
+    /**global语句中的变量在全局变量表中的下标*/
+    int         global_index;
     struct IdentifierList_tag   *next;
 } IdentifierList;
 
@@ -230,27 +396,110 @@ typedef struct Elsif_tag {
     struct Elsif_tag    *next;
 } Elsif;
 
+/**
+ * 分派表的一个分支，字符串的键在同一个散列桶中连成链表
+ */
+typedef struct DispatchCase_tag {
+    long long   int_key;
+    LEN_String  *string_key;
+    unsigned int    hash;
+    Block       *block;
+    struct DispatchCase_tag *next;
+} DispatchCase;
+
+typedef enum {
+    /**整数的键密集，按键减去最小的键直接查跳转表*/
+    DISPATCH_DENSE,
+    /**整数的键稀疏，在排好序的分支中二分查找*/
+    DISPATCH_SORTED,
+    /**字符串的键，按散列值查找*/
+    DISPATCH_STRING
+} DispatchKind;
+
+/**
+ * if (x == 常量) ... elsif (x == 常量) ...的分派表，由dispatch.c生成
+ * 遍历分析树时按x的值直接找到执行的分支，不再依次求每个条件
+ */
+typedef struct {
+    DispatchKind    kind;
+    /**比较的变量*/
+    int         slot;
+    int         global_index;
+    /**DISPATCH_DENSE时最小的键*/
+    long long   min;
+    /**跳转表的大小、分支的数量或者散列桶的数量*/
+    int         size;
+    /**DISPATCH_DENSE的跳转表，没有对应的分支时为NULL*/
+    Block       **table;
+    /**DISPATCH_SORTED按键排好序的分支*/
+    DispatchCase    *cases;
+    /**DISPATCH_STRING的散列桶*/
+    DispatchCase    **bucket;
+} DispatchTable;
+
 typedef struct {
     Expression  *condition;
     Block       *then_block;
     Elsif       *elsif_list;
     Block       *else_block;
+    /**分派表，不是变量和常量比较的分支链时为NULL*/
+    DispatchTable   *dispatch;
 } IfStatement;
 
+/**
+ * 循环的trace信息，遍历分析树执行时使用
+ */
+typedef struct {
+    /**执行过的迭代次数，超过TRACE_THRESHOLD之后记录trace*/
+    int         iteration_count;
+    /**正在记录trace，递归执行同一个循环时不再记录*/
+    LEN_Boolean recording;
+    /**side exit太多，以后不再使用trace*/
+    LEN_Boolean blacklisted;
+    struct Trace_tag *trace;
+} LoopTraceInfo;
+
 typedef struct {
     Expression  *condition;
     Block       *block;
+    LoopTraceInfo   trace_info;
 } WhileStatement;
 
+/**
+ * 计数循环for (i = 初值; i < 上限; i = i + 增量)，由loop.c识别
+ * 循环体中不给计数变量和上限赋值，遍历分析树时直接按int计数
+ */
+typedef struct {
+    /**计数变量，局部变量的下标或者全局变量在全局变量表中的下标*/
+    int         slot;
+    int         global_index;
+    /**比较操作符，计数变量在左边*/
+    ExpressionType  operator;
+    /**上限，变量或者整数常量*/
+    Expression  *limit;
+    /**每次迭代的增量*/
+    long long   step;
+    /**强度削弱的乘法(FUSED_INDUCTION)，循环体中没有函数调用时才有*/
+    int         induction_count;
+    Expression  **induction;
+    /**执行时每个乘法每次迭代的增量*/
+    long long   *induction_step;
+} CountedLoop;
+
 typedef struct {
     Expression  *init;
     Expression  *condition;
     Expression  *post;
     Block       *block;
+    LoopTraceInfo   trace_info;
+    /**计数循环，不是时为NULL*/
+    CountedLoop *counted;
 } ForStatement;
 
 typedef struct {
     Expression *return_value;
+    /**返回值是循环外面的用户函数调用，遍历分析树时作为尾调用执行*/
+    LEN_Boolean tail_call;
 } ReturnStatement;
 
 /**
@@ -287,6 +536,8 @@ typedef enum {
     RETURN_STATEMENT_RESULT,
     BREAK_STATEMENT_RESULT,
     CONTINUE_STATEMENT_RESULT,
+    /**尾调用，释放当前的局部环境之后再调用，被调用的函数和参数在LEN_Interpreter中*/
+    TAIL_CALL_STATEMENT_RESULT,
     STATEMENT_RESULT_TYPE_COUNT_PLUS_1
 } StatementResultType;
 
@@ -312,6 +563,33 @@ typedef enum{
     NATIVE_FUNCTION_DEFINITION
 } FunctionDefinitionType;
 
+/**纯函数结果缓存的槽数，2的幂*/
+#define MEMO_TABLE_SIZE     (4096)
+/**缓存结果的函数最多的参数数量*/
+#define MEMO_ARGUMENT_MAX   (8)
+
+/**
+ * 结果缓存的一个槽，参数放在MemoTable的argument中
+ */
+typedef struct {
+    LEN_Boolean     used;
+    unsigned int    hash;
+    LEN_Value       result;
+} MemoSlot;
+
+/**
+ * 纯函数按参数的值缓存的结果，由memo.c生成
+ * 每组参数直接映射到一个槽，冲突时新的结果替换旧的结果，
+ * 所以一个函数最多占用MEMO_TABLE_SIZE个槽
+ */
+typedef struct {
+    int         argument_count;
+    /**第一次保存结果时分配，之前为NULL*/
+    MemoSlot    *slot;
+    /**每个槽argument_count个参数*/
+    LEN_Value   *argument;
+} MemoTable;
+
 /**
  * 函数定义
  */
@@ -326,6 +604,16 @@ typedef struct FunctionDefinition_tag{
             ParameterList *parameter;
             /**函数主体*/
             Block *block;
+            /**参数和局部变量的数量(局部环境中的下标)*/
+            int local_variable_count;
+            /**不读写全局变量也不调用native函数的纯函数，由pure.c分析*/
+            LEN_Boolean pure;
+            /**缓存调用结果的纯函数的缓存，不缓存时为NULL*/
+            MemoTable *memo;
+            /**函数主体编译后的字节码*/
+            struct ByteCode_tag *code;
+            /**函数主体编译后的closure*/
+            struct StatementClosure_tag *closure;
         } lemon_f;
         struct {
             LEN_NativeFunctionProc *proc;
@@ -337,34 +625,43 @@ typedef struct FunctionDefinition_tag{
 
 /******************************* 开始变量信息定义 ********************************/
 
-/**
- * 变量定义
- */
-typedef struct Variable_tag{
-    /**变量名*/
-    char *name;
-    /**变量值*/
-    LEN_Value value;
-    /**下一个变量*/
-    struct Variable_tag *next;
-} Variable;
+/**还没有赋值的变量*/
+#define LEN_UNDEFINED_VALUE ((LEN_ValueType)0)
 
 /**
- * 全局变量引用定义
+ * 全局变量表，编译时给程序中出现的全局变量分配下标
  */
-typedef struct GlobalVariableRef_tag {
-    Variable    *variable;
-    struct GlobalVariableRef_tag *next;
-} GlobalVariableRef;
+typedef struct {
+    int         count;
+    int         alloc_size;
+    /**变量名*/
+    char        **name;
+    /**变量值，还没有赋值的变量为LEN_UNDEFINED_VALUE*/
+    LEN_Value   *value;
+} GlobalVariableTable;
 
 /**
  * 局部环境变量定义
  */
 typedef struct {
-    Variable    *variable;
-    GlobalVariableRef   *global_variable;
+    /**按下标访问的参数和局部变量*/
+    int         local_variable_count;
+    LEN_Value   *local_variable;
 } LocalEnvironment;
 
+/**
+ * 调用栈的一块连续内存，局部环境和native函数的参数从这里按栈的顺序分配
+ * 块不会移动，局部环境的地址在调用期间保持不变
+ */
+typedef struct FrameChunk_tag {
+    int                     alloc_size;
+    int                     used;
+    LEN_Value               *value;
+    struct FrameChunk_tag   *prev;
+    /**弹出之后留下来重复使用的块*/
+    struct FrameChunk_tag   *next;
+} FrameChunk;
+
 /***********************************/
 
 /**
@@ -373,7 +670,11 @@ typedef struct {
 struct LEN_String_tag {
     int         ref_count;
     char        *string;
-    LEN_Boolean is_literal;
+    /**
+     * 字符串字面量在编译时创建一次，不计引用计数，
+     * 和分析树一起随interpreter_storage释放
+     */
+    LEN_Boolean is_immortal;
 };
 
 /**
@@ -383,22 +684,283 @@ typedef struct {
     LEN_String  *strings;
 } StringPool;
 
+/*************************************开始字节码定义*********************************/
+
+/**
+ * 字节码指令定义
+ * 寄存器式虚拟机，a/b/c是寄存器编号、常量下标或者跳转目标
+ */
+typedef enum {
+    /**reg[a] = null*/
+    OP_LOAD_NULL = 1,
+    /**reg[a] = b(boolean)*/
+    OP_LOAD_BOOLEAN,
+    /**reg[a] = constant[b](int/double/字符串字面量)*/
+    OP_LOAD_CONSTANT,
+    /**reg[a] = 全局变量b的值*/
+    OP_LOAD_GLOBAL,
+    /**全局变量b = reg[a]，reg[a]保留赋值表达式的值*/
+    OP_STORE_GLOBAL,
+    /**reg[a] = 局部变量b的值，c为变量名在name中的下标*/
+    OP_LOAD_LOCAL,
+    /**局部变量b = reg[a]*/
+    OP_STORE_LOCAL,
+    /**reg[a] = reg[b] op reg[c]*/
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_EQ,
+    OP_NE,
+    OP_GT,
+    OP_GE,
+    OP_LT,
+    OP_LE,
+    OP_BIT_AND,
+    OP_BIT_OR,
+    OP_BIT_XOR,
+    OP_LEFT_SHIFT,
+    OP_RIGHT_SHIFT,
+    /**reg[a] = -reg[b]*/
+    OP_MINUS,
+    /**reg[a] = ~reg[b]*/
+    OP_BIT_NOT,
+    /**检查reg[a]是否是boolean型*/
+    OP_CHECK_BOOLEAN,
+    /**pc = b*/
+    OP_JUMP,
+    /**reg[a]为false时 pc = b，reg[a]必须是boolean型*/
+    OP_JUMP_IF_FALSE,
+    /**reg[a]为true时 pc = b，reg[a]必须是boolean型*/
+    OP_JUMP_IF_TRUE,
+    /**reg[a] = function[b](reg[a] ... reg[a+c-1])*/
+    OP_CALL,
+    /**尾调用function[b](reg[a] ... reg[a+c-1])，后面一定是OP_RETURN a*/
+    OP_TAIL_CALL,
+    /**丢弃reg[a]的值(表达式语句)*/
+    OP_POP,
+    /**reg[a] = reg[b]，string增加引用计数*/
+    OP_COPY,
+    /**释放reg[a]原来的值，reg[a] = reg[b]，保存可以重用的运算结果*/
+    OP_SAVE,
+    /**global 全局变量b*/
+    OP_GLOBAL,
+    /**返回reg[a]*/
+    OP_RETURN,
+    /**返回null*/
+    OP_RETURN_NULL,
+    OP_CODE_COUNT_PLUS_1
+} OpCode;
+
+/**
+ * 字节码指令
+ * 跳转指令的目标放在b(低16位)和c(高16位)里，指令超过65535条的大脚本也能跳转
+ * dkc_set_jump_target()会对target求值两次，target不能依赖ins本身
+ */
+typedef struct {
+    unsigned short opcode;
+    unsigned short a;
+    unsigned short b;
+    unsigned short c;
+} Instruction;
+
+#define dkc_jump_target(ins) \
+((int)((ins)->b | ((unsigned int)(ins)->c << 16)))
+#define dkc_set_jump_target(ins, target) \
+((ins)->b = (unsigned short)(target), \
+ (ins)->c = (unsigned short)((unsigned int)(target) >> 16))
+
+/**
+ * 编译后的字节码，对应一个函数或者顶层语句链
+ */
+typedef struct ByteCode_tag {
+    /**指令序列*/
+    int         code_size;
+    Instruction *code;
+    /**每条指令对应的行号，用于运行时错误*/
+    int         *line_number;
+    /**常量池，字符串字面量是编译时创建的不朽字符串*/
+    int         constant_count;
+    LEN_Value   *constant;
+    /**变量名*/
+    int         name_count;
+    char        **name;
+    /**调用的函数，编译时已经绑定*/
+    int         function_count;
+    struct FunctionDefinition_tag   **function;
+    /**需要的寄存器数量*/
+    int         register_count;
+    /**被调用的次数，超过JIT_THRESHOLD之后交给JIT编译*/
+    int         call_count;
+    /**JIT编译后的机器码，没有编译时为NULL*/
+    struct JitCode_tag *jit_code;
+    /**包含JIT不支持的指令，以后一直用虚拟机执行*/
+    LEN_Boolean jit_failed;
+} ByteCode;
+
+/**
+ * 虚拟机的寄存器栈，每次调用在栈顶分配寄存器窗口
+ */
+typedef struct {
+    int         alloc_size;
+    int         stack_pointer;
+    LEN_Value   *stack;
+} Stack;
+
+/*************************************开始closure定义*********************************/
+
+typedef struct ExpressionClosure_tag ExpressionClosure;
+typedef struct StatementClosure_tag StatementClosure;
+
+/**表达式closure的执行函数*/
+typedef LEN_Value ExpressionClosureProc(LEN_Interpreter *inter,
+                                        LocalEnvironment *env,
+                                        ExpressionClosure *self);
+
+/**语句closure的执行函数，return的值通过ret返回*/
+typedef StatementResultType StatementClosureProc(LEN_Interpreter *inter,
+                                                 LocalEnvironment *env,
+                                                 StatementClosure *self,
+                                                 LEN_Value *ret);
+
+/**
+ * 表达式closure，proc根据表达式的类型和操作数特化
+ */
+struct ExpressionClosure_tag {
+    ExpressionClosureProc *proc;
+    /**行号*/
+    int line_number;
+    union {
+        LEN_Value       constant;
+        IdentifierExpression    identifier;
+        struct {
+            int                 slot;
+            int                 global_index;
+            ExpressionClosure   *operand;
+        } assign;
+        struct {
+            ExpressionClosure   *left;
+            ExpressionClosure   *right;
+            /**右操作数是int常量时的值*/
+            long long           right_int;
+        } binary;
+        ExpressionClosure       *operand;
+        struct {
+            struct FunctionDefinition_tag   *function;
+            int                 argument_count;
+            ExpressionClosure   **argument;
+        } call;
+        struct {
+            int                 binding_count;
+            ExpressionClosure   **binding;
+            int                 branch_count;
+            ExpressionClosure   **condition;
+            ExpressionClosure   **value;
+            ExpressionClosure   *body;
+        } inline_call;
+    } u;
+};
+
+/**
+ * 语句closure
+ */
+struct StatementClosure_tag {
+    StatementClosureProc *proc;
+    /**行号*/
+    int line_number;
+    union {
+        ExpressionClosure   *expression;
+        IdentifierList      *global_list;
+        struct {
+            int                 statement_count;
+            StatementClosure    **statement;
+        } block;
+        struct {
+            /**if和elsif的条件和语句块*/
+            int                 branch_count;
+            ExpressionClosure   **condition;
+            StatementClosure    **block;
+            StatementClosure    *else_block;
+        } if_s;
+        struct {
+            ExpressionClosure   *init;
+            ExpressionClosure   *condition;
+            ExpressionClosure   *post;
+            StatementClosure    *block;
+        } loop;
+        ExpressionClosure   *return_value;
+    } u;
+};
+
 /**
  * 解释器定义
  */
+/**
+ * 符号表中的一个名字
+ */
+typedef struct Symbol_tag {
+    char                *name;
+    struct Symbol_tag   *next;
+} Symbol;
+
+/**
+ * 符号表，每个不同的名字只保存一次，名字的比较可以直接比较指针
+ */
+typedef struct {
+    int     bucket_count;
+    Symbol  **bucket;
+} SymbolTable;
+
+/**原生指针散列表的桶数，2的幂*/
+#define NATIVE_POINTER_BUCKET_SIZE  (64)
+
+/**
+ * 已经分配的原生指针，相同的信息和指针共用一个
+ * 释放之后从散列表中删除，但不重新使用，保存着它的值可以判断已经关闭
+ */
+typedef struct NativePointerBox_tag {
+    LEN_NativePointer           native_pointer;
+    /**散列桶的下一个*/
+    struct NativePointerBox_tag *next;
+} NativePointerBox;
+
 struct LEN_Interpreter_tag {
     /**解释器的内存*/
     MEM_Storage interpreter_storage;
     /**运行时的内存*/
     MEM_Storage execute_storage;
-    /**全局变量链表*/
-    Variable *variable;
+    /**变量名和函数名的符号表*/
+    SymbolTable symbol_table;
+    /**全局变量表*/
+    GlobalVariableTable global_variable;
+    /**按信息和指针散列的原生指针*/
+    NativePointerBox *native_pointer_bucket[NATIVE_POINTER_BUCKET_SIZE];
     /**函数定义链表*/
     FunctionDefinition *function_list;
     /**语句链表*/
     StatementList *statement_list;
     /**当前行号*/
     int current_line_number;
+    /**顶层语句链编译后的字节码*/
+    ByteCode *top_level_code;
+    /**虚拟机的寄存器栈*/
+    Stack stack;
+    /**调用栈当前使用的块*/
+    FrameChunk *frame_chunk;
+    /**尾调用的函数和参数，当前的局部环境释放之前从调用栈移到这里*/
+    struct FunctionDefinition_tag *tail_call_function;
+    LEN_Value *tail_call_argument;
+    int tail_call_argument_count;
+    int tail_call_argument_size;
+    /**顶层语句链编译后的closure*/
+    StatementClosure *top_level_closure;
+    /**执行方式*/
+    LEN_ExecuteMode execute_mode;
+    /**字节码的优化(LEN_OptimizeFlag的组合)*/
+    int optimize_flags;
+    /**JIT生成的机器码链表*/
+    struct JitCode_tag *jit_code_list;
 };
 /*************************************函数声明**************************************/
 
@@ -409,6 +971,8 @@ ParameterList *len_create_parameter(char *identifier);
 ParameterList *len_chain_parameter(ParameterList *list,
                                    char *identifier);
 ArgumentList *len_create_argument_list(Expression *expression);
+/**用折叠的值改写表达式，行号保持不变*/
+void len_convert_value_to_expression(LEN_Value *v, Expression *expr);
 ArgumentList *len_chain_argument_list(ArgumentList *list, Expression *expr);
 StatementList *len_create_statement_list(Statement *statement);
 StatementList *len_chain_statement_list(StatementList *list,
@@ -416,6 +980,7 @@ StatementList *len_chain_statement_list(StatementList *list,
 Expression *len_create_assign_expression(char *variable,
                                              Expression *operand);
 Expression *len_create_minus_expression(Expression *operand);
+Expression *len_create_bit_not_expression(Expression *operand);
 Expression *len_create_identifier_expression(char *identifier);
 Expression *len_create_function_call_expression(char *func_name,
                                                 ArgumentList *argument);
@@ -444,15 +1009,139 @@ Expression *len_create_binary_expression(ExpressionType operator,
 
 /**为指定的表达式类型分配内存*/
 Expression *len_alloc_expression(ExpressionType type);
+/**删除执行不到的代码(常量false的分支、while (false)、return之后的语句)*/
+void len_eliminate_dead_code(LEN_Interpreter *inter);
 
 /* execute.c */
+/**执行单条语句*/
+StatementResult len_execute_statement(LEN_Interpreter *inter,
+                                      LocalEnvironment *env,
+                                      Statement *statement);
 StatementResult len_execute_statement_list(LEN_Interpreter *inter, LocalEnvironment *env, StatementList *list);
+/**从elsif_list开始执行if语句剩下的分支(elsif和else)*/
+StatementResult len_execute_elsif_and_else(LEN_Interpreter *inter,
+                                           LocalEnvironment *env,
+                                           Statement *statement,
+                                           Elsif *elsif_list);
+/**执行global声明，检查下标为index的全局变量是否存在*/
+void len_declare_global_variable(LEN_Interpreter *inter, LocalEnvironment *env,
+                                 int index, int line_number);
+
+/* resolve.c */
+/**给每个函数的参数和局部变量分配局部环境中的下标*/
+void len_resolve_variables(LEN_Interpreter *inter);
+
+/* inline.c */
+/**把小的、不调用其他函数的用户函数展开到调用的位置*/
+void len_inline_functions(LEN_Interpreter *inter);
+
+/* infer.c */
+/**推断表达式的类型，遍历分析树执行时省掉确定类型的表达式的类型检查*/
+void len_infer_types(LEN_Interpreter *inter);
+
+/* fuse.c */
+/**把常见的形状融合成一个节点，遍历分析树执行时减少节点的分派*/
+void len_fuse_expressions(LEN_Interpreter *inter);
+/**不赋值也不调用函数的表达式*/
+LEN_Boolean len_is_pure_expression(Expression *expr);
+
+/* loop.c */
+/**识别计数循环，强度削弱循环体中计数变量的乘法*/
+void len_find_counted_loops(LEN_Interpreter *inter);
+
+/* pure.c */
+/**分析哪些用户函数是纯函数*/
+void len_analyze_pure_functions(LEN_Interpreter *inter);
+/**参数都是常量的纯函数调用在编译时求值，替换成结果的常量*/
+void len_fold_pure_calls(LEN_Interpreter *inter);
+
+/* dispatch.c */
+/**把变量和常量比较的if/elsif分支链编译成分派表*/
+void len_build_dispatch_tables(LEN_Interpreter *inter);
+
+/* borrow.c */
+/**标记字符串只在表达式中使用一下的变量，省掉成对的引用计数操作*/
+void len_mark_borrowed_operands(LEN_Interpreter *inter);
+
+/* memo.c */
+/**选出缓存调用结果的纯函数*/
+void len_select_memo_functions(LEN_Interpreter *inter);
+/**按参数查找缓存的结果，没有时复制参数作为保存结果用的键*/
+LEN_Boolean len_memo_lookup(MemoTable *memo, LEN_Value *args,
+                            LEN_Value *key, LEN_Value *result);
+/**保存函数的结果，释放键*/
+void len_memo_store(MemoTable *memo, LEN_Value *key, LEN_Value *result);
+/**释放所有函数的结果缓存*/
+void len_dispose_memo_tables(LEN_Interpreter *inter);
+
+/* generate.c */
+/**将函数定义和顶层语句链编译成字节码*/
+void len_generate_code(LEN_Interpreter *inter);
+
+/* optimize.c */
+/**基于SSA的全局值编号，消除字节码中冗余的运算*/
+void len_optimize_code(LEN_Interpreter *inter, ByteCode *code,
+                       int parameter_count);
+/**循环中有循环不变的运算，值得剥离第一次迭代*/
+LEN_Boolean len_has_loop_invariant(Statement *statement);
+
+/* closure.c */
+/**将函数定义和顶层语句链编译成closure*/
+void len_compile_closure(LEN_Interpreter *inter);
+/**执行closure，返回return语句的值*/
+LEN_Value len_execute_closure(LEN_Interpreter *inter, LocalEnvironment *env,
+                              StatementClosure *closure);
+
+/* vm.c */
+/**执行字节码，返回return语句的值*/
+LEN_Value len_execute_bytecode(LEN_Interpreter *inter, LocalEnvironment *env,
+                               ByteCode *code);
+/**释放寄存器栈*/
+void len_dispose_stack(LEN_Interpreter *inter);
+/**确保寄存器栈还有need个空位*/
+void len_expand_stack(LEN_Interpreter *inter, int need);
+/**根据函数名调用函数，args是调用者的寄存器*/
+LEN_Value len_vm_call_function(LEN_Interpreter *inter,
+                               FunctionDefinition *func,
+                               int arg_count, LEN_Value *args);
+
+/* jit.c */
+/**统计调用次数，函数变热之后编译成机器码执行，否则交给虚拟机*/
+LEN_Value len_execute_jit(LEN_Interpreter *inter, LocalEnvironment *env,
+                          ByteCode *code);
+/**释放JIT生成的机器码*/
+void len_dispose_jit(LEN_Interpreter *inter);
+
+/* trace.c */
+/**初始化循环的trace信息*/
+void len_init_loop_trace_info(LoopTraceInfo *info);
+/**
+ * 在循环每次迭代之前调用，循环变热之后记录并执行trace
+ * 返回LEN_TRUE时循环已经执行完毕，结果放在result中
+ */
+LEN_Boolean len_execute_trace(LEN_Interpreter *inter, LocalEnvironment *env,
+                              Statement *statement, StatementResult *result);
+
+/* emit.c */
+/**将函数定义和顶层语句链翻译成C语言*/
+void len_emit_c(LEN_Interpreter *inter, FILE *fp);
+
+/* interface.c */
+/**--emit-c生成的顶层语句链*/
+typedef LEN_Value EmittedTopLevelProc(LEN_Interpreter *inter);
+/**执行--emit-c生成的代码，由生成的main()调用*/
+void len_interpret_emitted(LEN_Interpreter *inter,
+                           EmittedTopLevelProc *top_level);
 
 /* string_pool.c */
 /**将char数组转为String类型*/
 LEN_String *len_literal_to_len_string(LEN_Interpreter *inter, char *str);
 void len_refer_string(LEN_String *str);
 void len_release_string(LEN_String *str);
+/**值是string类型时，引用计数+1*/
+void len_refer_if_string(LEN_Value *v);
+/**值是string类型时，引用计数-1*/
+void len_release_if_string(LEN_Value *v);
 LEN_String *len_search_len_string(LEN_Interpreter *inter, char *str);
 LEN_String *len_create_lemon_string(LEN_Interpreter *inter, char *str);
 
@@ -463,18 +1152,61 @@ LEN_Interpreter *len_get_current_interpreter(void);
 void len_set_current_interpreter(LEN_Interpreter *inter);
 /**将指定的表达式转为字符串形式*/
 char *len_get_operator_string(ExpressionType type);
-/**根据符号查找局部变量*/
-Variable *len_search_local_variable(LocalEnvironment *env, char *identifier);
-/**根据符号查找全局变量*/
-Variable *len_search_global_variable(LEN_Interpreter *inter, char *identifier);
+/**根据符号查找全局变量，返回全局变量表中的下标，找不到时返回-1*/
+int len_search_global_variable(LEN_Interpreter *inter, char *identifier);
+/**在全局变量表中增加还没有赋值的变量，已经存在时返回原来的下标*/
+int len_add_global_variable(LEN_Interpreter *inter, char *identifier);
+/**释放全局变量表*/
+void len_dispose_global_variable(LEN_Interpreter *inter);
 /**分配指定大小的内存*/
 void *len_malloc(size_t size);
-/**增加局部变量*/
-void len_add_local_variable(LocalEnvironment *env,char *identifier, LEN_Value *value);
 /**根据函数名查找指定的函数*/
 FunctionDefinition *len_search_function(char *name);
 
 /* eval.c */
+/**对已经求值的两个操作数进行二元运算，操作数的引用由本函数释放*/
+LEN_Value len_eval_binary_values(LEN_Interpreter *inter,
+                                 ExpressionType operator,
+                                 LEN_Value *left, LEN_Value *right,
+                                 int line_number);
+/**对已经求值的操作数取负*/
+LEN_Value len_eval_minus_value(LEN_Interpreter *inter, LEN_Value *operand,
+                               int line_number);
+/**对已经求值的操作数按位取反*/
+LEN_Value len_eval_bit_not_value(LEN_Interpreter *inter, LEN_Value *operand,
+                                 int line_number);
+/**读取下标为index的全局变量的值，string类型的引用计数+1*/
+LEN_Value len_get_global_variable_value(LEN_Interpreter *inter, int index,
+                                        int line_number);
+/**给下标为index的全局变量赋值，调用者仍然持有value的一个引用*/
+void len_assign_global_variable(LEN_Interpreter *inter, int index,
+                                LEN_Value *value);
+/**读取下标为slot的局部变量的值，string类型的引用计数+1*/
+LEN_Value len_get_local_variable_value(LocalEnvironment *env, int slot,
+                                       char *identifier, int line_number);
+/**给下标为slot的局部变量赋值*/
+void len_assign_local_variable(LocalEnvironment *env, int slot,
+                               LEN_Value *value);
+/**为用户函数创建局部环境，参数的引用交给局部环境*/
+LocalEnvironment *len_create_function_environment(LEN_Interpreter *inter,
+                                                  FunctionDefinition *func,
+                                                  int arg_count,
+                                                  LEN_Value *args);
+/**调用native函数，调用结束后释放参数*/
+LEN_Value len_call_native_function(LEN_Interpreter *inter,
+                                   LEN_NativeFunctionProc *proc,
+                                   int arg_count, LEN_Value *args);
+/**在调用栈上分配count个值*/
+LEN_Value *len_push_frame(LEN_Interpreter *inter, int count);
+/**弹出调用栈上最后分配的count个值*/
+void len_pop_frame(LEN_Interpreter *inter, int count);
+void len_dispose_frame_stack(LEN_Interpreter *inter);
+/**在调用栈上分配局部环境*/
+LocalEnvironment *len_alloc_local_environment(LEN_Interpreter *inter,
+                                              int local_variable_count);
+/**释放局部环境*/
+void len_dispose_local_environment(LEN_Interpreter *inter,
+                                   LocalEnvironment *env);
 LEN_Value len_eval_binary_expression(LEN_Interpreter *inter,
                                      LocalEnvironment *env,
                                      ExpressionType operator,
@@ -482,8 +1214,31 @@ LEN_Value len_eval_binary_expression(LEN_Interpreter *inter,
 
 LEN_Value len_eval_minus_expression(LEN_Interpreter *inter,
                                     LocalEnvironment *env, Expression *operand);
+LEN_Value len_eval_bit_not_expression(LEN_Interpreter *inter,
+                                      LocalEnvironment *env,
+                                      Expression *operand);
 LEN_Value len_eval_expression(LEN_Interpreter *inter,
                               LocalEnvironment *env, Expression *expr);
+/**return语句中的尾调用，只求参数，由len_execute_function_body()调用函数*/
+StatementResult len_eval_tail_call(LEN_Interpreter *inter,
+                                   LocalEnvironment *env, Expression *expr);
+/**记下尾调用的函数，参数和它们的引用移到tail_call_argument*/
+void len_set_tail_call(LEN_Interpreter *inter, FunctionDefinition *func,
+                       int arg_count, LEN_Value *args);
+/**执行用户函数的主体并且释放局部环境，尾调用在同一个位置创建局部环境*/
+LEN_Value len_execute_function_body(LEN_Interpreter *inter,
+                                    FunctionDefinition *func,
+                                    LocalEnvironment *local_env);
+/**变量在局部环境或者全局变量表中的位置*/
+LEN_Value *len_variable_address(LEN_Interpreter *inter, LocalEnvironment *env,
+                                int slot, int global_index);
+/**求if、while和for的条件，不是boolean类型时报错*/
+LEN_Boolean len_eval_condition(LEN_Interpreter *inter,
+                               LocalEnvironment *env, Expression *expr);
+/**根据操作数的类型选择二元表达式特化的求值方式*/
+BinarySpecialization len_specialize_binary_types(ExpressionType operator,
+                                                 LEN_ValueType left,
+                                                 LEN_ValueType right);
 /* error.c */
 void len_compile_error(CompileError id, ...);
 void len_runtime_error(int line_number, RuntimeError id, ...);
@@ -501,7 +1256,14 @@ LEN_Value len_nv_fputs_proc(LEN_Interpreter *interpreter,
 void len_add_std_fp(LEN_Interpreter *inter);
 
 /* string.c */
+/**返回符号表中的名字，第一次出现时加入符号表*/
+char *len_intern_symbol(LEN_Interpreter *inter, char *str);
+void len_dispose_symbol_table(LEN_Interpreter *inter);
 char *len_create_identifier(char *str);
+/**返回符号表中还没有的名字，用于编译器生成的变量*/
+char *len_create_unique_symbol(LEN_Interpreter *inter, char *prefix);
+/**字符串的散列值，符号表和分派表使用*/
+unsigned int len_hash_string(char *str);
 void len_open_string_literal(void);
 void len_add_string_literal(int letter);
 void len_reset_string_literal_buffer(void);
@@ -21,11 +21,13 @@
 %token FUNCTION IF ELSE ELSIF WHILE FOR RETURN_T BREAK CONTINUE NULL_T
 LP RP LC RC SEMICOLON COMMA ASSIGN LOGICAL_AND LOGICAL_OR
 EQ NE GT GE LT LE ADD SUB MUL DIV MOD TRUE_T FALSE_T GLOBAL_T
+BIT_AND BIT_OR BIT_XOR BIT_NOT LEFT_SHIFT RIGHT_SHIFT
 %type   <parameter_list> parameter_list
 %type   <argument_list> argument_list
 %type   <expression> expression expression_opt
 logical_and_expression logical_or_expression
-equality_expression relational_expression
+bit_or_expression bit_xor_expression bit_and_expression
+equality_expression relational_expression shift_expression
 additive_expression multiplicative_expression
 unary_expression primary_expression
 %type   <statement> statement global_statement
@@ -105,12 +107,33 @@ logical_or_expression
 }
 ;
 logical_and_expression
-: equality_expression
-| logical_and_expression LOGICAL_AND equality_expression
+: bit_or_expression
+| logical_and_expression LOGICAL_AND bit_or_expression
 {
     $$ = len_create_binary_expression(LOGICAL_AND_EXPRESSION, $1, $3);
 }
 ;
+bit_or_expression
+: bit_xor_expression
+| bit_or_expression BIT_OR bit_xor_expression
+{
+    $$ = len_create_binary_expression(BIT_OR_EXPRESSION, $1, $3);
+}
+;
+bit_xor_expression
+: bit_and_expression
+| bit_xor_expression BIT_XOR bit_and_expression
+{
+    $$ = len_create_binary_expression(BIT_XOR_EXPRESSION, $1, $3);
+}
+;
+bit_and_expression
+: equality_expression
+| bit_and_expression BIT_AND equality_expression
+{
+    $$ = len_create_binary_expression(BIT_AND_EXPRESSION, $1, $3);
+}
+;
 equality_expression
 : relational_expression
 | equality_expression EQ relational_expression
@@ -123,24 +146,35 @@ equality_expression
 }
 ;
 relational_expression
-: additive_expression
-| relational_expression GT additive_expression
+: shift_expression
+| relational_expression GT shift_expression
 {
     $$ = len_create_binary_expression(GT_EXPRESSION, $1, $3);
 }
-| relational_expression GE additive_expression
+| relational_expression GE shift_expression
 {
     $$ = len_create_binary_expression(GE_EXPRESSION, $1, $3);
 }
-| relational_expression LT additive_expression
+| relational_expression LT shift_expression
 {
     $$ = len_create_binary_expression(LT_EXPRESSION, $1, $3);
 }
-| relational_expression LE additive_expression
+| relational_expression LE shift_expression
 {
     $$ = len_create_binary_expression(LE_EXPRESSION, $1, $3);
 }
 ;
+shift_expression
+: additive_expression
+| shift_expression LEFT_SHIFT additive_expression
+{
+    $$ = len_create_binary_expression(LEFT_SHIFT_EXPRESSION, $1, $3);
+}
+| shift_expression RIGHT_SHIFT additive_expression
+{
+    $$ = len_create_binary_expression(RIGHT_SHIFT_EXPRESSION, $1, $3);
+}
+;
 additive_expression
 : multiplicative_expression
 | additive_expression ADD multiplicative_expression
@@ -173,6 +207,10 @@ unary_expression
 {
     $$ = len_create_minus_expression($2);
 }
+| BIT_NOT unary_expression
+{
+    $$ = len_create_bit_not_expression($2);
+}
 ;
 primary_expression
 : IDENTIFIER LP argument_list RP
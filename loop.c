@@ -0,0 +1,442 @@
+//
+//  loop.c
+//  lemon
+//  这个文件在编译结束时识别计数循环for (i = 初值; i < 上限; i = i + 常量)，
+//  循环体中不给计数变量和上限赋值时，遍历分析树执行时直接按int计数，
+//  不再每次迭代求条件和post表达式。
+//  循环体中没有函数调用时，计数变量乘以循环不变量的乘法强度削弱成加法，
+//  每次迭代给积加上增量，溢出时退回乘法
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+typedef struct {
+    /**局部变量的数量，顶层语句链为0*/
+    int         local_count;
+    /**局部变量和全局变量的数量*/
+    int         variable_count;
+    /**循环体中赋值的变量，局部变量在前，全局变量在后*/
+    LEN_Boolean *written;
+    /**循环体中调用了用户函数，用户函数中可能给全局变量赋值*/
+    LEN_Boolean has_call;
+    /**正在收集强度削弱的乘法的计数循环*/
+    CountedLoop *loop;
+    int         induction_alloc_size;
+} LoopScan;
+
+typedef void (*ExpressionVisitor)(LoopScan *scan, Expression *expr);
+
+static void walk_statement_list(LoopScan *scan, StatementList *list,
+                                ExpressionVisitor visit);
+static void find_in_statement_list(LoopScan *scan, StatementList *list);
+
+/**
+ * 先访问子节点再访问expr
+ */
+static void
+walk_expression(LoopScan *scan, Expression *expr, ExpressionVisitor visit)
+{
+    ArgumentList *arg_p;
+    InlineBranch *branch;
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+        case INT_EXPRESSION:        /* FALLTHRU */
+        case DOUBLE_EXPRESSION:     /* FALLTHRU */
+        case STRING_EXPRESSION:     /* FALLTHRU */
+        case NULL_EXPRESSION:       /* FALLTHRU */
+        case IDENTIFIER_EXPRESSION:
+            break;
+        case ASSIGN_EXPRESSION:
+            walk_expression(scan, expr->u.assign_expression.operand, visit);
+            break;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            walk_expression(scan, expr->u.binary_expression.left, visit);
+            walk_expression(scan, expr->u.binary_expression.right, visit);
+            break;
+        case MINUS_EXPRESSION:
+            walk_expression(scan, expr->u.minus_expression, visit);
+            break;
+        case BIT_NOT_EXPRESSION:
+            walk_expression(scan, expr->u.bit_not_expression, visit);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            for (arg_p = expr->u.function_call_expression.argument; arg_p;
+                 arg_p = arg_p->next) {
+                walk_expression(scan, arg_p->expression, visit);
+            }
+            break;
+        case INLINE_CALL_EXPRESSION:
+            for (arg_p = expr->u.inline_call_expression.binding; arg_p;
+                 arg_p = arg_p->next) {
+                walk_expression(scan, arg_p->expression, visit);
+            }
+            for (branch = expr->u.inline_call_expression.branch; branch;
+                 branch = branch->next) {
+                walk_expression(scan, branch->condition, visit);
+                walk_expression(scan, branch->value, visit);
+            }
+            walk_expression(scan, expr->u.inline_call_expression.body, visit);
+            break;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+    visit(scan, expr);
+}
+
+static void
+walk_statement(LoopScan *scan, Statement *statement, ExpressionVisitor visit)
+{
+    Elsif *elsif;
+
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            walk_expression(scan, statement->u.expression_s, visit);
+            break;
+        case IF_STATEMENT:
+            walk_expression(scan, statement->u.if_s.condition, visit);
+            walk_statement_list(scan, statement->u.if_s.then_block
+                                ->statement_list, visit);
+            for (elsif = statement->u.if_s.elsif_list; elsif;
+                 elsif = elsif->next) {
+                walk_expression(scan, elsif->condition, visit);
+                walk_statement_list(scan, elsif->block->statement_list,
+                                    visit);
+            }
+            if (statement->u.if_s.else_block) {
+                walk_statement_list(scan, statement->u.if_s.else_block
+                                    ->statement_list, visit);
+            }
+            break;
+        case WHILE_STATEMENT:
+            walk_expression(scan, statement->u.while_s.condition, visit);
+            walk_statement_list(scan, statement->u.while_s.block
+                                ->statement_list, visit);
+            break;
+        case FOR_STATEMENT:
+            if (statement->u.for_s.init) {
+                walk_expression(scan, statement->u.for_s.init, visit);
+            }
+            if (statement->u.for_s.condition) {
+                walk_expression(scan, statement->u.for_s.condition, visit);
+            }
+            if (statement->u.for_s.post) {
+                walk_expression(scan, statement->u.for_s.post, visit);
+            }
+            walk_statement_list(scan, statement->u.for_s.block
+                                ->statement_list, visit);
+            break;
+        case RETURN_STATEMENT:
+            if (statement->u.return_s.return_value) {
+                walk_expression(scan, statement->u.return_s.return_value,
+                                visit);
+            }
+            break;
+        case GLOBAL_STATEMENT:      /* FALLTHRU */
+        case BREAK_STATEMENT:       /* FALLTHRU */
+        case CONTINUE_STATEMENT:
+            break;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n", statement->type));
+    }
+}
+
+static void
+walk_statement_list(LoopScan *scan, StatementList *list,
+                    ExpressionVisitor visit)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        walk_statement(scan, pos->statement, visit);
+    }
+}
+
+static int
+variable_index(LoopScan *scan, int slot, int global_index)
+{
+    if (slot >= 0)
+        return slot;
+    return scan->local_count + global_index;
+}
+
+/**
+ * 记录赋值的变量和用户函数的调用
+ */
+static void
+scan_write(LoopScan *scan, Expression *expr)
+{
+    FunctionDefinition *func;
+
+    if (expr->type == ASSIGN_EXPRESSION) {
+        scan->written[variable_index(scan, expr->u.assign_expression.slot,
+                                     expr->u.assign_expression
+                                     .global_index)] = LEN_TRUE;
+    } else if (expr->type == FUNCTION_CALL_EXPRESSION) {
+        func = expr->u.function_call_expression.function;
+        if (func == NULL || func->type == LEMON_FUNCTION_DEFINITION) {
+            scan->has_call = LEN_TRUE;
+        }
+    }
+}
+
+/**
+ * 循环体中值不变的变量，全局变量还要求循环体中没有用户函数的调用
+ */
+static LEN_Boolean
+is_invariant_variable(LoopScan *scan, Expression *identifier)
+{
+    if (scan->written[variable_index(scan, identifier->u.identifier.slot,
+                                     identifier->u.identifier.global_index)])
+        return LEN_FALSE;
+    return identifier->u.identifier.slot >= 0 || !scan->has_call;
+}
+
+static LEN_Boolean
+is_counter(CountedLoop *loop, Expression *expr)
+{
+    return expr->type == IDENTIFIER_EXPRESSION
+        && expr->u.identifier.slot == loop->slot
+        && expr->u.identifier.global_index == loop->global_index;
+}
+
+/**
+ * 收集计数变量乘以整数常量或者循环不变量的乘法
+ * 内层的计数循环已经收集过的乘法不再收集
+ */
+static void
+scan_induction(LoopScan *scan, Expression *expr)
+{
+    CountedLoop *loop = scan->loop;
+    Expression  *factor;
+
+    if (expr->type != MUL_EXPRESSION || expr->fused != FUSED_NONE)
+        return;
+    if (is_counter(loop, expr->u.binary_expression.left)) {
+        factor = expr->u.binary_expression.right;
+    } else if (is_counter(loop, expr->u.binary_expression.right)) {
+        factor = expr->u.binary_expression.left;
+    } else {
+        return;
+    }
+    if (factor->type != INT_EXPRESSION
+        && (factor->type != IDENTIFIER_EXPRESSION || is_counter(loop, factor)
+            || !is_invariant_variable(scan, factor)))
+        return;
+
+    if (loop->induction_count >= scan->induction_alloc_size) {
+        scan->induction_alloc_size = scan->induction_alloc_size * 2 + 4;
+        loop->induction = MEM_realloc(loop->induction,
+                                      sizeof(Expression*)
+                                      * scan->induction_alloc_size);
+    }
+    loop->induction[loop->induction_count++] = expr;
+    expr->fused = FUSED_INDUCTION;
+}
+
+/**
+ * 强度削弱的乘法的列表复制到interpreter_storage
+ */
+static void
+fix_inductions(CountedLoop *loop)
+{
+    Expression **induction = loop->induction;
+
+    if (loop->induction_count == 0) {
+        MEM_free(induction);
+        loop->induction = NULL;
+        loop->induction_step = NULL;
+        return;
+    }
+    loop->induction = len_malloc(sizeof(Expression*) * loop->induction_count);
+    memcpy(loop->induction, induction,
+           sizeof(Expression*) * loop->induction_count);
+    MEM_free(induction);
+    loop->induction_step = len_malloc(sizeof(long long)
+                                      * loop->induction_count);
+}
+
+/**
+ * 识别for (i = 初值; i 比较 上限; i = i ± 常量)
+ * 条件是计数变量和变量或者整数常量的比较(==除外)，计数变量在左边
+ */
+static void
+find_counted_loop(LoopScan *scan, Statement *statement)
+{
+    Expression  *cond = statement->u.for_s.condition;
+    Expression  *post = statement->u.for_s.post;
+    Expression  *counter;
+    Expression  *limit;
+    Expression  *operand;
+    CountedLoop counted;
+    CountedLoop *loop = &counted;
+    long long   step;
+
+    if (cond == NULL || post == NULL || !dkc_is_compare_operator(cond->type)
+        || cond->type == EQ_EXPRESSION)
+        return;
+    counter = cond->u.binary_expression.left;
+    limit = cond->u.binary_expression.right;
+    if (counter->type != IDENTIFIER_EXPRESSION
+        || (limit->type != INT_EXPRESSION
+            && limit->type != IDENTIFIER_EXPRESSION))
+        return;
+
+    if (post->type != ASSIGN_EXPRESSION
+        || post->u.assign_expression.slot != counter->u.identifier.slot
+        || (post->u.assign_expression.global_index
+            != counter->u.identifier.global_index))
+        return;
+    operand = post->u.assign_expression.operand;
+    if ((operand->type != ADD_EXPRESSION && operand->type != SUB_EXPRESSION)
+        || operand->u.binary_expression.right->type != INT_EXPRESSION)
+        return;
+    loop->slot = counter->u.identifier.slot;
+    loop->global_index = counter->u.identifier.global_index;
+    if (!is_counter(loop, operand->u.binary_expression.left))
+        return;
+    step = operand->u.binary_expression.right->u.int_value;
+    if (operand->type == SUB_EXPRESSION) {
+        if (__builtin_sub_overflow(0, step, &step))
+            return;
+    }
+    if (step == 0)
+        return;
+
+    memset(scan->written, 0, sizeof(LEN_Boolean) * scan->variable_count);
+    scan->has_call = LEN_FALSE;
+    walk_statement_list(scan, statement->u.for_s.block->statement_list,
+                        scan_write);
+    if (!is_invariant_variable(scan, counter)
+        || (limit->type == IDENTIFIER_EXPRESSION
+            && (is_counter(loop, limit) || !is_invariant_variable(scan, limit))))
+        return;
+
+    loop->operator = cond->type;
+    loop->limit = limit;
+    loop->step = step;
+    loop->induction_count = 0;
+    loop->induction = NULL;
+    scan->induction_alloc_size = 0;
+    // 有函数调用时同一个循环可能递归执行，积不能保存在节点中
+    if (!scan->has_call) {
+        scan->loop = loop;
+        walk_statement_list(scan, statement->u.for_s.block->statement_list,
+                            scan_induction);
+    }
+    fix_inductions(loop);
+    statement->u.for_s.counted = len_malloc(sizeof(CountedLoop));
+    *statement->u.for_s.counted = counted;
+}
+
+/**
+ * 先处理内层的循环，内层的计数循环先收集属于自己的乘法
+ */
+static void
+find_in_statement(LoopScan *scan, Statement *statement)
+{
+    Elsif *elsif;
+
+    switch (statement->type) {
+        case IF_STATEMENT:
+            find_in_statement_list(scan, statement->u.if_s.then_block
+                                   ->statement_list);
+            for (elsif = statement->u.if_s.elsif_list; elsif;
+                 elsif = elsif->next) {
+                find_in_statement_list(scan, elsif->block->statement_list);
+            }
+            if (statement->u.if_s.else_block) {
+                find_in_statement_list(scan, statement->u.if_s.else_block
+                                       ->statement_list);
+            }
+            break;
+        case WHILE_STATEMENT:
+            find_in_statement_list(scan, statement->u.while_s.block
+                                   ->statement_list);
+            break;
+        case FOR_STATEMENT:
+            find_in_statement_list(scan, statement->u.for_s.block
+                                   ->statement_list);
+            find_counted_loop(scan, statement);
+            break;
+        case EXPRESSION_STATEMENT:  /* FALLTHRU */
+        case GLOBAL_STATEMENT:      /* FALLTHRU */
+        case RETURN_STATEMENT:      /* FALLTHRU */
+        case BREAK_STATEMENT:       /* FALLTHRU */
+        case CONTINUE_STATEMENT:
+            break;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n", statement->type));
+    }
+}
+
+static void
+find_in_statement_list(LoopScan *scan, StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        find_in_statement(scan, pos->statement);
+    }
+}
+
+static void
+find_in_block(LEN_Interpreter *inter, int local_count, StatementList *list)
+{
+    LoopScan    scan;
+
+    scan.local_count = local_count;
+    scan.variable_count = local_count + inter->global_variable.count;
+    scan.written = MEM_malloc(sizeof(LEN_Boolean)
+                              * (scan.variable_count + 1));
+    scan.has_call = LEN_FALSE;
+    scan.loop = NULL;
+    scan.induction_alloc_size = 0;
+    find_in_statement_list(&scan, list);
+    MEM_free(scan.written);
+}
+
+/**
+ * 识别函数和顶层语句链中的计数循环
+ */
+void
+len_find_counted_loops(LEN_Interpreter *inter)
+{
+    FunctionDefinition  *func;
+
+    if (!(inter->optimize_flags & LEN_OPTIMIZE_LOOP))
+        return;
+
+    find_in_block(inter, 0, inter->statement_list);
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type != LEMON_FUNCTION_DEFINITION)
+            continue;
+        find_in_block(inter, func->u.lemon_f.local_variable_count,
+                      func->u.lemon_f.block->statement_list);
+    }
+}
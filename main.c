@@ -7,27 +7,93 @@
 //
 
 #include <stdio.h>
+#include <string.h>
 #include "LEN.h"
 #include "MEM.h"
 
+static void
+usage(char *command)
+{
+    fprintf(stderr, "usage:%s [-ast|-vm|-closure|-jit|--emit-c] "
+            "[-O0|-fno-cse|-fno-gvn|-fno-licm|-fno-inline|-fno-infer"
+            "|-fno-fuse|-fno-loop|-fno-dispatch|-fno-borrow|-fno-pure|-fno-memo]"
+            " filename\n", command);
+    exit(1);
+}
+
 int
 main(int argc, char **argv)
 {
     LEN_Interpreter     *interpreter;
+    LEN_ExecuteMode     mode = LEN_EXECUTE_BYTECODE;
+    int                 emit_c = 0;
+    int                 optimize_flags = LEN_OPTIMIZE_ALL;
+    char *filename = NULL;
     FILE *fp;
-    
-    if (argc != 2) {
-        fprintf(stderr, "usage:%s filename", argv[0]);
-        exit(1);
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-ast")) {
+            mode = LEN_EXECUTE_AST;
+        } else if (!strcmp(argv[i], "-vm")) {
+            mode = LEN_EXECUTE_BYTECODE;
+        } else if (!strcmp(argv[i], "-closure")) {
+            mode = LEN_EXECUTE_CLOSURE;
+        } else if (!strcmp(argv[i], "-jit")) {
+            mode = LEN_EXECUTE_JIT;
+        } else if (!strcmp(argv[i], "--emit-c")) {
+            // 只需要分析树
+            mode = LEN_EXECUTE_AST;
+            emit_c = 1;
+        } else if (!strcmp(argv[i], "-O0")) {
+            optimize_flags = 0;
+        } else if (!strcmp(argv[i], "-fno-cse")) {
+            optimize_flags &= ~LEN_OPTIMIZE_CSE;
+        } else if (!strcmp(argv[i], "-fno-gvn")) {
+            optimize_flags &= ~LEN_OPTIMIZE_GVN;
+        } else if (!strcmp(argv[i], "-fno-licm")) {
+            optimize_flags &= ~LEN_OPTIMIZE_LICM;
+        } else if (!strcmp(argv[i], "-fno-inline")) {
+            optimize_flags &= ~LEN_OPTIMIZE_INLINE;
+        } else if (!strcmp(argv[i], "-fno-infer")) {
+            optimize_flags &= ~LEN_OPTIMIZE_INFER;
+        } else if (!strcmp(argv[i], "-fno-fuse")) {
+            optimize_flags &= ~LEN_OPTIMIZE_FUSE;
+        } else if (!strcmp(argv[i], "-fno-loop")) {
+            optimize_flags &= ~LEN_OPTIMIZE_LOOP;
+        } else if (!strcmp(argv[i], "-fno-dispatch")) {
+            optimize_flags &= ~LEN_OPTIMIZE_DISPATCH;
+        } else if (!strcmp(argv[i], "-fno-borrow")) {
+            optimize_flags &= ~LEN_OPTIMIZE_BORROW;
+        } else if (!strcmp(argv[i], "-fno-pure")) {
+            optimize_flags &= ~LEN_OPTIMIZE_PURE;
+        } else if (!strcmp(argv[i], "-fno-memo")) {
+            optimize_flags &= ~LEN_OPTIMIZE_MEMO;
+        } else if (argv[i][0] != '-' && filename == NULL) {
+            filename = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (filename == NULL) {
+        usage(argv[0]);
     }
     
-    fp = fopen(argv[1], "r");
+    fp = fopen(filename, "r");
     if (fp == NULL) {
-        fprintf(stderr, "%s not found.\n", argv[1]);
+        fprintf(stderr, "%s not found.\n", filename);
         exit(1);
     }
     interpreter = LEN_create_interpreter();
+    LEN_set_execute_mode(interpreter, mode);
+    LEN_set_optimize_flags(interpreter, optimize_flags);
     LEN_compile(interpreter, fp);
+    if (emit_c) {
+        // 生成的C代码输出到标准输出
+        LEN_emit_c(interpreter, stdout);
+        LEN_dispose_interpreter(interpreter);
+        return 0;
+    }
     LEN_interpret(interpreter);
     LEN_dispose_interpreter(interpreter);
     
@@ -0,0 +1,362 @@
+//
+//  memo.c
+//  lemon
+//  这个文件缓存纯函数的调用结果。纯函数的结果只由参数决定，
+//  遍历分析树执行时先按参数的值查找缓存，找到时不再执行函数主体。
+//  只缓存主体中有用户函数调用或者循环的纯函数，简单的函数查找缓存
+//  比直接执行还慢。参数是整数、实数、boolean、字符串和null时才缓存，
+//  每个函数的缓存是固定大小的直接映射表，冲突时新的结果替换旧的结果
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+static LEN_Boolean is_costly_statement_list(StatementList *list);
+
+/*
+ * 选出缓存结果的函数
+ */
+
+static LEN_Boolean
+is_costly_expression(Expression *expr)
+{
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+        case INT_EXPRESSION:        /* FALLTHRU */
+        case DOUBLE_EXPRESSION:     /* FALLTHRU */
+        case STRING_EXPRESSION:     /* FALLTHRU */
+        case NULL_EXPRESSION:       /* FALLTHRU */
+        case IDENTIFIER_EXPRESSION:
+            return LEN_FALSE;
+        case ASSIGN_EXPRESSION:
+            return is_costly_expression(expr->u.assign_expression.operand);
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            return is_costly_expression(expr->u.binary_expression.left)
+                || is_costly_expression(expr->u.binary_expression.right);
+        case MINUS_EXPRESSION:
+            return is_costly_expression(expr->u.minus_expression);
+        case BIT_NOT_EXPRESSION:
+            return is_costly_expression(expr->u.bit_not_expression);
+        case FUNCTION_CALL_EXPRESSION:  /* FALLTHRU */
+        case INLINE_CALL_EXPRESSION:
+            return LEN_TRUE;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+    return LEN_FALSE;
+}
+
+static LEN_Boolean
+is_costly_statement(Statement *statement)
+{
+    Elsif *elsif;
+
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            return is_costly_expression(statement->u.expression_s);
+        case IF_STATEMENT:
+            if (is_costly_expression(statement->u.if_s.condition)
+                || is_costly_statement_list(statement->u.if_s.then_block
+                                            ->statement_list))
+                return LEN_TRUE;
+            for (elsif = statement->u.if_s.elsif_list; elsif;
+                 elsif = elsif->next) {
+                if (is_costly_expression(elsif->condition)
+                    || is_costly_statement_list(elsif->block->statement_list))
+                    return LEN_TRUE;
+            }
+            return statement->u.if_s.else_block
+                && is_costly_statement_list(statement->u.if_s.else_block
+                                            ->statement_list);
+        case WHILE_STATEMENT:       /* FALLTHRU */
+        case FOR_STATEMENT:
+            return LEN_TRUE;
+        case RETURN_STATEMENT:
+            return statement->u.return_s.return_value
+                && is_costly_expression(statement->u.return_s.return_value);
+        case GLOBAL_STATEMENT:      /* FALLTHRU */
+        case BREAK_STATEMENT:       /* FALLTHRU */
+        case CONTINUE_STATEMENT:
+            return LEN_FALSE;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n", statement->type));
+    }
+    return LEN_FALSE;
+}
+
+static LEN_Boolean
+is_costly_statement_list(StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        if (is_costly_statement(pos->statement))
+            return LEN_TRUE;
+    }
+    return LEN_FALSE;
+}
+
+/**
+ * 给主体中有调用或者循环的纯函数创建缓存，表在第一次保存结果时分配
+ */
+void
+len_select_memo_functions(LEN_Interpreter *inter)
+{
+    FunctionDefinition  *func;
+    ParameterList       *param;
+    int count;
+
+    if (!(inter->optimize_flags & LEN_OPTIMIZE_MEMO))
+        return;
+
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type != LEMON_FUNCTION_DEFINITION || !func->u.lemon_f.pure)
+            continue;
+        for (count = 0, param = func->u.lemon_f.parameter; param;
+             param = param->next) {
+            count++;
+        }
+        if (count == 0 || count > MEMO_ARGUMENT_MAX
+            || !is_costly_statement_list(func->u.lemon_f.block
+                                         ->statement_list))
+            continue;
+        func->u.lemon_f.memo = len_malloc(sizeof(MemoTable));
+        func->u.lemon_f.memo->argument_count = count;
+        func->u.lemon_f.memo->slot = NULL;
+        func->u.lemon_f.memo->argument = NULL;
+    }
+}
+
+/*
+ * 运行时的查找和保存
+ */
+
+/**
+ * 参数或者结果能不能作为缓存的值，原生指针不缓存
+ */
+static LEN_Boolean
+is_memo_value(LEN_Value *v)
+{
+    return v->type != LEN_NATIVE_POINTER_VALUE;
+}
+
+static unsigned int
+hash_value(LEN_Value *v)
+{
+    unsigned long long bits = 0;
+
+    switch (v->type) {
+        case LEN_BOOLEAN_VALUE:
+            return v->u.boolean_value;
+        case LEN_INT_VALUE:
+            bits = (unsigned long long)v->u.int_value;
+            break;
+        case LEN_DOUBLE_VALUE:
+            memcpy(&bits, &v->u.double_value, sizeof(bits));
+            break;
+        case LEN_STRING_VALUE:
+            return len_hash_string(v->u.string_value->string);
+        case LEN_NULL_VALUE:
+            return 0;
+        case LEN_NATIVE_POINTER_VALUE:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", v->type));
+    }
+    return (unsigned int)(bits ^ (bits >> 32));
+}
+
+/**
+ * 类型相同并且值相同，实数按位比较，-0.0和0.0是不同的键
+ */
+static LEN_Boolean
+is_same_value(LEN_Value *a, LEN_Value *b)
+{
+    if (a->type != b->type)
+        return LEN_FALSE;
+    switch (a->type) {
+        case LEN_BOOLEAN_VALUE:
+            return a->u.boolean_value == b->u.boolean_value;
+        case LEN_INT_VALUE:
+            return a->u.int_value == b->u.int_value;
+        case LEN_DOUBLE_VALUE:
+            return !memcmp(&a->u.double_value, &b->u.double_value,
+                           sizeof(double));
+        case LEN_STRING_VALUE:
+            return a->u.string_value == b->u.string_value
+                || !strcmp(a->u.string_value->string,
+                           b->u.string_value->string);
+        case LEN_NULL_VALUE:
+            return LEN_TRUE;
+        case LEN_NATIVE_POINTER_VALUE:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", a->type));
+    }
+    return LEN_FALSE;
+}
+
+/**
+ * 参数的散列值，有不能缓存的参数时返回LEN_FALSE
+ */
+static LEN_Boolean
+hash_arguments(MemoTable *memo, LEN_Value *args, unsigned int *hash)
+{
+    unsigned int h = 0;
+    int i;
+
+    for (i = 0; i < memo->argument_count; i++) {
+        if (!is_memo_value(&args[i]))
+            return LEN_FALSE;
+        h = h * 31 + args[i].type;
+        h = h * 31 + hash_value(&args[i]);
+    }
+    *hash = h;
+    return LEN_TRUE;
+}
+
+/**
+ * 散列值打散之后取低位，连续的整数参数也能分散到不同的槽
+ */
+static int
+slot_index(unsigned int hash)
+{
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bU;
+    hash ^= hash >> 16;
+    return (int)(hash & (MEMO_TABLE_SIZE - 1));
+}
+
+/**
+ * 找到缓存的结果时放进result，字符串增加引用计数，返回LEN_TRUE
+ * 找不到时把参数复制到key，函数执行时可能给参数赋值，
+ * 所以字符串增加引用计数，由len_memo_store()保存结果时释放
+ */
+LEN_Boolean
+len_memo_lookup(MemoTable *memo, LEN_Value *args, LEN_Value *key,
+                LEN_Value *result)
+{
+    MemoSlot        *slot;
+    LEN_Value       *saved;
+    unsigned int    hash;
+    int index;
+    int i;
+
+    if (memo->slot && hash_arguments(memo, args, &hash)) {
+        index = slot_index(hash);
+        slot = &memo->slot[index];
+        saved = &memo->argument[index * memo->argument_count];
+        if (slot->used && slot->hash == hash) {
+            for (i = 0; i < memo->argument_count; i++) {
+                if (!is_same_value(&saved[i], &args[i]))
+                    break;
+            }
+            if (i == memo->argument_count) {
+                *result = slot->result;
+                len_refer_if_string(result);
+                return LEN_TRUE;
+            }
+        }
+    }
+    for (i = 0; i < memo->argument_count; i++) {
+        key[i] = args[i];
+        len_refer_if_string(&key[i]);
+    }
+    return LEN_FALSE;
+}
+
+static void
+release_slot(MemoTable *memo, int index)
+{
+    int i;
+
+    for (i = 0; i < memo->argument_count; i++) {
+        len_release_if_string(&memo->argument[index * memo->argument_count
+                                              + i]);
+    }
+    len_release_if_string(&memo->slot[index].result);
+}
+
+/**
+ * 把结果保存到参数对应的槽，槽里原来的结果被替换
+ * 键的引用计数转给缓存，不能缓存时直接释放
+ */
+void
+len_memo_store(MemoTable *memo, LEN_Value *key, LEN_Value *result)
+{
+    unsigned int    hash;
+    int index;
+    int i;
+
+    if (!is_memo_value(result) || !hash_arguments(memo, key, &hash)) {
+        for (i = 0; i < memo->argument_count; i++) {
+            len_release_if_string(&key[i]);
+        }
+        return;
+    }
+    if (memo->slot == NULL) {
+        memo->slot = MEM_malloc(sizeof(MemoSlot) * MEMO_TABLE_SIZE);
+        memo->argument = MEM_malloc(sizeof(LEN_Value) * MEMO_TABLE_SIZE
+                                    * memo->argument_count);
+        for (i = 0; i < MEMO_TABLE_SIZE; i++) {
+            memo->slot[i].used = LEN_FALSE;
+        }
+    }
+    index = slot_index(hash);
+    if (memo->slot[index].used) {
+        release_slot(memo, index);
+    }
+    memo->slot[index].used = LEN_TRUE;
+    memo->slot[index].hash = hash;
+    memo->slot[index].result = *result;
+    len_refer_if_string(&memo->slot[index].result);
+    memcpy(&memo->argument[index * memo->argument_count], key,
+           sizeof(LEN_Value) * memo->argument_count);
+}
+
+/**
+ * 释放缓存中的字符串和表，MemoTable本身随解释器的内存一起释放
+ */
+void
+len_dispose_memo_tables(LEN_Interpreter *inter)
+{
+    FunctionDefinition  *func;
+    MemoTable           *memo;
+    int i;
+
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type != LEMON_FUNCTION_DEFINITION
+            || (memo = func->u.lemon_f.memo) == NULL || memo->slot == NULL)
+            continue;
+        for (i = 0; i < MEMO_TABLE_SIZE; i++) {
+            if (memo->slot[i].used) {
+                release_slot(memo, i);
+            }
+        }
+        MEM_free(memo->slot);
+        MEM_free(memo->argument);
+        memo->slot = NULL;
+        memo->argument = NULL;
+    }
+}
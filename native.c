@@ -42,7 +42,7 @@ LEN_Value len_nv_print_proc(LEN_Interpreter *interpreter,
             }
             break;
         case LEN_INT_VALUE:
-            printf("%d", args[0].u.int_value);
+            printf("%lld", args[0].u.int_value);
             break;
         case LEN_DOUBLE_VALUE:
             printf("%f", args[0].u.double_value);
@@ -52,8 +52,8 @@ LEN_Value len_nv_print_proc(LEN_Interpreter *interpreter,
             break;
         case LEN_NATIVE_POINTER_VALUE:
             printf("(%s:%p)",
-                   args[0].u.native_pointer.info->name,
-                   args[0].u.native_pointer.pointer);
+                   LEN_native_pointer_info(&args[0])->name,
+                   LEN_native_pointer(&args[0]));
             break;
         case LEN_NULL_VALUE:
             printf("null");
@@ -87,9 +87,8 @@ LEN_Value len_nv_fopen_proc(LEN_Interpreter *interpreter,
     if (fp == NULL) {
         value.type = LEN_NULL_VALUE;
     } else {
-        value.type = LEN_NATIVE_POINTER_VALUE;
-        value.u.native_pointer.info = &st_native_lib_info;
-        value.u.native_pointer.pointer = fp;
+        value = LEN_create_native_pointer(interpreter,
+                                          &st_native_lib_info, fp);
     }
     
     return value;
@@ -98,7 +97,7 @@ LEN_Value len_nv_fopen_proc(LEN_Interpreter *interpreter,
 static LEN_Boolean
 check_native_pointer(LEN_Value *value)
 {
-    return value->u.native_pointer.info == &st_native_lib_info;
+    return LEN_native_pointer_info(value) == &st_native_lib_info;
 }
 
 LEN_Value len_nv_fclose_proc(LEN_Interpreter *interpreter,
@@ -120,8 +119,9 @@ LEN_Value len_nv_fclose_proc(LEN_Interpreter *interpreter,
         len_runtime_error(0, FCLOSE_ARGUMENT_TYPE_ERR,
                           MESSAGE_ARGUMENT_END);
     }
-    fp = args[0].u.native_pointer.pointer;
+    fp = LEN_native_pointer(&args[0]);
     fclose(fp);
+    LEN_release_native_pointer(interpreter, &args[0]);
     
     return value;
 }
@@ -147,7 +147,7 @@ LEN_Value len_nv_fgets_proc(LEN_Interpreter *interpreter,
         len_runtime_error(0, FGETS_ARGUMENT_TYPE_ERR,
                           MESSAGE_ARGUMENT_END);
     }
-    fp = args[0].u.native_pointer.pointer;
+    fp = LEN_native_pointer(&args[0]);
     
     while (fgets(buf, LINE_BUF_SIZE, fp)) {
         int new_len;
@@ -192,7 +192,7 @@ LEN_Value len_nv_fputs_proc(LEN_Interpreter *interpreter,
             len_runtime_error(0, FPUTS_ARGUMENT_TYPE_ERR,
                               MESSAGE_ARGUMENT_END);
         }
-    fp = args[1].u.native_pointer.pointer;
+    fp = LEN_native_pointer(&args[1]);
     
     fputs(args[0].u.string_value->string, fp);
     
@@ -204,16 +204,13 @@ len_add_std_fp(LEN_Interpreter *inter)
 {
     LEN_Value fp_value;
     
-    fp_value.type = LEN_NATIVE_POINTER_VALUE;
-    fp_value.u.native_pointer.info = &st_native_lib_info;
-    
-    fp_value.u.native_pointer.pointer = stdin;
+    fp_value = LEN_create_native_pointer(inter, &st_native_lib_info, stdin);
     LEN_add_global_variable(inter, "STDIN", &fp_value);
     
-    fp_value.u.native_pointer.pointer = stdout;
+    fp_value = LEN_create_native_pointer(inter, &st_native_lib_info, stdout);
     LEN_add_global_variable(inter, "STDOUT", &fp_value);
     
-    fp_value.u.native_pointer.pointer = stderr;
+    fp_value = LEN_create_native_pointer(inter, &st_native_lib_info, stderr);
     LEN_add_global_variable(inter, "STDERR", &fp_value);
 }
 
@@ -0,0 +1,1506 @@
+//
+//  optimize.c
+//  lemon
+//  这个文件主要用来优化generate.c生成的字节码
+//  把字节码划分成基本块，以寄存器、局部变量和全局变量为变量构造SSA形式，
+//  在支配树上进行全局值编号(GVN)，消除冗余的运算(CSE)。
+//  冗余运算的结果保存在新增的寄存器中，之后的运算改成复制，用不到的读取指令一并删除。
+//  循环不变量外提(LICM)由generate.c剥离循环的第一次迭代实现，
+//  循环中的不变运算被第一次迭代中的同样运算支配，由GVN消除
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+#define VALUE_TABLE_SIZE    (127)
+#define CODE_ALLOC_SIZE     (256)
+
+/**
+ * 基本块，下标0是虚拟的入口块，没有指令，定义所有变量的初始值
+ */
+typedef struct {
+    /**指令的范围[start, end)*/
+    int         start;
+    int         end;
+    int         successor_count;
+    int         successor[2];
+    int         predecessor_count;
+    int         *predecessor;
+    /**逆后序中的位置，-1表示执行不到*/
+    int         rpo;
+    /**直接支配者*/
+    int         idom;
+    /**支配树的子节点，按逆后序排列*/
+    int         child_count;
+    int         *child;
+    /**支配边界*/
+    int         frontier_count;
+    int         *frontier;
+    /**块开头的phi(SSA值的下标)*/
+    int         phi_count;
+    int         *phi;
+} BasicBlock;
+
+typedef enum {
+    /**函数入口处变量的值(参数或者还没有赋值)*/
+    SSA_ENTRY = 1,
+    /**指令定义的值*/
+    SSA_INSTRUCTION,
+    /**基本块开头的phi*/
+    SSA_PHI,
+    /**函数调用之后全局变量的值，调用可能修改全局变量*/
+    SSA_CLOBBER
+} SSAValueKind;
+
+/**
+ * SSA值
+ */
+typedef struct {
+    SSAValueKind kind;
+    int         variable;
+    /**定义这个值的指令(SSA_INSTRUCTION)*/
+    int         pc;
+    /**phi所在的基本块*/
+    int         block;
+    /**phi的操作数，和前驱一一对应，-1表示还没有确定(回边)*/
+    int         *operand;
+    /**SSA_CLOBBER之前的值*/
+    int         previous;
+    int         value_number;
+    /**变量一定有值，读取时不会报错*/
+    LEN_Boolean assigned;
+    LEN_Boolean live;
+} SSAValue;
+
+/**
+ * 每条指令的SSA信息
+ */
+typedef struct {
+    int         block;
+    /**定义的SSA值，没有时为-1*/
+    int         def;
+    int         use_count;
+    int         *use;
+    /**冗余的运算，值为支配它的同样运算的pc，不冗余时为-1*/
+    int         leader;
+    /**结果被重用时保存结果的寄存器，-1表示不需要保存*/
+    int         save_register;
+    LEN_Boolean live;
+} InstructionInfo;
+
+/**
+ * 值编号的散列表项，key是运算和操作数的值编号
+ */
+typedef struct ValueEntry_tag {
+    int         opcode;
+    int         left;
+    int         right;
+    int         value_number;
+    int         pc;
+    int         block;
+    struct ValueEntry_tag *next;
+} ValueEntry;
+
+typedef struct {
+    LEN_Interpreter *inter;
+    ByteCode    *code;
+    /**优化之前的指令数，info按它分配*/
+    int         code_size;
+    int         flags;
+    int         parameter_count;
+    /**变量的编号：寄存器、局部变量、全局变量依次排列*/
+    int         register_count;
+    int         local_count;
+    int         global_count;
+    int         variable_count;
+    int         block_count;
+    BasicBlock  *block;
+    /**逆后序排列的基本块*/
+    int         rpo_count;
+    int         *rpo_order;
+    InstructionInfo *info;
+    int         value_count;
+    int         value_alloc_size;
+    SSAValue    *value;
+    /**重命名时每个变量当前的SSA值*/
+    int         *current;
+    int         value_number_count;
+    /**常量的值编号，-1表示还没有分配*/
+    int         *constant_number;
+    int         boolean_number[2];
+    int         null_number;
+    ValueEntry  *table[VALUE_TABLE_SIZE];
+    int         saved_count;
+} Optimizer;
+
+#define register_variable(opt, reg)     (reg)
+#define local_variable(opt, slot)       ((opt)->register_count + (slot))
+#define global_variable(opt, index) \
+((opt)->register_count + (opt)->local_count + (index))
+#define is_global_variable(opt, var) \
+((var) >= (opt)->register_count + (opt)->local_count)
+
+#define is_jump_opcode(op) \
+((op) == OP_JUMP || (op) == OP_JUMP_IF_FALSE || (op) == OP_JUMP_IF_TRUE)
+#define is_return_opcode(op) \
+((op) == OP_RETURN || (op) == OP_RETURN_NULL)
+
+/**
+ * 可以编号并消除的运算：结果只由操作数决定，没有其他副作用
+ */
+static LEN_Boolean
+is_pure_operation(int opcode)
+{
+    switch (opcode) {
+        case OP_ADD:            /* FALLTHRU */
+        case OP_SUB:            /* FALLTHRU */
+        case OP_MUL:            /* FALLTHRU */
+        case OP_DIV:            /* FALLTHRU */
+        case OP_MOD:            /* FALLTHRU */
+        case OP_EQ:             /* FALLTHRU */
+        case OP_NE:             /* FALLTHRU */
+        case OP_GT:             /* FALLTHRU */
+        case OP_GE:             /* FALLTHRU */
+        case OP_LT:             /* FALLTHRU */
+        case OP_LE:             /* FALLTHRU */
+        case OP_BIT_AND:        /* FALLTHRU */
+        case OP_BIT_OR:         /* FALLTHRU */
+        case OP_BIT_XOR:        /* FALLTHRU */
+        case OP_LEFT_SHIFT:     /* FALLTHRU */
+        case OP_RIGHT_SHIFT:    /* FALLTHRU */
+        case OP_MINUS:          /* FALLTHRU */
+        case OP_BIT_NOT:
+            return LEN_TRUE;
+        default:
+            return LEN_FALSE;
+    }
+}
+
+/**
+ * 指令定义和使用的变量，没有定义时def为-1，use最多两个
+ * 函数调用的参数数量不定，由rename_block()处理
+ */
+static void
+get_operand_variables(Optimizer *opt, Instruction *ins, int *def,
+                      int *use, int *use_count)
+{
+    *def = -1;
+    *use_count = 0;
+    switch (ins->opcode) {
+        case OP_LOAD_NULL:      /* FALLTHRU */
+        case OP_LOAD_BOOLEAN:   /* FALLTHRU */
+        case OP_LOAD_CONSTANT:
+            *def = register_variable(opt, ins->a);
+            break;
+        case OP_LOAD_GLOBAL:
+            *def = register_variable(opt, ins->a);
+            use[(*use_count)++] = global_variable(opt, ins->b);
+            break;
+        case OP_STORE_GLOBAL:
+            *def = global_variable(opt, ins->b);
+            use[(*use_count)++] = register_variable(opt, ins->a);
+            break;
+        case OP_LOAD_LOCAL:
+            *def = register_variable(opt, ins->a);
+            use[(*use_count)++] = local_variable(opt, ins->b);
+            break;
+        case OP_STORE_LOCAL:
+            *def = local_variable(opt, ins->b);
+            use[(*use_count)++] = register_variable(opt, ins->a);
+            break;
+        case OP_ADD:            /* FALLTHRU */
+        case OP_SUB:            /* FALLTHRU */
+        case OP_MUL:            /* FALLTHRU */
+        case OP_DIV:            /* FALLTHRU */
+        case OP_MOD:            /* FALLTHRU */
+        case OP_EQ:             /* FALLTHRU */
+        case OP_NE:             /* FALLTHRU */
+        case OP_GT:             /* FALLTHRU */
+        case OP_GE:             /* FALLTHRU */
+        case OP_LT:             /* FALLTHRU */
+        case OP_LE:             /* FALLTHRU */
+        case OP_BIT_AND:        /* FALLTHRU */
+        case OP_BIT_OR:         /* FALLTHRU */
+        case OP_BIT_XOR:        /* FALLTHRU */
+        case OP_LEFT_SHIFT:     /* FALLTHRU */
+        case OP_RIGHT_SHIFT:
+            *def = register_variable(opt, ins->a);
+            use[(*use_count)++] = register_variable(opt, ins->b);
+            use[(*use_count)++] = register_variable(opt, ins->c);
+            break;
+        case OP_MINUS:          /* FALLTHRU */
+        case OP_BIT_NOT:
+            *def = register_variable(opt, ins->a);
+            use[(*use_count)++] = register_variable(opt, ins->b);
+            break;
+        case OP_CALL:
+            *def = register_variable(opt, ins->a);
+            break;
+        case OP_CHECK_BOOLEAN:  /* FALLTHRU */
+        case OP_JUMP_IF_FALSE:  /* FALLTHRU */
+        case OP_JUMP_IF_TRUE:   /* FALLTHRU */
+        case OP_POP:            /* FALLTHRU */
+        case OP_RETURN:
+            use[(*use_count)++] = register_variable(opt, ins->a);
+            break;
+        case OP_JUMP:           /* FALLTHRU */
+        case OP_GLOBAL:         /* FALLTHRU */
+        case OP_RETURN_NULL:
+            break;
+        case OP_COPY:           /* FALLTHRU */
+        case OP_SAVE:           /* FALLTHRU */
+        case OP_CODE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad opcode..%d\n", ins->opcode));
+    }
+}
+
+/**
+ * 函数调用改写结果和参数所在的寄存器，还可能修改任何全局变量
+ */
+static LEN_Boolean
+is_defined_by(Optimizer *opt, Instruction *ins, int var)
+{
+    int def;
+    int use[2];
+    int use_count;
+
+    if (ins->opcode == OP_CALL) {
+        return (var == register_variable(opt, ins->a)
+                || (var > register_variable(opt, ins->a)
+                    && var < register_variable(opt, ins->a + ins->c))
+                || is_global_variable(opt, var));
+    }
+    get_operand_variables(opt, ins, &def, use, &use_count);
+
+    return def == var;
+}
+
+static int *
+append_int(int *array, int *count, int value)
+{
+    array = MEM_realloc(array, sizeof(int) * (*count + 1));
+    array[(*count)++] = value;
+
+    return array;
+}
+
+/**
+ * 划分基本块，跳转目标和跳转、返回之后的指令是基本块的开头
+ */
+static void
+build_blocks(Optimizer *opt)
+{
+    ByteCode    *code = opt->code;
+    LEN_Boolean *leader;
+    BasicBlock  *block;
+    int *block_of;
+    int pc;
+    int i;
+
+    leader = MEM_malloc(sizeof(LEN_Boolean) * (code->code_size + 1));
+    for (pc = 0; pc <= code->code_size; pc++) {
+        leader[pc] = (pc == 0);
+    }
+    for (pc = 0; pc < code->code_size; pc++) {
+        if (is_jump_opcode(code->code[pc].opcode)) {
+            leader[dkc_jump_target(&code->code[pc])] = LEN_TRUE;
+        }
+        if (is_jump_opcode(code->code[pc].opcode)
+            || is_return_opcode(code->code[pc].opcode)) {
+            leader[pc + 1] = LEN_TRUE;
+        }
+    }
+    // 下标0是虚拟的入口块
+    opt->block_count = 1;
+    for (pc = 0; pc < code->code_size; pc++) {
+        if (leader[pc]) {
+            opt->block_count++;
+        }
+    }
+    opt->block = MEM_malloc(sizeof(BasicBlock) * opt->block_count);
+    memset(opt->block, 0, sizeof(BasicBlock) * opt->block_count);
+    block_of = MEM_malloc(sizeof(int) * code->code_size);
+
+    i = 0;
+    for (pc = 0; pc < code->code_size; pc++) {
+        if (leader[pc]) {
+            i++;
+            opt->block[i].start = pc;
+        }
+        opt->block[i].end = pc + 1;
+        block_of[pc] = i;
+        opt->info[pc].block = i;
+    }
+    opt->block[0].successor_count = 1;
+    opt->block[0].successor[0] = 1;
+    for (i = 1; i < opt->block_count; i++) {
+        block = &opt->block[i];
+        pc = block->end - 1;
+        switch (code->code[pc].opcode) {
+            case OP_JUMP:
+                block->successor[block->successor_count++]
+                = block_of[dkc_jump_target(&code->code[pc])];
+                break;
+            case OP_JUMP_IF_FALSE:  /* FALLTHRU */
+            case OP_JUMP_IF_TRUE:
+                block->successor[block->successor_count++]
+                = block_of[dkc_jump_target(&code->code[pc])];
+                DBG_assert(pc + 1 < code->code_size, ("pc..%d\n", pc));
+                block->successor[block->successor_count++]
+                = block_of[pc + 1];
+                break;
+            case OP_RETURN:         /* FALLTHRU */
+            case OP_RETURN_NULL:
+                break;
+            default:
+                DBG_assert(pc + 1 < code->code_size, ("pc..%d\n", pc));
+                block->successor[block->successor_count++]
+                = block_of[pc + 1];
+                break;
+        }
+    }
+    MEM_free(leader);
+    MEM_free(block_of);
+}
+
+static void
+number_postorder(Optimizer *opt, int b, LEN_Boolean *visited, int *count)
+{
+    BasicBlock *block = &opt->block[b];
+    int i;
+
+    visited[b] = LEN_TRUE;
+    for (i = 0; i < block->successor_count; i++) {
+        if (!visited[block->successor[i]]) {
+            number_postorder(opt, block->successor[i], visited, count);
+        }
+    }
+    opt->rpo_order[(*count)++] = b;
+}
+
+/**
+ * 计算逆后序，执行不到的基本块不参与之后的分析
+ * 前驱只记录执行得到的基本块
+ */
+static void
+order_blocks(Optimizer *opt)
+{
+    LEN_Boolean *visited;
+    int count = 0;
+    int temp;
+    int b;
+    int i;
+
+    visited = MEM_malloc(sizeof(LEN_Boolean) * opt->block_count);
+    for (b = 0; b < opt->block_count; b++) {
+        visited[b] = LEN_FALSE;
+        opt->block[b].rpo = -1;
+    }
+    opt->rpo_order = MEM_malloc(sizeof(int) * opt->block_count);
+    number_postorder(opt, 0, visited, &count);
+    for (i = 0; i < count / 2; i++) {
+        temp = opt->rpo_order[i];
+        opt->rpo_order[i] = opt->rpo_order[count - 1 - i];
+        opt->rpo_order[count - 1 - i] = temp;
+    }
+    opt->rpo_count = count;
+    for (i = 0; i < count; i++) {
+        opt->block[opt->rpo_order[i]].rpo = i;
+    }
+    for (i = 0; i < count; i++) {
+        b = opt->rpo_order[i];
+        for (temp = 0; temp < opt->block[b].successor_count; temp++) {
+            BasicBlock *succ = &opt->block[opt->block[b].successor[temp]];
+            succ->predecessor = append_int(succ->predecessor,
+                                           &succ->predecessor_count, b);
+        }
+    }
+    MEM_free(visited);
+}
+
+static int
+intersect(Optimizer *opt, int b1, int b2)
+{
+    while (b1 != b2) {
+        while (opt->block[b1].rpo > opt->block[b2].rpo) {
+            b1 = opt->block[b1].idom;
+        }
+        while (opt->block[b2].rpo > opt->block[b1].rpo) {
+            b2 = opt->block[b2].idom;
+        }
+    }
+    return b1;
+}
+
+/**
+ * 计算支配树(Cooper, Harvey, Kennedy的迭代算法)和支配边界
+ */
+static void
+build_dominator_tree(Optimizer *opt)
+{
+    BasicBlock  *block;
+    LEN_Boolean changed;
+    int new_idom;
+    int runner;
+    int b;
+    int i;
+    int j;
+
+    for (b = 0; b < opt->block_count; b++) {
+        opt->block[b].idom = -1;
+    }
+    opt->block[0].idom = 0;
+    do {
+        changed = LEN_FALSE;
+        for (i = 1; i < opt->rpo_count; i++) {
+            block = &opt->block[opt->rpo_order[i]];
+            new_idom = -1;
+            for (j = 0; j < block->predecessor_count; j++) {
+                if (opt->block[block->predecessor[j]].idom < 0)
+                    continue;
+                if (new_idom < 0) {
+                    new_idom = block->predecessor[j];
+                } else {
+                    new_idom = intersect(opt, block->predecessor[j],
+                                         new_idom);
+                }
+            }
+            if (block->idom != new_idom) {
+                block->idom = new_idom;
+                changed = LEN_TRUE;
+            }
+        }
+    } while (changed);
+
+    // 按逆后序加入子节点，子节点自然按逆后序排列
+    for (i = 1; i < opt->rpo_count; i++) {
+        b = opt->rpo_order[i];
+        block = &opt->block[opt->block[b].idom];
+        block->child = append_int(block->child, &block->child_count, b);
+    }
+    for (i = 0; i < opt->rpo_count; i++) {
+        b = opt->rpo_order[i];
+        block = &opt->block[b];
+        if (block->predecessor_count < 2)
+            continue;
+        for (j = 0; j < block->predecessor_count; j++) {
+            for (runner = block->predecessor[j]; runner != block->idom;
+                 runner = opt->block[runner].idom) {
+                BasicBlock *r = &opt->block[runner];
+                if (r->frontier_count > 0
+                    && r->frontier[r->frontier_count - 1] == b)
+                    continue;
+                r->frontier = append_int(r->frontier, &r->frontier_count, b);
+            }
+        }
+    }
+}
+
+static int
+new_value(Optimizer *opt, SSAValueKind kind, int variable)
+{
+    SSAValue *v;
+
+    if (opt->value_count == opt->value_alloc_size) {
+        opt->value_alloc_size += CODE_ALLOC_SIZE;
+        opt->value = MEM_realloc(opt->value,
+                                 sizeof(SSAValue) * opt->value_alloc_size);
+    }
+    v = &opt->value[opt->value_count];
+    v->kind = kind;
+    v->variable = variable;
+    v->pc = -1;
+    v->block = -1;
+    v->operand = NULL;
+    v->previous = -1;
+    v->value_number = opt->value_number_count++;
+    v->assigned = LEN_TRUE;
+    v->live = LEN_FALSE;
+
+    return opt->value_count++;
+}
+
+/**
+ * 在定义变量的基本块的迭代支配边界上放置phi
+ * 入口块定义所有变量的初始值
+ */
+static void
+place_phi(Optimizer *opt)
+{
+    BasicBlock  *block;
+    int *has_phi;
+    int *in_worklist;
+    int *worklist;
+    int worklist_count;
+    int var;
+    int pc;
+    int b;
+    int f;
+    int i;
+
+    has_phi = MEM_malloc(sizeof(int) * opt->block_count);
+    in_worklist = MEM_malloc(sizeof(int) * opt->block_count);
+    worklist = MEM_malloc(sizeof(int) * opt->block_count);
+    for (b = 0; b < opt->block_count; b++) {
+        has_phi[b] = -1;
+        in_worklist[b] = -1;
+    }
+    for (var = 0; var < opt->variable_count; var++) {
+        worklist_count = 0;
+        for (i = 0; i < opt->rpo_count; i++) {
+            b = opt->rpo_order[i];
+            block = &opt->block[b];
+            for (pc = block->start; pc < block->end; pc++) {
+                if (is_defined_by(opt, &opt->code->code[pc], var))
+                    break;
+            }
+            if (b == 0 || pc < block->end) {
+                worklist[worklist_count++] = b;
+                in_worklist[b] = var;
+            }
+        }
+        while (worklist_count > 0) {
+            block = &opt->block[worklist[--worklist_count]];
+            for (i = 0; i < block->frontier_count; i++) {
+                f = block->frontier[i];
+                if (has_phi[f] == var)
+                    continue;
+                has_phi[f] = var;
+                opt->block[f].phi = append_int(opt->block[f].phi,
+                                               &opt->block[f].phi_count,
+                                               new_value(opt, SSA_PHI, var));
+                if (in_worklist[f] != var) {
+                    in_worklist[f] = var;
+                    worklist[worklist_count++] = f;
+                }
+            }
+        }
+    }
+    // 前驱的数量已经确定，分配phi的操作数
+    for (b = 0; b < opt->block_count; b++) {
+        block = &opt->block[b];
+        for (i = 0; i < block->phi_count; i++) {
+            SSAValue *phi = &opt->value[block->phi[i]];
+            phi->block = b;
+            phi->operand = MEM_malloc(sizeof(int) * block->predecessor_count);
+            for (f = 0; f < block->predecessor_count; f++) {
+                phi->operand[f] = -1;
+            }
+        }
+    }
+    MEM_free(has_phi);
+    MEM_free(in_worklist);
+    MEM_free(worklist);
+}
+
+static int
+hash_value_key(int opcode, int left, int right)
+{
+    unsigned int hash;
+
+    hash = (unsigned int)opcode * 31u + (unsigned int)left;
+    hash = hash * 31u + (unsigned int)right;
+
+    return hash % VALUE_TABLE_SIZE;
+}
+
+/**
+ * 查找支配当前基本块的同样运算
+ * 只做基本块内的CSE时，只查找当前基本块中的运算
+ */
+static ValueEntry *
+search_value(Optimizer *opt, int opcode, int left, int right, int b)
+{
+    ValueEntry *pos;
+
+    for (pos = opt->table[hash_value_key(opcode, left, right)]; pos;
+         pos = pos->next) {
+        if (pos->opcode == opcode && pos->left == left
+            && pos->right == right) {
+            if (!(opt->flags & LEN_OPTIMIZE_GVN) && pos->block != b)
+                return NULL;
+            return pos;
+        }
+    }
+    return NULL;
+}
+
+static void
+add_value(Optimizer *opt, int opcode, int left, int right, int value_number,
+          int pc, int b)
+{
+    ValueEntry *entry;
+    int hash = hash_value_key(opcode, left, right);
+
+    entry = MEM_malloc(sizeof(ValueEntry));
+    entry->opcode = opcode;
+    entry->left = left;
+    entry->right = right;
+    entry->value_number = value_number;
+    entry->pc = pc;
+    entry->block = b;
+    entry->next = opt->table[hash];
+    opt->table[hash] = entry;
+}
+
+/**
+ * 离开基本块时删除这个基本块加入的运算
+ * 表项按加入的顺序倒序排在链表头部，所以只需要检查链表头
+ */
+static void
+remove_block_values(Optimizer *opt, int b)
+{
+    ValueEntry *temp;
+    int i;
+
+    for (i = 0; i < VALUE_TABLE_SIZE; i++) {
+        while (opt->table[i] && opt->table[i]->block == b) {
+            temp = opt->table[i];
+            opt->table[i] = temp->next;
+            MEM_free(temp);
+        }
+    }
+}
+
+static int
+constant_value_number(Optimizer *opt, Instruction *ins)
+{
+    int *number = NULL;
+
+    switch (ins->opcode) {
+        case OP_LOAD_NULL:
+            number = &opt->null_number;
+            break;
+        case OP_LOAD_BOOLEAN:
+            number = &opt->boolean_number[ins->b ? 1 : 0];
+            break;
+        case OP_LOAD_CONSTANT:
+            number = &opt->constant_number[ins->b];
+            break;
+        default:
+            DBG_panic(("bad opcode..%d\n", ins->opcode));
+    }
+    if (*number < 0) {
+        *number = opt->value_number_count++;
+    }
+    return *number;
+}
+
+/**
+ * phi的操作数都已经确定并且值编号相同时，phi的值就是操作数的值
+ */
+static void
+number_phi(Optimizer *opt, SSAValue *phi)
+{
+    BasicBlock *block = &opt->block[phi->block];
+    int number = -1;
+    int i;
+
+    for (i = 0; i < block->predecessor_count; i++) {
+        if (phi->operand[i] < 0)
+            return;
+        if (i == 0) {
+            number = opt->value[phi->operand[i]].value_number;
+        } else if (number != opt->value[phi->operand[i]].value_number) {
+            return;
+        }
+    }
+    if (number >= 0) {
+        phi->value_number = number;
+    }
+}
+
+/**
+ * 给指令定义的值编号，支配它的同样运算存在时记录为冗余
+ */
+static void
+number_instruction(Optimizer *opt, int pc, int b)
+{
+    Instruction     *ins = &opt->code->code[pc];
+    InstructionInfo *info = &opt->info[pc];
+    SSAValue    *def = &opt->value[info->def];
+    ValueEntry  *entry;
+    int left;
+    int right;
+
+    switch (ins->opcode) {
+        case OP_LOAD_NULL:      /* FALLTHRU */
+        case OP_LOAD_BOOLEAN:   /* FALLTHRU */
+        case OP_LOAD_CONSTANT:
+            def->value_number = constant_value_number(opt, ins);
+            break;
+        case OP_LOAD_GLOBAL:    /* FALLTHRU */
+        case OP_STORE_GLOBAL:   /* FALLTHRU */
+        case OP_LOAD_LOCAL:     /* FALLTHRU */
+        case OP_STORE_LOCAL:
+            // 复制：和读取(写入)的值相同
+            def->value_number = opt->value[info->use[0]].value_number;
+            break;
+        default:
+            if (!is_pure_operation(ins->opcode))
+                break;
+            left = opt->value[info->use[0]].value_number;
+            right = (info->use_count > 1)
+                ? opt->value[info->use[1]].value_number : -1;
+            entry = search_value(opt, ins->opcode, left, right, b);
+            if (entry) {
+                def->value_number = entry->value_number;
+                info->leader = entry->pc;
+            } else {
+                add_value(opt, ins->opcode, left, right, def->value_number,
+                          pc, b);
+            }
+            break;
+    }
+}
+
+/**
+ * 沿支配树重命名变量，同时进行值编号
+ * 子节点按逆后序访问，访问一个基本块时，除了回边之外的前驱都已经处理过
+ */
+static void
+rename_block(Optimizer *opt, int b)
+{
+    BasicBlock  *block = &opt->block[b];
+    BasicBlock  *succ;
+    Instruction *ins;
+    InstructionInfo *info;
+    int *saved_current;
+    int use[2];
+    int def;
+    int pc;
+    int i;
+    int j;
+
+    saved_current = MEM_malloc(sizeof(int) * opt->variable_count);
+    memcpy(saved_current, opt->current, sizeof(int) * opt->variable_count);
+
+    for (i = 0; i < block->phi_count; i++) {
+        number_phi(opt, &opt->value[block->phi[i]]);
+        opt->current[opt->value[block->phi[i]].variable] = block->phi[i];
+    }
+    for (pc = block->start; pc < block->end; pc++) {
+        ins = &opt->code->code[pc];
+        info = &opt->info[pc];
+        get_operand_variables(opt, ins, &def, use, &info->use_count);
+        if (ins->opcode == OP_CALL) {
+            // 参数依次放在reg[a]开始的寄存器中
+            info->use_count = ins->c;
+            info->use = MEM_malloc(sizeof(int) * (ins->c + 1));
+            for (i = 0; i < ins->c; i++) {
+                info->use[i]
+                = opt->current[register_variable(opt, ins->a + i)];
+            }
+        } else {
+            info->use = MEM_malloc(sizeof(int) * (info->use_count + 1));
+            for (i = 0; i < info->use_count; i++) {
+                info->use[i] = opt->current[use[i]];
+            }
+        }
+        if (def >= 0) {
+            info->def = new_value(opt, SSA_INSTRUCTION, def);
+            opt->value[info->def].pc = pc;
+            number_instruction(opt, pc, b);
+            opt->current[def] = info->def;
+        }
+        if (ins->opcode == OP_CALL) {
+            // 参数交给被调用的函数，调用可能修改任何全局变量
+            for (i = 1; i < ins->c; i++) {
+                opt->current[register_variable(opt, ins->a + i)]
+                = new_value(opt, SSA_CLOBBER,
+                            register_variable(opt, ins->a + i));
+            }
+            for (i = 0; i < opt->global_count; i++) {
+                j = new_value(opt, SSA_CLOBBER, global_variable(opt, i));
+                opt->value[j].pc = pc;
+                opt->value[j].previous
+                = opt->current[global_variable(opt, i)];
+                opt->current[global_variable(opt, i)] = j;
+            }
+        }
+    }
+    for (i = 0; i < block->successor_count; i++) {
+        succ = &opt->block[block->successor[i]];
+        for (j = 0; succ->predecessor[j] != b; j++)
+            ;
+        for (pc = 0; pc < succ->phi_count; pc++) {
+            SSAValue *phi = &opt->value[succ->phi[pc]];
+            phi->operand[j] = opt->current[phi->variable];
+        }
+    }
+    for (i = 0; i < block->child_count; i++) {
+        rename_block(opt, block->child[i]);
+    }
+    remove_block_values(opt, b);
+
+    memcpy(opt->current, saved_current, sizeof(int) * opt->variable_count);
+    MEM_free(saved_current);
+}
+
+/**
+ * 入口块定义所有变量的初始值，参数一定有值，其他变量还没有赋值
+ */
+static void
+build_ssa(Optimizer *opt)
+{
+    int var;
+    int v;
+
+    place_phi(opt);
+    opt->current = MEM_malloc(sizeof(int) * opt->variable_count);
+    for (var = 0; var < opt->variable_count; var++) {
+        v = new_value(opt, SSA_ENTRY, var);
+        opt->value[v].assigned
+        = (var >= local_variable(opt, 0)
+           && var < local_variable(opt, opt->parameter_count));
+        opt->current[var] = v;
+    }
+    rename_block(opt, 0);
+    MEM_free(opt->current);
+}
+
+/**
+ * 计算每个SSA值是否一定有值
+ * phi和函数调用之后的全局变量先假设有值，反复迭代直到不再变化
+ */
+static void
+compute_assigned(Optimizer *opt)
+{
+    SSAValue    *v;
+    LEN_Boolean changed;
+    LEN_Boolean assigned;
+    int i;
+    int j;
+
+    do {
+        changed = LEN_FALSE;
+        for (i = 0; i < opt->value_count; i++) {
+            v = &opt->value[i];
+            if (!v->assigned)
+                continue;
+            if (v->kind == SSA_PHI) {
+                assigned = LEN_TRUE;
+                for (j = 0; j < opt->block[v->block].predecessor_count; j++) {
+                    if (v->operand[j] >= 0
+                        && !opt->value[v->operand[j]].assigned) {
+                        assigned = LEN_FALSE;
+                    }
+                }
+            } else if (v->kind == SSA_CLOBBER && v->previous >= 0) {
+                assigned = opt->value[v->previous].assigned;
+            } else {
+                continue;
+            }
+            if (!assigned) {
+                v->assigned = LEN_FALSE;
+                changed = LEN_TRUE;
+            }
+        }
+    } while (changed);
+}
+
+/**
+ * 结果没有用到时可以删除的指令
+ * 读取变量只有在变量一定有值时才不会报错
+ */
+static LEN_Boolean
+is_removable(Optimizer *opt, int pc)
+{
+    Instruction     *ins = &opt->code->code[pc];
+    InstructionInfo *info = &opt->info[pc];
+
+    if (info->leader >= 0)
+        return LEN_TRUE;
+    switch (ins->opcode) {
+        case OP_LOAD_NULL:      /* FALLTHRU */
+        case OP_LOAD_BOOLEAN:   /* FALLTHRU */
+        case OP_LOAD_CONSTANT:
+            return LEN_TRUE;
+        case OP_LOAD_GLOBAL:    /* FALLTHRU */
+        case OP_LOAD_LOCAL:
+            return opt->value[info->use[0]].assigned;
+        default:
+            return LEN_FALSE;
+    }
+}
+
+/**
+ * 从不能删除的指令出发，标记用到的SSA值和定义它们的指令
+ * 冗余的运算改成复制保存的结果，不再使用原来的操作数
+ */
+static void
+mark_live(Optimizer *opt)
+{
+    InstructionInfo *info;
+    SSAValue    *v;
+    int *stack;
+    int stack_count = 0;
+    int pc;
+    int i;
+
+    stack = MEM_malloc(sizeof(int) * (opt->value_count + 1));
+    for (pc = 0; pc < opt->code->code_size; pc++) {
+        info = &opt->info[pc];
+        if (opt->block[info->block].rpo < 0 || is_removable(opt, pc))
+            continue;
+        info->live = LEN_TRUE;
+        for (i = 0; i < info->use_count; i++) {
+            if (!opt->value[info->use[i]].live) {
+                opt->value[info->use[i]].live = LEN_TRUE;
+                stack[stack_count++] = info->use[i];
+            }
+        }
+        // 用显式的栈代替递归，phi的链可能很长
+        while (stack_count > 0) {
+            v = &opt->value[stack[--stack_count]];
+            if (v->kind == SSA_PHI) {
+                for (i = 0; i < opt->block[v->block].predecessor_count; i++) {
+                    if (v->operand[i] >= 0
+                        && !opt->value[v->operand[i]].live) {
+                        opt->value[v->operand[i]].live = LEN_TRUE;
+                        stack[stack_count++] = v->operand[i];
+                    }
+                }
+            } else if (v->kind == SSA_INSTRUCTION
+                       && !opt->info[v->pc].live) {
+                opt->info[v->pc].live = LEN_TRUE;
+                if (opt->info[v->pc].leader >= 0)
+                    continue;
+                for (i = 0; i < opt->info[v->pc].use_count; i++) {
+                    int use = opt->info[v->pc].use[i];
+                    if (!opt->value[use].live) {
+                        opt->value[use].live = LEN_TRUE;
+                        stack[stack_count++] = use;
+                    }
+                }
+            }
+        }
+    }
+    MEM_free(stack);
+}
+
+/**
+ * 冗余运算的第一条运算之后保存结果
+ */
+static void
+assign_save_register(Optimizer *opt)
+{
+    InstructionInfo *info;
+    int pc;
+
+    for (pc = 0; pc < opt->code->code_size; pc++) {
+        info = &opt->info[pc];
+        if (info->leader < 0 || !info->live)
+            continue;
+        if (opt->info[info->leader].save_register < 0) {
+            opt->info[info->leader].save_register
+            = opt->register_count + opt->saved_count++;
+        }
+    }
+}
+
+typedef struct {
+    int         size;
+    int         alloc_size;
+    Instruction *code;
+    int         *line_number;
+} NewCode;
+
+static void
+append_instruction(NewCode *nc, int opcode, int a, int b, int c,
+                   int line_number)
+{
+    if (nc->size == nc->alloc_size) {
+        nc->alloc_size += CODE_ALLOC_SIZE;
+        nc->code = MEM_realloc(nc->code, sizeof(Instruction) * nc->alloc_size);
+        nc->line_number = MEM_realloc(nc->line_number,
+                                      sizeof(int) * nc->alloc_size);
+    }
+    DBG_assert(a >= 0 && a <= 65535, ("a..%d\n", a));
+    nc->code[nc->size].opcode = opcode;
+    nc->code[nc->size].a = a;
+    nc->code[nc->size].b = b;
+    nc->code[nc->size].c = c;
+    nc->line_number[nc->size] = line_number;
+    nc->size++;
+}
+
+/**
+ * 生成优化后的字节码
+ * 保存结果的寄存器在入口处置为null，返回之前释放
+ * 跳转目标按新的位置修正，删除的指令的位置由之后的第一条指令代替
+ */
+static void
+rewrite_code(Optimizer *opt)
+{
+    ByteCode        *code = opt->code;
+    Instruction     *ins;
+    InstructionInfo *info;
+    NewCode nc;
+    int *new_pc;
+    int target;
+    int line_number;
+    int pc;
+    int i;
+
+    memset(&nc, 0, sizeof(NewCode));
+    new_pc = MEM_malloc(sizeof(int) * (code->code_size + 1));
+    for (i = 0; i < opt->saved_count; i++) {
+        append_instruction(&nc, OP_LOAD_NULL, opt->register_count + i, 0, 0,
+                           code->line_number[0]);
+    }
+    for (pc = 0; pc < code->code_size; pc++) {
+        ins = &code->code[pc];
+        info = &opt->info[pc];
+        line_number = code->line_number[pc];
+        new_pc[pc] = nc.size;
+        if (opt->block[info->block].rpo < 0 || !info->live)
+            continue;
+        if (is_return_opcode(ins->opcode)) {
+            for (i = 0; i < opt->saved_count; i++) {
+                append_instruction(&nc, OP_POP, opt->register_count + i, 0, 0,
+                                   line_number);
+            }
+        }
+        if (info->leader >= 0) {
+            append_instruction(&nc, OP_COPY, ins->a,
+                               opt->info[info->leader].save_register, 0,
+                               line_number);
+            continue;
+        }
+        append_instruction(&nc, ins->opcode, ins->a, ins->b, ins->c,
+                           line_number);
+        if (info->save_register >= 0) {
+            append_instruction(&nc, OP_SAVE, info->save_register, ins->a, 0,
+                               line_number);
+        }
+    }
+    new_pc[code->code_size] = nc.size;
+    for (i = 0; i < nc.size; i++) {
+        if (is_jump_opcode(nc.code[i].opcode)) {
+            target = new_pc[dkc_jump_target(&nc.code[i])];
+            dkc_set_jump_target(&nc.code[i], target);
+        }
+    }
+
+    code->code_size = nc.size;
+    code->code = len_malloc(sizeof(Instruction) * nc.size);
+    memcpy(code->code, nc.code, sizeof(Instruction) * nc.size);
+    code->line_number = len_malloc(sizeof(int) * nc.size);
+    memcpy(code->line_number, nc.line_number, sizeof(int) * nc.size);
+    code->register_count = opt->register_count + opt->saved_count;
+
+    MEM_free(nc.code);
+    MEM_free(nc.line_number);
+    MEM_free(new_pc);
+}
+
+static void
+dispose_optimizer(Optimizer *opt)
+{
+    int i;
+
+    for (i = 0; i < opt->block_count; i++) {
+        MEM_free(opt->block[i].predecessor);
+        MEM_free(opt->block[i].child);
+        MEM_free(opt->block[i].frontier);
+        MEM_free(opt->block[i].phi);
+    }
+    MEM_free(opt->block);
+    MEM_free(opt->rpo_order);
+    for (i = 0; i < opt->code_size; i++) {
+        MEM_free(opt->info[i].use);
+    }
+    MEM_free(opt->info);
+    for (i = 0; i < opt->value_count; i++) {
+        MEM_free(opt->value[i].operand);
+    }
+    MEM_free(opt->value);
+    MEM_free(opt->constant_number);
+}
+
+/**
+ * 优化一个函数(或者顶层语句链)的字节码
+ * 没有可以消除的运算时保持原来的字节码不变
+ */
+void
+len_optimize_code(LEN_Interpreter *inter, ByteCode *code, int parameter_count)
+{
+    Optimizer   opt;
+    Instruction *ins;
+    LEN_Boolean changed = LEN_FALSE;
+    int pc;
+    int i;
+
+    if (!(inter->optimize_flags & (LEN_OPTIMIZE_CSE | LEN_OPTIMIZE_GVN)))
+        return;
+
+    memset(&opt, 0, sizeof(Optimizer));
+    opt.inter = inter;
+    opt.code = code;
+    opt.code_size = code->code_size;
+    opt.flags = inter->optimize_flags;
+    opt.parameter_count = parameter_count;
+    opt.register_count = code->register_count;
+    opt.local_count = parameter_count;
+    for (pc = 0; pc < code->code_size; pc++) {
+        ins = &code->code[pc];
+        if ((ins->opcode == OP_LOAD_LOCAL || ins->opcode == OP_STORE_LOCAL)
+            && ins->b >= opt.local_count) {
+            opt.local_count = ins->b + 1;
+        }
+    }
+    opt.global_count = inter->global_variable.count;
+    opt.variable_count = opt.register_count + opt.local_count
+        + opt.global_count;
+    opt.constant_number = MEM_malloc(sizeof(int) * (code->constant_count + 1));
+    for (i = 0; i < code->constant_count; i++) {
+        opt.constant_number[i] = -1;
+    }
+    opt.boolean_number[0] = opt.boolean_number[1] = -1;
+    opt.null_number = -1;
+    opt.info = MEM_malloc(sizeof(InstructionInfo) * code->code_size);
+    for (pc = 0; pc < code->code_size; pc++) {
+        opt.info[pc].block = -1;
+        opt.info[pc].def = -1;
+        opt.info[pc].use_count = 0;
+        opt.info[pc].use = NULL;
+        opt.info[pc].leader = -1;
+        opt.info[pc].save_register = -1;
+        opt.info[pc].live = LEN_FALSE;
+    }
+
+    build_blocks(&opt);
+    order_blocks(&opt);
+    build_dominator_tree(&opt);
+    build_ssa(&opt);
+    compute_assigned(&opt);
+    mark_live(&opt);
+    assign_save_register(&opt);
+
+    for (pc = 0; pc < code->code_size; pc++) {
+        if (opt.block[opt.info[pc].block].rpo < 0 || !opt.info[pc].live
+            || opt.info[pc].leader >= 0) {
+            changed = LEN_TRUE;
+        }
+    }
+    if (changed) {
+        rewrite_code(&opt);
+    }
+    dispose_optimizer(&opt);
+}
+
+/**
+ * 循环中的表达式和赋值的变量，用来判断循环是否值得剥离第一次迭代
+ */
+typedef struct {
+    int         expression_count;
+    Expression  **expression;
+    int         local_count;
+    int         *local;
+    int         global_count;
+    int         *global;
+    /**函数调用可能修改全局变量*/
+    LEN_Boolean has_call;
+    /**只剥离最内层的循环，避免代码成倍增长*/
+    LEN_Boolean has_loop;
+} LoopScan;
+
+static void
+add_loop_expression(LoopScan *scan, Expression *expr)
+{
+    if (expr == NULL)
+        return;
+    scan->expression = MEM_realloc(scan->expression, sizeof(Expression*)
+                                   * (scan->expression_count + 1));
+    scan->expression[scan->expression_count++] = expr;
+}
+
+static void
+collect_loop_statement_list(LoopScan *scan, StatementList *list)
+{
+    StatementList   *pos;
+    Statement       *statement;
+    Elsif           *elsif;
+
+    for (pos = list; pos; pos = pos->next) {
+        statement = pos->statement;
+        switch (statement->type) {
+            case EXPRESSION_STATEMENT:
+                add_loop_expression(scan, statement->u.expression_s);
+                break;
+            case IF_STATEMENT:
+                add_loop_expression(scan, statement->u.if_s.condition);
+                collect_loop_statement_list(scan, statement->u.if_s
+                                            .then_block->statement_list);
+                for (elsif = statement->u.if_s.elsif_list; elsif;
+                     elsif = elsif->next) {
+                    add_loop_expression(scan, elsif->condition);
+                    collect_loop_statement_list(scan,
+                                                elsif->block->statement_list);
+                }
+                if (statement->u.if_s.else_block) {
+                    collect_loop_statement_list(scan, statement->u.if_s
+                                                .else_block->statement_list);
+                }
+                break;
+            case WHILE_STATEMENT:   /* FALLTHRU */
+            case FOR_STATEMENT:
+                scan->has_loop = LEN_TRUE;
+                break;
+            case RETURN_STATEMENT:
+                add_loop_expression(scan, statement->u.return_s.return_value);
+                break;
+            case GLOBAL_STATEMENT:  /* FALLTHRU */
+            case BREAK_STATEMENT:   /* FALLTHRU */
+            case CONTINUE_STATEMENT:
+                break;
+            case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+            default:
+                DBG_panic(("bad case..%d\n", statement->type));
+        }
+    }
+}
+
+static void
+scan_assignment(LoopScan *scan, Expression *expr)
+{
+    ArgumentList *arg_p;
+    InlineBranch *branch;
+
+    switch (expr->type) {
+        case ASSIGN_EXPRESSION:
+            if (expr->u.assign_expression.slot >= 0) {
+                scan->local = append_int(scan->local, &scan->local_count,
+                                         expr->u.assign_expression.slot);
+            } else {
+                scan->global = append_int(scan->global, &scan->global_count,
+                                          expr->u.assign_expression
+                                          .global_index);
+            }
+            scan_assignment(scan, expr->u.assign_expression.operand);
+            break;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            scan_assignment(scan, expr->u.binary_expression.left);
+            scan_assignment(scan, expr->u.binary_expression.right);
+            break;
+        case MINUS_EXPRESSION:
+            scan_assignment(scan, expr->u.minus_expression);
+            break;
+        case BIT_NOT_EXPRESSION:
+            scan_assignment(scan, expr->u.bit_not_expression);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            scan->has_call = LEN_TRUE;
+            for (arg_p = expr->u.function_call_expression.argument; arg_p;
+                 arg_p = arg_p->next) {
+                scan_assignment(scan, arg_p->expression);
+            }
+            break;
+        case INLINE_CALL_EXPRESSION:
+            // 实参赋给临时变量
+            for (arg_p = expr->u.inline_call_expression.binding; arg_p;
+                 arg_p = arg_p->next) {
+                scan_assignment(scan, arg_p->expression);
+            }
+            for (branch = expr->u.inline_call_expression.branch; branch;
+                 branch = branch->next) {
+                scan_assignment(scan, branch->condition);
+                scan_assignment(scan, branch->value);
+            }
+            scan_assignment(scan, expr->u.inline_call_expression.body);
+            break;
+        default:
+            break;
+    }
+}
+
+static LEN_Boolean
+contains_int(int *array, int count, int value)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (array[i] == value)
+            return LEN_TRUE;
+    }
+    return LEN_FALSE;
+}
+
+/**
+ * 表达式只由常量和循环中没有赋值的变量构成，并且不会调用函数
+ */
+static LEN_Boolean
+is_invariant_expression(LoopScan *scan, Expression *expr)
+{
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+        case INT_EXPRESSION:        /* FALLTHRU */
+        case DOUBLE_EXPRESSION:     /* FALLTHRU */
+        case STRING_EXPRESSION:     /* FALLTHRU */
+        case NULL_EXPRESSION:
+            return LEN_TRUE;
+        case IDENTIFIER_EXPRESSION:
+            if (expr->u.identifier.slot >= 0) {
+                return !contains_int(scan->local, scan->local_count,
+                                     expr->u.identifier.slot);
+            }
+            return !scan->has_call
+                && !contains_int(scan->global, scan->global_count,
+                                 expr->u.identifier.global_index);
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            return is_invariant_expression(scan,
+                                           expr->u.binary_expression.left)
+                && is_invariant_expression(scan,
+                                           expr->u.binary_expression.right);
+        case MINUS_EXPRESSION:
+            return is_invariant_expression(scan, expr->u.minus_expression);
+        case BIT_NOT_EXPRESSION:
+            return is_invariant_expression(scan, expr->u.bit_not_expression);
+        default:
+            return LEN_FALSE;
+    }
+}
+
+/**
+ * 表达式中有循环不变的运算
+ * 常量之间的运算在create.c中已经折叠，剩下的运算至少用到一个变量
+ */
+static LEN_Boolean
+search_invariant(LoopScan *scan, Expression *expr)
+{
+    ArgumentList *arg_p;
+    InlineBranch *branch;
+
+    switch (expr->type) {
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            if (is_invariant_expression(scan, expr))
+                return LEN_TRUE;
+            /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION:
+            return search_invariant(scan, expr->u.binary_expression.left)
+                || search_invariant(scan, expr->u.binary_expression.right);
+        case MINUS_EXPRESSION:
+            return is_invariant_expression(scan, expr)
+                || search_invariant(scan, expr->u.minus_expression);
+        case BIT_NOT_EXPRESSION:
+            return is_invariant_expression(scan, expr)
+                || search_invariant(scan, expr->u.bit_not_expression);
+        case ASSIGN_EXPRESSION:
+            return search_invariant(scan, expr->u.assign_expression.operand);
+        case FUNCTION_CALL_EXPRESSION:
+            for (arg_p = expr->u.function_call_expression.argument; arg_p;
+                 arg_p = arg_p->next) {
+                if (search_invariant(scan, arg_p->expression))
+                    return LEN_TRUE;
+            }
+            return LEN_FALSE;
+        case INLINE_CALL_EXPRESSION:
+            for (arg_p = expr->u.inline_call_expression.binding; arg_p;
+                 arg_p = arg_p->next) {
+                if (search_invariant(scan, arg_p->expression))
+                    return LEN_TRUE;
+            }
+            for (branch = expr->u.inline_call_expression.branch; branch;
+                 branch = branch->next) {
+                if (search_invariant(scan, branch->condition)
+                    || search_invariant(scan, branch->value))
+                    return LEN_TRUE;
+            }
+            return search_invariant(scan, expr->u.inline_call_expression.body);
+        default:
+            return LEN_FALSE;
+    }
+}
+
+/**
+ * while/for循环是最内层的循环，并且有循环不变的运算
+ * 这样的循环由generate.c剥离第一次迭代
+ */
+LEN_Boolean
+len_has_loop_invariant(Statement *statement)
+{
+    LoopScan    scan;
+    LEN_Boolean result = LEN_FALSE;
+    int i;
+
+    memset(&scan, 0, sizeof(LoopScan));
+    if (statement->type == WHILE_STATEMENT) {
+        add_loop_expression(&scan, statement->u.while_s.condition);
+        collect_loop_statement_list(&scan, statement->u.while_s.block
+                                    ->statement_list);
+    } else {
+        DBG_assert(statement->type == FOR_STATEMENT,
+                   ("statement->type..%d\n", statement->type));
+        add_loop_expression(&scan, statement->u.for_s.condition);
+        add_loop_expression(&scan, statement->u.for_s.post);
+        collect_loop_statement_list(&scan, statement->u.for_s.block
+                                    ->statement_list);
+    }
+    if (!scan.has_loop) {
+        for (i = 0; i < scan.expression_count; i++) {
+            scan_assignment(&scan, scan.expression[i]);
+        }
+        for (i = 0; i < scan.expression_count && !result; i++) {
+            result = search_invariant(&scan, scan.expression[i]);
+        }
+    }
+    MEM_free(scan.expression);
+    MEM_free(scan.local);
+    MEM_free(scan.global);
+
+    return result;
+}
@@ -0,0 +1,754 @@
+//
+//  pure.c
+//  lemon
+//  这个文件在编译时分析纯函数，不读写全局变量、不调用native函数
+//  (native函数都有输入输出或者副作用)，只调用纯函数的用户函数是纯函数。
+//  参数都是数值或者boolean常量的纯函数调用在编译时求值，替换成结果的常量。
+//  编译时的求值不能报错也不能停不下来，所以不借用eval.c，
+//  由这里的小解释器执行：会报错的运算、字符串和null、超过步数或者
+//  递归深度时放弃折叠，调用留到运行时照常执行
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include <math.h>
+#include <limits.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+/**一次折叠最多执行的表达式数量*/
+#define FOLD_STEP_MAX   (10000)
+/**折叠时用户函数调用的最大深度*/
+#define FOLD_DEPTH_MAX  (64)
+
+typedef enum {
+    FOLD_NORMAL,
+    FOLD_RETURN,
+    FOLD_BREAK,
+    FOLD_CONTINUE,
+    /**遇到不能在编译时求值的情况，放弃折叠*/
+    FOLD_FAIL
+} FoldStatus;
+
+typedef struct {
+    LEN_Interpreter *inter;
+    /**剩下的执行步数*/
+    int steps;
+    int depth;
+} FoldContext;
+
+static LEN_Boolean is_pure_statement_list(StatementList *list);
+static LEN_Boolean fold_eval(FoldContext *fc, LEN_Value *local,
+                             Expression *expr, LEN_Value *result);
+static FoldStatus fold_execute_list(FoldContext *fc, LEN_Value *local,
+                                    StatementList *list, LEN_Value *ret);
+static void fold_expression(LEN_Interpreter *inter, Expression *expr);
+static void fold_statement_list(LEN_Interpreter *inter,
+                                StatementList *list);
+
+/*
+ * 纯函数的分析
+ */
+
+static LEN_Boolean
+is_pure_call(Expression *expr)
+{
+    FunctionDefinition *func = expr->u.function_call_expression.function;
+
+    return func != NULL && func->type == LEMON_FUNCTION_DEFINITION
+        && func->u.lemon_f.pure;
+}
+
+static LEN_Boolean
+is_pure_body_expression(Expression *expr)
+{
+    ArgumentList *arg_p;
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+        case INT_EXPRESSION:        /* FALLTHRU */
+        case DOUBLE_EXPRESSION:     /* FALLTHRU */
+        case STRING_EXPRESSION:     /* FALLTHRU */
+        case NULL_EXPRESSION:
+            return LEN_TRUE;
+        case IDENTIFIER_EXPRESSION:
+            return expr->u.identifier.slot >= 0;
+        case ASSIGN_EXPRESSION:
+            return expr->u.assign_expression.slot >= 0
+                && is_pure_body_expression(expr->u.assign_expression.operand);
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            return is_pure_body_expression(expr->u.binary_expression.left)
+                && is_pure_body_expression(expr->u.binary_expression.right);
+        case MINUS_EXPRESSION:
+            return is_pure_body_expression(expr->u.minus_expression);
+        case BIT_NOT_EXPRESSION:
+            return is_pure_body_expression(expr->u.bit_not_expression);
+        case FUNCTION_CALL_EXPRESSION:
+            if (!is_pure_call(expr))
+                return LEN_FALSE;
+            for (arg_p = expr->u.function_call_expression.argument; arg_p;
+                 arg_p = arg_p->next) {
+                if (!is_pure_body_expression(arg_p->expression))
+                    return LEN_FALSE;
+            }
+            return LEN_TRUE;
+        case INLINE_CALL_EXPRESSION:
+            return LEN_FALSE;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+    return LEN_FALSE;
+}
+
+static LEN_Boolean
+is_pure_statement(Statement *statement)
+{
+    Elsif *elsif;
+
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            return is_pure_body_expression(statement->u.expression_s);
+        case GLOBAL_STATEMENT:
+            return LEN_FALSE;
+        case IF_STATEMENT:
+            if (!is_pure_body_expression(statement->u.if_s.condition)
+                || !is_pure_statement_list(statement->u.if_s.then_block
+                                           ->statement_list))
+                return LEN_FALSE;
+            for (elsif = statement->u.if_s.elsif_list; elsif;
+                 elsif = elsif->next) {
+                if (!is_pure_body_expression(elsif->condition)
+                    || !is_pure_statement_list(elsif->block->statement_list))
+                    return LEN_FALSE;
+            }
+            return statement->u.if_s.else_block == NULL
+                || is_pure_statement_list(statement->u.if_s.else_block
+                                          ->statement_list);
+        case WHILE_STATEMENT:
+            return is_pure_body_expression(statement->u.while_s.condition)
+                && is_pure_statement_list(statement->u.while_s.block
+                                          ->statement_list);
+        case FOR_STATEMENT:
+            return (statement->u.for_s.init == NULL
+                    || is_pure_body_expression(statement->u.for_s.init))
+                && (statement->u.for_s.condition == NULL
+                    || is_pure_body_expression(statement->u.for_s.condition))
+                && (statement->u.for_s.post == NULL
+                    || is_pure_body_expression(statement->u.for_s.post))
+                && is_pure_statement_list(statement->u.for_s.block
+                                          ->statement_list);
+        case RETURN_STATEMENT:
+            return statement->u.return_s.return_value == NULL
+                || is_pure_body_expression(statement->u.return_s
+                                           .return_value);
+        case BREAK_STATEMENT:       /* FALLTHRU */
+        case CONTINUE_STATEMENT:
+            return LEN_TRUE;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n", statement->type));
+    }
+    return LEN_FALSE;
+}
+
+static LEN_Boolean
+is_pure_statement_list(StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        if (!is_pure_statement(pos->statement))
+            return LEN_FALSE;
+    }
+    return LEN_TRUE;
+}
+
+/**
+ * 先假设所有的用户函数都是纯函数，反复去掉不纯的函数直到不再变化
+ * 互相递归的纯函数也能保留下来
+ */
+void
+len_analyze_pure_functions(LEN_Interpreter *inter)
+{
+    FunctionDefinition  *func;
+    LEN_Boolean changed;
+
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type == LEMON_FUNCTION_DEFINITION) {
+            func->u.lemon_f.pure = LEN_TRUE;
+        }
+    }
+    do {
+        changed = LEN_FALSE;
+        for (func = inter->function_list; func; func = func->next) {
+            if (func->type != LEMON_FUNCTION_DEFINITION
+                || !func->u.lemon_f.pure)
+                continue;
+            if (!is_pure_statement_list(func->u.lemon_f.block
+                                        ->statement_list)) {
+                func->u.lemon_f.pure = LEN_FALSE;
+                changed = LEN_TRUE;
+            }
+        }
+    } while (changed);
+}
+
+/*
+ * 编译时的求值
+ */
+
+/**
+ * 编译时可以处理的值，double只保留有限的值，字面量可以原样写出来
+ */
+static LEN_Boolean
+is_constant_value(LEN_Value *v)
+{
+    return v->type == LEN_INT_VALUE || v->type == LEN_BOOLEAN_VALUE
+        || (v->type == LEN_DOUBLE_VALUE && isfinite(v->u.double_value));
+}
+
+static LEN_Boolean
+is_number_value(LEN_Value *v)
+{
+    return v->type == LEN_INT_VALUE || v->type == LEN_DOUBLE_VALUE;
+}
+
+/**
+ * 运行时一定不会报错的二元运算
+ */
+static LEN_Boolean
+is_safe_binary(ExpressionType operator, LEN_Value *left, LEN_Value *right)
+{
+    long long dummy;
+
+    if (left->type == LEN_INT_VALUE && right->type == LEN_INT_VALUE) {
+        switch (operator) {
+            case ADD_EXPRESSION:
+                return !__builtin_add_overflow(left->u.int_value,
+                                               right->u.int_value, &dummy);
+            case SUB_EXPRESSION:
+                return !__builtin_sub_overflow(left->u.int_value,
+                                               right->u.int_value, &dummy);
+            case MUL_EXPRESSION:
+                return !__builtin_mul_overflow(left->u.int_value,
+                                               right->u.int_value, &dummy);
+            case DIV_EXPRESSION:        /* FALLTHRU */
+            case MOD_EXPRESSION:
+                return right->u.int_value != 0
+                    && !(left->u.int_value == LLONG_MIN
+                         && right->u.int_value == -1);
+            default:
+                return LEN_TRUE;
+        }
+    }
+    if (is_number_value(left) && is_number_value(right)) {
+        return dkc_is_math_operator(operator)
+            || dkc_is_compare_operator(operator);
+    }
+    if (left->type == LEN_BOOLEAN_VALUE && right->type == LEN_BOOLEAN_VALUE) {
+        return operator == EQ_EXPRESSION || operator == NE_EXPRESSION;
+    }
+    return LEN_FALSE;
+}
+
+static LEN_Boolean
+fold_eval_binary(FoldContext *fc, LEN_Value *local, Expression *expr,
+                 LEN_Value *result)
+{
+    LEN_Value left;
+    LEN_Value right;
+
+    if (!fold_eval(fc, local, expr->u.binary_expression.left, &left)
+        || !fold_eval(fc, local, expr->u.binary_expression.right, &right)
+        || !is_safe_binary(expr->type, &left, &right))
+        return LEN_FALSE;
+    *result = len_eval_binary_values(fc->inter, expr->type, &left, &right,
+                                     expr->line_number);
+    return is_constant_value(result);
+}
+
+static LEN_Boolean
+fold_eval_logical(FoldContext *fc, LEN_Value *local, Expression *expr,
+                  LEN_Value *result)
+{
+    if (!fold_eval(fc, local, expr->u.binary_expression.left, result)
+        || result->type != LEN_BOOLEAN_VALUE)
+        return LEN_FALSE;
+    if (result->u.boolean_value == (expr->type == LOGICAL_OR_EXPRESSION))
+        return LEN_TRUE;
+    return fold_eval(fc, local, expr->u.binary_expression.right, result)
+        && result->type == LEN_BOOLEAN_VALUE;
+}
+
+/**
+ * 在编译时调用纯函数，参数的数量和定义不同时放弃
+ */
+static LEN_Boolean
+fold_call(FoldContext *fc, FunctionDefinition *func, int arg_count,
+          LEN_Value *args, LEN_Value *result)
+{
+    ParameterList   *param;
+    LEN_Value       *local;
+    FoldStatus      status;
+    int param_count = 0;
+    int i;
+
+    for (param = func->u.lemon_f.parameter; param; param = param->next) {
+        param_count++;
+    }
+    if (param_count != arg_count || fc->depth >= FOLD_DEPTH_MAX)
+        return LEN_FALSE;
+
+    local = MEM_malloc(sizeof(LEN_Value)
+                       * (func->u.lemon_f.local_variable_count + 1));
+    for (i = 0; i < func->u.lemon_f.local_variable_count; i++) {
+        local[i].type = LEN_UNDEFINED_VALUE;
+    }
+    for (i = 0; i < arg_count; i++) {
+        local[i] = args[i];
+    }
+    fc->depth++;
+    status = fold_execute_list(fc, local, func->u.lemon_f.block
+                               ->statement_list, result);
+    fc->depth--;
+    MEM_free(local);
+
+    // 没有返回值的函数返回null，不折叠
+    return status == FOLD_RETURN;
+}
+
+static LEN_Boolean
+fold_eval_call(FoldContext *fc, LEN_Value *local, Expression *expr,
+               LEN_Value *result)
+{
+    ArgumentList    *arg_p;
+    LEN_Value       *args;
+    LEN_Boolean     ok = LEN_TRUE;
+    int arg_count = 0;
+    int i;
+
+    if (!is_pure_call(expr))
+        return LEN_FALSE;
+    for (arg_p = expr->u.function_call_expression.argument; arg_p;
+         arg_p = arg_p->next) {
+        arg_count++;
+    }
+    args = MEM_malloc(sizeof(LEN_Value) * (arg_count + 1));
+    for (arg_p = expr->u.function_call_expression.argument, i = 0;
+         arg_p && ok; arg_p = arg_p->next, i++) {
+        ok = fold_eval(fc, local, arg_p->expression, &args[i]);
+    }
+    if (ok) {
+        ok = fold_call(fc, expr->u.function_call_expression.function,
+                       arg_count, args, result);
+    }
+    MEM_free(args);
+
+    return ok;
+}
+
+/**
+ * 在编译时求表达式的值，不能求值时返回LEN_FALSE
+ */
+static LEN_Boolean
+fold_eval(FoldContext *fc, LEN_Value *local, Expression *expr,
+          LEN_Value *result)
+{
+    LEN_Value operand;
+
+    if (--fc->steps < 0)
+        return LEN_FALSE;
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:
+            result->type = LEN_BOOLEAN_VALUE;
+            result->u.boolean_value = expr->u.boolean_value;
+            return LEN_TRUE;
+        case INT_EXPRESSION:
+            result->type = LEN_INT_VALUE;
+            result->u.int_value = expr->u.int_value;
+            return LEN_TRUE;
+        case DOUBLE_EXPRESSION:
+            result->type = LEN_DOUBLE_VALUE;
+            result->u.double_value = expr->u.double_value;
+            return LEN_TRUE;
+        case IDENTIFIER_EXPRESSION:
+            *result = local[expr->u.identifier.slot];
+            return result->type != LEN_UNDEFINED_VALUE;
+        case ASSIGN_EXPRESSION:
+            if (!fold_eval(fc, local, expr->u.assign_expression.operand,
+                           result))
+                return LEN_FALSE;
+            local[expr->u.assign_expression.slot] = *result;
+            return LEN_TRUE;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            return fold_eval_binary(fc, local, expr, result);
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION:
+            return fold_eval_logical(fc, local, expr, result);
+        case MINUS_EXPRESSION:
+            if (!fold_eval(fc, local, expr->u.minus_expression, &operand)
+                || !is_number_value(&operand)
+                || (operand.type == LEN_INT_VALUE
+                    && operand.u.int_value == LLONG_MIN))
+                return LEN_FALSE;
+            *result = len_eval_minus_value(fc->inter, &operand,
+                                           expr->line_number);
+            return LEN_TRUE;
+        case BIT_NOT_EXPRESSION:
+            if (!fold_eval(fc, local, expr->u.bit_not_expression, &operand)
+                || operand.type != LEN_INT_VALUE)
+                return LEN_FALSE;
+            *result = len_eval_bit_not_value(fc->inter, &operand,
+                                             expr->line_number);
+            return LEN_TRUE;
+        case FUNCTION_CALL_EXPRESSION:
+            return fold_eval_call(fc, local, expr, result);
+        case STRING_EXPRESSION:     /* FALLTHRU */
+        case NULL_EXPRESSION:       /* FALLTHRU */
+        case INLINE_CALL_EXPRESSION:
+            return LEN_FALSE;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+    return LEN_FALSE;
+}
+
+static FoldStatus
+fold_condition(FoldContext *fc, LEN_Value *local, Expression *expr,
+               LEN_Boolean *cond)
+{
+    LEN_Value v;
+
+    if (!fold_eval(fc, local, expr, &v) || v.type != LEN_BOOLEAN_VALUE)
+        return FOLD_FAIL;
+    *cond = v.u.boolean_value;
+    return FOLD_NORMAL;
+}
+
+static FoldStatus
+fold_execute_if(FoldContext *fc, LEN_Value *local, Statement *statement,
+                LEN_Value *ret)
+{
+    Elsif       *elsif;
+    LEN_Boolean cond;
+
+    if (fold_condition(fc, local, statement->u.if_s.condition, &cond)
+        == FOLD_FAIL)
+        return FOLD_FAIL;
+    if (cond)
+        return fold_execute_list(fc, local, statement->u.if_s.then_block
+                                 ->statement_list, ret);
+    for (elsif = statement->u.if_s.elsif_list; elsif; elsif = elsif->next) {
+        if (fold_condition(fc, local, elsif->condition, &cond) == FOLD_FAIL)
+            return FOLD_FAIL;
+        if (cond)
+            return fold_execute_list(fc, local, elsif->block->statement_list,
+                                     ret);
+    }
+    if (statement->u.if_s.else_block)
+        return fold_execute_list(fc, local, statement->u.if_s.else_block
+                                 ->statement_list, ret);
+    return FOLD_NORMAL;
+}
+
+/**
+ * while和for共用，while没有init和post
+ */
+static FoldStatus
+fold_execute_loop(FoldContext *fc, LEN_Value *local, Expression *init,
+                  Expression *condition, Expression *post, Block *block,
+                  LEN_Value *ret)
+{
+    LEN_Value   v;
+    LEN_Boolean cond;
+    FoldStatus  status;
+
+    if (init && !fold_eval(fc, local, init, &v))
+        return FOLD_FAIL;
+    for (;;) {
+        if (condition) {
+            if (fold_condition(fc, local, condition, &cond) == FOLD_FAIL)
+                return FOLD_FAIL;
+            if (!cond)
+                break;
+        }
+        status = fold_execute_list(fc, local, block->statement_list, ret);
+        if (status == FOLD_RETURN || status == FOLD_FAIL)
+            return status;
+        if (status == FOLD_BREAK)
+            break;
+        if (post && !fold_eval(fc, local, post, &v))
+            return FOLD_FAIL;
+    }
+    return FOLD_NORMAL;
+}
+
+static FoldStatus
+fold_execute(FoldContext *fc, LEN_Value *local, Statement *statement,
+             LEN_Value *ret)
+{
+    LEN_Value v;
+
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            if (!fold_eval(fc, local, statement->u.expression_s, &v))
+                return FOLD_FAIL;
+            return FOLD_NORMAL;
+        case IF_STATEMENT:
+            return fold_execute_if(fc, local, statement, ret);
+        case WHILE_STATEMENT:
+            return fold_execute_loop(fc, local, NULL,
+                                     statement->u.while_s.condition, NULL,
+                                     statement->u.while_s.block, ret);
+        case FOR_STATEMENT:
+            return fold_execute_loop(fc, local, statement->u.for_s.init,
+                                     statement->u.for_s.condition,
+                                     statement->u.for_s.post,
+                                     statement->u.for_s.block, ret);
+        case RETURN_STATEMENT:
+            if (statement->u.return_s.return_value == NULL
+                || !fold_eval(fc, local, statement->u.return_s.return_value,
+                              ret))
+                return FOLD_FAIL;
+            return FOLD_RETURN;
+        case BREAK_STATEMENT:
+            return FOLD_BREAK;
+        case CONTINUE_STATEMENT:
+            return FOLD_CONTINUE;
+        case GLOBAL_STATEMENT:
+            return FOLD_FAIL;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n", statement->type));
+    }
+    return FOLD_FAIL;
+}
+
+static FoldStatus
+fold_execute_list(FoldContext *fc, LEN_Value *local, StatementList *list,
+                  LEN_Value *ret)
+{
+    StatementList   *pos;
+    FoldStatus      status;
+
+    for (pos = list; pos; pos = pos->next) {
+        status = fold_execute(fc, local, pos->statement, ret);
+        if (status != FOLD_NORMAL)
+            return status;
+    }
+    return FOLD_NORMAL;
+}
+
+/*
+ * 替换常量调用
+ */
+
+static LEN_Boolean
+is_constant_expression(Expression *expr)
+{
+    return expr->type == INT_EXPRESSION || expr->type == DOUBLE_EXPRESSION
+        || expr->type == BOOLEAN_EXPRESSION;
+}
+
+/**
+ * 参数都是常量的纯函数调用求值成功时改写成结果的常量
+ */
+static void
+fold_call_expression(LEN_Interpreter *inter, Expression *expr)
+{
+    ArgumentList    *arg_p;
+    FoldContext     fc;
+    LEN_Value       result;
+
+    if (!is_pure_call(expr))
+        return;
+    for (arg_p = expr->u.function_call_expression.argument; arg_p;
+         arg_p = arg_p->next) {
+        if (!is_constant_expression(arg_p->expression))
+            return;
+    }
+    fc.inter = inter;
+    fc.steps = FOLD_STEP_MAX;
+    fc.depth = 0;
+    if (fold_eval_call(&fc, NULL, expr, &result)) {
+        len_convert_value_to_expression(&result, expr);
+    }
+}
+
+static void
+fold_expression(LEN_Interpreter *inter, Expression *expr)
+{
+    ArgumentList *arg_p;
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+        case INT_EXPRESSION:        /* FALLTHRU */
+        case DOUBLE_EXPRESSION:     /* FALLTHRU */
+        case STRING_EXPRESSION:     /* FALLTHRU */
+        case NULL_EXPRESSION:       /* FALLTHRU */
+        case IDENTIFIER_EXPRESSION:
+            break;
+        case ASSIGN_EXPRESSION:
+            fold_expression(inter, expr->u.assign_expression.operand);
+            break;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            fold_expression(inter, expr->u.binary_expression.left);
+            fold_expression(inter, expr->u.binary_expression.right);
+            break;
+        case MINUS_EXPRESSION:
+            fold_expression(inter, expr->u.minus_expression);
+            break;
+        case BIT_NOT_EXPRESSION:
+            fold_expression(inter, expr->u.bit_not_expression);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            for (arg_p = expr->u.function_call_expression.argument; arg_p;
+                 arg_p = arg_p->next) {
+                fold_expression(inter, arg_p->expression);
+            }
+            fold_call_expression(inter, expr);
+            break;
+        case INLINE_CALL_EXPRESSION:    /* FALLTHRU */
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+}
+
+static void
+fold_statement(LEN_Interpreter *inter, Statement *statement)
+{
+    Elsif *elsif;
+
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            fold_expression(inter, statement->u.expression_s);
+            break;
+        case IF_STATEMENT:
+            fold_expression(inter, statement->u.if_s.condition);
+            fold_statement_list(inter, statement->u.if_s.then_block
+                                ->statement_list);
+            for (elsif = statement->u.if_s.elsif_list; elsif;
+                 elsif = elsif->next) {
+                fold_expression(inter, elsif->condition);
+                fold_statement_list(inter, elsif->block->statement_list);
+            }
+            if (statement->u.if_s.else_block) {
+                fold_statement_list(inter, statement->u.if_s.else_block
+                                    ->statement_list);
+            }
+            break;
+        case WHILE_STATEMENT:
+            fold_expression(inter, statement->u.while_s.condition);
+            fold_statement_list(inter, statement->u.while_s.block
+                                ->statement_list);
+            break;
+        case FOR_STATEMENT:
+            if (statement->u.for_s.init) {
+                fold_expression(inter, statement->u.for_s.init);
+            }
+            if (statement->u.for_s.condition) {
+                fold_expression(inter, statement->u.for_s.condition);
+            }
+            if (statement->u.for_s.post) {
+                fold_expression(inter, statement->u.for_s.post);
+            }
+            fold_statement_list(inter, statement->u.for_s.block
+                                ->statement_list);
+            break;
+        case RETURN_STATEMENT:
+            if (statement->u.return_s.return_value) {
+                fold_expression(inter, statement->u.return_s.return_value);
+            }
+            break;
+        case GLOBAL_STATEMENT:      /* FALLTHRU */
+        case BREAK_STATEMENT:       /* FALLTHRU */
+        case CONTINUE_STATEMENT:
+            break;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n", statement->type));
+    }
+}
+
+static void
+fold_statement_list(LEN_Interpreter *inter, StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        fold_statement(inter, pos->statement);
+    }
+}
+
+/**
+ * 折叠函数和顶层语句链中参数都是常量的纯函数调用
+ */
+void
+len_fold_pure_calls(LEN_Interpreter *inter)
+{
+    FunctionDefinition  *func;
+
+    if (!(inter->optimize_flags & LEN_OPTIMIZE_PURE))
+        return;
+
+    fold_statement_list(inter, inter->statement_list);
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type != LEMON_FUNCTION_DEFINITION)
+            continue;
+        fold_statement_list(inter, func->u.lemon_f.block->statement_list);
+    }
+}
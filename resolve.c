@@ -0,0 +1,405 @@
+//
+//  resolve.c
+//  lemon
+//  这个文件在语法分析之后给每个函数的参数和局部变量分配下标，给全局变量分配全局变量表的下标
+//  执行时局部环境是按下标访问的LEN_Value数组，全局变量也按下标访问，不再按名字查找
+//  同时把函数调用绑定到函数定义并检查参数的数量，找不到函数时在执行之前报错，
+//  并且标记遍历分析树时作为尾调用执行的return语句
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+/**
+ * 名字的列表，局部变量的下标就是名字在列表中的位置
+ */
+typedef struct {
+    int     count;
+    char    **name;
+} NameList;
+
+typedef struct {
+    LEN_Interpreter *inter;
+    /**顶层语句链中的变量都是全局变量*/
+    LEN_Boolean     toplevel;
+    /**参数和局部变量，前parameter_count个是参数*/
+    NameList        local;
+    int             parameter_count;
+    /**global语句中出现的名字，这些名字不分配局部变量的下标*/
+    NameList        global;
+    /**正在处理的循环的层数，循环中的return不作为尾调用*/
+    int             loop_depth;
+} ResolveContext;
+
+static void resolve_expression(ResolveContext *rc, Expression *expr);
+static void resolve_statement_list(ResolveContext *rc, StatementList *list);
+
+/**
+ * 从后往前查找，参数重名时和按名字查找一样使用后面的参数
+ * 名字都在符号表中，直接比较指针
+ */
+static int
+search_name(NameList *list, char *name)
+{
+    int i;
+
+    for (i = list->count - 1; i >= 0; i--) {
+        if (list->name[i] == name)
+            return i;
+    }
+    return -1;
+}
+
+static int
+add_name(NameList *list, char *name)
+{
+    list->name = MEM_realloc(list->name, sizeof(char*) * (list->count + 1));
+    list->name[list->count] = name;
+
+    return list->count++;
+}
+
+/**
+ * 收集global语句中出现的名字
+ */
+static void
+collect_global_names(ResolveContext *rc, StatementList *list)
+{
+    StatementList   *pos;
+    IdentifierList  *id_p;
+    Statement       *statement;
+    Elsif           *elsif;
+
+    for (pos = list; pos; pos = pos->next) {
+        statement = pos->statement;
+        switch (statement->type) {
+            case GLOBAL_STATEMENT:
+                for (id_p = statement->u.global_s.identifier_list; id_p;
+                     id_p = id_p->next) {
+                    if (search_name(&rc->global, id_p->name) < 0) {
+                        add_name(&rc->global, id_p->name);
+                    }
+                }
+                break;
+            case IF_STATEMENT:
+                collect_global_names(rc, statement->u.if_s.then_block
+                                     ->statement_list);
+                for (elsif = statement->u.if_s.elsif_list; elsif;
+                     elsif = elsif->next) {
+                    collect_global_names(rc, elsif->block->statement_list);
+                }
+                if (statement->u.if_s.else_block) {
+                    collect_global_names(rc, statement->u.if_s.else_block
+                                         ->statement_list);
+                }
+                break;
+            case WHILE_STATEMENT:
+                collect_global_names(rc, statement->u.while_s.block
+                                     ->statement_list);
+                break;
+            case FOR_STATEMENT:
+                collect_global_names(rc, statement->u.for_s.block
+                                     ->statement_list);
+                break;
+            case EXPRESSION_STATEMENT:  /* FALLTHRU */
+            case RETURN_STATEMENT:      /* FALLTHRU */
+            case BREAK_STATEMENT:       /* FALLTHRU */
+            case CONTINUE_STATEMENT:
+                break;
+            case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+            default:
+                DBG_panic(("bad case..%d\n", statement->type));
+        }
+    }
+}
+
+/**
+ * 取得变量的下标，第一次出现时分配
+ * 参数总是优先于全局变量；函数中任何位置的global语句声明过的其他名字
+ * 在整个函数中都指向全局变量，局部变量的下标是-1
+ */
+static void
+resolve_name(ResolveContext *rc, char *name, int *slot, int *global_index)
+{
+    int local;
+
+    *slot = -1;
+    *global_index = -1;
+    if (rc->toplevel) {
+        *global_index = len_add_global_variable(rc->inter, name);
+        return;
+    }
+    local = search_name(&rc->local, name);
+    if (local >= 0 && local < rc->parameter_count) {
+        *slot = local;
+        return;
+    }
+    if (search_name(&rc->global, name) >= 0) {
+        *global_index = len_add_global_variable(rc->inter, name);
+        return;
+    }
+    if (local < 0) {
+        local = add_name(&rc->local, name);
+    }
+    *slot = local;
+}
+
+/**
+ * 把函数调用绑定到函数定义，用户函数检查参数的数量
+ * native函数自己检查参数
+ */
+static void
+link_function_call(ResolveContext *rc, Expression *expr)
+{
+    FunctionCallExpression  *call = &expr->u.function_call_expression;
+    FunctionDefinition      *func;
+    ArgumentList            *arg_p;
+    ParameterList           *param_p;
+    int arg_count = 0;
+    int param_count = 0;
+
+    func = len_search_function(call->identifier);
+    if (func == NULL) {
+        rc->inter->current_line_number = expr->line_number;
+        len_compile_error(FUNCTION_NOT_DEFINED_ERR,
+                          STRING_MESSAGE_ARGUMENT, "name", call->identifier,
+                          MESSAGE_ARGUMENT_END);
+    }
+    if (func->type == LEMON_FUNCTION_DEFINITION) {
+        for (arg_p = call->argument; arg_p; arg_p = arg_p->next) {
+            arg_count++;
+        }
+        for (param_p = func->u.lemon_f.parameter; param_p;
+             param_p = param_p->next) {
+            param_count++;
+        }
+        if (arg_count != param_count) {
+            rc->inter->current_line_number = expr->line_number;
+            len_compile_error(ARGUMENT_COUNT_MISMATCH_ERR,
+                              STRING_MESSAGE_ARGUMENT, "name", call->identifier,
+                              INT_MESSAGE_ARGUMENT, "need", param_count,
+                              INT_MESSAGE_ARGUMENT, "count", arg_count,
+                              MESSAGE_ARGUMENT_END);
+        }
+    }
+    call->function = func;
+}
+
+static void
+resolve_expression(ResolveContext *rc, Expression *expr)
+{
+    ArgumentList *arg_p;
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+        case INT_EXPRESSION:        /* FALLTHRU */
+        case DOUBLE_EXPRESSION:     /* FALLTHRU */
+        case STRING_EXPRESSION:     /* FALLTHRU */
+        case NULL_EXPRESSION:
+            break;
+        case IDENTIFIER_EXPRESSION:
+            resolve_name(rc, expr->u.identifier.name,
+                         &expr->u.identifier.slot,
+                         &expr->u.identifier.global_index);
+            break;
+        case ASSIGN_EXPRESSION:
+            resolve_expression(rc, expr->u.assign_expression.operand);
+            resolve_name(rc, expr->u.assign_expression.variable,
+                         &expr->u.assign_expression.slot,
+                         &expr->u.assign_expression.global_index);
+            break;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            resolve_expression(rc, expr->u.binary_expression.left);
+            resolve_expression(rc, expr->u.binary_expression.right);
+            break;
+        case MINUS_EXPRESSION:
+            resolve_expression(rc, expr->u.minus_expression);
+            break;
+        case BIT_NOT_EXPRESSION:
+            resolve_expression(rc, expr->u.bit_not_expression);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            for (arg_p = expr->u.function_call_expression.argument; arg_p;
+                 arg_p = arg_p->next) {
+                resolve_expression(rc, arg_p->expression);
+            }
+            link_function_call(rc, expr);
+            break;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+}
+
+/**
+ * 函数中循环外面的return f(...)，f是用户函数时作为尾调用
+ * 循环中的return和trace交织在一起，仍然按通常的调用执行
+ */
+static void
+mark_tail_call(ResolveContext *rc, Statement *statement)
+{
+    Expression *value = statement->u.return_s.return_value;
+
+    if (!rc->toplevel && rc->loop_depth == 0
+        && value->type == FUNCTION_CALL_EXPRESSION
+        && (value->u.function_call_expression.function->type
+            == LEMON_FUNCTION_DEFINITION)) {
+        statement->u.return_s.tail_call = LEN_TRUE;
+    }
+}
+
+static void
+resolve_statement(ResolveContext *rc, Statement *statement)
+{
+    Elsif           *elsif;
+    IdentifierList  *id_p;
+
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            resolve_expression(rc, statement->u.expression_s);
+            break;
+        case GLOBAL_STATEMENT:
+            for (id_p = statement->u.global_s.identifier_list; id_p;
+                 id_p = id_p->next) {
+                id_p->global_index = len_add_global_variable(rc->inter,
+                                                             id_p->name);
+            }
+            break;
+        case IF_STATEMENT:
+            resolve_expression(rc, statement->u.if_s.condition);
+            resolve_statement_list(rc, statement->u.if_s.then_block
+                                   ->statement_list);
+            for (elsif = statement->u.if_s.elsif_list; elsif;
+                 elsif = elsif->next) {
+                resolve_expression(rc, elsif->condition);
+                resolve_statement_list(rc, elsif->block->statement_list);
+            }
+            if (statement->u.if_s.else_block) {
+                resolve_statement_list(rc, statement->u.if_s.else_block
+                                       ->statement_list);
+            }
+            break;
+        case WHILE_STATEMENT:
+            resolve_expression(rc, statement->u.while_s.condition);
+            rc->loop_depth++;
+            resolve_statement_list(rc, statement->u.while_s.block
+                                   ->statement_list);
+            rc->loop_depth--;
+            break;
+        case FOR_STATEMENT:
+            if (statement->u.for_s.init) {
+                resolve_expression(rc, statement->u.for_s.init);
+            }
+            if (statement->u.for_s.condition) {
+                resolve_expression(rc, statement->u.for_s.condition);
+            }
+            if (statement->u.for_s.post) {
+                resolve_expression(rc, statement->u.for_s.post);
+            }
+            rc->loop_depth++;
+            resolve_statement_list(rc, statement->u.for_s.block
+                                   ->statement_list);
+            rc->loop_depth--;
+            break;
+        case RETURN_STATEMENT:
+            if (statement->u.return_s.return_value) {
+                resolve_expression(rc, statement->u.return_s.return_value);
+                mark_tail_call(rc, statement);
+            }
+            break;
+        case BREAK_STATEMENT:       /* FALLTHRU */
+        case CONTINUE_STATEMENT:
+            break;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n", statement->type));
+    }
+}
+
+static void
+resolve_statement_list(ResolveContext *rc, StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        resolve_statement(rc, pos->statement);
+    }
+}
+
+/**
+ * 参数的下标和参数的位置相同，局部变量按出现的顺序排在参数后面
+ */
+static void
+resolve_function(LEN_Interpreter *inter, FunctionDefinition *func)
+{
+    ResolveContext  rc;
+    ParameterList   *param_p;
+
+    rc.inter = inter;
+    rc.toplevel = LEN_FALSE;
+    rc.local.count = 0;
+    rc.local.name = NULL;
+    rc.global.count = 0;
+    rc.global.name = NULL;
+    rc.loop_depth = 0;
+
+    for (param_p = func->u.lemon_f.parameter; param_p;
+         param_p = param_p->next) {
+        add_name(&rc.local, param_p->name);
+    }
+    rc.parameter_count = rc.local.count;
+    collect_global_names(&rc, func->u.lemon_f.block->statement_list);
+    resolve_statement_list(&rc, func->u.lemon_f.block->statement_list);
+    func->u.lemon_f.local_variable_count = rc.local.count;
+
+    MEM_free(rc.local.name);
+    MEM_free(rc.global.name);
+}
+
+/**
+ * 顶层语句链中的变量都是全局变量，局部变量的下标保持-1
+ * 先处理顶层语句链，全局变量表的下标按顶层出现的顺序分配
+ */
+void
+len_resolve_variables(LEN_Interpreter *inter)
+{
+    ResolveContext      rc;
+    FunctionDefinition  *func;
+
+    rc.inter = inter;
+    rc.toplevel = LEN_TRUE;
+    rc.local.count = 0;
+    rc.local.name = NULL;
+    rc.parameter_count = 0;
+    rc.global.count = 0;
+    rc.global.name = NULL;
+    rc.loop_depth = 0;
+    resolve_statement_list(&rc, inter->statement_list);
+
+    for (func = inter->function_list; func; func = func->next) {
+        if (func->type == LEMON_FUNCTION_DEFINITION) {
+            resolve_function(inter, func);
+        }
+    }
+}
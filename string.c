@@ -12,6 +12,7 @@
 #include "lemon.h"
 
 #define STRING_ALLOC_SIZE       (256)
+#define SYMBOL_BUCKET_COUNT     (256)
 
 static char *st_string_literal_buffer = NULL;
 static int st_string_literal_buffer_size = 0;
@@ -58,16 +59,100 @@ len_close_string_literal(void)
     return new_str;
 }
 
-char *
-len_create_identifier(char *str)
+unsigned int
+len_hash_string(char *str)
 {
-    char *new_str;
+    unsigned int hash = 0;
     
-    new_str = len_malloc(strlen(str) + 1);
+    for (; *str; str++) {
+        hash = hash * 31 + (unsigned char)*str;
+    }
+    return hash;
+}
+
+static Symbol *
+search_symbol(SymbolTable *table, char *str)
+{
+    Symbol *pos;
+
+    if (table->bucket == NULL)
+        return NULL;
+    for (pos = table->bucket[len_hash_string(str) % table->bucket_count]; pos;
+         pos = pos->next) {
+        if (!strcmp(pos->name, str))
+            return pos;
+    }
+    return NULL;
+}
+
+/**
+ * 在符号表中查找名字，没有时复制一份加入符号表
+ * 名字保存在interpreter_storage中，和解释器的生命周期相同
+ */
+char *
+len_intern_symbol(LEN_Interpreter *inter, char *str)
+{
+    SymbolTable *table = &inter->symbol_table;
+    Symbol      *pos;
+    int         index;
     
-    strcpy(new_str, str);
+    pos = search_symbol(table, str);
+    if (pos)
+        return pos->name;
+    if (table->bucket == NULL) {
+        table->bucket_count = SYMBOL_BUCKET_COUNT;
+        table->bucket = MEM_malloc(sizeof(Symbol*) * table->bucket_count);
+        memset(table->bucket, 0, sizeof(Symbol*) * table->bucket_count);
+    }
+    index = len_hash_string(str) % table->bucket_count;
+    pos = MEM_storage_malloc(inter->interpreter_storage, sizeof(Symbol));
+    pos->name = MEM_storage_malloc(inter->interpreter_storage,
+                                   strlen(str) + 1);
+    strcpy(pos->name, str);
+    pos->next = table->bucket[index];
+    table->bucket[index] = pos;
     
-    return new_str;
+    return pos->name;
+}
+
+/**
+ * 生成符号表中还没有的名字prefix_1、prefix_2……
+ * 程序中的标识符都已经在符号表中，生成的名字不会和它们重复
+ */
+char *
+len_create_unique_symbol(LEN_Interpreter *inter, char *prefix)
+{
+    char    *buf;
+    char    *name;
+    int     serial;
+
+    buf = MEM_malloc(strlen(prefix) + 16);
+    for (serial = 1; ; serial++) {
+        sprintf(buf, "%s_%d", prefix, serial);
+        if (search_symbol(&inter->symbol_table, buf) == NULL)
+            break;
+    }
+    name = len_intern_symbol(inter, buf);
+    MEM_free(buf);
+
+    return name;
+}
+
+void
+len_dispose_symbol_table(LEN_Interpreter *inter)
+{
+    MEM_free(inter->symbol_table.bucket);
+    inter->symbol_table.bucket = NULL;
+    inter->symbol_table.bucket_count = 0;
+}
+
+/**
+ * 标识符都保存在符号表中
+ */
+char *
+len_create_identifier(char *str)
+{
+    return len_intern_symbol(len_get_current_interpreter(), str);
 }
 
 
@@ -13,51 +13,80 @@
 #include "lemon.h"
 
 static LEN_String *
-alloc_len_string(LEN_Interpreter *inter, char *str, LEN_Boolean is_literal)
+alloc_len_string(LEN_Interpreter *inter, char *str)
 {
     LEN_String *ret;
     ret = MEM_malloc(sizeof(LEN_String));
     ret->ref_count = 0;
-    ret->is_literal = is_literal;
+    ret->is_immortal = LEN_FALSE;
     ret->string = str;
     return ret;
 }
 
+/**
+ * 字符串字面量在编译时转换成不朽的LEN_String，每个字面量只创建一次
+ * 分配在interpreter_storage中，求值时直接使用，不再分配内存
+ */
 LEN_String *
 len_literal_to_len_string(LEN_Interpreter *inter, char *str)
 {
     LEN_String *ret;
-    ret = alloc_len_string(inter, str, LEN_TRUE);
-    // 引用计数
+    ret = MEM_storage_malloc(inter->interpreter_storage, sizeof(LEN_String));
     ret->ref_count = 1;
+    ret->is_immortal = LEN_TRUE;
+    ret->string = str;
     return ret;
 }
 
 void
 len_refer_string(LEN_String *str)
 {
+    if (str->is_immortal)
+        return;
     str->ref_count++;
 }
 
 void
 len_release_string(LEN_String *str)
 {
+    if (str->is_immortal)
+        return;
     str->ref_count--;
     
     DBG_assert(str->ref_count >= 0, ("str->ref_count..%d\n",
                                      str->ref_count));
     if (str->ref_count == 0) {
-        if (!str->is_literal) {
-            MEM_free(str->string);
-        }
+        MEM_free(str->string);
         MEM_free(str);
     }
 }
 
+/**
+ * 使用了引用类型是LEN_STRING的引用计数+1
+ */
+void
+len_refer_if_string(LEN_Value *v)
+{
+    if (v->type == LEN_STRING_VALUE) {
+        len_refer_string(v->u.string_value);
+    }
+}
+
+/**
+ * ref_count-=1 加入引用计数为0，回收内存
+ */
+void
+len_release_if_string(LEN_Value *v)
+{
+    if (v->type == LEN_STRING_VALUE) {
+        len_release_string(v->u.string_value);
+    }
+}
+
 LEN_String *
 len_create_lemon_string(LEN_Interpreter *inter, char *str)
 {
-    LEN_String *ret = alloc_len_string(inter, str, LEN_FALSE);
+    LEN_String *ret = alloc_len_string(inter, str);
     ret->ref_count = 1;
     return ret;
 }
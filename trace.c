@@ -0,0 +1,1266 @@
+//
+//  trace.c
+//  lemon
+//  这个文件是遍历分析树执行时的trace记录器
+//  while/for循环变热之后，记录一次迭代实际经过的路径和操作数的类型，
+//  生成一段线性的、带guard的trace指令，之后的迭代直接执行trace。
+//  guard失败时(分支方向和记录时不同)退回分析树继续执行这次迭代
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+/**循环迭代多少次之后记录trace*/
+#define TRACE_THRESHOLD     (16)
+/**side exit超过这个次数，并且超过迭代次数的一半时放弃trace*/
+#define TRACE_EXIT_MAX      (32)
+#define TRACE_ALLOC_SIZE    (64)
+
+typedef enum {
+    TR_LOAD_VALUE = 1,
+    /**全局变量表中的全局变量，b为下标*/
+    TR_LOAD_GLOBAL,
+    TR_STORE_GLOBAL,
+    /**分配了下标的局部变量，b为下标*/
+    TR_LOAD_LOCAL,
+    TR_STORE_LOCAL,
+    /**按照记录时的类型特化的二元运算，类型不符时走通用路径*/
+    TR_ADD_INT,
+    TR_SUB_INT,
+    TR_MUL_INT,
+    TR_EQ_INT,
+    TR_NE_INT,
+    TR_GT_INT,
+    TR_GE_INT,
+    TR_LT_INT,
+    TR_LE_INT,
+    TR_BIT_AND_INT,
+    TR_BIT_OR_INT,
+    TR_BIT_XOR_INT,
+    TR_LEFT_SHIFT_INT,
+    TR_RIGHT_SHIFT_INT,
+    TR_ADD_DOUBLE,
+    TR_SUB_DOUBLE,
+    TR_MUL_DOUBLE,
+    TR_DIV_DOUBLE,
+    TR_EQ_DOUBLE,
+    TR_NE_DOUBLE,
+    TR_GT_DOUBLE,
+    TR_GE_DOUBLE,
+    TR_LT_DOUBLE,
+    TR_LE_DOUBLE,
+    TR_BINARY,
+    TR_MINUS,
+    TR_BIT_NOT,
+    /**a为false(true)时跳到b，否则继续计算右操作数*/
+    TR_LOGICAL_AND,
+    TR_LOGICAL_OR,
+    /**逻辑运算右操作数的值，检查类型后放到a*/
+    TR_LOGICAL_VALUE,
+    /**无条件跳到b，展开的函数调用中条件成立的分支跳过后面的分支*/
+    TR_JUMP,
+    TR_CALL,
+    TR_POP,
+    /**循环条件，为false时循环结束*/
+    TR_LOOP_CONDITION,
+    /**分支条件，和记录时的方向b不同时side exit*/
+    TR_GUARD,
+    /**trace不展开的语句(嵌套的循环和global语句)交给分析树执行*/
+    TR_STATEMENT,
+    TR_BREAK,
+    TR_RETURN,
+    /**回到trace开头*/
+    TR_LOOP
+} TraceOpCode;
+
+/**
+ * trace指令，a、b、c是临时变量的下标或者其他操作数
+ */
+typedef struct {
+    TraceOpCode     opcode;
+    int             a;
+    int             b;
+    int             c;
+    int             line_number;
+    /**二元运算的类型，特化的运算类型不符时使用*/
+    ExpressionType  operator;
+    /**变量名、函数名*/
+    char            *name;
+    union {
+        LEN_Value           value;
+        FunctionDefinition  *function;
+        Statement           *statement;
+    } u;
+} TraceInstruction;
+
+/**
+ * side exit之后继续执行的位置
+ */
+typedef struct {
+    /**guard所在的if语句*/
+    Statement       *statement;
+    /**guard所在的elsif，NULL表示if的条件*/
+    Elsif           *elsif;
+    /**各层语句链中if语句后面的位置，从外到内*/
+    int             chain_count;
+    StatementList   **chain;
+} TraceGuard;
+
+typedef struct Trace_tag {
+    int                 code_size;
+    TraceInstruction    *code;
+    int                 guard_count;
+    TraceGuard          *guard;
+    int                 temp_count;
+    /**continue之后跳转的位置(for循环的post)*/
+    int                 continue_pc;
+    /**执行过的迭代次数和side exit的次数*/
+    int                 iteration_count;
+    int                 exit_count;
+} Trace;
+
+/**
+ * 执行trace时每次进入循环的状态，递归调用同一个循环时各自独立
+ */
+typedef struct {
+    LEN_Interpreter     *inter;
+    LocalEnvironment    *env;
+    int                 temp_alloc_size;
+    LEN_Value           *temp;
+} TraceState;
+
+/**
+ * 记录过程中迭代结束的方式
+ */
+typedef enum {
+    RECORD_CONTINUING = 1,
+    RECORD_CONTINUE,
+    RECORD_BREAK,
+    RECORD_RETURN
+} RecordStatus;
+
+/**
+ * 记录trace时的缓冲
+ */
+typedef struct {
+    TraceState          *state;
+    /**LEN_FALSE时只生成指令不执行(短路求值没有执行的右操作数)*/
+    LEN_Boolean         executing;
+    int                 code_alloc_size;
+    int                 code_size;
+    TraceInstruction    *code;
+    int                 guard_count;
+    TraceGuard          *guard;
+    int                 current_temp;
+    int                 temp_count;
+    /**正在记录的语句在各层语句链中的下一个位置*/
+    int                 chain_count;
+    StatementList       **chain;
+    RecordStatus        status;
+    LEN_Value           return_value;
+} TraceRecorder;
+
+static void record_expression(TraceRecorder *rec, Expression *expr, int dst);
+static RecordStatus record_statement_list(TraceRecorder *rec,
+                                          StatementList *list);
+
+void
+len_init_loop_trace_info(LoopTraceInfo *info)
+{
+    info->iteration_count = 0;
+    info->recording = LEN_FALSE;
+    info->blacklisted = LEN_FALSE;
+    info->trace = NULL;
+}
+
+static LoopTraceInfo *
+get_trace_info(Statement *loop)
+{
+    if (loop->type == WHILE_STATEMENT) {
+        return &loop->u.while_s.trace_info;
+    }
+    DBG_assert(loop->type == FOR_STATEMENT, ("type..%d\n", loop->type));
+    return &loop->u.for_s.trace_info;
+}
+
+/**************************************执行*************************************/
+
+static void
+check_boolean(LEN_Value *v, int line_number)
+{
+    if (v->type != LEN_BOOLEAN_VALUE) {
+        len_runtime_error(line_number, NOT_BOOLEAN_TYPE_ERR,
+                          MESSAGE_ARGUMENT_END);
+    }
+}
+
+/**
+ * 和eval.c一样，参数求值之后调用函数
+ */
+static LEN_Value
+call_function(TraceState *state, TraceInstruction *ins, LEN_Value *args)
+{
+    LEN_Value           value;
+    FunctionDefinition  *func = ins->u.function;
+    LocalEnvironment    *local_env;
+
+    if (func->type == NATIVE_FUNCTION_DEFINITION) {
+        return len_call_native_function(state->inter, func->u.native_f.proc,
+                                        ins->b, args);
+    }
+    local_env = len_create_function_environment(state->inter, func,
+                                                ins->b, args);
+    value = len_execute_function_body(state->inter, func, local_env);
+
+    return value;
+}
+
+/**两个操作数都是指定的类型*/
+#define is_type_pair(left, right, value_type) \
+((left)->type == (value_type) && (right)->type == (value_type))
+
+/**特化的二元运算，类型和记录时不同时交给len_eval_binary_values()*/
+#define SPECIALIZED_BINARY(value_type, member, op, result_type, \
+                           result_member) \
+if (is_type_pair(&temp[ins->b], &temp[ins->c], (value_type))) {\
+    temp[ins->a].result_member\
+    = temp[ins->b].member op temp[ins->c].member;\
+    temp[ins->a].type = (result_type);\
+} else {\
+    temp[ins->a] = len_eval_binary_values(state->inter, ins->operator,\
+                                          &temp[ins->b], &temp[ins->c],\
+                                          ins->line_number);\
+}
+
+#define INT_MATH(op) \
+SPECIALIZED_BINARY(LEN_INT_VALUE, u.int_value, op, \
+                   LEN_INT_VALUE, u.int_value)
+/**加减乘的结果先放在int_result，溢出时不破坏操作数*/
+#define INT_CHECKED_MATH(builtin) \
+if (is_type_pair(&temp[ins->b], &temp[ins->c], LEN_INT_VALUE)\
+    && !builtin(temp[ins->b].u.int_value, temp[ins->c].u.int_value,\
+                &int_result)) {\
+    temp[ins->a].u.int_value = int_result;\
+    temp[ins->a].type = LEN_INT_VALUE;\
+} else {\
+    temp[ins->a] = len_eval_binary_values(state->inter, ins->operator,\
+                                          &temp[ins->b], &temp[ins->c],\
+                                          ins->line_number);\
+}
+#define INT_SHIFT(shift) \
+if (is_type_pair(&temp[ins->b], &temp[ins->c], LEN_INT_VALUE)) {\
+    temp[ins->a].u.int_value\
+    = shift(temp[ins->b].u.int_value, temp[ins->c].u.int_value);\
+    temp[ins->a].type = LEN_INT_VALUE;\
+} else {\
+    temp[ins->a] = len_eval_binary_values(state->inter, ins->operator,\
+                                          &temp[ins->b], &temp[ins->c],\
+                                          ins->line_number);\
+}
+#define INT_COMPARE(op) \
+SPECIALIZED_BINARY(LEN_INT_VALUE, u.int_value, op, \
+                   LEN_BOOLEAN_VALUE, u.boolean_value)
+#define DOUBLE_MATH(op) \
+SPECIALIZED_BINARY(LEN_DOUBLE_VALUE, u.double_value, op, \
+                   LEN_DOUBLE_VALUE, u.double_value)
+#define DOUBLE_COMPARE(op) \
+SPECIALIZED_BINARY(LEN_DOUBLE_VALUE, u.double_value, op, \
+                   LEN_BOOLEAN_VALUE, u.boolean_value)
+
+/**
+ * 执行一条不改变控制流的指令，记录和执行trace时共用
+ */
+static void
+execute_instruction(TraceState *state, TraceInstruction *ins)
+{
+    LEN_Value   *temp = state->temp;
+    LEN_Value   *global;
+    long long   int_result;
+
+    switch (ins->opcode) {
+        case TR_LOAD_VALUE:
+            temp[ins->a] = ins->u.value;
+            break;
+        case TR_LOAD_GLOBAL:
+            global = &state->inter->global_variable.value[ins->b];
+            if (global->type == LEN_UNDEFINED_VALUE) {
+                len_runtime_error(ins->line_number, VARIABLE_NOT_FOUND_ERR,
+                                  STRING_MESSAGE_ARGUMENT, "name", ins->name,
+                                  MESSAGE_ARGUMENT_END);
+            }
+            temp[ins->a] = *global;
+            len_refer_if_string(&temp[ins->a]);
+            break;
+        case TR_STORE_GLOBAL:
+            global = &state->inter->global_variable.value[ins->b];
+            len_release_if_string(global);
+            *global = temp[ins->a];
+            len_refer_if_string(global);
+            break;
+        case TR_LOAD_LOCAL:
+            temp[ins->a] = len_get_local_variable_value(state->env, ins->b,
+                                                        ins->name,
+                                                        ins->line_number);
+            break;
+        case TR_STORE_LOCAL:
+            len_assign_local_variable(state->env, ins->b, &temp[ins->a]);
+            break;
+        case TR_ADD_INT:
+            INT_CHECKED_MATH(__builtin_add_overflow);
+            break;
+        case TR_SUB_INT:
+            INT_CHECKED_MATH(__builtin_sub_overflow);
+            break;
+        case TR_MUL_INT:
+            INT_CHECKED_MATH(__builtin_mul_overflow);
+            break;
+        case TR_EQ_INT:
+            INT_COMPARE(==);
+            break;
+        case TR_NE_INT:
+            INT_COMPARE(!=);
+            break;
+        case TR_GT_INT:
+            INT_COMPARE(>);
+            break;
+        case TR_GE_INT:
+            INT_COMPARE(>=);
+            break;
+        case TR_LT_INT:
+            INT_COMPARE(<);
+            break;
+        case TR_LE_INT:
+            INT_COMPARE(<=);
+            break;
+        case TR_BIT_AND_INT:
+            INT_MATH(&);
+            break;
+        case TR_BIT_OR_INT:
+            INT_MATH(|);
+            break;
+        case TR_BIT_XOR_INT:
+            INT_MATH(^);
+            break;
+        case TR_LEFT_SHIFT_INT:
+            INT_SHIFT(dkc_shift_left);
+            break;
+        case TR_RIGHT_SHIFT_INT:
+            INT_SHIFT(dkc_shift_right);
+            break;
+        case TR_ADD_DOUBLE:
+            DOUBLE_MATH(+);
+            break;
+        case TR_SUB_DOUBLE:
+            DOUBLE_MATH(-);
+            break;
+        case TR_MUL_DOUBLE:
+            DOUBLE_MATH(*);
+            break;
+        case TR_DIV_DOUBLE:
+            DOUBLE_MATH(/);
+            break;
+        case TR_EQ_DOUBLE:
+            DOUBLE_COMPARE(==);
+            break;
+        case TR_NE_DOUBLE:
+            DOUBLE_COMPARE(!=);
+            break;
+        case TR_GT_DOUBLE:
+            DOUBLE_COMPARE(>);
+            break;
+        case TR_GE_DOUBLE:
+            DOUBLE_COMPARE(>=);
+            break;
+        case TR_LT_DOUBLE:
+            DOUBLE_COMPARE(<);
+            break;
+        case TR_LE_DOUBLE:
+            DOUBLE_COMPARE(<=);
+            break;
+        case TR_BINARY:
+            temp[ins->a] = len_eval_binary_values(state->inter, ins->operator,
+                                                  &temp[ins->b],
+                                                  &temp[ins->c],
+                                                  ins->line_number);
+            break;
+        case TR_MINUS:
+            temp[ins->a] = len_eval_minus_value(state->inter, &temp[ins->b],
+                                                ins->line_number);
+            break;
+        case TR_BIT_NOT:
+            temp[ins->a] = len_eval_bit_not_value(state->inter,
+                                                  &temp[ins->b],
+                                                  ins->line_number);
+            break;
+        case TR_LOGICAL_VALUE:
+            check_boolean(&temp[ins->b], ins->line_number);
+            temp[ins->a] = temp[ins->b];
+            break;
+        case TR_CALL:
+            temp[ins->a] = call_function(state, ins, &temp[ins->a]);
+            break;
+        case TR_POP:
+            len_release_if_string(&temp[ins->a]);
+            break;
+        default:
+            DBG_panic(("bad opcode..%d\n", ins->opcode));
+    }
+}
+
+/**
+ * guard失败之后由分析树执行这次迭代剩下的部分
+ * cond是if(或elsif)条件实际的值
+ */
+static StatementResult
+side_exit(TraceState *state, TraceGuard *guard, LEN_Boolean cond)
+{
+    StatementResult result;
+    Block   *block;
+    int i;
+
+    if (cond) {
+        if (guard->elsif) {
+            block = guard->elsif->block;
+        } else {
+            block = guard->statement->u.if_s.then_block;
+        }
+        result = len_execute_statement_list(state->inter, state->env,
+                                            block->statement_list);
+    } else {
+        result = len_execute_elsif_and_else(state->inter, state->env,
+                                            guard->statement,
+                                            guard->elsif
+                                            ? guard->elsif->next
+                                            : guard->statement->u.if_s
+                                            .elsif_list);
+    }
+    for (i = guard->chain_count - 1;
+         i >= 0 && result.type == NORMAL_STATEMENT_RESULT; i--) {
+        result = len_execute_statement_list(state->inter, state->env,
+                                            guard->chain[i]);
+    }
+    return result;
+}
+
+/**
+ * 执行for循环的post，side exit之后和continue时使用
+ */
+static void
+execute_post(TraceState *state, Statement *loop)
+{
+    LEN_Value v;
+
+    if (loop->type == FOR_STATEMENT && loop->u.for_s.post) {
+        v = len_eval_expression(state->inter, state->env,
+                                loop->u.for_s.post);
+        len_release_if_string(&v);
+    }
+}
+
+/**
+ * 反复执行trace直到循环结束
+ * 返回LEN_FALSE表示trace被放弃，剩下的迭代交给分析树
+ */
+static LEN_Boolean
+execute_trace(TraceState *state, Statement *loop, Trace *trace,
+              StatementResult *result)
+{
+    LEN_Value           *temp = state->temp;
+    TraceInstruction    *ins;
+    StatementResult     exit_result;
+    int pc;
+
+    result->type = NORMAL_STATEMENT_RESULT;
+    for (pc = 0; ; ) {
+        ins = &trace->code[pc];
+        switch (ins->opcode) {
+            case TR_LOGICAL_AND:
+                check_boolean(&temp[ins->a], ins->line_number);
+                pc = temp[ins->a].u.boolean_value ? pc + 1 : ins->b;
+                break;
+            case TR_LOGICAL_OR:
+                check_boolean(&temp[ins->a], ins->line_number);
+                pc = temp[ins->a].u.boolean_value ? ins->b : pc + 1;
+                break;
+            case TR_JUMP:
+                pc = ins->b;
+                break;
+            case TR_LOOP_CONDITION:
+                check_boolean(&temp[ins->a], ins->line_number);
+                if (!temp[ins->a].u.boolean_value)
+                    return LEN_TRUE;
+                pc++;
+                break;
+            case TR_GUARD:
+                check_boolean(&temp[ins->a], ins->line_number);
+                if (temp[ins->a].u.boolean_value == (LEN_Boolean)ins->b) {
+                    pc++;
+                    break;
+                }
+                // 分支方向不同，退回分析树
+                trace->exit_count++;
+                exit_result = side_exit(state, &trace->guard[ins->c],
+                                        temp[ins->a].u.boolean_value);
+                if (exit_result.type == RETURN_STATEMENT_RESULT) {
+                    *result = exit_result;
+                    return LEN_TRUE;
+                } else if (exit_result.type == BREAK_STATEMENT_RESULT) {
+                    return LEN_TRUE;
+                }
+                execute_post(state, loop);
+                trace->iteration_count++;
+                if (trace->exit_count > TRACE_EXIT_MAX
+                    && trace->exit_count * 2 > trace->iteration_count) {
+                    get_trace_info(loop)->blacklisted = LEN_TRUE;
+                    return LEN_FALSE;
+                }
+                pc = 0;
+                break;
+            case TR_STATEMENT:
+                exit_result = len_execute_statement(state->inter, state->env,
+                                                    ins->u.statement);
+                if (exit_result.type == RETURN_STATEMENT_RESULT) {
+                    *result = exit_result;
+                    return LEN_TRUE;
+                } else if (exit_result.type == BREAK_STATEMENT_RESULT) {
+                    return LEN_TRUE;
+                } else if (exit_result.type == CONTINUE_STATEMENT_RESULT) {
+                    if (trace->continue_pc >= 0) {
+                        pc = trace->continue_pc;
+                    } else {
+                        execute_post(state, loop);
+                        trace->iteration_count++;
+                        pc = 0;
+                    }
+                } else {
+                    pc++;
+                }
+                break;
+            case TR_BREAK:
+                return LEN_TRUE;
+            case TR_RETURN:
+                result->type = RETURN_STATEMENT_RESULT;
+                result->u.return_value = temp[ins->a];
+                return LEN_TRUE;
+            case TR_LOOP:
+                trace->iteration_count++;
+                pc = 0;
+                break;
+            default:
+                execute_instruction(state, ins);
+                pc++;
+        }
+    }
+}
+
+/**************************************记录*************************************/
+
+static void
+expand_state(TraceState *state, int temp_count)
+{
+    if (temp_count > state->temp_alloc_size) {
+        state->temp_alloc_size = temp_count + TRACE_ALLOC_SIZE;
+        state->temp = MEM_realloc(state->temp, sizeof(LEN_Value)
+                                  * state->temp_alloc_size);
+    }
+}
+
+static int
+alloc_temp(TraceRecorder *rec)
+{
+    int temp;
+
+    temp = rec->current_temp++;
+    if (rec->current_temp > rec->temp_count) {
+        rec->temp_count = rec->current_temp;
+        expand_state(rec->state, rec->temp_count);
+    }
+    return temp;
+}
+
+static void
+free_temp(TraceRecorder *rec, int temp)
+{
+    rec->current_temp--;
+    DBG_assert(rec->current_temp == temp, ("temp..%d\n", temp));
+}
+
+/**
+ * 追加一条指令，返回指令的位置
+ */
+static int
+add_instruction(TraceRecorder *rec, TraceOpCode opcode, int a, int b, int c,
+                int line_number)
+{
+    TraceInstruction *ins;
+
+    if (rec->code_size == rec->code_alloc_size) {
+        rec->code_alloc_size += TRACE_ALLOC_SIZE;
+        rec->code = MEM_realloc(rec->code, sizeof(TraceInstruction)
+                                * rec->code_alloc_size);
+    }
+    ins = &rec->code[rec->code_size];
+    ins->opcode = opcode;
+    ins->a = a;
+    ins->b = b;
+    ins->c = c;
+    ins->line_number = line_number;
+    ins->operator = EXPRESSION_TYPE_COUNT_PLUS_1;
+    ins->name = NULL;
+
+    return rec->code_size++;
+}
+
+/**
+ * 记录时立即执行刚追加的指令
+ */
+static void
+execute_last(TraceRecorder *rec)
+{
+    if (rec->executing) {
+        execute_instruction(rec->state, &rec->code[rec->code_size - 1]);
+    }
+}
+
+/**
+ * 根据记录时操作数的类型选择特化的指令
+ */
+static TraceOpCode
+specialize_binary(ExpressionType operator, LEN_Value *left, LEN_Value *right)
+{
+    if (is_type_pair(left, right, LEN_INT_VALUE)) {
+        switch (operator) {
+            case ADD_EXPRESSION:
+                return TR_ADD_INT;
+            case SUB_EXPRESSION:
+                return TR_SUB_INT;
+            case MUL_EXPRESSION:
+                return TR_MUL_INT;
+            case EQ_EXPRESSION:
+                return TR_EQ_INT;
+            case NE_EXPRESSION:
+                return TR_NE_INT;
+            case GT_EXPRESSION:
+                return TR_GT_INT;
+            case GE_EXPRESSION:
+                return TR_GE_INT;
+            case LT_EXPRESSION:
+                return TR_LT_INT;
+            case LE_EXPRESSION:
+                return TR_LE_INT;
+            case BIT_AND_EXPRESSION:
+                return TR_BIT_AND_INT;
+            case BIT_OR_EXPRESSION:
+                return TR_BIT_OR_INT;
+            case BIT_XOR_EXPRESSION:
+                return TR_BIT_XOR_INT;
+            case LEFT_SHIFT_EXPRESSION:
+                return TR_LEFT_SHIFT_INT;
+            case RIGHT_SHIFT_EXPRESSION:
+                return TR_RIGHT_SHIFT_INT;
+            default:
+                // 除法要检查除数是否为0
+                return TR_BINARY;
+        }
+    }
+    if (is_type_pair(left, right, LEN_DOUBLE_VALUE)) {
+        switch (operator) {
+            case ADD_EXPRESSION:
+                return TR_ADD_DOUBLE;
+            case SUB_EXPRESSION:
+                return TR_SUB_DOUBLE;
+            case MUL_EXPRESSION:
+                return TR_MUL_DOUBLE;
+            case DIV_EXPRESSION:
+                return TR_DIV_DOUBLE;
+            case EQ_EXPRESSION:
+                return TR_EQ_DOUBLE;
+            case NE_EXPRESSION:
+                return TR_NE_DOUBLE;
+            case GT_EXPRESSION:
+                return TR_GT_DOUBLE;
+            case GE_EXPRESSION:
+                return TR_GE_DOUBLE;
+            case LT_EXPRESSION:
+                return TR_LT_DOUBLE;
+            case LE_EXPRESSION:
+                return TR_LE_DOUBLE;
+            default:
+                return TR_BINARY;
+        }
+    }
+    return TR_BINARY;
+}
+
+static void
+record_binary_expression(TraceRecorder *rec, Expression *expr, int dst)
+{
+    TraceOpCode opcode = TR_BINARY;
+    int right;
+    int pc;
+
+    record_expression(rec, expr->u.binary_expression.left, dst);
+    right = alloc_temp(rec);
+    record_expression(rec, expr->u.binary_expression.right, right);
+    if (rec->executing) {
+        opcode = specialize_binary(expr->type, &rec->state->temp[dst],
+                                   &rec->state->temp[right]);
+    }
+    pc = add_instruction(rec, opcode, dst, dst, right,
+                         expr->u.binary_expression.left->line_number);
+    rec->code[pc].operator = expr->type;
+    execute_last(rec);
+    free_temp(rec, right);
+}
+
+/**
+ * 逻辑运算，短路时右操作数只生成指令不执行
+ */
+static void
+record_logical_expression(TraceRecorder *rec, Expression *expr, int dst)
+{
+    Expression  *left = expr->u.binary_expression.left;
+    Expression  *right = expr->u.binary_expression.right;
+    LEN_Boolean executing = rec->executing;
+    LEN_Value   *v;
+    int right_temp;
+    int jump_pc;
+
+    record_expression(rec, left, dst);
+    jump_pc = add_instruction(rec, expr->type == LOGICAL_AND_EXPRESSION
+                              ? TR_LOGICAL_AND : TR_LOGICAL_OR,
+                              dst, 0, 0, left->line_number);
+    if (executing) {
+        v = &rec->state->temp[dst];
+        check_boolean(v, left->line_number);
+        if ((expr->type == LOGICAL_AND_EXPRESSION && !v->u.boolean_value)
+            || (expr->type == LOGICAL_OR_EXPRESSION && v->u.boolean_value)) {
+            rec->executing = LEN_FALSE;
+        }
+    }
+    right_temp = alloc_temp(rec);
+    record_expression(rec, right, right_temp);
+    add_instruction(rec, TR_LOGICAL_VALUE, dst, right_temp, 0,
+                    right->line_number);
+    execute_last(rec);
+    free_temp(rec, right_temp);
+    rec->code[jump_pc].b = rec->code_size;
+    rec->executing = executing;
+}
+
+static void
+record_function_call_expression(TraceRecorder *rec, Expression *expr, int dst)
+{
+    ArgumentList    *arg_p;
+    int arg_count = 0;
+    int arg_temp;
+    int pc;
+    int i;
+
+    for (arg_p = expr->u.function_call_expression.argument; arg_p;
+         arg_p = arg_p->next) {
+        arg_temp = (arg_count == 0) ? dst : alloc_temp(rec);
+        record_expression(rec, arg_p->expression, arg_temp);
+        arg_count++;
+    }
+    pc = add_instruction(rec, TR_CALL, dst, arg_count, 0, expr->line_number);
+    rec->code[pc].u.function = expr->u.function_call_expression.function;
+    execute_last(rec);
+    for (i = arg_count - 1; i > 0; i--) {
+        free_temp(rec, dst + i);
+    }
+}
+
+/**
+ * 展开的函数调用，赋值的结果先放在dst中丢弃，再计算返回值
+ * 分支的条件用TR_LOGICAL_AND在false时跳到下一个分支，
+ * 记录时只执行实际求值的条件和返回值
+ */
+static void
+record_inline_call_expression(TraceRecorder *rec, Expression *expr, int dst)
+{
+    ArgumentList    *pos;
+    InlineBranch    *branch;
+    LEN_Boolean     executing = rec->executing;
+    LEN_Boolean     live = rec->executing;
+    LEN_Boolean     taken;
+    LEN_Value       *v;
+    int             *end_pc;
+    int branch_count = 0;
+    int false_pc;
+    int i;
+
+    for (pos = expr->u.inline_call_expression.binding; pos; pos = pos->next) {
+        record_expression(rec, pos->expression, dst);
+        add_instruction(rec, TR_POP, dst, 0, 0, pos->expression->line_number);
+        execute_last(rec);
+    }
+    for (branch = expr->u.inline_call_expression.branch; branch;
+         branch = branch->next) {
+        branch_count++;
+    }
+    end_pc = MEM_malloc(sizeof(int) * (branch_count + 1));
+    for (branch = expr->u.inline_call_expression.branch, i = 0; branch;
+         branch = branch->next, i++) {
+        record_expression(rec, branch->condition, dst);
+        false_pc = add_instruction(rec, TR_LOGICAL_AND, dst, 0, 0,
+                                   branch->condition->line_number);
+        taken = LEN_FALSE;
+        if (rec->executing) {
+            v = &rec->state->temp[dst];
+            check_boolean(v, branch->condition->line_number);
+            taken = v->u.boolean_value;
+        }
+        rec->executing = taken;
+        record_expression(rec, branch->value, dst);
+        end_pc[i] = add_instruction(rec, TR_JUMP, 0, 0, 0,
+                                    expr->line_number);
+        rec->code[false_pc].b = rec->code_size;
+        // 记录时已经有分支成立的话，后面的条件都不会求值
+        if (taken) {
+            live = LEN_FALSE;
+        }
+        rec->executing = live;
+    }
+    record_expression(rec, expr->u.inline_call_expression.body, dst);
+    for (i = 0; i < branch_count; i++) {
+        rec->code[end_pc[i]].b = rec->code_size;
+    }
+    MEM_free(end_pc);
+    rec->executing = executing;
+}
+
+static void
+record_expression(TraceRecorder *rec, Expression *expr, int dst)
+{
+    LEN_Value   value;
+    int pc;
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:
+            value.type = LEN_BOOLEAN_VALUE;
+            value.u.boolean_value = expr->u.boolean_value;
+            pc = add_instruction(rec, TR_LOAD_VALUE, dst, 0, 0,
+                                 expr->line_number);
+            rec->code[pc].u.value = value;
+            execute_last(rec);
+            break;
+        case INT_EXPRESSION:
+            value.type = LEN_INT_VALUE;
+            value.u.int_value = expr->u.int_value;
+            pc = add_instruction(rec, TR_LOAD_VALUE, dst, 0, 0,
+                                 expr->line_number);
+            rec->code[pc].u.value = value;
+            execute_last(rec);
+            break;
+        case DOUBLE_EXPRESSION:
+            value.type = LEN_DOUBLE_VALUE;
+            value.u.double_value = expr->u.double_value;
+            pc = add_instruction(rec, TR_LOAD_VALUE, dst, 0, 0,
+                                 expr->line_number);
+            rec->code[pc].u.value = value;
+            execute_last(rec);
+            break;
+        case NULL_EXPRESSION:
+            value.type = LEN_NULL_VALUE;
+            pc = add_instruction(rec, TR_LOAD_VALUE, dst, 0, 0,
+                                 expr->line_number);
+            rec->code[pc].u.value = value;
+            execute_last(rec);
+            break;
+        case STRING_EXPRESSION:
+            value.type = LEN_STRING_VALUE;
+            value.u.string_value = expr->u.string_value;
+            pc = add_instruction(rec, TR_LOAD_VALUE, dst, 0, 0,
+                                 expr->line_number);
+            rec->code[pc].u.value = value;
+            execute_last(rec);
+            break;
+        case IDENTIFIER_EXPRESSION:
+            if (expr->u.identifier.slot >= 0) {
+                pc = add_instruction(rec, TR_LOAD_LOCAL, dst,
+                                     expr->u.identifier.slot, 0,
+                                     expr->line_number);
+            } else {
+                pc = add_instruction(rec, TR_LOAD_GLOBAL, dst,
+                                     expr->u.identifier.global_index, 0,
+                                     expr->line_number);
+            }
+            rec->code[pc].name = expr->u.identifier.name;
+            execute_last(rec);
+            break;
+        case ASSIGN_EXPRESSION:
+            record_expression(rec, expr->u.assign_expression.operand, dst);
+            if (expr->u.assign_expression.slot >= 0) {
+                pc = add_instruction(rec, TR_STORE_LOCAL, dst,
+                                     expr->u.assign_expression.slot, 0,
+                                     expr->line_number);
+            } else {
+                pc = add_instruction(rec, TR_STORE_GLOBAL, dst,
+                                     expr->u.assign_expression.global_index,
+                                     0, expr->line_number);
+            }
+            rec->code[pc].name = expr->u.assign_expression.variable;
+            execute_last(rec);
+            break;
+        case ADD_EXPRESSION:        /* FALLTHRU */
+        case SUB_EXPRESSION:        /* FALLTHRU */
+        case MUL_EXPRESSION:        /* FALLTHRU */
+        case DIV_EXPRESSION:        /* FALLTHRU */
+        case MOD_EXPRESSION:        /* FALLTHRU */
+        case EQ_EXPRESSION:         /* FALLTHRU */
+        case NE_EXPRESSION:         /* FALLTHRU */
+        case GT_EXPRESSION:         /* FALLTHRU */
+        case GE_EXPRESSION:         /* FALLTHRU */
+        case LT_EXPRESSION:         /* FALLTHRU */
+        case LE_EXPRESSION:         /* FALLTHRU */
+        case BIT_AND_EXPRESSION:    /* FALLTHRU */
+        case BIT_OR_EXPRESSION:     /* FALLTHRU */
+        case BIT_XOR_EXPRESSION:    /* FALLTHRU */
+        case LEFT_SHIFT_EXPRESSION: /* FALLTHRU */
+        case RIGHT_SHIFT_EXPRESSION:
+            record_binary_expression(rec, expr, dst);
+            break;
+        case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+        case LOGICAL_OR_EXPRESSION:
+            record_logical_expression(rec, expr, dst);
+            break;
+        case MINUS_EXPRESSION:
+            record_expression(rec, expr->u.minus_expression, dst);
+            add_instruction(rec, TR_MINUS, dst, dst, 0,
+                            expr->u.minus_expression->line_number);
+            execute_last(rec);
+            break;
+        case BIT_NOT_EXPRESSION:
+            record_expression(rec, expr->u.bit_not_expression, dst);
+            add_instruction(rec, TR_BIT_NOT, dst, dst, 0,
+                            expr->u.bit_not_expression->line_number);
+            execute_last(rec);
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            record_function_call_expression(rec, expr, dst);
+            break;
+        case INLINE_CALL_EXPRESSION:
+            record_inline_call_expression(rec, expr, dst);
+            break;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+        default:
+            DBG_panic(("bad case. type..%d\n", expr->type));
+    }
+}
+
+/**
+ * 记录条件，返回记录时条件的值
+ */
+static LEN_Boolean
+record_condition(TraceRecorder *rec, Expression *condition,
+                 Statement *statement, Elsif *elsif)
+{
+    TraceGuard  *guard;
+    LEN_Value   *v;
+    int temp;
+    int i;
+
+    temp = alloc_temp(rec);
+    record_expression(rec, condition, temp);
+    v = &rec->state->temp[temp];
+    check_boolean(v, condition->line_number);
+
+    rec->guard = MEM_realloc(rec->guard,
+                             sizeof(TraceGuard) * (rec->guard_count + 1));
+    guard = &rec->guard[rec->guard_count];
+    guard->statement = statement;
+    guard->elsif = elsif;
+    guard->chain_count = rec->chain_count;
+    guard->chain = len_malloc(sizeof(StatementList*) * rec->chain_count);
+    for (i = 0; i < rec->chain_count; i++) {
+        guard->chain[i] = rec->chain[i];
+    }
+    add_instruction(rec, TR_GUARD, temp, v->u.boolean_value,
+                    rec->guard_count, condition->line_number);
+    rec->guard_count++;
+    free_temp(rec, temp);
+
+    return v->u.boolean_value;
+}
+
+/**
+ * 沿着实际执行的分支记录if语句
+ */
+static void
+record_if_statement(TraceRecorder *rec, Statement *statement)
+{
+    Elsif   *elsif;
+
+    if (record_condition(rec, statement->u.if_s.condition, statement, NULL)) {
+        record_statement_list(rec,
+                              statement->u.if_s.then_block->statement_list);
+        return;
+    }
+    for (elsif = statement->u.if_s.elsif_list; elsif; elsif = elsif->next) {
+        if (record_condition(rec, elsif->condition, statement, elsif)) {
+            record_statement_list(rec, elsif->block->statement_list);
+            return;
+        }
+    }
+    if (statement->u.if_s.else_block) {
+        record_statement_list(rec,
+                              statement->u.if_s.else_block->statement_list);
+    }
+}
+
+/**
+ * 不展开的语句交给分析树执行
+ */
+static void
+record_opaque_statement(TraceRecorder *rec, Statement *statement)
+{
+    StatementResult result;
+    int pc;
+
+    pc = add_instruction(rec, TR_STATEMENT, 0, 0, 0, statement->line_number);
+    rec->code[pc].u.statement = statement;
+    result = len_execute_statement(rec->state->inter, rec->state->env,
+                                   statement);
+    switch (result.type) {
+        case NORMAL_STATEMENT_RESULT:
+            break;
+        case RETURN_STATEMENT_RESULT:
+            rec->status = RECORD_RETURN;
+            rec->return_value = result.u.return_value;
+            break;
+        case BREAK_STATEMENT_RESULT:
+            rec->status = RECORD_BREAK;
+            break;
+        case CONTINUE_STATEMENT_RESULT:
+            rec->status = RECORD_CONTINUE;
+            break;
+        case TAIL_CALL_STATEMENT_RESULT:            /* FALLTHRU */
+        case STATEMENT_RESULT_TYPE_COUNT_PLUS_1:    /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n", result.type));
+    }
+}
+
+static void
+record_statement(TraceRecorder *rec, Statement *statement)
+{
+    int temp;
+    int pc;
+
+    switch (statement->type) {
+        case EXPRESSION_STATEMENT:
+            temp = alloc_temp(rec);
+            record_expression(rec, statement->u.expression_s, temp);
+            add_instruction(rec, TR_POP, temp, 0, 0, statement->line_number);
+            execute_last(rec);
+            free_temp(rec, temp);
+            break;
+        case IF_STATEMENT:
+            record_if_statement(rec, statement);
+            break;
+        case GLOBAL_STATEMENT:  /* FALLTHRU */
+        case WHILE_STATEMENT:   /* FALLTHRU */
+        case FOR_STATEMENT:
+            record_opaque_statement(rec, statement);
+            break;
+        case RETURN_STATEMENT:
+            temp = alloc_temp(rec);
+            if (statement->u.return_s.return_value) {
+                record_expression(rec, statement->u.return_s.return_value,
+                                  temp);
+            } else {
+                pc = add_instruction(rec, TR_LOAD_VALUE, temp, 0, 0,
+                                     statement->line_number);
+                rec->code[pc].u.value.type = LEN_NULL_VALUE;
+                execute_last(rec);
+            }
+            add_instruction(rec, TR_RETURN, temp, 0, 0,
+                            statement->line_number);
+            rec->return_value = rec->state->temp[temp];
+            rec->status = RECORD_RETURN;
+            free_temp(rec, temp);
+            break;
+        case BREAK_STATEMENT:
+            add_instruction(rec, TR_BREAK, 0, 0, 0, statement->line_number);
+            rec->status = RECORD_BREAK;
+            break;
+        case CONTINUE_STATEMENT:
+            // trace是线性的，continue之后直接接着记录post
+            rec->status = RECORD_CONTINUE;
+            break;
+        case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+        default:
+            DBG_panic(("bad case..%d\n", statement->type));
+    }
+}
+
+static RecordStatus
+record_statement_list(TraceRecorder *rec, StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos && rec->status == RECORD_CONTINUING;
+         pos = pos->next) {
+        rec->chain = MEM_realloc(rec->chain, sizeof(StatementList*)
+                                 * (rec->chain_count + 1));
+        rec->chain[rec->chain_count++] = pos->next;
+        record_statement(rec, pos->statement);
+        rec->chain_count--;
+    }
+    return rec->status;
+}
+
+/**
+ * 把记录的内容复制到解释器的内存中
+ */
+static Trace *
+fix_trace(TraceRecorder *rec, int continue_pc)
+{
+    Trace   *trace;
+
+    trace = len_malloc(sizeof(Trace));
+    trace->code_size = rec->code_size;
+    trace->code = len_malloc(sizeof(TraceInstruction) * rec->code_size);
+    memcpy(trace->code, rec->code, sizeof(TraceInstruction) * rec->code_size);
+    trace->guard_count = rec->guard_count;
+    trace->guard = len_malloc(sizeof(TraceGuard) * (rec->guard_count + 1));
+    if (rec->guard_count > 0) {
+        memcpy(trace->guard, rec->guard,
+               sizeof(TraceGuard) * rec->guard_count);
+    }
+    trace->temp_count = rec->temp_count;
+    trace->continue_pc = continue_pc;
+    trace->iteration_count = 1;
+    trace->exit_count = 0;
+
+    return trace;
+}
+
+/**
+ * 执行一次迭代并记录成trace
+ * 返回LEN_TRUE表示循环在这次迭代中结束
+ */
+static LEN_Boolean
+record_trace(TraceState *state, Statement *loop, StatementResult *result)
+{
+    TraceRecorder   rec;
+    Expression      *condition;
+    Expression      *post = NULL;
+    Block           *block;
+    LEN_Boolean     finished = LEN_FALSE;
+    int continue_pc = -1;
+    int temp;
+
+    rec.state = state;
+    rec.executing = LEN_TRUE;
+    rec.code_alloc_size = 0;
+    rec.code_size = 0;
+    rec.code = NULL;
+    rec.guard_count = 0;
+    rec.guard = NULL;
+    rec.current_temp = 0;
+    rec.temp_count = 0;
+    rec.chain_count = 0;
+    rec.chain = NULL;
+    rec.status = RECORD_CONTINUING;
+
+    if (loop->type == WHILE_STATEMENT) {
+        condition = loop->u.while_s.condition;
+        block = loop->u.while_s.block;
+    } else {
+        condition = loop->u.for_s.condition;
+        post = loop->u.for_s.post;
+        block = loop->u.for_s.block;
+    }
+
+    result->type = NORMAL_STATEMENT_RESULT;
+    if (condition) {
+        temp = alloc_temp(&rec);
+        record_expression(&rec, condition, temp);
+        add_instruction(&rec, TR_LOOP_CONDITION, temp, 0, 0,
+                        condition->line_number);
+        check_boolean(&state->temp[temp], condition->line_number);
+        free_temp(&rec, temp);
+        if (!state->temp[temp].u.boolean_value) {
+            // 循环已经结束，没有记录到循环体
+            finished = LEN_TRUE;
+            goto FUNC_END;
+        }
+    }
+
+    record_statement_list(&rec, block->statement_list);
+    if (rec.status == RECORD_BREAK) {
+        finished = LEN_TRUE;
+    } else if (rec.status == RECORD_RETURN) {
+        result->type = RETURN_STATEMENT_RESULT;
+        result->u.return_value = rec.return_value;
+        finished = LEN_TRUE;
+    } else {
+        rec.status = RECORD_CONTINUING;
+        continue_pc = rec.code_size;
+        if (post) {
+            temp = alloc_temp(&rec);
+            record_expression(&rec, post, temp);
+            add_instruction(&rec, TR_POP, temp, 0, 0, post->line_number);
+            execute_last(&rec);
+            free_temp(&rec, temp);
+        }
+        add_instruction(&rec, TR_LOOP, 0, 0, 0, 0);
+    }
+    get_trace_info(loop)->trace = fix_trace(&rec, continue_pc);
+
+FUNC_END:
+    MEM_free(rec.code);
+    MEM_free(rec.guard);
+    MEM_free(rec.chain);
+
+    return finished;
+}
+
+LEN_Boolean
+len_execute_trace(LEN_Interpreter *inter, LocalEnvironment *env,
+                  Statement *statement, StatementResult *result)
+{
+    LoopTraceInfo   *info = get_trace_info(statement);
+    TraceState      state;
+    Trace           *trace;
+    LEN_Boolean     finished;
+
+    if (info->blacklisted || info->recording)
+        return LEN_FALSE;
+    if (info->trace == NULL) {
+        info->iteration_count++;
+        if (info->iteration_count < TRACE_THRESHOLD)
+            return LEN_FALSE;
+    }
+
+    state.inter = inter;
+    state.env = env;
+    state.temp_alloc_size = 0;
+    state.temp = NULL;
+
+    if (info->trace == NULL) {
+        info->recording = LEN_TRUE;
+        finished = record_trace(&state, statement, result);
+        info->recording = LEN_FALSE;
+        if (info->trace == NULL) {
+            // 循环条件不成立，下次进入循环时重新计数
+            info->iteration_count = 0;
+        }
+        if (finished || info->trace == NULL)
+            goto FUNC_END;
+    }
+    trace = info->trace;
+    expand_state(&state, trace->temp_count);
+    finished = execute_trace(&state, statement, trace, result);
+
+FUNC_END:
+    MEM_free(state.temp);
+
+    return finished;
+}
@@ -12,6 +12,8 @@
 #include "DBG.h"
 #include "lemon.h"
 
+#define GLOBAL_VARIABLE_ALLOC_SIZE  (64)
+
 /**保存了当前的解释器*/
 static LEN_Interpreter *st_current_interpreter;
 
@@ -40,22 +42,19 @@ len_execute_malloc(LEN_Interpreter *inter, size_t size)
 void *
 len_malloc(size_t size)
 {
-    /* 原书实现
     void *p;
     LEN_Interpreter *inter;
     
+    // 分析树在编译期创建，此时execute_storage还没有分配，
+    // 所以必须使用interpreter_storage
     inter = len_get_current_interpreter();
     p = MEM_storage_malloc(inter->interpreter_storage, size);
     
     return p;
-     */
-    
-    // 修改过后的实现
-    return len_execute_malloc(len_get_current_interpreter(), size);
 }
 
 /**
- * 查找指定的函数
+ * 查找指定的函数，name必须是符号表中的名字
  */
 FunctionDefinition *
 len_search_function(char *name)
@@ -65,78 +64,88 @@ len_search_function(char *name)
     
     inter = len_get_current_interpreter();
     for (pos = inter->function_list; pos; pos = pos->next) {
-        if (!strcmp(pos->name, name))
+        if (pos->name == name)
             break;
     }
     return pos;
 }
 
 /**
- * 搜索局部变量
+ * 查找全局变量，返回全局变量表中的下标，identifier必须是符号表中的名字
  */
-Variable *
-len_search_local_variable(LocalEnvironment *env, char *identifier)
+int
+len_search_global_variable(LEN_Interpreter *inter, char *identifier)
 {
-    Variable *pos;
+    GlobalVariableTable *table = &inter->global_variable;
+    int i;
     
-    if (env == NULL)
-        return NULL;
-    for (pos = env->variable; pos; pos = pos->next) {
-        if (!strcmp(pos->name, identifier))
-            break;
-    }
-    if (pos == NULL) {
-        return NULL;
-    } else {
-        return pos;
+    for (i = 0; i < table->count; i++) {
+        if (table->name[i] == identifier)
+            return i;
     }
+    
+    return -1;
 }
 
 /**
- * 查找全局变量
+ * 在全局变量表中增加变量，编译时由resolve.c调用
  */
-Variable *
-len_search_global_variable(LEN_Interpreter *inter, char *identifier)
+int
+len_add_global_variable(LEN_Interpreter *inter, char *identifier)
 {
-    Variable *pos;
+    GlobalVariableTable *table = &inter->global_variable;
+    int index;
+    
+    index = len_search_global_variable(inter, identifier);
+    if (index >= 0)
+        return index;
     
-    for (pos = inter->variable; pos; pos = pos->next) {
-        if (!strcmp(pos->name, identifier))
-            return pos;
+    if (table->count == table->alloc_size) {
+        table->alloc_size += GLOBAL_VARIABLE_ALLOC_SIZE;
+        table->name = MEM_realloc(table->name,
+                                  sizeof(char*) * table->alloc_size);
+        table->value = MEM_realloc(table->value,
+                                   sizeof(LEN_Value) * table->alloc_size);
     }
+    table->name[table->count] = identifier;
+    table->value[table->count].type = LEN_UNDEFINED_VALUE;
     
-    return NULL;
+    return table->count++;
 }
 
+/**
+ * 增加全局变量，变量已经存在时覆盖原来的值
+ */
 void
-len_add_local_variable(LocalEnvironment *env,
-                       char *identifier, LEN_Value *value)
+LEN_add_global_variable(LEN_Interpreter *inter, char *identifier,
+                        LEN_Value *value)
 {
-    Variable    *new_variable;
-    // 申请内存
-    new_variable = MEM_malloc(sizeof(Variable));
-    new_variable->name = identifier;
-    new_variable->value = *value;
-    // 在链表头部添加
-    new_variable->next = env->variable;
-    env->variable = new_variable;
+    int         index;
+    
+    index = len_add_global_variable(inter,
+                                    len_intern_symbol(inter, identifier));
+    len_release_if_string(&inter->global_variable.value[index]);
+    inter->global_variable.value[index] = *value;
 }
 
 /**
- * 增加全局变量, 与len_add_local_variable()实现基本类似
+ * 释放全局变量表，string类型的值释放引用
  */
 void
-LEN_add_global_variable(LEN_Interpreter *inter, char *identifier,
-                        LEN_Value *value)
+len_dispose_global_variable(LEN_Interpreter *inter)
 {
-    Variable    *new_variable;
+    GlobalVariableTable *table = &inter->global_variable;
+    int i;
     
-    new_variable = len_execute_malloc(inter, sizeof(Variable));
-    new_variable->name = len_execute_malloc(inter, strlen(identifier) + 1);
-    strcpy(new_variable->name, identifier);
-    new_variable->next = inter->variable;
-    inter->variable = new_variable;
-    new_variable->value = *value;
+    for (i = 0; i < table->count; i++) {
+        len_release_if_string(&table->value[i]);
+    }
+    MEM_free(table->name);
+    MEM_free(table->value);
+    table->count = 0;
+    table->alloc_size = 0;
+    table->name = NULL;
+    table->value = NULL;
 }
 
 /**
@@ -197,11 +206,30 @@ len_get_operator_string(ExpressionType type)
         case LE_EXPRESSION:
             str = ">=";
             break;
+        case BIT_AND_EXPRESSION:
+            str = "&";
+            break;
+        case BIT_OR_EXPRESSION:
+            str = "|";
+            break;
+        case BIT_XOR_EXPRESSION:
+            str = "^";
+            break;
+        case LEFT_SHIFT_EXPRESSION:
+            str = "<<";
+            break;
+        case RIGHT_SHIFT_EXPRESSION:
+            str = ">>";
+            break;
         case MINUS_EXPRESSION:
             str = "-";
             break;
+        case BIT_NOT_EXPRESSION:
+            str = "~";
+            break;
         case FUNCTION_CALL_EXPRESSION:  /* FALLTHRU */
         case NULL_EXPRESSION:  /* FALLTHRU */
+        case INLINE_CALL_EXPRESSION:  /* FALLTHRU */
         case EXPRESSION_TYPE_COUNT_PLUS_1:
         default:
             DBG_panic(("bad expression type..%d\n", type));
@@ -0,0 +1,359 @@
+//
+//  vm.c
+//  lemon
+//  这个文件主要用来执行generate.c生成的字节码
+//  Created by Azure on 2018/1/28.
+//  Copyright © 2018年 Azure. All rights reserved.
+//
+
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "lemon.h"
+
+#define STACK_ALLOC_SIZE    (1024)
+
+/**两个操作数都是int类型*/
+#define is_int_pair(left, right) \
+((left)->type == LEN_INT_VALUE && (right)->type == LEN_INT_VALUE)
+
+/**int类型的算术运算，其他类型交给len_eval_binary_values()*/
+#define BINARY_INT_MATH(operator, expr_type) \
+if (is_int_pair(&reg[ins->b], &reg[ins->c])) {\
+    reg[ins->a].type = LEN_INT_VALUE;\
+    reg[ins->a].u.int_value\
+    = reg[ins->b].u.int_value operator reg[ins->c].u.int_value;\
+} else {\
+    reg[ins->a] = len_eval_binary_values(inter, (expr_type),\
+                                         &reg[ins->b], &reg[ins->c],\
+                                         code->line_number[pc]);\
+}
+
+/**
+ * int类型的加减乘，溢出或者其他类型交给len_eval_binary_values()
+ * 结果先放在int_result，溢出时不破坏操作数
+ */
+#define BINARY_INT_CHECKED(builtin, expr_type) \
+if (is_int_pair(&reg[ins->b], &reg[ins->c])\
+    && !builtin(reg[ins->b].u.int_value, reg[ins->c].u.int_value,\
+                &int_result)) {\
+    reg[ins->a].type = LEN_INT_VALUE;\
+    reg[ins->a].u.int_value = int_result;\
+} else {\
+    reg[ins->a] = len_eval_binary_values(inter, (expr_type),\
+                                         &reg[ins->b], &reg[ins->c],\
+                                         code->line_number[pc]);\
+}
+
+/**int类型的移位运算，其他类型交给len_eval_binary_values()*/
+#define BINARY_INT_SHIFT(shift, expr_type) \
+if (is_int_pair(&reg[ins->b], &reg[ins->c])) {\
+    reg[ins->a].type = LEN_INT_VALUE;\
+    reg[ins->a].u.int_value\
+    = shift(reg[ins->b].u.int_value, reg[ins->c].u.int_value);\
+} else {\
+    reg[ins->a] = len_eval_binary_values(inter, (expr_type),\
+                                         &reg[ins->b], &reg[ins->c],\
+                                         code->line_number[pc]);\
+}
+
+/**int类型的比较运算，其他类型交给len_eval_binary_values()*/
+#define BINARY_INT_COMPARE(operator, expr_type) \
+if (is_int_pair(&reg[ins->b], &reg[ins->c])) {\
+    LEN_Boolean result\
+    = reg[ins->b].u.int_value operator reg[ins->c].u.int_value;\
+    reg[ins->a].type = LEN_BOOLEAN_VALUE;\
+    reg[ins->a].u.boolean_value = result;\
+} else {\
+    reg[ins->a] = len_eval_binary_values(inter, (expr_type),\
+                                         &reg[ins->b], &reg[ins->c],\
+                                         code->line_number[pc]);\
+}
+
+/**
+ * 确保寄存器栈还有need个空位
+ */
+void
+len_expand_stack(LEN_Interpreter *inter, int need)
+{
+    Stack *stack = &inter->stack;
+
+    if (stack->stack_pointer + need > stack->alloc_size) {
+        stack->alloc_size = stack->stack_pointer + need + STACK_ALLOC_SIZE;
+        stack->stack = MEM_realloc(stack->stack,
+                                   sizeof(LEN_Value) * stack->alloc_size);
+    }
+}
+
+void
+len_dispose_stack(LEN_Interpreter *inter)
+{
+    MEM_free(inter->stack.stack);
+    inter->stack.stack = NULL;
+    inter->stack.alloc_size = 0;
+    inter->stack.stack_pointer = 0;
+}
+
+static void
+check_boolean(LEN_Value *v, int line_number)
+{
+    if (v->type != LEN_BOOLEAN_VALUE) {
+        len_runtime_error(line_number, NOT_BOOLEAN_TYPE_ERR,
+                          MESSAGE_ARGUMENT_END);
+    }
+}
+
+/**
+ * 调用编译时绑定的函数，用户函数的参数引用交给新的局部环境
+ * JIT模式下用户函数交给len_execute_jit()，由它决定是否编译成机器码
+ * 用户函数以尾调用返回时释放局部环境，接着在同一层调用被调用的函数
+ */
+LEN_Value
+len_vm_call_function(LEN_Interpreter *inter, FunctionDefinition *func,
+                     int arg_count, LEN_Value *args)
+{
+    LEN_Value           value;
+    LocalEnvironment    *local_env;
+
+    switch (func->type) {
+        case LEMON_FUNCTION_DEFINITION:
+            local_env = len_create_function_environment(inter, func,
+                                                        arg_count, args);
+            for (;;) {
+                if (inter->execute_mode == LEN_EXECUTE_JIT) {
+                    value = len_execute_jit(inter, local_env,
+                                            func->u.lemon_f.code);
+                } else {
+                    value = len_execute_bytecode(inter, local_env,
+                                                 func->u.lemon_f.code);
+                }
+                len_dispose_local_environment(inter, local_env);
+                if (inter->tail_call_function == NULL)
+                    break;
+                func = inter->tail_call_function;
+                inter->tail_call_function = NULL;
+                local_env
+                = len_create_function_environment(inter, func,
+                                                  inter
+                                                  ->tail_call_argument_count,
+                                                  inter->tail_call_argument);
+            }
+            break;
+        case NATIVE_FUNCTION_DEFINITION:
+            value = len_call_native_function(inter, func->u.native_f.proc,
+                                             arg_count, args);
+            break;
+        default:
+            DBG_panic(("bad case..%d\n", func->type));
+    }
+
+    return value;
+}
+
+/**
+ * 执行字节码
+ * 寄存器窗口分配在寄存器栈的栈顶，函数调用可能会扩展寄存器栈，
+ * 所以调用之后要重新计算reg
+ */
+LEN_Value
+len_execute_bytecode(LEN_Interpreter *inter, LocalEnvironment *env,
+                     ByteCode *code)
+{
+    LEN_Value   ret;
+    LEN_Value   *reg;
+    Instruction *ins;
+    long long   int_result;
+    int base;
+    int pc;
+
+    len_expand_stack(inter, code->register_count);
+    base = inter->stack.stack_pointer;
+    inter->stack.stack_pointer += code->register_count;
+    reg = &inter->stack.stack[base];
+
+    for (pc = 0; ; ) {
+        ins = &code->code[pc];
+        switch (ins->opcode) {
+            case OP_LOAD_NULL:
+                reg[ins->a].type = LEN_NULL_VALUE;
+                pc++;
+                break;
+            case OP_LOAD_BOOLEAN:
+                reg[ins->a].type = LEN_BOOLEAN_VALUE;
+                reg[ins->a].u.boolean_value = ins->b;
+                pc++;
+                break;
+            case OP_LOAD_CONSTANT:
+                reg[ins->a] = code->constant[ins->b];
+                pc++;
+                break;
+            case OP_LOAD_GLOBAL:
+                reg[ins->a] = len_get_global_variable_value(inter, ins->b,
+                                                            code->line_number[pc]);
+                pc++;
+                break;
+            case OP_STORE_GLOBAL:
+                len_assign_global_variable(inter, ins->b, &reg[ins->a]);
+                pc++;
+                break;
+            case OP_LOAD_LOCAL:
+                reg[ins->a] = len_get_local_variable_value(env, ins->b,
+                                                           code->name[ins->c],
+                                                           code->line_number[pc]);
+                pc++;
+                break;
+            case OP_STORE_LOCAL:
+                len_assign_local_variable(env, ins->b, &reg[ins->a]);
+                pc++;
+                break;
+            case OP_ADD:
+                BINARY_INT_CHECKED(__builtin_add_overflow, ADD_EXPRESSION);
+                pc++;
+                break;
+            case OP_SUB:
+                BINARY_INT_CHECKED(__builtin_sub_overflow, SUB_EXPRESSION);
+                pc++;
+                break;
+            case OP_MUL:
+                BINARY_INT_CHECKED(__builtin_mul_overflow, MUL_EXPRESSION);
+                pc++;
+                break;
+            case OP_DIV:
+                reg[ins->a] = len_eval_binary_values(inter, DIV_EXPRESSION,
+                                                     &reg[ins->b],
+                                                     &reg[ins->c],
+                                                     code->line_number[pc]);
+                pc++;
+                break;
+            case OP_MOD:
+                reg[ins->a] = len_eval_binary_values(inter, MOD_EXPRESSION,
+                                                     &reg[ins->b],
+                                                     &reg[ins->c],
+                                                     code->line_number[pc]);
+                pc++;
+                break;
+            case OP_EQ:
+                BINARY_INT_COMPARE(==, EQ_EXPRESSION);
+                pc++;
+                break;
+            case OP_NE:
+                BINARY_INT_COMPARE(!=, NE_EXPRESSION);
+                pc++;
+                break;
+            case OP_GT:
+                BINARY_INT_COMPARE(>, GT_EXPRESSION);
+                pc++;
+                break;
+            case OP_GE:
+                BINARY_INT_COMPARE(>=, GE_EXPRESSION);
+                pc++;
+                break;
+            case OP_LT:
+                BINARY_INT_COMPARE(<, LT_EXPRESSION);
+                pc++;
+                break;
+            case OP_LE:
+                BINARY_INT_COMPARE(<=, LE_EXPRESSION);
+                pc++;
+                break;
+            case OP_BIT_AND:
+                BINARY_INT_MATH(&, BIT_AND_EXPRESSION);
+                pc++;
+                break;
+            case OP_BIT_OR:
+                BINARY_INT_MATH(|, BIT_OR_EXPRESSION);
+                pc++;
+                break;
+            case OP_BIT_XOR:
+                BINARY_INT_MATH(^, BIT_XOR_EXPRESSION);
+                pc++;
+                break;
+            case OP_LEFT_SHIFT:
+                BINARY_INT_SHIFT(dkc_shift_left, LEFT_SHIFT_EXPRESSION);
+                pc++;
+                break;
+            case OP_RIGHT_SHIFT:
+                BINARY_INT_SHIFT(dkc_shift_right, RIGHT_SHIFT_EXPRESSION);
+                pc++;
+                break;
+            case OP_MINUS:
+                reg[ins->a] = len_eval_minus_value(inter, &reg[ins->b],
+                                                   code->line_number[pc]);
+                pc++;
+                break;
+            case OP_BIT_NOT:
+                reg[ins->a] = len_eval_bit_not_value(inter, &reg[ins->b],
+                                                     code->line_number[pc]);
+                pc++;
+                break;
+            case OP_CHECK_BOOLEAN:
+                check_boolean(&reg[ins->a], code->line_number[pc]);
+                pc++;
+                break;
+            case OP_JUMP:
+                pc = dkc_jump_target(ins);
+                break;
+            case OP_JUMP_IF_FALSE:
+                check_boolean(&reg[ins->a], code->line_number[pc]);
+                if (!reg[ins->a].u.boolean_value) {
+                    pc = dkc_jump_target(ins);
+                } else {
+                    pc++;
+                }
+                break;
+            case OP_JUMP_IF_TRUE:
+                check_boolean(&reg[ins->a], code->line_number[pc]);
+                if (reg[ins->a].u.boolean_value) {
+                    pc = dkc_jump_target(ins);
+                } else {
+                    pc++;
+                }
+                break;
+            case OP_CALL:
+                ret = len_vm_call_function(inter, code->function[ins->b],
+                                           ins->c, &reg[ins->a]);
+                reg = &inter->stack.stack[base];
+                reg[ins->a] = ret;
+                pc++;
+                break;
+            case OP_TAIL_CALL:
+                len_set_tail_call(inter, code->function[ins->b], ins->c,
+                                  &reg[ins->a]);
+                ret.type = LEN_NULL_VALUE;
+                goto FUNC_END;
+            case OP_POP:
+                len_release_if_string(&reg[ins->a]);
+                pc++;
+                break;
+            case OP_COPY:
+                reg[ins->a] = reg[ins->b];
+                len_refer_if_string(&reg[ins->a]);
+                pc++;
+                break;
+            case OP_SAVE:
+                len_release_if_string(&reg[ins->a]);
+                reg[ins->a] = reg[ins->b];
+                len_refer_if_string(&reg[ins->a]);
+                pc++;
+                break;
+            case OP_GLOBAL:
+                len_declare_global_variable(inter, env, ins->b,
+                                            code->line_number[pc]);
+                pc++;
+                break;
+            case OP_RETURN:
+                ret = reg[ins->a];
+                goto FUNC_END;
+            case OP_RETURN_NULL:
+                ret.type = LEN_NULL_VALUE;
+                goto FUNC_END;
+            case OP_CODE_COUNT_PLUS_1:  /* FALLTHRU */
+            default:
+                DBG_panic(("bad opcode..%d\n", ins->opcode));
+        }
+    }
+
+FUNC_END:
+    inter->stack.stack_pointer = base;
+    return ret;
+}